@@ -35,6 +35,14 @@ static int read_config_from_json(json_t *root)
         printf("load matchengine clt config fail: %d\n", ret);
         return -__LINE__;
     }
+    if (json_object_get(root, "matchengine_follower")) {
+        ret = load_cfg_rpc_clt(root, "matchengine_follower", &settings.matchengine_follower);
+        if (ret < 0) {
+            printf("load matchengine_follower clt config fail: %d\n", ret);
+            return -__LINE__;
+        }
+        settings.has_follower = true;
+    }
     ret = load_cfg_rpc_clt(root, "marketprice", &settings.marketprice);
     if (ret < 0) {
         printf("load marketprice clt config fail: %d\n", ret);
@@ -48,6 +56,10 @@ static int read_config_from_json(json_t *root)
 
     ERR_RET(read_cfg_real(root, "timeout", &settings.timeout, false, 1.0));
     ERR_RET(read_cfg_int(root, "worker_num", &settings.worker_num, false, 1));
+    ERR_RET(read_cfg_real(root, "follower_staleness", &settings.follower_staleness, false, 1.0));
+    ERR_RET(read_cfg_str(root, "handover_path", &settings.handover_path, ""));
+    ERR_RET(read_cfg_real(root, "handover_drain", &settings.handover_drain, false, 3));
+    ERR_RET(read_cfg_real(root, "handover_timeout", &settings.handover_timeout, false, 60));
 
     return 0;
 }
@@ -28,11 +28,14 @@
 # include "ut_config.h"
 # include "ut_decimal.h"
 # include "ut_rpc_clt.h"
+# include "ut_rpc_route.h"
+# include "ut_handover.h"
 # include "ut_rpc_svr.h"
 # include "ut_rpc_cmd.h"
 # include "ut_http_svr.h"
 
 # define AH_LISTENER_BIND   "seqpacket@/tmp/accesshttp_listener.sock"
+# define AH_LISTENER_DRAIN  1   /* listener -> worker: handed over, drain and exit */
 
 struct settings {
     process_cfg         process;
@@ -41,6 +44,12 @@ struct settings {
     http_svr_cfg        svr;
     nw_svr_cfg          monitor;
     rpc_clt_cfg         matchengine;
+    bool                has_follower;
+    rpc_clt_cfg         matchengine_follower;
+    double              follower_staleness;
+    char                *handover_path;
+    double              handover_drain;
+    double              handover_timeout;
     rpc_clt_cfg         marketprice;
     rpc_clt_cfg         readhistory;
     double              timeout;
@@ -1,7 +1,13 @@
 # ifndef _AH_LISTENER_H_
 # define _AH_LISTENER_H_
 
+# include "ah_config.h"
+
 int init_listener(void);
 
+/* tell the workers to drain after the listening fds are handed over */
+void listener_handover(void);
+bool listener_drained(void);
+
 # endif
 
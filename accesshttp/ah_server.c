@@ -5,8 +5,11 @@ static http_svr *svr;
 static nw_state *state;
 static dict_t *methods;
 static rpc_clt *listener;
+static double drain_deadline;
+static bool listener_closed;
 
 static rpc_clt *matchengine;
+static rpc_route *matchengine_route;
 static rpc_clt *marketprice;
 static rpc_clt *readhistory;
 
@@ -18,6 +21,7 @@ struct state_info {
 
 struct request_info {
     rpc_clt *clt;
+    rpc_route *route;   // set for reads that a follower may serve
     uint32_t cmd;
 };
 
@@ -88,7 +92,8 @@ static int on_http_request(nw_ses *ses, http_request_t *request)
         reply_not_found(ses, json_integer_value(id));
     } else {
         struct request_info *req = entry->val;
-        if (!rpc_clt_connected(req->clt)) {
+        rpc_clt *clt = req->route ? rpc_route_read(req->route) : req->clt;
+        if (!rpc_clt_connected(clt)) {
             reply_internal_error(ses);
             json_decref(body);
             return 0;
@@ -109,9 +114,9 @@ static int on_http_request(nw_ses *ses, http_request_t *request)
         pkg.body      = json_dumps(params, 0);
         pkg.body_size = strlen(pkg.body);
 
-        rpc_clt_send(req->clt, &pkg);
+        rpc_clt_send(clt, &pkg);
         log_debug("send request to %s, cmd: %u, sequence: %u",
-                nw_sock_human_addr(rpc_clt_peer_addr(req->clt)), pkg.command, pkg.sequence);
+                nw_sock_human_addr(rpc_clt_peer_addr(clt)), pkg.command, pkg.sequence);
         free(pkg.body);
     }
 
@@ -205,7 +210,10 @@ static void on_listener_connect(nw_ses *ses, bool result)
 
 static void on_listener_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
 {
-    return;
+    if (pkg->command == AH_LISTENER_DRAIN && drain_deadline == 0) {
+        drain_deadline = current_timestamp() + settings.handover_drain;
+        log_vip("listener handed over, drain %u connections", svr->raw_svr->clt_count);
+    }
 }
 
 static void on_listener_recv_fd(nw_ses *ses, int fd)
@@ -251,22 +259,30 @@ static int add_handler(char *method, rpc_clt *clt, uint32_t cmd)
     return 0;
 }
 
+static int add_read_handler(char *method, rpc_route *route, uint32_t cmd)
+{
+    struct request_info info = { .clt = rpc_route_write(route), .route = route, .cmd = cmd };
+    if (dict_add(methods, method, &info) == NULL)
+        return __LINE__;
+    return 0;
+}
+
 static int init_methods_handler(void)
 {
-    ERR_RET_LN(add_handler("group.list", matchengine, CMD_GROUP_LIST));
-    ERR_RET_LN(add_handler("symbol.list", matchengine, CMD_SYMBOL_LIST));
+    ERR_RET_LN(add_read_handler("group.list", matchengine_route, CMD_GROUP_LIST));
+    ERR_RET_LN(add_read_handler("symbol.list", matchengine_route, CMD_SYMBOL_LIST));
 
-    ERR_RET_LN(add_handler("balance.query", matchengine, CMD_BALANCE_QUERY));
+    ERR_RET_LN(add_read_handler("balance.query", matchengine_route, CMD_BALANCE_QUERY));
     ERR_RET_LN(add_handler("balance.update", matchengine, CMD_BALANCE_UPDATE));
     ERR_RET_LN(add_handler("balance.history", readhistory, CMD_BALANCE_HISTORY));
 
     ERR_RET_LN(add_handler("order.open", matchengine, CMD_ORDER_OPEN));
     ERR_RET_LN(add_handler("order.close", matchengine, CMD_ORDER_CLOSE));
-    ERR_RET_LN(add_handler("order.position", matchengine, CMD_ORDER_POSITION));
+    ERR_RET_LN(add_read_handler("order.position", matchengine_route, CMD_ORDER_POSITION));
     ERR_RET_LN(add_handler("order.update", matchengine, CMD_ORDER_UPDATE));
     ERR_RET_LN(add_handler("order.limit", matchengine, CMD_ORDER_LIMIT));
     ERR_RET_LN(add_handler("order.cancel", matchengine, CMD_ORDER_CANCEL));
-    ERR_RET_LN(add_handler("order.pending", matchengine, CMD_ORDER_PENDING));
+    ERR_RET_LN(add_read_handler("order.pending", matchengine_route, CMD_ORDER_PENDING));
     ERR_RET_LN(add_handler("order.history", readhistory, CMD_ORDER_HISTORY));
 
     ERR_RET_LN(add_handler("order.close_external", matchengine, CMD_ORDER_CLOSE_EXTERNAL));
@@ -276,6 +292,7 @@ static int init_methods_handler(void)
     ERR_RET_LN(add_handler("order.close2", matchengine, CMD_ORDER_CLOSE2));
 
     ERR_RET_LN(add_handler("tick.status", matchengine, CMD_TICK_STATUS));
+    ERR_RET_LN(add_handler("tick.history", matchengine, CMD_TICK_HISTORY));
 
 /*
     ERR_RET_LN(add_handler("order.put_limit", matchengine, CMD_ORDER_PUT_LIMIT));
@@ -326,11 +343,13 @@ int init_server(void)
     memset(&ct, 0, sizeof(ct));
     ct.on_connect = on_backend_connect;
     ct.on_recv_pkg = on_backend_recv_pkg;
-    matchengine = rpc_clt_create(&settings.matchengine, &ct);
-    if (matchengine == NULL)
+    matchengine_route = rpc_route_create(&settings.matchengine,
+            settings.has_follower ? &settings.matchengine_follower : NULL, &ct, settings.follower_staleness);
+    if (matchengine_route == NULL)
         return -__LINE__;
-    if (rpc_clt_start(matchengine) < 0)
+    if (rpc_route_start(matchengine_route) < 0)
         return -__LINE__;
+    matchengine = rpc_route_write(matchengine_route);
 
 /*
     marketprice = rpc_clt_create(&settings.marketprice, &ct);
@@ -356,3 +375,15 @@ int init_server(void)
     return 0;
 }
 
+// the listener is closed here rather than in its callback, so the worker
+// stops reconnecting and the new listener never hands it any connection
+bool server_drained(void)
+{
+    if (drain_deadline == 0)
+        return false;
+    if (!listener_closed) {
+        rpc_clt_close(listener);
+        listener_closed = true;
+    }
+    return svr->raw_svr->clt_count == 0 || current_timestamp() >= drain_deadline;
+}
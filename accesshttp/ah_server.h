@@ -3,5 +3,8 @@
 
 int init_server(void);
 
+/* true once a drain requested by the listener is done */
+bool server_drained(void);
+
 # endif
 
@@ -3,7 +3,7 @@
 # include "aw_server.h"
 
 static dict_t *dict_sub;
-static rpc_clt *matchengine;
+static rpc_route *matchengine;
 static nw_state *state_context;
 
 struct sub_unit {
@@ -155,10 +155,11 @@ int init_asset(void)
     ct.on_connect = on_backend_connect;
     ct.on_recv_pkg = on_backend_recv_pkg;
 
-    matchengine = rpc_clt_create(&settings.matchengine, &ct);
+    matchengine = rpc_route_create(&settings.matchengine,
+            settings.has_follower ? &settings.matchengine_follower : NULL, &ct, settings.follower_staleness);
     if (matchengine == NULL)
         return -__LINE__;
-    if (rpc_clt_start(matchengine) < 0)
+    if (rpc_route_start(matchengine) < 0)
         return -__LINE__;
 
     nw_state_type st;
@@ -268,9 +269,10 @@ int asset_on_update(uint32_t user_id, const char *asset)
     pkg.body      = json_dumps(trade_params, 0);
     pkg.body_size = strlen(pkg.body);
 
-    rpc_clt_send(matchengine, &pkg);
+    rpc_clt *clt = rpc_route_read(matchengine);
+    rpc_clt_send(clt, &pkg);
     log_trace("send request to %s, cmd: %u, sequence: %u, params: %s",
-            nw_sock_human_addr(rpc_clt_peer_addr(matchengine)), pkg.command, pkg.sequence, (char *)pkg.body);
+            nw_sock_human_addr(rpc_clt_peer_addr(clt)), pkg.command, pkg.sequence, (char *)pkg.body);
     free(pkg.body);
     json_decref(trade_params);
 
@@ -196,7 +196,6 @@ int balance_on_update(json_t *msg)
         send_notify(unit->ses, "balance.update", msg);
     }
     list_release_iterator(iter);
-    json_decref(msg);
 
     return 0;
 }
@@ -71,6 +71,14 @@ static int read_config_from_json(json_t *root)
         printf("load matchengine clt config fail: %d\n", ret);
         return -__LINE__;
     }
+    if (json_object_get(root, "matchengine_follower")) {
+        ret = load_cfg_rpc_clt(root, "matchengine_follower", &settings.matchengine_follower);
+        if (ret < 0) {
+            printf("load matchengine_follower clt config fail: %d\n", ret);
+            return -__LINE__;
+        }
+        settings.has_follower = true;
+    }
     ret = load_cfg_rpc_clt(root, "marketprice", &settings.marketprice);
     if (ret < 0) {
         printf("load marketprice clt config fail: %d\n", ret);
@@ -97,6 +105,10 @@ static int read_config_from_json(json_t *root)
     ERR_RET(read_cfg_str(root, "sign_url", &settings.sign_url, NULL));
     ERR_RET(read_cfg_real(root, "backend_timeout", &settings.backend_timeout, false, 1.0));
     ERR_RET(read_cfg_real(root, "cache_timeout", &settings.cache_timeout, false, 0.5));
+    ERR_RET(read_cfg_real(root, "follower_staleness", &settings.follower_staleness, false, 1.0));
+    ERR_RET(read_cfg_str(root, "handover_path", &settings.handover_path, ""));
+    ERR_RET(read_cfg_real(root, "handover_drain", &settings.handover_drain, false, 3));
+    ERR_RET(read_cfg_real(root, "handover_timeout", &settings.handover_timeout, false, 60));
 
     ERR_RET(read_cfg_real(root, "deals_interval", &settings.deals_interval, false, 0.5));
     ERR_RET(read_cfg_real(root, "price_interval", &settings.price_interval, false, 0.5));
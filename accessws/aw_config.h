@@ -28,6 +28,8 @@
 # include "ut_config.h"
 # include "ut_decimal.h"
 # include "ut_rpc_clt.h"
+# include "ut_rpc_route.h"
+# include "ut_handover.h"
 # include "ut_rpc_svr.h"
 # include "ut_rpc_cmd.h"
 # include "ut_ws_svr.h"
@@ -38,6 +40,7 @@
 # define INTERVAL_MAX_LEN       16
 
 # define AW_LISTENER_BIND   "seqpacket@/tmp/accessws_listener.sock"
+# define AW_LISTENER_DRAIN  1   /* listener -> worker: handed over, drain and exit */
 
 typedef struct depth_limit_cfg {
     int     count;
@@ -56,6 +59,12 @@ struct settings {
     ws_svr_cfg          svr;
     nw_svr_cfg          monitor;
     rpc_clt_cfg         matchengine;
+    bool                has_follower;
+    rpc_clt_cfg         matchengine_follower;
+    double              follower_staleness;
+    char                *handover_path;
+    double              handover_drain;
+    double              handover_timeout;
     rpc_clt_cfg         marketprice;
     rpc_clt_cfg         readhistory;
     kafka_consumer_cfg  orders;
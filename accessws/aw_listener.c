@@ -4,6 +4,7 @@
 static nw_svr *listener_svr;
 static nw_svr *monitor_svr;
 static rpc_svr *worker_svr;
+static double drain_deadline;
 
 static int listener_decode_pkg(nw_ses *ses, void *data, size_t max)
 {
@@ -140,3 +141,23 @@ int init_listener(void)
     return 0;
 }
 
+void listener_handover(void)
+{
+    rpc_pkg pkg;
+    memset(&pkg, 0, sizeof(pkg));
+    pkg.pkg_type = RPC_PKG_TYPE_PUSH;
+    pkg.command  = AW_LISTENER_DRAIN;
+
+    for (nw_ses *curr = worker_svr->raw_svr->clt_list_head; curr; curr = curr->next) {
+        rpc_send(curr, &pkg);
+    }
+    drain_deadline = current_timestamp() + settings.handover_drain;
+    log_vip("notify %u workers to drain", worker_svr->raw_svr->clt_count);
+}
+
+bool listener_drained(void)
+{
+    if (drain_deadline == 0)
+        return false;
+    return worker_svr->raw_svr->clt_count == 0 || current_timestamp() >= drain_deadline;
+}
@@ -1,7 +1,13 @@
 # ifndef _AW_LISTENER_H_
 # define _AW_LISTENER_H_
 
+# include "aw_config.h"
+
 int init_listener(void);
 
+/* tell the workers to drain after the listening fds are handed over */
+void listener_handover(void);
+bool listener_drained(void);
+
 # endif
 
@@ -27,6 +27,29 @@ static void on_cron_check(nw_timer *timer, void *data)
         nw_loop_break();
         signal_exit = 0;
     }
+    // handed over to a new process: the listener exits once its workers
+    // are gone, a worker once its connections are closed or drain times out
+    if (listener_drained() || server_drained()) {
+        log_vip("handover drain done");
+        nw_loop_break();
+    }
+}
+
+// binary upgrade: take the listening fds from the old listener, then wait
+// for its workers to drain and release the process lock
+static int take_over(void)
+{
+    int ret = handover_take(settings.handover_path, settings.handover_timeout);
+    if (ret < 0)
+        return ret;
+    log_stderr("handover %d listening fds", ret);
+
+    for (int i = 0; process_exist(__process__) != 0; ++i) {
+        if (i * 0.1 >= settings.handover_timeout)
+            return -__LINE__;
+        usleep(100 * 1000);
+    }
+    return 0;
 }
 
 static int init_process(void)
@@ -62,10 +85,11 @@ int main(int argc, char *argv[])
     printf("process: %s version: %s, compile date: %s %s\n", __process__, __version__, __DATE__, __TIME__);
 
     if (argc < 2) {
-        printf("usage: %s config.json\n", argv[0]);
+        printf("usage: %s config.json [upgrade]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
-    if (process_exist(__process__) != 0) {
+    bool upgrade = argc > 2 && strcmp(argv[2], "upgrade") == 0;
+    if (!upgrade && process_exist(__process__) != 0) {
         printf("process: %s exist\n", __process__);
         exit(EXIT_FAILURE);
     }
@@ -88,6 +112,12 @@ int main(int argc, char *argv[])
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init log fail: %d", ret);
     }
+    if (upgrade) {
+        ret = take_over();
+        if (ret < 0) {
+            error(EXIT_FAILURE, errno, "take over fail: %d", ret);
+        }
+    }
 
     for (int i = 0; i < settings.worker_num; ++i) {
         int pid = fork();
@@ -111,6 +141,12 @@ int main(int argc, char *argv[])
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init listener fail: %d", ret);
     }
+    if (settings.handover_path[0] != '\0') {
+        ret = handover_init(settings.handover_path, listener_handover);
+        if (ret < 0) {
+            error(EXIT_FAILURE, errno, "init handover fail: %d", ret);
+        }
+    }
     goto run;
 
 server:
@@ -175,6 +211,7 @@ server:
     }
 
 run:
+    nw_svr_inherit_release();
     nw_timer_set(&cron_timer, 0.5, true, on_cron_check, NULL);
     nw_timer_start(&cron_timer);
 
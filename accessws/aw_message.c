@@ -2,6 +2,7 @@
 # include "aw_message.h"
 # include "aw_asset.h"
 # include "aw_order.h"
+# include "ut_binmsg.h"
 
 static kafka_consumer_t *kafka_orders;
 static kafka_consumer_t *kafka_balances;
@@ -33,12 +34,18 @@ static int process_orders_message_v2(json_t *msg)
     return 0;
 }
 
-static void on_orders_message(sds message, int64_t offset)
+static void on_orders_message(sds message, int32_t partition, int64_t offset)
 {
-    log_trace("order message: %s", message);
-    json_t *msg = json_loads(message, 0, NULL);
+    json_t *msg;
+    if (binmsg_is_binary(message, sdslen(message))) {
+        log_trace("order message: %zu bytes", sdslen(message));
+        msg = binmsg_decode(message, sdslen(message));
+    } else {
+        log_trace("order message: %s", message);
+        msg = json_loadb(message, sdslen(message), 0, NULL);
+    }
     if (!msg) {
-        log_error("invalid balance message: %s", message);
+        log_error("invalid order message: %zu bytes", sdslen(message));
         return;
     }
 
@@ -69,12 +76,18 @@ static int process_balances_message_v2(json_t *msg)
     return 0;
 }
 
-static void on_balances_message(sds message, int64_t offset)
+static void on_balances_message(sds message, int32_t partition, int64_t offset)
 {
-    log_trace("balance message: %s", message);
-    json_t *msg = json_loads(message, 0, NULL);
+    json_t *msg;
+    if (binmsg_is_binary(message, sdslen(message))) {
+        log_trace("balance message: %zu bytes", sdslen(message));
+        msg = binmsg_decode(message, sdslen(message));
+    } else {
+        log_trace("balance message: %s", message);
+        msg = json_loadb(message, sdslen(message), 0, NULL);
+    }
     if (!msg) {
-        log_error("invalid balance message: %s", message);
+        log_error("invalid balance message: %zu bytes", sdslen(message));
         return;
     }
 
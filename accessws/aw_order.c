@@ -216,7 +216,6 @@ int order_on_update(json_t *msg)
         send_notify(unit->ses, "order.update", msg);
     }
     list_release_iterator(iter);
-    json_decref(msg);
 
     return 0;
 }
@@ -16,11 +16,13 @@ static ws_svr *svr;
 static dict_t *method_map;
 static dict_t *backend_cache;
 static rpc_clt *listener;
+static double drain_deadline;
+static bool listener_closed;
 static nw_state *state_context;
 static nw_cache *privdata_cache;
 static nw_timer cache_timer;
 
-static rpc_clt *matchengine;
+static rpc_route *matchengine;
 static rpc_clt *marketprice;
 static rpc_clt *readhistory;
 
@@ -240,7 +242,8 @@ static int on_method_kline_unsubscribe(nw_ses *ses, uint64_t id, struct clt_info
 
 static int on_method_depth_query(nw_ses *ses, uint64_t id, struct clt_info *info, json_t *params)
 {
-    if (!rpc_clt_connected(matchengine))
+    rpc_clt *clt = rpc_route_read(matchengine);
+    if (!rpc_clt_connected(clt))
         return send_error_internal_error(ses, id);
 
     sds key = sdsempty();
@@ -269,9 +272,9 @@ static int on_method_depth_query(nw_ses *ses, uint64_t id, struct clt_info *info
     pkg.body      = params_str;
     pkg.body_size = strlen(pkg.body);
 
-    rpc_clt_send(matchengine, &pkg);
+    rpc_clt_send(clt, &pkg);
     log_trace("send request to %s, cmd: %u, sequence: %u, params: %s",
-            nw_sock_human_addr(rpc_clt_peer_addr(matchengine)), pkg.command, pkg.sequence, (char *)pkg.body);
+            nw_sock_human_addr(rpc_clt_peer_addr(clt)), pkg.command, pkg.sequence, (char *)pkg.body);
     free(pkg.body);
 
     return 0;
@@ -569,7 +572,8 @@ static int on_method_deals_unsubscribe(nw_ses *ses, uint64_t id, struct clt_info
 
 static int on_method_order_query(nw_ses *ses, uint64_t id, struct clt_info *info, json_t *params)
 {
-    if (!rpc_clt_connected(matchengine))
+    rpc_clt *clt = rpc_route_read(matchengine);
+    if (!rpc_clt_connected(clt))
         return send_error_internal_error(ses, id);
 
     if (!info->auth)
@@ -608,9 +612,9 @@ static int on_method_order_query(nw_ses *ses, uint64_t id, struct clt_info *info
     pkg.body      = json_dumps(trade_params, 0);
     pkg.body_size = strlen(pkg.body);
 
-    rpc_clt_send(matchengine, &pkg);
+    rpc_clt_send(clt, &pkg);
     log_trace("send request to %s, cmd: %u, sequence: %u, params: %s",
-            nw_sock_human_addr(rpc_clt_peer_addr(matchengine)), pkg.command, pkg.sequence, (char *)pkg.body);
+            nw_sock_human_addr(rpc_clt_peer_addr(clt)), pkg.command, pkg.sequence, (char *)pkg.body);
     free(pkg.body);
     json_decref(trade_params);
 
@@ -689,7 +693,8 @@ static int on_method_asset_query(nw_ses *ses, uint64_t id, struct clt_info *info
     if (!info->auth)
         return send_error_require_auth(ses, id);
 
-    if (!rpc_clt_connected(matchengine))
+    rpc_clt *clt = rpc_route_read(matchengine);
+    if (!rpc_clt_connected(clt))
         return send_error_internal_error(ses, id);
 
     json_t *trade_params = json_array();
@@ -711,9 +716,9 @@ static int on_method_asset_query(nw_ses *ses, uint64_t id, struct clt_info *info
     pkg.body      = json_dumps(trade_params, 0);
     pkg.body_size = strlen(pkg.body);
 
-    rpc_clt_send(matchengine, &pkg);
+    rpc_clt_send(clt, &pkg);
     log_trace("send request to %s, cmd: %u, sequence: %u, params: %s",
-            nw_sock_human_addr(rpc_clt_peer_addr(matchengine)), pkg.command, pkg.sequence, (char *)pkg.body);
+            nw_sock_human_addr(rpc_clt_peer_addr(clt)), pkg.command, pkg.sequence, (char *)pkg.body);
     free(pkg.body);
     json_decref(trade_params);
 
@@ -1128,10 +1133,11 @@ static int init_backend(void)
     ct.on_connect = on_backend_connect;
     ct.on_recv_pkg = on_backend_recv_pkg;
 
-    matchengine = rpc_clt_create(&settings.matchengine, &ct);
+    matchengine = rpc_route_create(&settings.matchengine,
+            settings.has_follower ? &settings.matchengine_follower : NULL, &ct, settings.follower_staleness);
     if (matchengine == NULL)
         return -__LINE__;
-    if (rpc_clt_start(matchengine) < 0)
+    if (rpc_route_start(matchengine) < 0)
         return -__LINE__;
 
 /*
@@ -1178,7 +1184,10 @@ static void on_listener_connect(nw_ses *ses, bool result)
 
 static void on_listener_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
 {
-    return;
+    if (pkg->command == AW_LISTENER_DRAIN && drain_deadline == 0) {
+        drain_deadline = current_timestamp() + settings.handover_drain;
+        log_vip("listener handed over, drain %u connections", svr->raw_svr->clt_count);
+    }
 }
 
 static void on_listener_recv_fd(nw_ses *ses, int fd)
@@ -1225,3 +1234,15 @@ int init_server(void)
     return 0;
 }
 
+// the listener is closed here rather than in its callback, so the worker
+// stops reconnecting and the new listener never hands it any connection
+bool server_drained(void)
+{
+    if (drain_deadline == 0)
+        return false;
+    if (!listener_closed) {
+        rpc_clt_close(listener);
+        listener_closed = true;
+    }
+    return svr->raw_svr->clt_count == 0 || current_timestamp() >= drain_deadline;
+}
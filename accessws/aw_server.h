@@ -10,6 +10,8 @@ struct clt_info {
 };
 
 int init_server(void);
+/* true once a drain requested by the listener is done */
+bool server_drained(void);
 
 int send_error(nw_ses *ses, uint64_t id, int code, const char *message);
 int send_error_invalid_argument(nw_ses *ses, uint64_t id);
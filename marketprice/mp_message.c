@@ -8,6 +8,7 @@
 # include "mp_config.h"
 # include "mp_message.h"
 # include "mp_kline.h"
+# include "ut_binmsg.h"
 
 struct market_info {
     char   *name;
@@ -39,7 +40,8 @@ static kafka_consumer_t *deals;
 static dict_t *dict_market;
 
 static double   last_flush;
-static int64_t  last_offset;
+static int64_t  *last_offset;   // 按分区记录，-1 表示该分区还没有消费过
+static int      offset_num;
 static nw_timer market_timer;
 static nw_timer clear_timer;
 static nw_timer redis_timer;
@@ -519,12 +521,32 @@ static int market_update(const char *market, double timestamp, mpd_t *price, mpd
     return 0;
 }
 
-static void on_deals_message(sds message, int64_t offset)
+static void set_last_offset(int32_t partition, int64_t offset)
 {
-    log_trace("deals message: %s, offset: %"PRIi64, message, offset);
-    json_t *obj = json_loadb(message, sdslen(message), 0, NULL);
+    if (partition < 0)
+        return;
+    if (partition >= offset_num) {
+        last_offset = realloc(last_offset, sizeof(int64_t) * (partition + 1));
+        for (int i = offset_num; i <= partition; ++i) {
+            last_offset[i] = -1;
+        }
+        offset_num = partition + 1;
+    }
+    last_offset[partition] = offset;
+}
+
+static void on_deals_message(sds message, int32_t partition, int64_t offset)
+{
+    json_t *obj;
+    if (binmsg_is_binary(message, sdslen(message))) {
+        log_trace("deals message: %zu bytes, offset: %"PRIi64, sdslen(message), offset);
+        obj = binmsg_decode(message, sdslen(message));
+    } else {
+        log_trace("deals message: %s, offset: %"PRIi64, message, offset);
+        obj = json_loadb(message, sdslen(message), 0, NULL);
+    }
     if (obj == NULL) {
-        log_error("invalid message: %s, offset: %"PRIi64, message, offset);
+        log_error("invalid message, offset: %"PRIi64, offset);
         return;
     }
 
@@ -561,10 +583,10 @@ static void on_deals_message(sds message, int64_t offset)
 
     int ret = market_update(market, timestamp, price, amount, side, id);
     if (ret < 0) {
-        log_error("market_update fail %d, message: %s", ret, message);
+        log_error("market_update fail %d, offset: %"PRIi64, ret, offset);
         goto cleanup;
     }
-    last_offset = offset;
+    set_last_offset(partition, offset);
 
     mpd_del(price);
     mpd_del(amount);
@@ -572,7 +594,7 @@ static void on_deals_message(sds message, int64_t offset)
     return;
 
 cleanup:
-    log_error("invalid message: %s, offset: %"PRIi64, message, offset);
+    log_error("invalid message: %zu bytes, offset: %"PRIi64, sdslen(message), offset);
     if (price)
         mpd_del(price);
     if (amount)
@@ -666,13 +688,17 @@ static int flush_kline(redisContext *context, struct market_info *info, struct u
     return 0;
 }
 
-static int flush_offset(redisContext *context, int64_t offset)
+static int flush_offset(redisContext *context)
 {
-    redisReply *reply = redisCmd(context, "SET k:offset %"PRIi64, offset);
-    if (reply == NULL) {
-        return -__LINE__;
+    for (int i = 0; i < offset_num; ++i) {
+        if (last_offset[i] < 0)
+            continue;
+        redisReply *reply = redisCmd(context, "HSET k:offsets %d %"PRIi64, i, last_offset[i]);
+        if (reply == NULL) {
+            return -__LINE__;
+        }
+        freeReplyObject(reply);
     }
-    freeReplyObject(reply);
 
     return 0;
 }
@@ -746,7 +772,7 @@ static int flush_market(void)
     }
     dict_release_iterator(iter);
 
-    ret = flush_offset(context, last_offset);
+    ret = flush_offset(context);
     if (ret < 0) {
         redisFree(context);
         return -__LINE__;
@@ -853,24 +879,39 @@ static void on_redis_timer(nw_timer *timer, void *privdata)
     }
 }
 
-static int64_t get_message_offset(void)
+// k:offsets 按分区保存最后处理的 offset，只有单分区时的旧 k:offset 作为分区 0
+static int load_message_offset(void)
 {
     redisContext *context = redis_sentinel_connect_master(redis);
     if (context == NULL)
         return -__LINE__;
-    redisReply *reply = redisCmd(context, "GET k:offset");
+    redisReply *reply = redisCmd(context, "HGETALL k:offsets");
     if (reply == NULL) {
         redisFree(context);
         return -__LINE__;
     }
-    int64_t offset = 0;
-    if (reply->type == REDIS_REPLY_STRING) {
-        offset = strtoll(reply->str, NULL, 0);
+    if (reply->type == REDIS_REPLY_ARRAY) {
+        for (size_t i = 0; i + 1 < reply->elements; i += 2) {
+            int32_t partition = strtol(reply->element[i]->str, NULL, 0);
+            set_last_offset(partition, strtoll(reply->element[i + 1]->str, NULL, 0));
+        }
     }
     freeReplyObject(reply);
+
+    if (offset_num == 0) {
+        reply = redisCmd(context, "GET k:offset");
+        if (reply == NULL) {
+            redisFree(context);
+            return -__LINE__;
+        }
+        if (reply->type == REDIS_REPLY_STRING) {
+            set_last_offset(0, strtoll(reply->str, NULL, 0));
+        }
+        freeReplyObject(reply);
+    }
     redisFree(context);
 
-    return offset;
+    return 0;
 }
 
 int init_message(void)
@@ -883,12 +924,21 @@ int init_message(void)
     if (ret < 0) {
         return ret;
     }
-    last_offset = get_message_offset();
-    if (last_offset < 0) {
-        return -__LINE__;
+    ret = load_message_offset();
+    if (ret < 0) {
+        return ret;
+    }
+    // 从每个分区最后处理的下一条开始，没有记录的分区从配置的 offset 开始
+    int64_t *offsets = malloc(sizeof(int64_t) * (offset_num ? offset_num : 1));
+    for (int i = 0; i < offset_num; ++i) {
+        offsets[i] = last_offset[i] >= 0 ? last_offset[i] + 1 : settings.deals.offset;
     }
-    settings.deals.offset = last_offset + 1;
+    settings.deals.offsets = offsets;
+    settings.deals.offset_num = offset_num;
     deals = kafka_consumer_create(&settings.deals, on_deals_message);
+    settings.deals.offsets = NULL;
+    settings.deals.offset_num = 0;
+    free(offsets);
     if (deals == NULL) {
         return -__LINE__;
     }
@@ -1,5 +1,8 @@
 # include "me_config.h"
 # include "me_balance.h"
+# include "me_stop.h"
+# include "me_snapshot.h"
+# include "me_digest.h"
 
 dict_t *dict_balance;
 
@@ -253,6 +256,17 @@ mpd_t *balance_get_v2(uint64_t sid, uint32_t type)
     return NULL;
 }
 
+// 余额变化: 标记增量快照和状态摘要，影响 margin level 的同步风险索引
+static void balance_changed(uint64_t sid, uint32_t type)
+{
+    if (type <= BALANCE_TYPE_FREE)
+        snapshot_touch(sid);
+    if (type == BALANCE_TYPE_BALANCE)
+        digest_touch(sid);
+    if (type == BALANCE_TYPE_EQUITY || type == BALANCE_TYPE_MARGIN || type == BALANCE_TYPE_FLOAT)
+        stop_out_touch(sid);
+}
+
 void balance_del_v2(uint64_t sid, uint32_t type)
 {
     struct balance_key key;
@@ -261,6 +275,7 @@ void balance_del_v2(uint64_t sid, uint32_t type)
     key.sid2 = sid % 100;
     key.type = type;
     dict_delete(dict_balance, &key);
+    balance_changed(sid, type);
 }
 
 mpd_t *balance_set_v2(uint64_t sid, uint32_t type, mpd_t *amount)
@@ -291,6 +306,7 @@ mpd_t *balance_set_v2(uint64_t sid, uint32_t type, mpd_t *amount)
     if (entry == NULL)
         return NULL;
     result = entry->val;
+    balance_changed(sid, type);
 
     return result;
 }
@@ -311,6 +327,7 @@ mpd_t *balance_add_v2(uint64_t sid, uint32_t type, mpd_t *amount)
     if (entry) {
         result = entry->val;
         mpd_add(result, result, amount, &mpd_ctx);
+        balance_changed(sid, type);
         return result;
     }
 
@@ -333,6 +350,7 @@ mpd_t *balance_sub_v2(uint64_t sid, uint32_t type, mpd_t *amount)
         balance_del_v2(sid, type);
         return mpd_zero;
     }
+    balance_changed(sid, type);
 
     return result;
 }
@@ -377,6 +395,9 @@ mpd_t *balance_add_float(uint64_t sid, uint32_t type, mpd_t *amount)
     } else {
         result = balance_set_float(sid, type, amount);
     }
+    // 浮动盈亏的差额由调用方通过 stop_out_pnl 同步
+    if (type != BALANCE_TYPE_FLOAT)
+        balance_changed(sid, type);
     return result;
 }
 
@@ -388,5 +409,6 @@ mpd_t *balance_sub_float(uint64_t sid, uint32_t type, mpd_t *amount)
     } else {
 	mpd_minus(result, amount, &mpd_ctx);
     }
+    balance_changed(sid, type);
     return result;
 }
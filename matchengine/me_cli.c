@@ -7,6 +7,8 @@
 # include "me_operlog.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_repl.h"
+# include "me_digest.h"
 
 static cli_svr *svr;
 
@@ -17,6 +19,8 @@ static sds on_cmd_status(const char *cmd, int argc, sds *argv)
     reply = operlog_status(reply);
     reply = history_status(reply);
     reply = message_status(reply);
+    reply = repl_status(reply);
+    reply = digest_status(reply);
     return reply;
 }
 
@@ -155,6 +159,65 @@ error:
     return sdsnew("usage market summary\n");
 }
 
+static sds on_cmd_repl(const char *cmd, int argc, sds *argv)
+{
+    if (argc > 0) {
+        if (strcmp(argv[0], "status") == 0) {
+            return repl_status(sdsempty());
+        } else if (strcmp(argv[0], "promote") == 0) {
+            int ret = repl_promote();
+            if (ret < 0)
+                return sdscatprintf(sdsempty(), "promote fail: %d\n", ret);
+            return sdsnew("OK\n");
+        } else {
+            goto error;
+        }
+    }
+
+error:
+    return sdsnew("usage repl status|promote\n");
+}
+
+// digest [bucket [leaf]]，逐层比较两个引擎的输出定位不一致的账户
+static sds on_cmd_digest(const char *cmd, int argc, sds *argv)
+{
+    if (argc > 2)
+        goto error;
+    uint32_t index[2];
+    for (int i = 0; i < argc; ++i) {
+        char *end;
+        unsigned long val = strtoul(argv[i], &end, 0);
+        if (*end != '\0' || val >= DIGEST_FANOUT)
+            goto error;
+        index[i] = val;
+    }
+
+    sds reply = sdsempty();
+    if (argc == 0) {
+        reply = sdscatprintf(reply, "root: %016"PRIx64", accounts: %zu, last id: %"PRIu64"\n",
+                digest_root(), digest_accounts(), operlog_id_start);
+        for (uint32_t i = 0; i < DIGEST_FANOUT; ++i)
+            reply = sdscatprintf(reply, "%3u %016"PRIx64"\n", i, digest_bucket(i));
+    } else if (argc == 1) {
+        reply = sdscatprintf(reply, "bucket %u: %016"PRIx64"\n", index[0], digest_bucket(index[0]));
+        for (uint32_t i = 0; i < DIGEST_FANOUT; ++i)
+            reply = sdscatprintf(reply, "%3u %016"PRIx64"\n", i, digest_leaf(index[0], i));
+    } else {
+        reply = sdscatprintf(reply, "leaf %u %u: %016"PRIx64"\n", index[0], index[1], digest_leaf(index[0], index[1]));
+        json_t *accounts = digest_leaf_accounts(index[0], index[1]);
+        const char *sid;
+        json_t *hash;
+        json_object_foreach(accounts, sid, hash) {
+            reply = sdscatprintf(reply, "%s %s\n", sid, json_string_value(hash));
+        }
+        json_decref(accounts);
+    }
+    return reply;
+
+error:
+    return sdsnew("usage digest [bucket [leaf]]\n");
+}
+
 static sds on_cmd_makeslice(const char *cmd, int argc, sds *argv)
 {
     time_t now = time(NULL);
@@ -173,6 +236,8 @@ int init_cli(void)
     cli_svr_add_cmd(svr, "balance", on_cmd_balance);
     cli_svr_add_cmd(svr, "market",  on_cmd_market);
     cli_svr_add_cmd(svr, "makeslice", on_cmd_makeslice);
+    cli_svr_add_cmd(svr, "repl", on_cmd_repl);
+    cli_svr_add_cmd(svr, "digest", on_cmd_digest);
 
     return 0;
 }
@@ -58,6 +58,26 @@ static int load_markets(json_t *root, const char *key)
     return 0;
 }
 
+static int load_str_list(json_t *root, const char *key, size_t *num, char ***list)
+{
+    json_t *node = json_object_get(root, key);
+    if (!node)
+        return 0;
+    if (!json_is_array(node))
+        return -__LINE__;
+
+    *num = json_array_size(node);
+    *list = malloc(sizeof(char *) * (*num));
+    for (size_t i = 0; i < *num; ++i) {
+        json_t *row = json_array_get(node, i);
+        if (!json_is_string(row))
+            return -__LINE__;
+        (*list)[i] = strdup(json_string_value(row));
+    }
+
+    return 0;
+}
+
 static int read_config_from_json(json_t *root)
 {
     int ret;
@@ -96,6 +116,22 @@ static int read_config_from_json(json_t *root)
         printf("load cli config fail: %d\n", ret);
         return -__LINE__;
     }
+    if (json_object_get(root, "repl_svr")) {
+        ret = load_cfg_rpc_svr(root, "repl_svr", &settings.repl_svr);
+        if (ret < 0) {
+            printf("load repl_svr config fail: %d\n", ret);
+            return -__LINE__;
+        }
+        settings.has_repl_svr = true;
+    }
+    if (json_object_get(root, "repl_master")) {
+        ret = load_cfg_rpc_clt(root, "repl_master", &settings.repl_master);
+        if (ret < 0) {
+            printf("load repl_master config fail: %d\n", ret);
+            return -__LINE__;
+        }
+        settings.standby = true;
+    }
     ret = load_cfg_mysql(root, "db_config", &settings.db_config);
     if (ret < 0) {
         printf("load config db config fail: %d\n", ret);
@@ -141,17 +177,58 @@ static int read_config_from_json(json_t *root)
         printf("load history_thread fail: %d", ret);
         return -__LINE__;
     }
+    ret = read_cfg_int(root, "replay_thread", &settings.replay_thread, false, 4);
+    if (ret < 0) {
+        printf("load replay_thread fail: %d", ret);
+        return -__LINE__;
+    }
+    ret = read_cfg_int(root, "load_thread", &settings.load_thread, false, 4);
+    if (ret < 0) {
+        printf("load load_thread fail: %d", ret);
+        return -__LINE__;
+    }
     ret = read_cfg_str(root, "tick_svr", &settings.tick_svr, NULL);
     if (ret < 0) {
         printf("load tick_svr fail: %d\n", ret);
         return -__LINE__;
     }
+    ret = read_cfg_int(root, "tick_history", &settings.tick_history, false, 4096);
+    if (ret < 0 || settings.tick_history <= 0) {
+        printf("load tick_history fail: %d\n", ret);
+        return -__LINE__;
+    }
 
     ret = read_cfg_int(root, "gmt_time", &settings.gmt_time, false, 0);
     if (ret < 0) {
         printf("load gmt_time fail: %d", ret);
         return -__LINE__;
     }
+    ERR_RET_LN(read_cfg_int(root, "tick_log_sample", &settings.tick_log_sample, false, 1));
+    ERR_RET_LN(read_cfg_str(root, "operlog_path", &settings.operlog_path, "operlog"));
+    ERR_RET_LN(read_cfg_int(root, "operlog_segment_size", &settings.operlog_segment_size, false, 256));
+    ERR_RET_LN(read_cfg_real(root, "operlog_sync_interval", &settings.operlog_sync_interval, false, 0.002));
+    ERR_RET_LN(read_cfg_bool(root, "operlog_fsync", &settings.operlog_fsync, false, true));
+    ERR_RET_LN(read_cfg_str(root, "snapshot_path", &settings.snapshot_path, "slice"));
+    ERR_RET_LN(read_cfg_int(root, "snapshot_delta_interval", &settings.snapshot_delta_interval, false, 60));
+    ERR_RET_LN(read_cfg_bool(root, "slice_mysql", &settings.slice_mysql, false, true));
+    ERR_RET_LN(read_cfg_int(root, "kafka_partitions", &settings.kafka_partitions, false, 1));
+    ERR_RET_LN(read_cfg_int(root, "kafka_linger_ms", &settings.kafka_linger_ms, false, 1));
+    ERR_RET_LN(read_cfg_int(root, "kafka_batch_num", &settings.kafka_batch_num, false, 10000));
+    ERR_RET_LN(read_cfg_str(root, "kafka_compression", &settings.kafka_compression, "none"));
+    // 按 sid 分区，accessws/marketprice 的消费者默认读所有分区
+    if (settings.kafka_partitions < 1) {
+        printf("invalid kafka_partitions: %d\n", settings.kafka_partitions);
+        return -__LINE__;
+    }
+    ERR_RET_LN(load_str_list(root, "kafka_binary", &settings.kafka_binary_num, &settings.kafka_binary));
+    ERR_RET_LN(load_str_list(root, "bulk_load", &settings.bulk_load_num, &settings.bulk_load));
+    ERR_RET_LN(read_cfg_real(root, "history_coalesce", &settings.history_coalesce, false, 1.0));
+    ERR_RET_LN(read_cfg_real(root, "digest_interval", &settings.digest_interval, false, 60));
+    ERR_RET_LN(read_cfg_bool(root, "follower", &settings.follower, false, false));
+    ERR_RET_LN(read_cfg_int(root, "repl_backlog", &settings.repl_backlog, false, 100000));
+    ERR_RET_LN(read_cfg_str(root, "handover_path", &settings.handover_path, ""));
+    ERR_RET_LN(read_cfg_real(root, "handover_drain", &settings.handover_drain, false, 3));
+    ERR_RET_LN(read_cfg_real(root, "handover_timeout", &settings.handover_timeout, false, 60));
     ERR_RET_LN(read_cfg_mpd(root, "stop_out", &settings.stop_out, "0.3"));
 
     ERR_RET_LN(read_cfg_real(root, "cache_timeout", &settings.cache_timeout, false, 0.45));
@@ -182,3 +259,20 @@ int init_config(const char *path)
     return 0;
 }
 
+bool is_bulk_load(const char *table)
+{
+    for (size_t i = 0; i < settings.bulk_load_num; ++i) {
+        if (strncmp(table, settings.bulk_load[i], strlen(settings.bulk_load[i])) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool is_kafka_binary(const char *topic)
+{
+    for (size_t i = 0; i < settings.kafka_binary_num; ++i) {
+        if (strcmp(topic, settings.kafka_binary[i]) == 0)
+            return true;
+    }
+    return false;
+}
@@ -26,6 +26,7 @@
 # include "ut_signal.h"
 # include "ut_define.h"
 # include "ut_config.h"
+# include "ut_handover.h"
 # include "ut_decimal.h"
 # include "ut_rpc_clt.h"
 # include "ut_rpc_svr.h"
@@ -38,8 +39,10 @@
 
 # define ORDER_BOOK_MAX_LEN     101
 # define ORDER_LIST_MAX_LEN     101
+# define TICK_HISTORY_MAX_LEN   1000
 
 # define MAX_PENDING_OPERLOG    100
+# define MAX_ARCHIVE_OPERLOG    1000000
 # define MAX_PENDING_HISTORY    1000
 # define MAX_PENDING_MESSAGE    1000
 
@@ -67,6 +70,11 @@ struct settings {
     alert_cfg           alert;
     rpc_svr_cfg         svr;
     cli_svr_cfg         cli;
+    bool                has_repl_svr;
+    rpc_svr_cfg         repl_svr;
+    bool                standby;
+    bool                follower;
+    rpc_clt_cfg         repl_master;
     mysql_cfg           db_config;
     mysql_cfg           db_log;
     mysql_cfg           db_history;
@@ -78,19 +86,48 @@ struct settings {
     struct market       *markets;
 
     char                *brokers;
+    int                 kafka_partitions;
+    int                 kafka_linger_ms;
+    int                 kafka_batch_num;
+    char                *kafka_compression;
+    size_t              kafka_binary_num;
+    char                **kafka_binary;  // 用二进制编码的 topic
     int                 slice_interval;
     int                 slice_keeptime;
     int                 history_thread;
+    double              history_coalesce;
+    size_t              bulk_load_num;
+    char                **bulk_load;     // 用 LOAD DATA 写入的表名前缀
+    int                 replay_thread;
+    int                 load_thread;
     double              cache_timeout;
 
+    char                *operlog_path;
+    int                 operlog_segment_size;
+    double              operlog_sync_interval;
+    bool                operlog_fsync;
+
+    char                *snapshot_path;
+    int                 snapshot_delta_interval;
+    bool                slice_mysql;
+    char                *handover_path;
+    double              handover_drain;
+    double              handover_timeout;
+    int                 repl_backlog;
+    double              digest_interval;
+
     mpd_t               *stop_out;
     char                *tick_svr;
+    int                 tick_history;
+    int                 tick_log_sample;
     int                 gmt_time;
 };
 
 extern struct settings settings;
 
 int init_config(const char *path);
+bool is_bulk_load(const char *table);
+bool is_kafka_binary(const char *topic);
 
 # endif
 
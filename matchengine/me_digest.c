@@ -0,0 +1,416 @@
+# include "me_digest.h"
+# include "me_balance.h"
+# include "me_market.h"
+# include "me_trade.h"
+# include "me_operlog.h"
+# include "me_repl.h"
+
+# define FNV_OFFSET     14695981039346656037ULL
+# define FNV_PRIME      1099511628211ULL
+
+struct dict_sid_key {
+    uint64_t    sid;
+};
+
+struct digest_val {
+    uint64_t    hash;
+};
+
+// 账户当前计入摘要的哈希，账户为空时不保存
+static dict_t *dict_account;
+// 变化过、还没重算的 sid
+static dict_t *dict_dirty;
+static uint64_t root;
+static uint64_t buckets[DIGEST_FANOUT];
+static uint64_t leaves[DIGEST_FANOUT * DIGEST_FANOUT];
+static mpd_t *reduced;
+
+static nw_timer timer;
+static uint64_t last_digest_id;
+static uint64_t verify_count;
+static uint64_t verify_fail;
+
+static uint32_t dict_sid_hash_function(const void *key)
+{
+    return dict_generic_hash_function(key, sizeof(struct dict_sid_key));
+}
+
+static int dict_sid_key_compare(const void *key1, const void *key2)
+{
+    const struct dict_sid_key *obj1 = key1;
+    const struct dict_sid_key *obj2 = key2;
+    if (obj1->sid == obj2->sid) {
+        return 0;
+    }
+    return 1;
+}
+
+static void *dict_sid_key_dup(const void *key)
+{
+    struct dict_sid_key *obj = malloc(sizeof(struct dict_sid_key));
+    memcpy(obj, key, sizeof(struct dict_sid_key));
+    return obj;
+}
+
+static void dict_sid_key_free(void *key)
+{
+    free(key);
+}
+
+static void *dict_digest_val_dup(const void *val)
+{
+    struct digest_val *obj = malloc(sizeof(struct digest_val));
+    memcpy(obj, val, sizeof(struct digest_val));
+    return obj;
+}
+
+static void dict_digest_val_free(void *val)
+{
+    free(val);
+}
+
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint32_t leaf_index(uint64_t sid)
+{
+    return mix64(sid) % (DIGEST_FANOUT * DIGEST_FANOUT);
+}
+
+static void hash_data(uint64_t *h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; ++i) {
+        *h ^= p[i];
+        *h *= FNV_PRIME;
+    }
+}
+
+static void hash_u64(uint64_t *h, uint64_t val)
+{
+    hash_data(h, &val, sizeof(val));
+}
+
+static void hash_str(uint64_t *h, const char *str)
+{
+    // 带上结尾的 0，避免相邻字段拼接产生歧义
+    hash_data(h, str ? str : "", str ? strlen(str) + 1 : 1);
+}
+
+// 去掉尾部的 0，MySQL 切片加载的 1.10000000 和内存中的 1.1 算出同样的哈希
+static void hash_mpd(uint64_t *h, mpd_t *val)
+{
+    if (val == NULL) {
+        hash_str(h, NULL);
+        return;
+    }
+    mpd_reduce(reduced, val, &mpd_ctx);
+    char *str = mpd_to_sci(reduced, 0);
+    hash_str(h, str);
+    free(str);
+}
+
+static void hash_order(uint64_t *h, order_t *order)
+{
+    hash_u64(h, order->id);
+    hash_u64(h, order->side);
+    hash_str(h, order->symbol);
+    hash_mpd(h, order->lot);
+    hash_mpd(h, order->price);
+    hash_mpd(h, order->fee);
+    hash_mpd(h, order->tp);
+    hash_mpd(h, order->sl);
+}
+
+static uint64_t account_hash(uint64_t sid)
+{
+    bool empty = true;
+    uint64_t h = FNV_OFFSET;
+    hash_u64(&h, sid);
+
+    mpd_t *balance = balance_get_v2(sid, BALANCE_TYPE_BALANCE);
+    if (balance) {
+        hash_mpd(&h, balance);
+        empty = false;
+    }
+    hash_u64(&h, 0);
+
+    skiplist_t *list = market_get_positions(sid);
+    if (list) {
+        skiplist_iter *iter = skiplist_get_iterator(list);
+        skiplist_node *node;
+        while ((node = skiplist_next(iter)) != NULL) {
+            hash_order(&h, node->value);
+            empty = false;
+        }
+        skiplist_release_iterator(iter);
+    }
+    hash_u64(&h, 0);
+
+    for (int i = 0; i < configs.symbol_num; ++i) {
+        market_t *m = get_market(configs.symbols[i].name);
+        if (m == NULL)
+            continue;
+        list = market_get_limit_list(m, sid);
+        if (list == NULL)
+            continue;
+        skiplist_iter *iter = skiplist_get_iterator(list);
+        skiplist_node *node;
+        while ((node = skiplist_next(iter)) != NULL) {
+            order_t *order = node->value;
+            hash_order(&h, order);
+            hash_u64(&h, order->expire_time);
+            empty = false;
+        }
+        skiplist_release_iterator(iter);
+    }
+
+    // 0 留给空账户，异或进树后等于不存在
+    if (empty)
+        return 0;
+    h = mix64(h);
+    return h ? h : 1;
+}
+
+static void account_update(uint64_t sid)
+{
+    struct dict_sid_key key = { .sid = sid };
+    uint64_t old = 0;
+    dict_entry *entry = dict_find(dict_account, &key);
+    if (entry) {
+        struct digest_val *val = entry->val;
+        old = val->hash;
+    }
+    uint64_t hash = account_hash(sid);
+    if (hash == old)
+        return;
+
+    uint64_t delta = old ^ hash;
+    uint32_t leaf = leaf_index(sid);
+    leaves[leaf] ^= delta;
+    buckets[leaf / DIGEST_FANOUT] ^= delta;
+    root ^= delta;
+
+    if (hash == 0) {
+        dict_delete(dict_account, &key);
+    } else if (entry) {
+        struct digest_val *val = entry->val;
+        val->hash = hash;
+    } else {
+        struct digest_val val = { .hash = hash };
+        dict_add(dict_account, &key, &val);
+    }
+}
+
+static void digest_flush(void)
+{
+    if (dict_dirty == NULL || dict_size(dict_dirty) == 0)
+        return;
+
+    dict_iterator *iter = dict_get_iterator(dict_dirty);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct dict_sid_key *key = entry->key;
+        account_update(key->sid);
+    }
+    dict_release_iterator(iter);
+    dict_clear(dict_dirty);
+}
+
+void digest_touch(uint64_t sid)
+{
+    if (dict_dirty == NULL)
+        return;
+
+    struct dict_sid_key key = { .sid = sid };
+    if (dict_find(dict_dirty, &key) == NULL)
+        dict_add(dict_dirty, &key, NULL);
+}
+
+static void touch_order_list(skiplist_t *list)
+{
+    skiplist_iter *iter = skiplist_get_iterator(list);
+    skiplist_node *node;
+    while ((node = skiplist_next(iter)) != NULL) {
+        order_t *order = node->value;
+        digest_touch(order->sid);
+    }
+    skiplist_release_iterator(iter);
+}
+
+int digest_rebuild(void)
+{
+    double begin = current_timestamp();
+    dict_clear(dict_account);
+    dict_clear(dict_dirty);
+    root = 0;
+    memset(buckets, 0, sizeof(buckets));
+    memset(leaves, 0, sizeof(leaves));
+
+    dict_iterator *iter = dict_get_iterator(dict_balance);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct balance_key *key = entry->key;
+        if (key->type != BALANCE_TYPE_BALANCE)
+            continue;
+        uint64_t sid1 = key->sid1;
+        digest_touch(sid1 * 100 + key->sid2);
+    }
+    dict_release_iterator(iter);
+
+    for (int i = 0; i < configs.symbol_num; ++i) {
+        market_t *m = get_market(configs.symbols[i].name);
+        if (m == NULL)
+            return -__LINE__;
+        touch_order_list(m->buys);
+        touch_order_list(m->sells);
+        touch_order_list(m->limit_buys);
+        touch_order_list(m->limit_sells);
+    }
+
+    digest_flush();
+    log_info("digest rebuild, accounts: %u, root: %016"PRIx64", cost: %.3fs",
+            dict_size(dict_account), root, current_timestamp() - begin);
+    return 0;
+}
+
+uint64_t digest_root(void)
+{
+    digest_flush();
+    return root;
+}
+
+uint64_t digest_bucket(uint32_t bucket)
+{
+    digest_flush();
+    return buckets[bucket % DIGEST_FANOUT];
+}
+
+uint64_t digest_leaf(uint32_t bucket, uint32_t leaf)
+{
+    digest_flush();
+    return leaves[(bucket % DIGEST_FANOUT) * DIGEST_FANOUT + leaf % DIGEST_FANOUT];
+}
+
+uint64_t digest_account(uint64_t sid)
+{
+    digest_flush();
+    struct dict_sid_key key = { .sid = sid };
+    dict_entry *entry = dict_find(dict_account, &key);
+    if (entry == NULL)
+        return 0;
+    struct digest_val *val = entry->val;
+    return val->hash;
+}
+
+size_t digest_accounts(void)
+{
+    digest_flush();
+    return dict_size(dict_account);
+}
+
+json_t *digest_leaf_accounts(uint32_t bucket, uint32_t leaf)
+{
+    digest_flush();
+    uint32_t index = (bucket % DIGEST_FANOUT) * DIGEST_FANOUT + leaf % DIGEST_FANOUT;
+    json_t *result = json_object();
+    dict_iterator *iter = dict_get_iterator(dict_account);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct dict_sid_key *key = entry->key;
+        if (leaf_index(key->sid) != index)
+            continue;
+        struct digest_val *val = entry->val;
+        char sid[32], hash[32];
+        snprintf(sid, sizeof(sid), "%"PRIu64, key->sid);
+        snprintf(hash, sizeof(hash), "%016"PRIx64, val->hash);
+        json_object_set_new(result, sid, json_string(hash));
+    }
+    dict_release_iterator(iter);
+    return result;
+}
+
+int digest_verify(const char *source, uint64_t expect)
+{
+    uint64_t actual = digest_root();
+    verify_count++;
+    if (actual != expect) {
+        verify_fail++;
+        log_fatal("state digest mismatch, source: %s, expect: %016"PRIx64", actual: %016"PRIx64", oper id: %"PRIu64,
+                source, expect, actual, operlog_id_start);
+        return -__LINE__;
+    }
+    log_info("state digest verified, source: %s, digest: %016"PRIx64", oper id: %"PRIu64, source, actual, operlog_id_start);
+    return 0;
+}
+
+int append_digest_operlog(void)
+{
+    char hash[32];
+    snprintf(hash, sizeof(hash), "%016"PRIx64, digest_root());
+    json_t *params = json_array();
+    json_array_append_new(params, json_string(hash));
+    int ret = append_operlog("state_digest", params);
+    json_decref(params);
+    last_digest_id = operlog_id_start;
+    return ret;
+}
+
+// 摘要不一致只报警，不中断回放和复制
+int load_state_digest(json_t *params)
+{
+    if (json_array_size(params) != 1 || !json_is_string(json_array_get(params, 0)))
+        return -__LINE__;
+    uint64_t expect = strtoull(json_string_value(json_array_get(params, 0)), NULL, 16);
+    digest_verify("operlog", expect);
+    return 0;
+}
+
+static void on_timer(nw_timer *timer, void *privdata)
+{
+    if (repl_is_standby() || operlog_id_start == last_digest_id)
+        return;
+    append_digest_operlog();
+}
+
+sds digest_status(sds reply)
+{
+    reply = sdscatprintf(reply, "digest root: %016"PRIx64", accounts: %zu, verified: %"PRIu64", mismatch: %"PRIu64"\n",
+            digest_root(), digest_accounts(), verify_count, verify_fail);
+    return reply;
+}
+
+int init_digest(void)
+{
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function    = dict_sid_hash_function;
+    dt.key_compare      = dict_sid_key_compare;
+    dt.key_dup          = dict_sid_key_dup;
+    dt.key_destructor   = dict_sid_key_free;
+    dict_dirty = dict_create(&dt, 1024);
+    if (dict_dirty == NULL)
+        return -__LINE__;
+
+    dt.val_dup          = dict_digest_val_dup;
+    dt.val_destructor   = dict_digest_val_free;
+    dict_account = dict_create(&dt, 1024);
+    if (dict_account == NULL)
+        return -__LINE__;
+
+    reduced = mpd_new(&mpd_ctx);
+    if (settings.digest_interval > 0) {
+        nw_timer_set(&timer, settings.digest_interval, true, on_timer, NULL);
+        nw_timer_start(&timer);
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,39 @@
+# ifndef _ME_DIGEST_H_
+# define _ME_DIGEST_H_
+
+# include "me_config.h"
+
+/*
+ * 状态摘要
+ *
+ * 每个 sid 的余额(BALANCE_TYPE_BALANCE)、持仓和挂单算一个 64 位哈希，按 sid 哈希分到
+ * 256 x 256 个叶子，叶子、桶、根都是下层哈希的异或。账户变化时只标记，取摘要时重算脏账户，
+ * 两个引擎比较根即可，不一致时逐层比较桶和叶子定位到账户。
+ * 只覆盖由 operlog 决定的字段，随行情变化的 equity/margin/float 以及隔夜费不计入。
+ */
+# define DIGEST_FANOUT      256
+
+int init_digest(void);
+void digest_touch(uint64_t sid);
+// 快照加载后全部重算
+int digest_rebuild(void);
+
+uint64_t digest_root(void);
+uint64_t digest_bucket(uint32_t bucket);
+uint64_t digest_leaf(uint32_t bucket, uint32_t leaf);
+uint64_t digest_account(uint64_t sid);
+size_t digest_accounts(void);
+// 列出某个叶子下的账户，需要扫描全部账户，只用于最后一层定位
+json_t *digest_leaf_accounts(uint32_t bucket, uint32_t leaf);
+
+// 与记录的摘要比较，不一致时报警，返回 0 表示一致
+int digest_verify(const char *source, uint64_t expect);
+
+// 主机定时写 state_digest 记录，回放和备机应用时校验
+int append_digest_operlog(void);
+int load_state_digest(json_t *params);
+
+sds digest_status(sds reply);
+
+# endif
+
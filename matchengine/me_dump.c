@@ -14,6 +14,32 @@ static sds sql_append_mpd(sds sql, mpd_t *val, bool comma)
     return sql;
 }
 
+# define BULK_LOAD_ROWS 100000
+
+static sds bulk_append_mpd(sds buf, mpd_t *val, bool last)
+{
+    char *str = mpd_to_sci(val, 0);
+    buf = mysql_bulk_append_str(buf, str, last);
+    free(str);
+    return buf;
+}
+
+// 按 LOAD DATA 的文本格式攒行，满 BULK_LOAD_ROWS 或结束时写入
+static int bulk_flush(MYSQL *conn, const char *table, const char *columns, sds buf, size_t *rows)
+{
+    if (*rows == 0)
+        return 0;
+    // 有转换或截断告警的切片不可信，按失败处理，不记入 slice_history
+    int ret = mysql_load_data(conn, table, columns, buf, sdslen(buf));
+    if (ret < 0)
+        return ret;
+    if (ret > 0)
+        return -__LINE__;
+    sdsclear(buf);
+    *rows = 0;
+    return 0;
+}
+
 /*
 static int dump_orders_list(MYSQL *conn, const char *table, skiplist_t *list)
 {
@@ -231,6 +257,42 @@ static int dump_positions_list(MYSQL *conn, const char *table, skiplist_t *list)
     return 0;
 }
 
+static int dump_positions_list_bulk(MYSQL *conn, const char *table, skiplist_t *list)
+{
+    const char *columns = "`id`, `sid`, `side`, `create_time`, `update_time`, `symbol`, `external`, "
+        "`comment`, `price`, `lot`, `margin`, `fee`, `swap`, `swaps`, `tp`, `sl`, `margin_price`";
+    sds buf = sdsempty();
+    size_t rows = 0;
+    skiplist_iter *iter = skiplist_get_iterator(list);
+    skiplist_node *node;
+    while ((node = skiplist_next(iter)) != NULL) {
+        order_t *order = node->value;
+        buf = sdscatprintf(buf, "%"PRIu64"\t%"PRIu64"\t%u\t%f\t%f\t%s\t%"PRIu64"\t",
+                order->id, order->sid, order->side, order->create_time, order->update_time, order->symbol, order->external);
+        buf = mysql_bulk_append_str(buf, order->comment, false);
+        buf = bulk_append_mpd(buf, order->price, false);
+        buf = bulk_append_mpd(buf, order->lot, false);
+        buf = bulk_append_mpd(buf, order->margin, false);
+        buf = bulk_append_mpd(buf, order->fee, false);
+        buf = bulk_append_mpd(buf, order->swap, false);
+        buf = bulk_append_mpd(buf, order->swaps, false);
+        buf = bulk_append_mpd(buf, order->tp, false);
+        buf = bulk_append_mpd(buf, order->sl, false);
+        buf = bulk_append_mpd(buf, order->margin_price, true);
+
+        if (++rows == BULK_LOAD_ROWS && bulk_flush(conn, table, columns, buf, &rows) < 0) {
+            skiplist_release_iterator(iter);
+            sdsfree(buf);
+            return -__LINE__;
+        }
+    }
+    skiplist_release_iterator(iter);
+
+    int ret = bulk_flush(conn, table, columns, buf, &rows);
+    sdsfree(buf);
+    return ret < 0 ? -__LINE__ : 0;
+}
+
 static int dump_limit_list(MYSQL *conn, const char *table, skiplist_t *list)
 {
     sds sql = sdsempty();
@@ -289,6 +351,40 @@ static int dump_limit_list(MYSQL *conn, const char *table, skiplist_t *list)
     return 0;
 }
 
+static int dump_limit_list_bulk(MYSQL *conn, const char *table, skiplist_t *list)
+{
+    const char *columns = "`id`, `sid`, `side`, `create_time`, `expire_time`, `symbol`, `external`, "
+        "`comment`, `price`, `lot`, `margin`, `fee`, `swap`, `tp`, `sl`";
+    sds buf = sdsempty();
+    size_t rows = 0;
+    skiplist_iter *iter = skiplist_get_iterator(list);
+    skiplist_node *node;
+    while ((node = skiplist_next(iter)) != NULL) {
+        order_t *order = node->value;
+        buf = sdscatprintf(buf, "%"PRIu64"\t%"PRIu64"\t%u\t%f\t%"PRIu64"\t%s\t%"PRIu64"\t",
+                order->id, order->sid, order->side, order->create_time, order->expire_time, order->symbol, order->external);
+        buf = mysql_bulk_append_str(buf, order->comment, false);
+        buf = bulk_append_mpd(buf, order->price, false);
+        buf = bulk_append_mpd(buf, order->lot, false);
+        buf = bulk_append_mpd(buf, order->margin, false);
+        buf = bulk_append_mpd(buf, order->fee, false);
+        buf = bulk_append_mpd(buf, order->swap, false);
+        buf = bulk_append_mpd(buf, order->tp, false);
+        buf = bulk_append_mpd(buf, order->sl, true);
+
+        if (++rows == BULK_LOAD_ROWS && bulk_flush(conn, table, columns, buf, &rows) < 0) {
+            skiplist_release_iterator(iter);
+            sdsfree(buf);
+            return -__LINE__;
+        }
+    }
+    skiplist_release_iterator(iter);
+
+    int ret = bulk_flush(conn, table, columns, buf, &rows);
+    sdsfree(buf);
+    return ret < 0 ? -__LINE__ : 0;
+}
+
 static int dump_balance_dict_v2(MYSQL *conn, const char *table, dict_t *dict)
 {
     sds sql = sdsempty();
@@ -346,6 +442,37 @@ static int dump_balance_dict_v2(MYSQL *conn, const char *table, dict_t *dict)
     return 0;
 }
 
+static int dump_balance_dict_bulk(MYSQL *conn, const char *table, dict_t *dict)
+{
+    const char *columns = "`sid`, `t`, `balance`";
+    sds buf = sdsempty();
+    size_t rows = 0;
+    dict_iterator *iter = dict_get_iterator(dict);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct balance_key *key = entry->key;
+        // float not dump
+        if (key->type > 4)
+            continue;
+
+        uint64_t sid1 = key->sid1;
+        uint64_t sid = sid1 * 100 + key->sid2;
+        buf = sdscatprintf(buf, "%"PRIu64"\t%u\t", sid, key->type);
+        buf = bulk_append_mpd(buf, entry->val, true);
+
+        if (++rows == BULK_LOAD_ROWS && bulk_flush(conn, table, columns, buf, &rows) < 0) {
+            dict_release_iterator(iter);
+            sdsfree(buf);
+            return -__LINE__;
+        }
+    }
+    dict_release_iterator(iter);
+
+    int ret = bulk_flush(conn, table, columns, buf, &rows);
+    sdsfree(buf);
+    return ret < 0 ? -__LINE__ : 0;
+}
+
 int dump_balance(MYSQL *conn, const char *table)
 {
     sds sql = sdsempty();
@@ -370,7 +497,11 @@ int dump_balance(MYSQL *conn, const char *table)
     sdsfree(sql);
 
 //    ret = dump_balance_dict(conn, table, dict_balance);
-    ret = dump_balance_dict_v2(conn, table, dict_balance);
+    if (is_bulk_load(table)) {
+        ret = dump_balance_dict_bulk(conn, table, dict_balance);
+    } else {
+        ret = dump_balance_dict_v2(conn, table, dict_balance);
+    }
     if (ret < 0) {
         log_error("dump_balance_dict fail: %d", ret);
         return -__LINE__;
@@ -402,18 +533,19 @@ int dump_positions(MYSQL *conn, const char *table)
     }
     sdsfree(sql);
 
+    int (*dump_list)(MYSQL *, const char *, skiplist_t *) = is_bulk_load(table) ? dump_positions_list_bulk : dump_positions_list;
     for (int i = 0; i < configs.symbol_num; ++i) {
         market_t *market = get_market(configs.symbols[i].name);
         if (market == NULL) {
             return -__LINE__;
         }
         int ret;
-        ret = dump_positions_list(conn, table, market->buys);
+        ret = dump_list(conn, table, market->buys);
         if (ret < 0) {
             log_error("dump positions: %s buys orders list fail: %d", market->name, ret);
             return -__LINE__;
         }
-        ret = dump_positions_list(conn, table, market->sells);
+        ret = dump_list(conn, table, market->sells);
         if (ret < 0) {
             log_error("dump positions: %s sells orders list fail: %d", market->name, ret);
             return -__LINE__;
@@ -446,18 +578,19 @@ int dump_limits(MYSQL *conn, const char *table)
     }
     sdsfree(sql);
 
+    int (*dump_list)(MYSQL *, const char *, skiplist_t *) = is_bulk_load(table) ? dump_limit_list_bulk : dump_limit_list;
     for (int i = 0; i < configs.symbol_num; ++i) {
         market_t *market = get_market(configs.symbols[i].name);
         if (market == NULL) {
             return -__LINE__;
         }
         int ret;
-        ret = dump_limit_list(conn, table, market->limit_buys);
+        ret = dump_list(conn, table, market->limit_buys);
         if (ret < 0) {
             log_error("dump limits: %s buys orders list fail: %d", market->name, ret);
             return -__LINE__;
         }
-        ret = dump_limit_list(conn, table, market->limit_sells);
+        ret = dump_list(conn, table, market->limit_sells);
         if (ret < 0) {
             log_error("dump limits: %s sells orders list fail: %d", market->name, ret);
             return -__LINE__;
@@ -1,150 +1,274 @@
+
+# include <pthread.h>
+
 # include "me_config.h"
 # include "me_history.h"
 # include "me_balance.h"
 
-static MYSQL *mysql_conn;
-static nw_job *job;
-static dict_t *dict_sql;
-static nw_timer timer;
+/*
+ * 主线程只把字段拷进定长记录，按分表 hash 放进对应线程的单生产者单消费者环形队列；
+ * 队列满时进该线程的溢出链表，引擎线程不等待；
+ * 拼 SQL、mpd_to_sci、转义和批量写入都在历史线程里完成。
+ * 同一个分表(同一个 sid)总是进同一个线程，插入和删除的先后不会乱。
+ */
+# define HISTORY_RING_SIZE      4096    // 每个线程，2 的幂
+# define HISTORY_DEC_WORDS      2       // 38 位有效数字，更长的在主线程转成字符串
+# define HISTORY_BATCH_ROWS     1000
+# define HISTORY_FLUSH_INTERVAL 0.1
 
 enum {
     HISTORY_USER_BALANCE,
-    HISTORY_USER_ORDER,
-    HISTORY_USER_DEAL,
-    HISTORY_ORDER_DETAIL,
     HISTORY_ORDER_DEAL,
     POSITION_INSERT,
     POSITION_DELETE,
     LIMIT_INSERT,
     LIMIT_CANCEL,
-    HISTORY_INSERT
+    HISTORY_INSERT,
+    HISTORY_BALANCE_V2,
+    HISTORY_TYPE_MAX
 };
 
-struct dict_sql_key {
-    uint32_t type;
-    uint32_t hash;
+// mpd_t 的原始字段，线程里拼回一个只读的 mpd_t 再格式化
+struct history_dec {
+    uint8_t         flags;
+    mpd_ssize_t     exp;
+    mpd_ssize_t     digits;
+    mpd_ssize_t     len;
+    mpd_uint_t      data[HISTORY_DEC_WORDS];
+    char            *text;
 };
 
-static uint32_t dict_sql_hash_function(const void *key)
-{
-    return dict_generic_hash_function(key, sizeof(struct dict_sql_key));
-}
+struct history_order {
+    uint64_t        id;
+    uint64_t        external;
+    uint64_t        sid;
+    uint64_t        expire_time;
+    uint32_t        side;
+    double          create_time;
+    double          update_time;
+    double          finish_time;
+    const char      *symbol;    // 指向 market 名字，常驻
+    char            *comment;
+    struct history_dec price;
+    struct history_dec close_price;
+    struct history_dec lot;
+    struct history_dec margin;
+    struct history_dec fee;
+    struct history_dec swap;
+    struct history_dec swaps;
+    struct history_dec profit;
+    struct history_dec tp;
+    struct history_dec sl;
+};
 
-static void *dict_sql_key_dup(const void *key)
-{
-    struct dict_sql_key *obj = malloc(sizeof(struct dict_sql_key));
-    memcpy(obj, key, sizeof(struct dict_sql_key));
-    return obj;
-}
+struct history_balance {
+    double          t;
+    uint64_t        sid;
+    uint64_t        order_id;
+    uint32_t        user_id;
+    int             business;
+    char            *asset;
+    const char      *business_str;
+    char            *comment;
+    struct history_dec change;
+    struct history_dec balance;
+};
 
-static int dict_sql_key_compare(const void *key1, const void *key2)
-{
-    return memcmp(key1, key2, sizeof(struct dict_sql_key));
-}
+struct history_deal {
+    double          t;
+    uint32_t        user_id;
+    uint64_t        deal_id;
+    uint64_t        order_id;
+    uint64_t        deal_order_id;
+    int             role;
+    struct history_dec price;
+    struct history_dec amount;
+    struct history_dec deal;
+    struct history_dec fee;
+    struct history_dec deal_fee;
+};
 
-static void dict_sql_key_free(void *key)
-{
-    free(key);
-}
+struct history_rec {
+    uint32_t        type;
+    uint32_t        hash;
+    union {
+        struct history_order    order;
+        struct history_balance  balance;
+        struct history_deal     deal;
+    };
+};
+
+struct history_spill {
+    struct history_spill *next;
+    struct history_rec rec;
+};
 
-static void *on_job_init(void)
+struct history_worker {
+    pthread_t       tid;
+    // head 只由主线程写，tail 只由工作线程写
+    uint64_t        head __attribute__((aligned(64)));
+    uint64_t        tail __attribute__((aligned(64)));
+    struct history_rec *ring;
+
+    // 只由主线程访问
+    struct history_spill *spill_head;
+    struct history_spill *spill_tail;
+    uint64_t        spill_count;
+
+    MYSQL           *conn;
+    sds             batch[HISTORY_TYPE_MAX][HISTORY_HASH_NUM];
+    size_t          rows;
+    double          last_flush;
+
+    dict_t          *mirror;
+    double          mirror_since;
+    uint64_t        mirror_in;
+    uint64_t        mirror_out;
+};
+
+/*
+ * position/pending 是实时镜像表，只关心窗口结束时的净结果:
+ * 窗口内新建又关闭的单两条都不写，重复写入只保留最后一次，
+ * 其余按 REPLACE / DELETE 批量执行
+ */
+enum {
+    MIRROR_UPSERT,
+    MIRROR_DELETE,
+};
+
+struct mirror_key {
+    uint64_t        id;
+    uint32_t        type;   // POSITION_INSERT 或 LIMIT_INSERT，区分两张表
+};
+
+struct mirror_op {
+    struct mirror_key key;
+    int             op;
+    bool            fresh;  // 窗口内新建，库里还没有这一行
+    struct history_rec rec;
+};
+
+static struct history_worker *workers;
+static int worker_num;
+static bool stop;
+
+// 按 LOAD DATA 文本格式攒批的历史表，init_history 时按 bulk_load 配置决定
+static bool bulk_type[HISTORY_TYPE_MAX];
+static const char *bulk_columns[HISTORY_TYPE_MAX] = {
+    [HISTORY_BALANCE_V2] = "`time`, `sid`, `business`, `order`, `change`, `balance`, `comment`",
+    [HISTORY_INSERT]     = "`id`, `external`, `sid`, `side`, `create_time`, `update_time`, `finish_time`, "
+                           "`symbol`, `comment`, `price`, `close_price`, `lot`, `margin`, `fee`, `swaps`, `profit`, `tp`, `sl`",
+};
+static const char *bulk_tables[HISTORY_TYPE_MAX] = {
+    [HISTORY_BALANCE_V2] = "balance_history",
+    [HISTORY_INSERT]     = "order_history",
+};
+static uint64_t ring_full;          // 进溢出链表的记录数
+static double spill_logged;
+static nw_timer spill_timer;
+
+static uint64_t ring_count(struct history_worker *w)
 {
-    return mysql_connect(&settings.db_history);
+    return w->head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
 }
 
-static void on_job(nw_job_entry *entry, void *privdata)
+// 溢出链表里的记录按顺序搬回环形队列
+static void spill_drain(struct history_worker *w)
 {
-    MYSQL *conn = privdata;
-    sds sql = entry->request;
-    log_trace("exec sql: %s", sql);
-    while (true) {
-        int ret = mysql_real_query(conn, sql, sdslen(sql));
-        if (ret != 0 && mysql_errno(conn) != 1062) {
-            log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-            usleep(1000 * 1000);
-            continue;
-        }
-        break;
+    while (w->spill_head && ring_count(w) < HISTORY_RING_SIZE) {
+        struct history_spill *node = w->spill_head;
+        w->ring[w->head & (HISTORY_RING_SIZE - 1)] = node->rec;
+        __atomic_store_n(&w->head, w->head + 1, __ATOMIC_RELEASE);
+        w->spill_head = node->next;
+        if (w->spill_head == NULL)
+            w->spill_tail = NULL;
+        w->spill_count--;
+        free(node);
     }
 }
 
-static void on_job_cleanup(nw_job_entry *entry)
+static void on_spill_timer(nw_timer *timer, void *privdata)
 {
-    sdsfree(entry->request);
+    for (int i = 0; i < worker_num; ++i)
+        spill_drain(&workers[i]);
 }
 
-static void on_job_release(void *privdata)
+// 队列满时引擎线程不等待，记录进该线程的溢出链表，由定时器搬回队列；
+// 链表非空时后续记录也进链表，保证同一线程内的顺序
+static struct history_rec *rec_alloc(uint32_t type, uint32_t hash)
 {
-    mysql_close(privdata);
+    struct history_worker *w = &workers[hash % worker_num];
+    spill_drain(w);
+    struct history_rec *rec;
+    if (w->spill_head == NULL && ring_count(w) < HISTORY_RING_SIZE) {
+        rec = &w->ring[w->head & (HISTORY_RING_SIZE - 1)];
+    } else {
+        struct history_spill *node = malloc(sizeof(struct history_spill));
+        node->next = NULL;
+        rec = &node->rec;
+        ring_full++;
+        double now = current_timestamp();
+        if (now - spill_logged >= 1.0) {
+            log_fatal("history queue full, spilled: %"PRIu64", worker: %u", w->spill_count + 1, hash % worker_num);
+            spill_logged = now;
+        }
+    }
+    rec->type = type;
+    rec->hash = hash;
+    return rec;
 }
 
-static void on_timer(nw_timer *t, void *privdata)
+static void rec_commit(struct history_rec *rec)
 {
-    size_t count = 0;
-    dict_iterator *iter = dict_get_iterator(dict_sql);
-    dict_entry *entry;
-    while ((entry = dict_next(iter)) != NULL) {
-        nw_job_add(job, 0, entry->val);
-        dict_delete(dict_sql, entry->key);
-        count++;
+    struct history_worker *w = &workers[rec->hash % worker_num];
+    if (rec >= w->ring && rec < w->ring + HISTORY_RING_SIZE) {
+        __atomic_store_n(&w->head, w->head + 1, __ATOMIC_RELEASE);
+        return;
     }
-    dict_release_iterator(iter);
-
-    if (count) {
-        log_debug("flush history count: %zu", count);
+    struct history_spill *node = (struct history_spill *)((char *)rec - offsetof(struct history_spill, rec));
+    if (w->spill_tail) {
+        w->spill_tail->next = node;
+    } else {
+        w->spill_head = node;
     }
+    w->spill_tail = node;
+    w->spill_count++;
 }
 
-int init_history(void)
+static void dec_set(struct history_dec *d, const mpd_t *val)
 {
-    mysql_conn = mysql_init(NULL);
-    if (mysql_conn == NULL)
-        return -__LINE__;
-    if (mysql_options(mysql_conn, MYSQL_SET_CHARSET_NAME, settings.db_history.charset) != 0)
-        return -__LINE__;
-
-    dict_types dt;
-    memset(&dt, 0, sizeof(dt));
-    dt.hash_function  = dict_sql_hash_function;
-    dt.key_compare    = dict_sql_key_compare;
-    dt.key_dup        = dict_sql_key_dup;
-    dt.key_destructor = dict_sql_key_free;
-
-    dict_sql = dict_create(&dt, 1024);
-    if (dict_sql == 0) {
-        return -__LINE__;
+    if (val == NULL || val->len > HISTORY_DEC_WORDS) {
+        d->text = val ? mpd_to_sci(val, 0) : strdup("0");
+        return;
     }
-
-    nw_job_type jt;
-    memset(&jt, 0, sizeof(jt));
-    jt.on_init    = on_job_init;
-    jt.on_job     = on_job;
-    jt.on_cleanup = on_job_cleanup;
-    jt.on_release = on_job_release;
-
-    job = nw_job_create(&jt, settings.history_thread);
-    if (job == NULL)
-        return -__LINE__;
-
-    nw_timer_set(&timer, 0.1, true, on_timer, NULL);
-    nw_timer_start(&timer);
-
-    return 0;
+    d->text = NULL;
+    d->flags = val->flags & ~(MPD_STATIC | MPD_DATAFLAGS);
+    d->exp = val->exp;
+    d->digits = val->digits;
+    d->len = val->len;
+    memcpy(d->data, val->data, val->len * sizeof(mpd_uint_t));
 }
 
-int fini_history(void)
+static char *dec_str(struct history_dec *d)
 {
-    on_timer(NULL, NULL);
-
-    usleep(100 * 1000);
-    nw_job_release(job);
-
-    return 0;
+    if (d->text) {
+        char *str = d->text;
+        d->text = NULL;
+        return str;
+    }
+    mpd_t val;
+    val.flags = d->flags | MPD_STATIC | MPD_CONST_DATA;
+    val.exp = d->exp;
+    val.digits = d->digits;
+    val.len = d->len;
+    val.alloc = HISTORY_DEC_WORDS;
+    val.data = d->data;
+    return mpd_to_sci(&val, 0);
 }
 
-static sds sql_append_mpd(sds sql, mpd_t *val, bool comma)
+static sds sql_append_dec(sds sql, struct history_dec *d, bool comma)
 {
-    char *str = mpd_to_sci(val, 0);
+    char *str = dec_str(d);
     sql = sdscatprintf(sql, "'%s'", str);
     if (comma) {
         sql = sdscatprintf(sql, ", ");
@@ -153,406 +277,626 @@ static sds sql_append_mpd(sds sql, mpd_t *val, bool comma)
     return sql;
 }
 
-static sds get_sql(struct dict_sql_key *key)
+static sds sql_append_str(MYSQL *conn, sds sql, const char *str, bool comma)
 {
-    dict_entry *entry = dict_find(dict_sql, key);
-    if (!entry) {
-        sds val = sdsempty();
-        entry = dict_add(dict_sql, key, val);
-        if (entry == NULL) {
-            sdsfree(val);
-            return NULL;
-        }
+    size_t len = str ? strlen(str) : 0;
+    char *buf = malloc(len * 2 + 1);
+    mysql_real_escape_string(conn, buf, str ? str : "", len);
+    sql = sdscatprintf(sql, "'%s'", buf);
+    if (comma) {
+        sql = sdscatprintf(sql, ", ");
     }
-    return entry->val;
+    free(buf);
+    return sql;
 }
 
-static void set_sql(struct dict_sql_key *key, sds sql)
-{
-    dict_entry *entry = dict_find(dict_sql, key);
-    if (entry) {
-        entry->val = sql;
+static void order_set(struct history_order *o, order_t *order, bool full)
+{
+    o->id = order->id;
+    if (!full)
+        return;
+    o->external = order->external;
+    o->sid = order->sid;
+    o->expire_time = order->expire_time;
+    o->side = order->side;
+    o->create_time = order->create_time;
+    o->update_time = order->update_time;
+    o->finish_time = order->finish_time;
+    o->symbol = order->symbol;
+    o->comment = order->comment ? strdup(order->comment) : NULL;
+    dec_set(&o->price, order->price);
+    dec_set(&o->close_price, order->close_price);
+    dec_set(&o->lot, order->lot);
+    dec_set(&o->margin, order->margin);
+    dec_set(&o->fee, order->fee);
+    dec_set(&o->swap, order->swap);
+    dec_set(&o->swaps, order->swaps);
+    dec_set(&o->profit, order->profit);
+    dec_set(&o->tp, order->tp);
+    dec_set(&o->sl, order->sl);
+}
+
+static void order_free(struct history_order *o)
+{
+    free(o->comment);
+    struct history_dec *decs[] = { &o->price, &o->close_price, &o->lot, &o->margin, &o->fee,
+        &o->swap, &o->swaps, &o->profit, &o->tp, &o->sl };
+    for (size_t i = 0; i < sizeof(decs) / sizeof(decs[0]); ++i) {
+        free(decs[i]->text);
+        decs[i]->text = NULL;
     }
 }
 
-/*
-static int append_user_order(order_t *order)
+// 各类记录的 SQL，batch 为空时加上语句头
+static sds format_user_balance(MYSQL *conn, sds sql, struct history_rec *rec)
 {
-    struct dict_sql_key key;
-    key.hash = order->user_id % HISTORY_HASH_NUM;
-    key.type = HISTORY_USER_ORDER;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
-        return -__LINE__;
-
+    struct history_balance *b = &rec->balance;
     if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `order_history_%u` (`id`, `create_time`, `finish_time`, `user_id`, "
-                "`market`, `source`, `t`, `side`, `price`, `amount`, `taker_fee`, `maker_fee`, `deal_stock`, `deal_money`, `deal_fee`) VALUES ", key.hash);
+        sql = sdscatprintf(sql, "INSERT INTO `balance_history_%u` (`id`, `time`, `user_id`, `asset`, `business`, `change`, `balance`, `detail`) VALUES ", rec->hash);
     } else {
         sql = sdscatprintf(sql, ", ");
     }
-
-    sql = sdscatprintf(sql, "(%"PRIu64", %f, %f, %u, '%s', '%s', %u, %u, ", order->id,
-        order->create_time, order->update_time, order->user_id, order->market, order->source, order->type, order->side);
-    sql = sql_append_mpd(sql, order->price, true);
-    sql = sql_append_mpd(sql, order->amount, true);
-    sql = sql_append_mpd(sql, order->taker_fee, true);
-    sql = sql_append_mpd(sql, order->maker_fee, true);
-    sql = sql_append_mpd(sql, order->deal_stock, true);
-    sql = sql_append_mpd(sql, order->deal_money, true);
-    sql = sql_append_mpd(sql, order->deal_fee, false);
+    sql = sdscatprintf(sql, "(NULL, %f, %u, ", b->t, b->user_id);
+    sql = sql_append_str(conn, sql, b->asset, true);
+    sql = sql_append_str(conn, sql, b->business_str, true);
+    sql = sql_append_dec(sql, &b->change, true);
+    sql = sql_append_dec(sql, &b->balance, true);
+    sql = sql_append_str(conn, sql, b->comment, false);
     sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
-
-    return 0;
+    free(b->asset);
+    free(b->comment);
+    return sql;
 }
 
-static int append_order_detail(order_t *order)
+static sds format_balance_v2(MYSQL *conn, sds sql, struct history_rec *rec)
 {
-    struct dict_sql_key key;
-    key.hash = order->id % HISTORY_HASH_NUM;
-    key.type = HISTORY_ORDER_DETAIL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
-        return -__LINE__;
-
+    struct history_balance *b = &rec->balance;
     if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `order_detail_%u` (`id`, `create_time`, `finish_time`, `user_id`, "
-                "`market`, `source`, `t`, `side`, `price`, `amount`, `taker_fee`, `maker_fee`, `deal_stock`, `deal_money`, `deal_fee`) VALUES ", key.hash);
+        sql = sdscatprintf(sql, "INSERT INTO `balance_history_%u` (`id`, `time`, `sid`, `business`, `order`, `change`, `balance`, `comment`) VALUES ", rec->hash);
     } else {
         sql = sdscatprintf(sql, ", ");
     }
-
-    sql = sdscatprintf(sql, "(%"PRIu64", %f, %f, %u, '%s', '%s', %u, %u, ", order->id,
-        order->create_time, order->update_time, order->user_id, order->market, order->source, order->type, order->side);
-    sql = sql_append_mpd(sql, order->price, true);
-    sql = sql_append_mpd(sql, order->amount, true);
-    sql = sql_append_mpd(sql, order->taker_fee, true);
-    sql = sql_append_mpd(sql, order->maker_fee, true);
-    sql = sql_append_mpd(sql, order->deal_stock, true);
-    sql = sql_append_mpd(sql, order->deal_money, true);
-    sql = sql_append_mpd(sql, order->deal_fee, false);
+    sql = sdscatprintf(sql, "(NULL, %f, %"PRIu64", '%d', %"PRIu64", ", b->t, b->sid, b->business, b->order_id);
+    sql = sql_append_dec(sql, &b->change, true);
+    sql = sql_append_dec(sql, &b->balance, true);
+    sql = sql_append_str(conn, sql, b->comment, false);
     sql = sdscatprintf(sql, ")");
+    free(b->comment);
+    return sql;
+}
 
-    set_sql(&key, sql);
+static sds bulk_append_dec(sds buf, struct history_dec *d, bool last)
+{
+    char *str = dec_str(d);
+    buf = mysql_bulk_append_str(buf, str, last);
+    free(str);
+    return buf;
+}
 
-    return 0;
+static sds format_balance_v2_bulk(sds buf, struct history_rec *rec)
+{
+    struct history_balance *b = &rec->balance;
+    buf = sdscatprintf(buf, "%f\t%"PRIu64"\t%d\t%"PRIu64"\t", b->t, b->sid, b->business, b->order_id);
+    buf = bulk_append_dec(buf, &b->change, false);
+    buf = bulk_append_dec(buf, &b->balance, false);
+    buf = mysql_bulk_append_str(buf, b->comment, true);
+    free(b->comment);
+    return buf;
 }
-*/
 
-static int append_order_deal(double t, uint32_t user_id, uint64_t deal_id, uint64_t order_id, uint64_t deal_order_id, int role, mpd_t *price, mpd_t *amount, mpd_t *deal, mpd_t *fee, mpd_t *deal_fee)
+static sds format_order_history_bulk(sds buf, struct history_rec *rec)
 {
-    struct dict_sql_key key;
-    key.hash = order_id % HISTORY_HASH_NUM;
-    key.type = HISTORY_ORDER_DEAL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
-        return -__LINE__;
+    struct history_order *o = &rec->order;
+    buf = sdscatprintf(buf, "%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%u\t%f\t%f\t%f\t%s\t", o->id, o->external,
+            o->sid, o->side, o->create_time, o->update_time, o->finish_time, o->symbol);
+    buf = mysql_bulk_append_str(buf, o->comment ? o->comment : "", false);
+    buf = bulk_append_dec(buf, &o->price, false);
+    buf = bulk_append_dec(buf, &o->close_price, false);
+    buf = bulk_append_dec(buf, &o->lot, false);
+    buf = bulk_append_dec(buf, &o->margin, false);
+    buf = bulk_append_dec(buf, &o->fee, false);
+    buf = bulk_append_dec(buf, &o->swaps, false);
+    buf = bulk_append_dec(buf, &o->profit, false);
+    buf = bulk_append_dec(buf, &o->tp, false);
+    buf = bulk_append_dec(buf, &o->sl, true);
+    return buf;
+}
 
+static sds format_order_deal(sds sql, struct history_rec *rec)
+{
+    struct history_deal *d = &rec->deal;
     if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `deal_history_%u` (`id`, `time`, `user_id`, `deal_id`, `order_id`, `deal_order_id`, `role`, `price`, `amount`, `deal`, `fee`, `deal_fee`) VALUES ", key.hash);
+        sql = sdscatprintf(sql, "INSERT INTO `deal_history_%u` (`id`, `time`, `user_id`, `deal_id`, `order_id`, `deal_order_id`, `role`, `price`, `amount`, `deal`, `fee`, `deal_fee`) VALUES ", rec->hash);
     } else {
         sql = sdscatprintf(sql, ", ");
     }
-
-    sql = sdscatprintf(sql, "(NULL, %f, %u, %"PRIu64", %"PRIu64", %"PRIu64", %d, ", t, user_id, deal_id, order_id, deal_order_id, role);
-    sql = sql_append_mpd(sql, price, true);
-    sql = sql_append_mpd(sql, amount, true);
-    sql = sql_append_mpd(sql, deal, true);
-    sql = sql_append_mpd(sql, fee, true);
-    sql = sql_append_mpd(sql, deal_fee, false);
+    sql = sdscatprintf(sql, "(NULL, %f, %u, %"PRIu64", %"PRIu64", %"PRIu64", %d, ", d->t, d->user_id, d->deal_id, d->order_id, d->deal_order_id, d->role);
+    sql = sql_append_dec(sql, &d->price, true);
+    sql = sql_append_dec(sql, &d->amount, true);
+    sql = sql_append_dec(sql, &d->deal, true);
+    sql = sql_append_dec(sql, &d->fee, true);
+    sql = sql_append_dec(sql, &d->deal_fee, false);
     sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
-
-    return 0;
+    return sql;
 }
 
-static int append_user_deal(double t, uint32_t user_id, const char *market, uint64_t deal_id, uint64_t order_id, uint64_t deal_order_id, int side, int role, mpd_t *price, mpd_t *amount, mpd_t *deal, mpd_t *fee, mpd_t *deal_fee)
+static sds format_position(MYSQL *conn, sds sql, struct history_rec *rec)
 {
-    struct dict_sql_key key;
-    key.hash = user_id % HISTORY_HASH_NUM;
-    key.type = HISTORY_USER_DEAL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
-        return -__LINE__;
-
+    struct history_order *o = &rec->order;
     if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `user_deal_history_%u` (`id`, `time`, `user_id`, `market`, `deal_id`, `order_id`, `deal_order_id`, `side`, `role`, `price`, `amount`, `deal`, `fee`, `deal_fee`) VALUES ", key.hash);
+        sql = sdscatprintf(sql, "REPLACE INTO `position` (`id`, `sid`, `side`, `create_time`, `update_time`, `symbol`, "
+                "`comment`, `price`, `lot`, `margin`, `fee`, `swap`, `tp`, `sl`) VALUES ");
     } else {
         sql = sdscatprintf(sql, ", ");
     }
-
-    sql = sdscatprintf(sql, "(NULL, %f, %u, '%s', %"PRIu64", %"PRIu64", %"PRIu64", %d, %d, ", t, user_id, market, deal_id, order_id, deal_order_id, side, role);
-    sql = sql_append_mpd(sql, price, true);
-    sql = sql_append_mpd(sql, amount, true);
-    sql = sql_append_mpd(sql, deal, true);
-    sql = sql_append_mpd(sql, fee, true);
-    sql = sql_append_mpd(sql, deal_fee, false);
+    sql = sdscatprintf(sql, "(%"PRIu64", %"PRIu64", %u, %f, %f, '%s', ",
+            o->id, o->sid, o->side, o->create_time, o->update_time, o->symbol);
+    sql = sql_append_str(conn, sql, o->comment, true);
+    sql = sql_append_dec(sql, &o->price, true);
+    sql = sql_append_dec(sql, &o->lot, true);
+    sql = sql_append_dec(sql, &o->margin, true);
+    sql = sql_append_dec(sql, &o->fee, true);
+    sql = sql_append_dec(sql, &o->swap, true);
+    sql = sql_append_dec(sql, &o->tp, true);
+    sql = sql_append_dec(sql, &o->sl, false);
     sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
-
-    return 0;
+    return sql;
 }
 
-static int append_user_balance(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change, mpd_t *balance, const char *detail)
+static sds format_limit(MYSQL *conn, sds sql, struct history_rec *rec)
 {
-    struct dict_sql_key key;
-    key.hash = user_id % HISTORY_HASH_NUM;
-    key.type = HISTORY_USER_BALANCE;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
-        return -__LINE__;
-
+    struct history_order *o = &rec->order;
     if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `balance_history_%u` (`id`, `time`, `user_id`, `asset`, `business`, `change`, `balance`, `detail`) VALUES ", key.hash);
+        sql = sdscatprintf(sql, "REPLACE INTO `pending` (`id`, `sid`, `side`, `create_time`, `expire_time`, `symbol`, "
+                "`comment`, `price`, `lot`, `margin`, `fee`, `swap`, `tp`, `sl`) VALUES ");
     } else {
         sql = sdscatprintf(sql, ", ");
     }
-
-    char buf[10 * 1024];
-    sql = sdscatprintf(sql, "(NULL, %f, %u, '%s', '%s', ", t, user_id, asset, business);
-    sql = sql_append_mpd(sql, change, true);
-    sql = sql_append_mpd(sql, balance, true);
-    mysql_real_escape_string(mysql_conn, buf, detail, strlen(detail));
-    sql = sdscatprintf(sql, "'%s')", buf);
-
-    set_sql(&key, sql);
-
-    return 0;
+    sql = sdscatprintf(sql, "(%"PRIu64", %"PRIu64", %u, %f, %"PRIu64", '%s', ",
+            o->id, o->sid, o->side, o->create_time, o->expire_time, o->symbol);
+    sql = sql_append_str(conn, sql, o->comment, true);
+    sql = sql_append_dec(sql, &o->price, true);
+    sql = sql_append_dec(sql, &o->lot, true);
+    sql = sql_append_dec(sql, &o->margin, true);
+    sql = sql_append_dec(sql, &o->fee, true);
+    sql = sql_append_dec(sql, &o->swap, true);
+    sql = sql_append_dec(sql, &o->tp, true);
+    sql = sql_append_dec(sql, &o->sl, false);
+    sql = sdscatprintf(sql, ")");
+    return sql;
 }
 
-int append_order_history(order_t *order)
+static sds format_order_history(MYSQL *conn, sds sql, struct history_rec *rec)
 {
-//    append_user_order(order);
-//    append_order_detail(order);
-
-    return 0;
+    struct history_order *o = &rec->order;
+    if (sdslen(sql) == 0) {
+        sql = sdscatprintf(sql, "INSERT INTO `order_history_%u` (`id`, `external`, `sid`, `side`, `create_time`, `update_time`, `finish_time`, "
+               "`symbol`, `comment`, `price`, `close_price`, `lot`, `margin`, `fee`, `swaps`, `profit`, `tp`, `sl`) VALUES ", rec->hash);
+    } else {
+        sql = sdscatprintf(sql, ", ");
+    }
+    sql = sdscatprintf(sql, "(%"PRIu64", %"PRIu64", %"PRIu64", %u, %f, %f, %f, '%s', ", o->id, o->external,
+            o->sid, o->side, o->create_time, o->update_time, o->finish_time, o->symbol);
+    sql = sql_append_str(conn, sql, o->comment, true);
+    sql = sql_append_dec(sql, &o->price, true);
+    sql = sql_append_dec(sql, &o->close_price, true);
+    sql = sql_append_dec(sql, &o->lot, true);
+    sql = sql_append_dec(sql, &o->margin, true);
+    sql = sql_append_dec(sql, &o->fee, true);
+    sql = sql_append_dec(sql, &o->swaps, true);
+    sql = sql_append_dec(sql, &o->profit, true);
+    sql = sql_append_dec(sql, &o->tp, true);
+    sql = sql_append_dec(sql, &o->sl, false);
+    sql = sdscatprintf(sql, ")");
+    return sql;
 }
 
-int append_order_deal_history(double t, uint64_t deal_id, order_t *ask, int ask_role, order_t *bid, int bid_role, mpd_t *price, mpd_t *amount, mpd_t *deal, mpd_t *ask_fee, mpd_t *bid_fee)
+static sds format_delete(sds sql, const char *table, struct history_rec *rec)
 {
-    append_order_deal(t, ask->user_id, deal_id, ask->id, bid->id, ask_role, price, amount, deal, ask_fee, bid_fee);
-    append_order_deal(t, bid->user_id, deal_id, bid->id, ask->id, bid_role, price, amount, deal, bid_fee, ask_fee);
-
-//    append_user_deal(t, ask->user_id, ask->market, deal_id, ask->id, bid->id, ask->side, ask_role, price, amount, deal, ask_fee, bid_fee);
-//    append_user_deal(t, bid->user_id, ask->market, deal_id, bid->id, ask->id, bid->side, bid_role, price, amount, deal, bid_fee, ask_fee);
-
-    return 0;
+    if (sdslen(sql) == 0) {
+        sql = sdscatprintf(sql, "DELETE FROM `%s` WHERE `id`=%"PRIu64"", table, rec->order.id);
+    } else {
+        sql = sdscatprintf(sql, " OR `id`=%"PRIu64"", rec->order.id);
+    }
+    return sql;
 }
 
-int append_user_balance_history(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change, const char *detail)
+static uint32_t mirror_hash_function(const void *key)
 {
-    mpd_t *balance = balance_total(user_id);
-    append_user_balance(t, user_id, asset, business, change, balance, detail);
-    mpd_del(balance);
-
-    return 0;
+    return dict_generic_hash_function(key, sizeof(struct mirror_key));
 }
 
-bool is_history_block(void)
+static int mirror_key_compare(const void *key1, const void *key2)
 {
-    if (job->request_count >= MAX_PENDING_HISTORY) {
-        return true;
-    }
-    return false;
+    return memcmp(key1, key2, sizeof(struct mirror_key));
 }
 
-sds history_status(sds reply)
+static void mirror_val_free(void *val)
 {
-    return sdscatprintf(reply, "history pending %d\n", job->request_count);
+    struct mirror_op *op = val;
+    if (op->op == MIRROR_UPSERT)
+        order_free(&op->rec.order);
+    free(op);
 }
 
-static int append_user_balance_v2(double t, uint64_t sid, uint64_t order_id, int business, mpd_t *change, mpd_t *balance, const char *comment)
+static void mirror_add(struct history_worker *w, struct history_rec *rec)
 {
-    uint32_t hash = sid % HISTORY_HASH_NUM;
-    struct dict_sql_key key;
-    key.hash = hash;
-    key.type = HISTORY_USER_BALANCE;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
-        return -__LINE__;
+    bool insert = rec->type == POSITION_INSERT || rec->type == LIMIT_INSERT;
+    struct mirror_key key = { .id = rec->order.id, .type = (rec->type == POSITION_INSERT || rec->type == POSITION_DELETE) ? POSITION_INSERT : LIMIT_INSERT };
+    if (dict_size(w->mirror) == 0)
+        w->mirror_since = current_timestamp();
+    __atomic_add_fetch(&w->mirror_in, 1, __ATOMIC_RELAXED);
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `balance_history_%u` (`id`, `time`, `sid`, `business`, `order`, `change`, `balance`, `comment`) VALUES ", key.hash);
+    dict_entry *entry = dict_find(w->mirror, &key);
+    struct mirror_op *op = entry ? entry->val : NULL;
+    if (op == NULL) {
+        op = malloc(sizeof(struct mirror_op));
+        op->key = key;
+        op->op = insert ? MIRROR_UPSERT : MIRROR_DELETE;
+        op->fresh = insert;
+        op->rec = *rec;
+        dict_add(w->mirror, &op->key, op);
+        return;
+    }
+
+    if (op->op == MIRROR_UPSERT)
+        order_free(&op->rec.order);
+    if (insert) {
+        op->op = MIRROR_UPSERT;
+        op->rec = *rec;
+    } else if (op->fresh) {
+        // 新建后关闭，两条都抵消；上面已释放，避免析构时再释放
+        op->op = MIRROR_DELETE;
+        dict_delete(w->mirror, &key);
     } else {
-        sql = sdscatprintf(sql, ", ");
+        op->op = MIRROR_DELETE;
+        op->rec = *rec;
+    }
+}
+
+static void mirror_flush(struct history_worker *w)
+{
+    dict_iterator *iter = dict_get_iterator(w->mirror);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct mirror_op *op = entry->val;
+        struct history_rec *rec = &op->rec;
+        uint32_t type = op->op == MIRROR_UPSERT ? op->key.type : (op->key.type == POSITION_INSERT ? POSITION_DELETE : LIMIT_CANCEL);
+        sds *sql = &w->batch[type][0];
+        if (*sql == NULL)
+            *sql = sdsempty();
+
+        switch (type) {
+        case POSITION_INSERT:
+            *sql = format_position(w->conn, *sql, rec);
+            break;
+        case LIMIT_INSERT:
+            *sql = format_limit(w->conn, *sql, rec);
+            break;
+        case POSITION_DELETE:
+            *sql = format_delete(*sql, "position", rec);
+            break;
+        case LIMIT_CANCEL:
+            *sql = format_delete(*sql, "pending", rec);
+            break;
+        }
+        __atomic_add_fetch(&w->mirror_out, 1, __ATOMIC_RELAXED);
     }
+    dict_release_iterator(iter);
+    dict_clear(w->mirror);
+}
 
-    char buf[10 * 1024];
-    sql = sdscatprintf(sql, "(NULL, %f, %"PRIu64", '%d', %d, ", t, sid, business, order_id);
-    sql = sql_append_mpd(sql, change, true);
-    sql = sql_append_mpd(sql, balance, true);
-    mysql_real_escape_string(mysql_conn, buf, comment, strlen(comment));
-    sql = sdscatprintf(sql, "'%s')", buf);
+static void format_rec(struct history_worker *w, struct history_rec *rec)
+{
+    switch (rec->type) {
+    case POSITION_INSERT:
+    case POSITION_DELETE:
+    case LIMIT_INSERT:
+    case LIMIT_CANCEL:
+        mirror_add(w, rec);
+        return;
+    }
 
-    set_sql(&key, sql);
+    sds *sql = &w->batch[rec->type][rec->hash];
+    if (*sql == NULL)
+        *sql = sdsempty();
 
-    return 0;
+    switch (rec->type) {
+    case HISTORY_USER_BALANCE:
+        *sql = format_user_balance(w->conn, *sql, rec);
+        break;
+    case HISTORY_BALANCE_V2:
+        if (bulk_type[rec->type]) {
+            *sql = format_balance_v2_bulk(*sql, rec);
+        } else {
+            *sql = format_balance_v2(w->conn, *sql, rec);
+        }
+        break;
+    case HISTORY_ORDER_DEAL:
+        *sql = format_order_deal(*sql, rec);
+        break;
+    case HISTORY_INSERT:
+        if (bulk_type[rec->type]) {
+            *sql = format_order_history_bulk(*sql, rec);
+        } else {
+            *sql = format_order_history(w->conn, *sql, rec);
+        }
+        // swap 不入历史表，未消费的文本同样释放
+        order_free(&rec->order);
+        break;
+    }
+    w->rows++;
 }
 
-int append_user_balance_history_v2(double t, uint64_t sid, uint64_t order_id, int business, mpd_t *change, mpd_t * balance, const char *comment)
+static void exec_sql(MYSQL *conn, sds sql)
 {
-    append_user_balance_v2(t, sid, order_id, business, change, balance, comment);
-    return 0;
+    log_trace("exec sql: %s", sql);
+    while (true) {
+        int ret = mysql_real_query(conn, sql, sdslen(sql));
+        if (ret != 0 && mysql_errno(conn) != 1062) {
+            log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+            usleep(1000 * 1000);
+            continue;
+        }
+        break;
+    }
 }
 
-int append_position(order_t *order)
+static void load_bulk(MYSQL *conn, int type, int hash, sds data)
 {
-    uint32_t hash = order->sid % HISTORY_HASH_NUM;
-    struct dict_sql_key key;
-    key.hash = hash;
-    key.type = POSITION_INSERT;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
-        return -__LINE__;
+    char table[64];
+    snprintf(table, sizeof(table), "%s_%d", bulk_tables[type], hash);
+    int ret;
+    while ((ret = mysql_load_data(conn, table, bulk_columns[type], data, sdslen(data))) < 0) {
+        log_fatal("load %s fail, %zu bytes", table, sdslen(data));
+        usleep(1000 * 1000);
+    }
+    // 行已写入，重试会让自增 id 的表重复，只告警
+    if (ret > 0) {
+        log_fatal("load %s with %d bad rows, %zu bytes", table, ret, sdslen(data));
+    }
+}
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `position` (`id`, `sid`, `side`, `create_time`, `update_time`, `symbol`, "
-                "`comment`, `price`, `lot`, `margin`, `fee`, `swap`, `tp`, `sl`) VALUES ");
-    } else {
-        sql = sdscatprintf(sql, ", ");
+// 按类型顺序执行，同一批里的插入总在删除之前
+static void flush_batch(struct history_worker *w)
+{
+    for (int type = 0; type < HISTORY_TYPE_MAX; ++type) {
+        for (int hash = 0; hash < HISTORY_HASH_NUM; ++hash) {
+            sds sql = w->batch[type][hash];
+            if (sql == NULL || sdslen(sql) == 0)
+                continue;
+            if (bulk_type[type]) {
+                load_bulk(w->conn, type, hash, sql);
+            } else {
+                exec_sql(w->conn, sql);
+            }
+            sdsclear(sql);
+        }
+    }
+    if (w->rows) {
+        log_debug("flush history rows: %zu", w->rows);
     }
+    w->rows = 0;
+    w->last_flush = current_timestamp();
+}
 
+static void *worker_thread(void *arg)
+{
+    struct history_worker *w = arg;
+    while ((w->conn = mysql_connect(&settings.db_history)) == NULL) {
+        log_fatal("history connect mysql fail");
+        usleep(1000 * 1000);
+    }
 
-    sql = sdscatprintf(sql, "(%"PRIu64", %"PRIu64", %u, %f, %f, '%s', '%s', ",
-            order->id, order->sid, order->side, order->create_time, order->update_time, order->symbol, order->comment);
-    sql = sql_append_mpd(sql, order->price, true);
-    sql = sql_append_mpd(sql, order->lot, true);
-    sql = sql_append_mpd(sql, order->margin, true);
-    sql = sql_append_mpd(sql, order->fee, true);
-    sql = sql_append_mpd(sql, order->swap, true);
-    sql = sql_append_mpd(sql, order->tp, true);
-    sql = sql_append_mpd(sql, order->sl, false);
-    sql = sdscatprintf(sql, ")");
+    while (true) {
+        uint64_t head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = w->tail;
+        while (tail != head && w->rows < HISTORY_BATCH_ROWS) {
+            format_rec(w, &w->ring[tail & (HISTORY_RING_SIZE - 1)]);
+            tail++;
+            __atomic_store_n(&w->tail, tail, __ATOMIC_RELEASE);
+        }
 
-    set_sql(&key, sql);
+        bool done = __atomic_load_n(&stop, __ATOMIC_ACQUIRE) && tail == __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+        if (dict_size(w->mirror) && (dict_size(w->mirror) >= HISTORY_BATCH_ROWS ||
+                    current_timestamp() - w->mirror_since >= settings.history_coalesce || done)) {
+            w->rows += dict_size(w->mirror);
+            mirror_flush(w);
+        }
+        if (w->rows >= HISTORY_BATCH_ROWS || (w->rows && current_timestamp() - w->last_flush >= HISTORY_FLUSH_INTERVAL) || done)
+            flush_batch(w);
+        if (done)
+            break;
+        if (tail == head)
+            usleep(1000);
+    }
 
-    return 0;
+    for (int type = 0; type < HISTORY_TYPE_MAX; ++type) {
+        for (int hash = 0; hash < HISTORY_HASH_NUM; ++hash) {
+            if (w->batch[type][hash])
+                sdsfree(w->batch[type][hash]);
+        }
+    }
+    dict_release(w->mirror);
+    mysql_close(w->conn);
+    return NULL;
 }
 
-static int delete_position(order_t *order)
+int init_history(void)
 {
-    uint32_t hash = order->sid % HISTORY_HASH_NUM;
-    struct dict_sql_key key;
-    key.hash = hash;
-    key.type = POSITION_DELETE;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    worker_num = settings.history_thread > 0 ? settings.history_thread : 1;
+    workers = calloc(worker_num, sizeof(struct history_worker));
+    if (workers == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "DELETE FROM `position` WHERE `id`=%"PRIu64"", order->id);
-    } else {
-        sql = sdscatprintf(sql, " OR `id`=%"PRIu64"", order->id);
+    for (int type = 0; type < HISTORY_TYPE_MAX; ++type) {
+        if (bulk_tables[type])
+            bulk_type[type] = is_bulk_load(bulk_tables[type]);
     }
 
-    set_sql(&key, sql);
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function    = mirror_hash_function;
+    dt.key_compare      = mirror_key_compare;
+    dt.val_destructor   = mirror_val_free;
+
+    for (int i = 0; i < worker_num; ++i) {
+        struct history_worker *w = &workers[i];
+        w->ring = malloc(sizeof(struct history_rec) * HISTORY_RING_SIZE);
+        if (w->ring == NULL)
+            return -__LINE__;
+        w->mirror = dict_create(&dt, 1024);
+        if (w->mirror == NULL)
+            return -__LINE__;
+        w->last_flush = current_timestamp();
+        if (pthread_create(&w->tid, NULL, worker_thread, w) != 0)
+            return -__LINE__;
+    }
+
+    nw_timer_set(&spill_timer, HISTORY_FLUSH_INTERVAL, true, on_spill_timer, NULL);
+    nw_timer_start(&spill_timer);
 
     return 0;
 }
 
-static int append_order_history_v2(order_t *order)
+int fini_history(void)
 {
-    uint32_t hash = order->sid % HISTORY_HASH_NUM;
-    struct dict_sql_key key;
-    key.hash = hash;
-    key.type = HISTORY_INSERT;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
-        return -__LINE__;
-
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `order_history_%u` (`id`, `external`, `sid`, `side`, `create_time`, `update_time`, `finish_time`, "
-               "`symbol`, `comment`, `price`, `close_price`, `lot`, `margin`, `fee`, `swaps`, `profit`, `tp`, `sl`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
+    nw_timer_stop(&spill_timer);
+    // 退出前把溢出的记录都交给工作线程
+    for (int i = 0; i < worker_num; ++i) {
+        while (workers[i].spill_head) {
+            spill_drain(&workers[i]);
+            if (workers[i].spill_head)
+                usleep(1000);
+        }
     }
-
-    sql = sdscatprintf(sql, "(%"PRIu64", %"PRIu64", %"PRIu64", %u, %f, %f, %f, '%s', '%s', ", order->id, order->external,
-            order->sid, order->side, order->create_time, order->update_time, order->finish_time, order->symbol, order->comment);
-    sql = sql_append_mpd(sql, order->price, true);
-    sql = sql_append_mpd(sql, order->close_price, true);
-    sql = sql_append_mpd(sql, order->lot, true);
-    sql = sql_append_mpd(sql, order->margin, true);
-    sql = sql_append_mpd(sql, order->fee, true);
-    sql = sql_append_mpd(sql, order->swaps, true);
-    sql = sql_append_mpd(sql, order->profit, true);
-    sql = sql_append_mpd(sql, order->tp, true);
-    sql = sql_append_mpd(sql, order->sl, false);
-    sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
+    __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+    for (int i = 0; i < worker_num; ++i) {
+        pthread_join(workers[i].tid, NULL);
+        free(workers[i].ring);
+    }
+    free(workers);
+    workers = NULL;
 
     return 0;
 }
 
-int finish_position(order_t *order)
+int append_order_history(order_t *order)
 {
-    delete_position(order);
-    append_order_history_v2(order);
+    return 0;
 }
 
-int append_limit(order_t *order)
+static void append_order_deal(double t, uint32_t user_id, uint64_t deal_id, uint64_t order_id, uint64_t deal_order_id, int role, mpd_t *price, mpd_t *amount, mpd_t *deal, mpd_t *fee, mpd_t *deal_fee)
 {
-    uint32_t hash = order->sid % HISTORY_HASH_NUM;
-    struct dict_sql_key key;
-    key.hash = hash;
-    key.type = LIMIT_INSERT;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
-        return -__LINE__;
+    struct history_rec *rec = rec_alloc(HISTORY_ORDER_DEAL, order_id % HISTORY_HASH_NUM);
+    struct history_deal *d = &rec->deal;
+    d->t = t;
+    d->user_id = user_id;
+    d->deal_id = deal_id;
+    d->order_id = order_id;
+    d->deal_order_id = deal_order_id;
+    d->role = role;
+    dec_set(&d->price, price);
+    dec_set(&d->amount, amount);
+    dec_set(&d->deal, deal);
+    dec_set(&d->fee, fee);
+    dec_set(&d->deal_fee, deal_fee);
+    rec_commit(rec);
+}
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `pending` (`id`, `sid`, `side`, `create_time`, `expire_time`, `symbol`, "
-                "`comment`, `price`, `lot`, `margin`, `fee`, `swap`, `tp`, `sl`) VALUES ");
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
+int append_order_deal_history(double t, uint64_t deal_id, order_t *ask, int ask_role, order_t *bid, int bid_role, mpd_t *price, mpd_t *amount, mpd_t *deal, mpd_t *ask_fee, mpd_t *bid_fee)
+{
+    append_order_deal(t, ask->user_id, deal_id, ask->id, bid->id, ask_role, price, amount, deal, ask_fee, bid_fee);
+    append_order_deal(t, bid->user_id, deal_id, bid->id, ask->id, bid_role, price, amount, deal, bid_fee, ask_fee);
+    return 0;
+}
 
+int append_user_balance_history(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change, const char *detail)
+{
+    mpd_t *balance = balance_total(user_id);
+    struct history_rec *rec = rec_alloc(HISTORY_USER_BALANCE, user_id % HISTORY_HASH_NUM);
+    struct history_balance *b = &rec->balance;
+    b->t = t;
+    b->user_id = user_id;
+    b->asset = strdup(asset);
+    b->business_str = business;     // 调用方传入的都是常量
+    b->comment = strdup(detail);
+    dec_set(&b->change, change);
+    dec_set(&b->balance, balance);
+    rec_commit(rec);
+    mpd_del(balance);
+    return 0;
+}
 
-    sql = sdscatprintf(sql, "(%"PRIu64", %"PRIu64", %u, %f, %"PRIu64", '%s', '%s', ",
-            order->id, order->sid, order->side, order->create_time, order->expire_time, order->symbol, order->comment);
-    sql = sql_append_mpd(sql, order->price, true);
-    sql = sql_append_mpd(sql, order->lot, true);
-    sql = sql_append_mpd(sql, order->margin, true);
-    sql = sql_append_mpd(sql, order->fee, true);
-    sql = sql_append_mpd(sql, order->swap, true);
-    sql = sql_append_mpd(sql, order->tp, true);
-    sql = sql_append_mpd(sql, order->sl, false);
-    sql = sdscatprintf(sql, ")");
+bool is_history_block(void)
+{
+    for (int i = 0; i < worker_num; ++i) {
+        if (workers[i].spill_head || ring_count(&workers[i]) >= HISTORY_RING_SIZE / 2)
+            return true;
+    }
+    return false;
+}
 
-    set_sql(&key, sql);
+sds history_status(sds reply)
+{
+    uint64_t pending = 0, spilled = 0, mirror_in = 0, mirror_out = 0;
+    for (int i = 0; i < worker_num; ++i) {
+        pending += ring_count(&workers[i]);
+        spilled += workers[i].spill_count;
+        mirror_in += __atomic_load_n(&workers[i].mirror_in, __ATOMIC_RELAXED);
+        mirror_out += __atomic_load_n(&workers[i].mirror_out, __ATOMIC_RELAXED);
+    }
+    reply = sdscatprintf(reply, "history pending %"PRIu64", spilled: %"PRIu64", queue full: %"PRIu64"\n", pending, spilled, ring_full);
+    reply = sdscatprintf(reply, "history mirror in: %"PRIu64", out: %"PRIu64"\n", mirror_in, mirror_out);
+    return mysql_bulk_status(reply);
+}
 
+int append_user_balance_history_v2(double t, uint64_t sid, uint64_t order_id, int business, mpd_t *change, mpd_t * balance, const char *comment)
+{
+    struct history_rec *rec = rec_alloc(HISTORY_BALANCE_V2, sid % HISTORY_HASH_NUM);
+    struct history_balance *b = &rec->balance;
+    b->t = t;
+    b->sid = sid;
+    b->order_id = order_id;
+    b->business = business;
+    b->comment = strdup(comment ? comment : "");
+    dec_set(&b->change, change);
+    dec_set(&b->balance, balance);
+    rec_commit(rec);
     return 0;
 }
 
-static int delete_limit(order_t *order)
+static void append_order_rec(uint32_t type, order_t *order, bool full)
 {
-    uint32_t hash = order->sid % HISTORY_HASH_NUM;
-    struct dict_sql_key key;
-    key.hash = hash;
-    key.type = LIMIT_CANCEL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
-        return -__LINE__;
+    struct history_rec *rec = rec_alloc(type, order->sid % HISTORY_HASH_NUM);
+    order_set(&rec->order, order, full);
+    rec_commit(rec);
+}
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "DELETE FROM `pending` WHERE `id`=%"PRIu64"", order->id);
-    } else {
-        sql = sdscatprintf(sql, " OR `id`=%"PRIu64"", order->id);
-    }
+int append_position(order_t *order)
+{
+    append_order_rec(POSITION_INSERT, order, true);
+    return 0;
+}
 
-    set_sql(&key, sql);
+int finish_position(order_t *order)
+{
+    append_order_rec(POSITION_DELETE, order, false);
+    append_order_rec(HISTORY_INSERT, order, true);
+    return 0;
+}
 
+int append_limit(order_t *order)
+{
+    append_order_rec(LIMIT_INSERT, order, true);
     return 0;
 }
 
 int finish_limit(order_t *order, bool cancel)
 {
-    delete_limit(order);
+    append_order_rec(LIMIT_CANCEL, order, false);
     if (cancel)
-        append_order_history_v2(order);
+        append_order_rec(HISTORY_INSERT, order, true);
+    return 0;
 }
+
@@ -39,29 +39,9 @@ static void flush_list(void)
         // margin price
         mpd_t *margin_bid_price = mpd_new(&mpd_ctx);
         mpd_t *margin_ask_price = mpd_new(&mpd_ctx);
-        mpd_copy(margin_bid_price, mpd_one, &mpd_ctx);
-        mpd_copy(margin_ask_price, mpd_one, &mpd_ctx);
-        symbol_t *sym = get_symbol(symbol);
-        if (sym->margin_calc == MARGIN_CALC_FOREX) {
-            if (sym->margin_type == MARGIN_TYPE_AC || sym->margin_type == MARGIN_TYPE_BC) {
-                mpd_copy(margin_ask_price, symbol_ask(sym->margin_symbol), &mpd_ctx);
-                mpd_copy(margin_bid_price, symbol_bid(sym->margin_symbol), &mpd_ctx);
-            }
-        } else {
-            if (strcmp(sym->name, "HSI") == 0) {
-                mpd_copy(margin_ask_price, symbol_ask("USDHKD"), &mpd_ctx);
-                mpd_copy(margin_bid_price, symbol_bid("USDHKD"), &mpd_ctx);
-            } else if (strcmp(sym->name, "DAX") == 0) {
-                mpd_copy(margin_ask_price, symbol_ask("EURUSD"), &mpd_ctx);
-                mpd_copy(margin_bid_price, symbol_bid("EURUSD"), &mpd_ctx);
-            } else if (strcmp(sym->name, "UK100") == 0) {
-                mpd_copy(margin_ask_price, symbol_ask("GBPUSD"), &mpd_ctx);
-                mpd_copy(margin_bid_price, symbol_bid("GBPUSD"), &mpd_ctx);
-            } else if (strcmp(sym->name, "JP225") == 0) {
-                mpd_copy(margin_ask_price, symbol_ask("USDJPY"), &mpd_ctx);
-                mpd_copy(margin_bid_price, symbol_bid("USDJPY"), &mpd_ctx);
-            }
-        }
+        symbol_t *sym = m->sym;
+        mpd_copy(margin_ask_price, symbol_margin_price(sym, ORDER_SIDE_BUY), &mpd_ctx);
+        mpd_copy(margin_bid_price, symbol_margin_price(sym, ORDER_SIDE_SELL), &mpd_ctx);
 
         if (mpd_cmp(margin_bid_price, mpd_zero, &mpd_ctx) <= 0) {
             mpd_del(bid);
@@ -1,159 +1,398 @@
+# include <pthread.h>
+
 # include "ut_mysql.h"
 # include "me_trade.h"
 # include "me_market.h"
 # include "me_update.h"
 # include "me_balance.h"
+# include "me_replay.h"
+# include "me_digest.h"
 
-int load_positions(MYSQL *conn, const char *table)
+/*
+ * 切片并行加载
+ *
+ * 每张表按 id 区间切成 load_thread 段，工作线程各用一个连接取数据并解析，
+ * 主线程按 表 -> 区间 的固定顺序依次合并进 dict_balance 和各 market，
+ * 合并顺序与逐表顺序加载一致。decimal() 会改写全局 mpd_ctx.status，
+ * 线程内使用 mpd_ctx 的副本。
+ */
+enum {
+    SLICE_BALANCE,
+    SLICE_POSITION,
+    SLICE_LIMIT,
+};
+
+struct slice_row {
+    uint64_t        sid;
+    uint32_t        type;
+    mpd_t           *balance;
+    order_t         *order;
+    char            *symbol;
+};
+
+struct slice_task {
+    int             kind;
+    const char      *table;
+    uint64_t        start_id;       // (start_id, end_id]
+    uint64_t        end_id;
+    bool            done;
+    int             ret;
+    size_t          num;
+    size_t          cap;
+    struct slice_row *rows;
+};
+
+struct slice_loader {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    struct slice_task *tasks;
+    size_t          task_num;
+    size_t          next;
+    bool            stop;
+};
+
+static mpd_t *decimal_ctx(const char *str, int prec, mpd_context_t *ctx)
 {
-    size_t query_limit = 1000;
-    uint64_t last_id = 0;
-    while (true) {
-        sds sql = sdsempty();
+    mpd_t *result = mpd_new(ctx);
+    ctx->status = 0;
+    mpd_set_string(result, str, ctx);
+    if (ctx->status == MPD_Conversion_syntax) {
+        mpd_del(result);
+        return NULL;
+    }
+
+    if (prec) {
+        mpd_rescale(result, result, -prec, ctx);
+    }
+
+    return result;
+}
+
+static mpd_t *mpd_const(mpd_t *val, mpd_context_t *ctx)
+{
+    mpd_t *result = mpd_new(ctx);
+    mpd_copy(result, val, ctx);
+    return result;
+}
+
+static void slice_order_free(order_t *order)
+{
+    free(order->comment);
+    mpd_t *vals[] = { order->price, order->lot, order->margin, order->fee, order->swap, order->swaps,
+        order->tp, order->sl, order->margin_price, order->close_price, order->profit, order->profit_price };
+    for (size_t i = 0; i < sizeof(vals) / sizeof(vals[0]); ++i) {
+        if (vals[i])
+            mpd_del(vals[i]);
+    }
+    free(order);
+}
+
+static order_t *parse_position(MYSQL_ROW row, mpd_context_t *ctx)
+{
+    order_t *order = malloc(sizeof(order_t));
+    memset(order, 0, sizeof(order_t));
+    order->id = strtoull(row[0], NULL, 0);
+    order->sid = strtoull(row[1], NULL, 0);
+    order->side = atoi(row[2]);
+    order->create_time = strtod(row[3], NULL);
+    order->update_time = strtod(row[4], NULL);
+    order->comment = strdup(row[6]);
+
+    order->price = decimal_ctx(row[7], PREC_PRICE, ctx);
+    order->lot = decimal_ctx(row[8], PREC_DEFAULT, ctx);
+    order->margin = decimal_ctx(row[9], PREC_DEFAULT, ctx);
+    order->fee = decimal_ctx(row[10], PREC_DEFAULT, ctx);
+    order->swap = decimal_ctx(row[11], PREC_SWAP, ctx);
+    order->swaps = decimal_ctx(row[12], PREC_DEFAULT, ctx);
+    order->tp = decimal_ctx(row[13], PREC_PRICE, ctx);
+    order->sl = decimal_ctx(row[14], PREC_PRICE, ctx);
+    order->margin_price = decimal_ctx(row[15], PREC_PRICE, ctx);
+    order->external = strtoull(row[16], NULL, 0);
+
+    order->type = MARKET_ORDER_TYPE_MARKET;
+    order->finish_time = 0;
+    order->expire_time = 0;
+    order->close_price = mpd_const(mpd_zero, ctx);
+    order->profit      = mpd_const(mpd_zero, ctx);
+    order->profit_price = mpd_const(mpd_one, ctx);
+    return order;
+}
+
+static order_t *parse_limit(MYSQL_ROW row, mpd_context_t *ctx)
+{
+    order_t *order = malloc(sizeof(order_t));
+    memset(order, 0, sizeof(order_t));
+    order->id = strtoull(row[0], NULL, 0);
+    order->sid = strtoull(row[1], NULL, 0);
+    order->side = atoi(row[2]);
+    order->create_time = strtod(row[3], NULL);
+    order->expire_time = strtoull(row[4], NULL, 0);
+    order->comment = strdup(row[6]);
+
+    order->price = decimal_ctx(row[7], PREC_PRICE, ctx);
+    order->lot = decimal_ctx(row[8], PREC_DEFAULT, ctx);
+    order->margin = decimal_ctx(row[9], PREC_DEFAULT, ctx);
+    order->fee = decimal_ctx(row[10], PREC_DEFAULT, ctx);
+    order->swap = decimal_ctx(row[11], PREC_SWAP, ctx);
+    order->tp = decimal_ctx(row[12], PREC_PRICE, ctx);
+    order->sl = decimal_ctx(row[13], PREC_PRICE, ctx);
+    order->external = strtoull(row[14], NULL, 0);
+
+    order->type = MARKET_ORDER_TYPE_LIMIT;
+    order->update_time = 0;
+    order->finish_time = 0;
+    order->close_price = mpd_const(mpd_zero, ctx);
+    order->swaps = mpd_const(mpd_zero, ctx);
+    order->profit      = mpd_const(mpd_zero, ctx);
+    order->margin_price = mpd_const(mpd_zero, ctx);
+    order->profit_price = mpd_const(mpd_one, ctx);
+    return order;
+}
+
+static sds slice_task_sql(sds sql, struct slice_task *task)
+{
+    switch (task->kind) {
+    case SLICE_BALANCE:
+        sql = sdscatprintf(sql, "SELECT `id`, `sid`, `t`, `balance` FROM `%s` ", task->table);
+        break;
+    case SLICE_POSITION:
         sql = sdscatprintf(sql, "SELECT `id`, `sid`, `side`, `create_time`, `update_time`, `symbol`, `comment`, "
-                "`price`, `lot`, `margin`, `fee`, `swap`, `swaps`, `tp`, `sl`, `margin_price`, `external` FROM `%s` "
-                "WHERE `id` > %"PRIu64" ORDER BY `id` LIMIT %zu", table, last_id, query_limit);
-//        log_trace("exec sql: %s", sql);
-        int ret = mysql_real_query(conn, sql, sdslen(sql));
-        if (ret != 0) {
-            log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-            sdsfree(sql);
-            return -__LINE__;
-        }
-        sdsfree(sql);
+                "`price`, `lot`, `margin`, `fee`, `swap`, `swaps`, `tp`, `sl`, `margin_price`, `external` FROM `%s` ", task->table);
+        break;
+    default:
+        sql = sdscatprintf(sql, "SELECT `id`, `sid`, `side`, `create_time`, `expire_time`, `symbol`, `comment`, "
+                "`price`, `lot`, `margin`, `fee`, `swap`, `tp`, `sl`, `external` FROM `%s` ", task->table);
+        break;
+    }
+    return sdscatprintf(sql, "WHERE `id` > %"PRIu64" AND `id` <= %"PRIu64" ORDER BY `id`", task->start_id, task->end_id);
+}
 
-        MYSQL_RES *result = mysql_store_result(conn);
-        size_t num_rows = mysql_num_rows(result);
-        for (size_t i = 0; i < num_rows; ++i) {
-            MYSQL_ROW row = mysql_fetch_row(result);
-            last_id = strtoull(row[0], NULL, 0);
-            market_t *market = get_market(row[5]);
-            if (market == NULL)
-                continue;
+static int slice_task_run(MYSQL *conn, mpd_context_t *ctx, struct slice_task *task)
+{
+    sds sql = slice_task_sql(sdsempty(), task);
+    log_trace("exec sql: %s", sql);
+    if (mysql_real_query(conn, sql, sdslen(sql)) != 0) {
+        log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        sdsfree(sql);
+        return -__LINE__;
+    }
+    sdsfree(sql);
 
-            order_t *order = malloc(sizeof(order_t));
-            memset(order, 0, sizeof(order_t));
-            order->id = strtoull(row[0], NULL, 0);
-            order->sid = strtoull(row[1], NULL, 0);
-            order->side = atoi(row[2]);
-            order->create_time = strtod(row[3], NULL);
-            order->update_time = strtod(row[4], NULL);
-            order->symbol = strdup(row[5]);
-            order->comment = strdup(row[6]);
-
-            order->price = decimal(row[7], PREC_PRICE);
-            order->lot = decimal(row[8], PREC_DEFAULT);
-            order->margin = decimal(row[9], PREC_DEFAULT);
-            order->fee = decimal(row[10], PREC_DEFAULT);
-            order->swap = decimal(row[11], PREC_SWAP);
-            order->swaps = decimal(row[12], PREC_DEFAULT);
-            order->tp = decimal(row[13], PREC_PRICE);
-            order->sl = decimal(row[14], PREC_PRICE);
-            order->margin_price = decimal(row[15], PREC_PRICE);
-            order->external = strtoull(row[16], NULL, 0);
-
-            order->type = MARKET_ORDER_TYPE_MARKET;
-            order->finish_time = 0;
-            order->expire_time = 0;
-            order->close_price = mpd_new(&mpd_ctx);
-            order->profit      = mpd_new(&mpd_ctx);
-            order->profit_price = mpd_new(&mpd_ctx);
-            mpd_copy(order->close_price, mpd_zero, &mpd_ctx);
-            mpd_copy(order->profit, mpd_zero, &mpd_ctx);
-            mpd_copy(order->profit_price, mpd_one, &mpd_ctx);
-
-            if (!order->symbol || !order->price || !order->lot) {
-                log_error("get order detail of order id: %"PRIu64" fail", order->id);
-                mysql_free_result(result);
-                return -__LINE__;
+    int ret = 0;
+    MYSQL_RES *result = mysql_use_result(conn);
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        if (task->num == task->cap) {
+            task->cap = task->cap ? task->cap * 2 : 1024;
+            task->rows = realloc(task->rows, task->cap * sizeof(struct slice_row));
+        }
+        struct slice_row *r = &task->rows[task->num];
+        memset(r, 0, sizeof(struct slice_row));
+        if (task->kind == SLICE_BALANCE) {
+            r->sid = strtoull(row[1], NULL, 0);
+            r->type = strtoul(row[2], NULL, 0);
+            r->balance = decimal_ctx(row[3], PREC_DEFAULT, ctx);
+            if (r->balance == NULL) {
+                log_error("invalid balance: %s in %s", row[0], task->table);
+                ret = -__LINE__;
+                break;
             }
-
-            market_put_position(market, order);
+        } else {
+            r->order = task->kind == SLICE_POSITION ? parse_position(row, ctx) : parse_limit(row, ctx);
+            r->symbol = strdup(row[5]);
+            task->num++;
+            if (!r->order->price || !r->order->lot) {
+                log_error("get order detail of order id: %"PRIu64" fail", r->order->id);
+                ret = -__LINE__;
+                break;
+            }
+            continue;
         }
-        mysql_free_result(result);
+        task->num++;
+    }
+    if (ret == 0 && mysql_errno(conn) != 0) {
+        log_error("fetch %s fail: %d %s", task->table, mysql_errno(conn), mysql_error(conn));
+        ret = -__LINE__;
+    }
+    mysql_free_result(result);
+    return ret;
+}
 
-        if (num_rows < query_limit)
-            break;
+static void slice_task_free(struct slice_task *task)
+{
+    for (size_t i = 0; i < task->num; ++i) {
+        struct slice_row *r = &task->rows[i];
+        if (r->balance)
+            mpd_del(r->balance);
+        if (r->order)
+            slice_order_free(r->order);
+        free(r->symbol);
     }
+    free(task->rows);
+    task->rows = NULL;
+    task->num = 0;
+}
 
-    return 0;
+static void *slice_worker(void *arg)
+{
+    struct slice_loader *loader = arg;
+    MYSQL *conn = mysql_connect(&settings.db_log);
+    if (conn == NULL) {
+        log_error("connect mysql fail");
+    }
+    mpd_context_t ctx = mpd_ctx;
+
+    pthread_mutex_lock(&loader->lock);
+    while (!loader->stop && loader->next < loader->task_num) {
+        struct slice_task *task = &loader->tasks[loader->next++];
+        pthread_mutex_unlock(&loader->lock);
+
+        int ret = conn ? slice_task_run(conn, &ctx, task) : -__LINE__;
+
+        pthread_mutex_lock(&loader->lock);
+        task->ret = ret;
+        task->done = true;
+        pthread_cond_broadcast(&loader->cond);
+    }
+    pthread_mutex_unlock(&loader->lock);
+
+    if (conn)
+        mysql_close(conn);
+    return NULL;
 }
 
-int load_limits(MYSQL *conn, const char *table)
+// 主线程合并，market 查找和插入都不是线程安全的
+static int slice_merge(struct slice_task *task)
 {
-    size_t query_limit = 1000;
-    uint64_t last_id = 0;
-    while (true) {
-        sds sql = sdsempty();
-        sql = sdscatprintf(sql, "SELECT `id`, `sid`, `side`, `create_time`, `expire_time`, `symbol`, `comment`, "
-                "`price`, `lot`, `margin`, `fee`, `swap`, `tp`, `sl`, `external` FROM `%s` "
-                "WHERE `id` > %"PRIu64" ORDER BY `id` LIMIT %zu", table, last_id, query_limit);
-        log_trace("exec sql: %s", sql);
-        int ret = mysql_real_query(conn, sql, sdslen(sql));
-        if (ret != 0) {
-            log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-            sdsfree(sql);
+    for (size_t i = 0; i < task->num; ++i) {
+        struct slice_row *r = &task->rows[i];
+        if (task->kind == SLICE_BALANCE) {
+            balance_set_float(r->sid, r->type, r->balance);
+            r->balance = NULL;
+            continue;
+        }
+
+        market_t *market = get_market(r->symbol);
+        if (market == NULL)
+            continue;
+        order_t *order = r->order;
+        r->order = NULL;
+        order->symbol = market->name;
+        order->symbol_id = market->sym->id;
+        int ret = task->kind == SLICE_POSITION ? market_put_position(market, order) : market_put_pending(market, order);
+        if (ret < 0) {
+            log_error("put order: %"PRIu64" from %s fail: %d", order->id, task->table, ret);
             return -__LINE__;
         }
+    }
+    return 0;
+}
+
+static int slice_table_range(MYSQL *conn, const char *table, uint64_t *min_id, uint64_t *max_id)
+{
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "SELECT MIN(`id`), MAX(`id`) FROM `%s`", table);
+    log_trace("exec sql: %s", sql);
+    if (mysql_real_query(conn, sql, sdslen(sql)) != 0) {
+        log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
         sdsfree(sql);
+        return -__LINE__;
+    }
+    sdsfree(sql);
+
+    MYSQL_RES *result = mysql_store_result(conn);
+    MYSQL_ROW row = mysql_fetch_row(result);
+    *min_id = 0;
+    *max_id = 0;
+    if (row && row[0] && row[1]) {
+        *min_id = strtoull(row[0], NULL, 0);
+        *max_id = strtoull(row[1], NULL, 0);
+    }
+    mysql_free_result(result);
+    return 0;
+}
 
-        MYSQL_RES *result = mysql_store_result(conn);
-        size_t num_rows = mysql_num_rows(result);
-        for (size_t i = 0; i < num_rows; ++i) {
-            MYSQL_ROW row = mysql_fetch_row(result);
-            last_id = strtoull(row[0], NULL, 0);
-            market_t *market = get_market(row[5]);
-            if (market == NULL)
-                continue;
+static int slice_add_tasks(MYSQL *conn, struct slice_loader *loader, int kind, const char *table, int chunks)
+{
+    uint64_t min_id, max_id;
+    ERR_RET(slice_table_range(conn, table, &min_id, &max_id));
+    if (max_id == 0)
+        return 0;
 
-            order_t *order = malloc(sizeof(order_t));
-            memset(order, 0, sizeof(order_t));
-            order->id = strtoull(row[0], NULL, 0);
-            order->sid = strtoull(row[1], NULL, 0);
-            order->side = atoi(row[2]);
-            order->create_time = strtod(row[3], NULL);
-            order->expire_time = strtoull(row[4], NULL, 0);
-            order->symbol = strdup(row[5]);
-            order->comment = strdup(row[6]);
-
-            order->price = decimal(row[7], PREC_PRICE);
-            order->lot = decimal(row[8], PREC_DEFAULT);
-            order->margin = decimal(row[9], PREC_DEFAULT);
-            order->fee = decimal(row[10], PREC_DEFAULT);
-            order->swap = decimal(row[11], PREC_SWAP);
-            order->tp = decimal(row[12], PREC_PRICE);
-            order->sl = decimal(row[13], PREC_PRICE);
-            order->external = strtoull(row[14], NULL, 0);
-
-            order->type = MARKET_ORDER_TYPE_LIMIT;
-            order->update_time = 0;
-            order->finish_time = 0;
-            order->close_price = mpd_new(&mpd_ctx);
-            order->swaps = mpd_new(&mpd_ctx);
-            order->profit      = mpd_new(&mpd_ctx);
-            order->margin_price = mpd_new(&mpd_ctx);
-            order->profit_price = mpd_new(&mpd_ctx);
-            mpd_copy(order->close_price, mpd_zero, &mpd_ctx);
-            mpd_copy(order->swaps, mpd_zero, &mpd_ctx);
-            mpd_copy(order->profit, mpd_zero, &mpd_ctx);
-            mpd_copy(order->margin_price, mpd_zero, &mpd_ctx);
-            mpd_copy(order->profit_price, mpd_one, &mpd_ctx);
-
-            if (!order->symbol || !order->price || !order->lot) {
-                log_error("get order detail of order id: %"PRIu64" fail", order->id);
-                mysql_free_result(result);
-                return -__LINE__;
-            }
+    uint64_t start = min_id - 1;
+    uint64_t step = (max_id - start + chunks - 1) / chunks;
+    while (start < max_id) {
+        struct slice_task *task = &loader->tasks[loader->task_num++];
+        memset(task, 0, sizeof(struct slice_task));
+        task->kind = kind;
+        task->table = table;
+        task->start_id = start;
+        task->end_id = max_id - start > step ? start + step : max_id;
+        start = task->end_id;
+    }
+    return 0;
+}
 
-            market_put_pending(market, order);
-        }
-        mysql_free_result(result);
+int load_slice_tables(MYSQL *conn, const char *balance_table, const char *position_table, const char *limit_table)
+{
+    int thread_num = settings.load_thread > 0 ? settings.load_thread : 1;
+    double begin = current_timestamp();
 
-        if (num_rows < query_limit)
+    struct slice_loader loader;
+    memset(&loader, 0, sizeof(loader));
+    loader.tasks = malloc(sizeof(struct slice_task) * thread_num * 3);
+    if (slice_add_tasks(conn, &loader, SLICE_BALANCE, balance_table, thread_num) < 0 ||
+            slice_add_tasks(conn, &loader, SLICE_POSITION, position_table, thread_num) < 0 ||
+            slice_add_tasks(conn, &loader, SLICE_LIMIT, limit_table, thread_num) < 0) {
+        free(loader.tasks);
+        return -__LINE__;
+    }
+    pthread_mutex_init(&loader.lock, NULL);
+    pthread_cond_init(&loader.cond, NULL);
+
+    pthread_t *tids = malloc(sizeof(pthread_t) * thread_num);
+    int started = 0;
+    for (; started < thread_num; ++started) {
+        if (pthread_create(&tids[started], NULL, slice_worker, &loader) != 0)
             break;
     }
 
-    return 0;
+    int ret = started > 0 ? 0 : -__LINE__;
+    size_t rows = 0;
+    pthread_mutex_lock(&loader.lock);
+    for (size_t i = 0; ret == 0 && i < loader.task_num; ++i) {
+        struct slice_task *task = &loader.tasks[i];
+        while (!task->done)
+            pthread_cond_wait(&loader.cond, &loader.lock);
+        pthread_mutex_unlock(&loader.lock);
+
+        if (task->ret < 0) {
+            log_error("load %s (%"PRIu64", %"PRIu64"] fail: %d", task->table, task->start_id, task->end_id, task->ret);
+            ret = -__LINE__;
+        } else if (slice_merge(task) < 0) {
+            ret = -__LINE__;
+        }
+        rows += task->num;
+        slice_task_free(task);
+
+        pthread_mutex_lock(&loader.lock);
+    }
+    loader.stop = true;
+    pthread_mutex_unlock(&loader.lock);
+
+    for (int i = 0; i < started; ++i)
+        pthread_join(tids[i], NULL);
+    free(tids);
+    for (size_t i = 0; i < loader.task_num; ++i)
+        slice_task_free(&loader.tasks[i]);
+    free(loader.tasks);
+    pthread_cond_destroy(&loader.cond);
+    pthread_mutex_destroy(&loader.lock);
+
+    log_info("load slice tables: %s %s %s, rows: %zu, threads: %d, cost: %.3fs, ret: %d",
+            balance_table, position_table, limit_table, rows, started, current_timestamp() - begin, ret);
+    log_stderr("load slice tables: rows: %zu, threads: %d, cost: %.3fs", rows, started, current_timestamp() - begin);
+    return ret;
 }
 
 /*
@@ -259,42 +498,6 @@ int load_balance(MYSQL *conn, const char *table)
     return 0;
 }
 
-int load_balance_v2(MYSQL *conn, const char *table)
-{
-    size_t query_limit = 1000;
-    uint64_t last_id = 0;
-    while (true) {
-        sds sql = sdsempty();
-        sql = sdscatprintf(sql, "SELECT `id`, `sid`, `t`, `balance` FROM `%s` "
-                "WHERE `id` > %"PRIu64" ORDER BY id LIMIT %zu", table, last_id, query_limit);
-//        log_trace("exec sql: %s", sql);
-        int ret = mysql_real_query(conn, sql, sdslen(sql));
-        if (ret != 0) {
-            log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-            sdsfree(sql);
-            return -__LINE__;
-        }
-        sdsfree(sql);
-
-        MYSQL_RES *result = mysql_store_result(conn);
-        size_t num_rows = mysql_num_rows(result);
-        for (size_t i = 0; i < num_rows; ++i) {
-            MYSQL_ROW row = mysql_fetch_row(result);
-            last_id = strtoull(row[0], NULL, 0);
-            uint64_t sid = strtoul(row[1], NULL, 0);
-            uint32_t type = strtoul(row[2], NULL, 0);
-            mpd_t *balance = decimal(row[3], PREC_DEFAULT);
-            balance_set_float(sid, type, balance);
-        }
-        mysql_free_result(result);
-
-        if (num_rows < query_limit)
-            break;
-    }
-
-    return 0;
-}
-
 /*
 static int load_update_balance(json_t *params)
 {
@@ -397,10 +600,11 @@ static int load_open_order2(json_t *params)
         return -__LINE__;
     const char *group = json_string_value(json_array_get(params, 1));
 
-    // get group leverage
-    int leverage = group_leverage(group);
-    if (leverage == 0)
+    // get group id and leverage
+    int gid = get_group_id(group);
+    if (gid < 0 || configs.groups[gid].leverage == 0)
         return -__LINE__;
+    int leverage = configs.groups[gid].leverage;
 
     // symbol
     if (!json_is_string(json_array_get(params, 2)))
@@ -477,15 +681,16 @@ static int load_open_order2(json_t *params)
 
     // fee
     mpd_t *fee = mpd_new(&mpd_ctx);
-    mpd_copy(fee, symbol_fee(group, symbol), &mpd_ctx);
+    struct fee_entry *fe = get_fee_entry(gid, market->sym->id);
+    mpd_copy(fee, fe->fee, &mpd_ctx);
     mpd_mul(fee, lot, fee, &mpd_ctx);
 
     // swap
     mpd_t *swap = mpd_new(&mpd_ctx);
     if (side == ORDER_SIDE_BUY) {
-        mpd_copy(swap, symbol_swap_long(group, symbol), &mpd_ctx);
+        mpd_copy(swap, fe->swap_long, &mpd_ctx);
     } else {
-        mpd_copy(swap, symbol_swap_short(group, symbol), &mpd_ctx);
+        mpd_copy(swap, fe->swap_short, &mpd_ctx);
     }
 
     int ret = market_open(false, NULL, market, get_symbol(symbol), sid, leverage, side, price, lot, tp, sl, fee, swap, 0, comment, margin_price, create_time);
@@ -608,9 +813,9 @@ static int load_open_order(json_t *params)
         return -__LINE__;
     const char *group = json_string_value(json_array_get(params, 1));
 
-    // get group leverage
-    int leverage = group_leverage(group);
-    if (leverage == 0)
+    // get group id and leverage
+    int gid = get_group_id(group);
+    if (gid < 0 || configs.groups[gid].leverage == 0)
         return -__LINE__;
 
     // symbol
@@ -693,19 +898,20 @@ static int load_open_order(json_t *params)
 
     // fee
     mpd_t *fee = mpd_new(&mpd_ctx);
-    mpd_copy(fee, symbol_fee(group, symbol), &mpd_ctx);
+    struct fee_entry *fe = get_fee_entry(gid, market->sym->id);
+    mpd_copy(fee, fe->fee, &mpd_ctx);
     mpd_mul(fee, lot, fee, &mpd_ctx);
 
     // swap
     mpd_t *swap = mpd_new(&mpd_ctx);
     if (side == ORDER_SIDE_BUY) {
-        mpd_copy(swap, symbol_swap_long(group, symbol), &mpd_ctx);
+        mpd_copy(swap, fe->swap_long, &mpd_ctx);
     } else {
-        mpd_copy(swap, symbol_swap_short(group, symbol), &mpd_ctx);
+        mpd_copy(swap, fe->swap_short, &mpd_ctx);
     }
 
 //    int ret = market_open(false, NULL, market, get_symbol(symbol), sid, leverage, side, price, lot, tp, sl, fee, swap, external, comment, margin_price, create_time);
-    int ret = market_open_hedged(false, NULL, market, get_symbol(symbol), sid, leverage, side, price, lot, tp, sl, symbol_percentage(group, symbol), fee, swap, external, comment, margin_price, create_time);
+    int ret = market_open_hedged(false, NULL, market, get_symbol(symbol), sid, side, price, lot, tp, sl, fe->margin_rate, fee, swap, external, comment, margin_price, create_time);
 
     mpd_del(price);
     mpd_del(lot);
@@ -826,10 +1032,11 @@ static int load_limit_order(json_t *params)
         return -__LINE__;
     const char *group = json_string_value(json_array_get(params, 1));
 
-    // get group leverage
-    int leverage = group_leverage(group);
-    if (leverage == 0)
+    // get group id and leverage
+    int gid = get_group_id(group);
+    if (gid < 0 || configs.groups[gid].leverage == 0)
         return -__LINE__;
+    int leverage = configs.groups[gid].leverage;
 
     // symbol
     if (!json_is_string(json_array_get(params, 2)))
@@ -909,18 +1116,19 @@ static int load_limit_order(json_t *params)
 
     // fee
     mpd_t *fee = mpd_new(&mpd_ctx);
-    mpd_copy(fee, symbol_fee(group, symbol), &mpd_ctx);
+    struct fee_entry *fe = get_fee_entry(gid, market->sym->id);
+    mpd_copy(fee, fe->fee, &mpd_ctx);
     mpd_mul(fee, lot, fee, &mpd_ctx);
 
     // swap
     mpd_t *swap = mpd_new(&mpd_ctx);
     if (side == ORDER_SIDE_BUY) {
-        mpd_copy(swap, symbol_swap_long(group, symbol), &mpd_ctx);
+        mpd_copy(swap, fe->swap_long, &mpd_ctx);
     } else {
-        mpd_copy(swap, symbol_swap_short(group, symbol), &mpd_ctx);
+        mpd_copy(swap, fe->swap_short, &mpd_ctx);
     }
 
-    int ret = market_put_limit(false, NULL, market, sid, leverage, side, price, lot, tp, sl, symbol_percentage(group, symbol), fee, swap, external, comment, create_time, expire_time);
+    int ret = market_put_limit(false, NULL, market, sid, leverage, side, price, lot, tp, sl, fe->percentage, fee, swap, external, comment, create_time, expire_time);
 
     mpd_del(price);
     mpd_del(lot);
@@ -1534,7 +1742,7 @@ static int load_cancel_order(json_t *params)
 }
 */
 
-static int load_oper(json_t *detail)
+int load_oper(json_t *detail)
 {
     const char *method = json_string_value(json_object_get(detail, "method"));
     if (method == NULL)
@@ -1572,6 +1780,8 @@ static int load_oper(json_t *detail)
         ret = load_update_external_order(params);
     } else if (strcmp(method, "cancel_external_order") == 0) {
         ret = load_cancel_external_order(params);
+    } else if (strcmp(method, "state_digest") == 0) {
+        ret = load_state_digest(params);
 /*
     } else if (strcmp(method, "limit_order") == 0) {
         ret = load_limit_order(params);
@@ -1589,52 +1799,5 @@ static int load_oper(json_t *detail)
 
 int load_operlog(MYSQL *conn, const char *table, uint64_t *start_id)
 {
-    size_t query_limit = 1000;
-    uint64_t last_id = *start_id;
-    while (true) {
-        sds sql = sdsempty();
-        sql = sdscatprintf(sql, "SELECT `id`, `detail` from `%s` WHERE `id` > %"PRIu64" ORDER BY `id` LIMIT %zu", table, last_id, query_limit);
-        log_trace("exec sql: %s", sql);
-        int ret = mysql_real_query(conn, sql, sdslen(sql));
-        if (ret != 0) {
-            log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-            sdsfree(sql);
-            return -__LINE__;
-        }
-        sdsfree(sql);
-
-        MYSQL_RES *result = mysql_store_result(conn);
-        size_t num_rows = mysql_num_rows(result);
-        for (size_t i = 0; i < num_rows; ++i) {
-            MYSQL_ROW row = mysql_fetch_row(result);
-            uint64_t id = strtoull(row[0], NULL, 0);
-            if (id != last_id + 1) {
-                log_error("invalid id: %"PRIu64", last id: %"PRIu64"", id, last_id);
-                return -__LINE__;
-            }
-            last_id = id;
-            json_t *detail = json_loadb(row[1], strlen(row[1]), 0, NULL);
-            if (detail == NULL) {
-                log_error("invalid detail data: %s", row[1]);
-                mysql_free_result(result);
-                return -__LINE__;
-            }
-            ret = load_oper(detail);
-            if (ret < 0) {
-                json_decref(detail);
-                log_error("load_oper: %"PRIu64":%s fail: %d", id, row[1], ret);
-                mysql_free_result(result);
-                return -__LINE__;
-            }
-            json_decref(detail);
-        }
-        mysql_free_result(result);
-
-        if (num_rows < query_limit)
-            break;
-    }
-
-    *start_id = last_id;
-    return 0;
+    return replay_mysql_table(table, start_id);
 }
-
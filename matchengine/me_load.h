@@ -9,11 +9,10 @@ int load_markets(MYSQL *conn, const char *table);
 int load_balance(MYSQL *conn, const char *table);
 
 int load_operlog(MYSQL *conn, const char *table, uint64_t *start_id);
+int load_oper(json_t *detail);
 
-int load_positions(MYSQL *conn, const char *table);
-int load_balance_v2(MYSQL *conn, const char *table);
-
-int load_limits(MYSQL *conn, const char *table);
+// 切片三张表按 id 区间由 load_thread 个线程并行读取解析，主线程按顺序合并
+int load_slice_tables(MYSQL *conn, const char *balance_table, const char *position_table, const char *limit_table);
 
 # endif
 
@@ -5,6 +5,7 @@
 # include "me_update.h"
 # include "me_trade.h"
 # include "me_persist.h"
+# include "me_snapshot.h"
 # include "me_history.h"
 # include "me_message.h"
 # include "me_cli.h"
@@ -14,12 +15,15 @@
 # include "me_tick.h"
 # include "me_tpsl.h"
 # include "me_stop.h"
+# include "me_repl.h"
+# include "me_digest.h"
 //# include "me_limit.h"
 
 const char *__process__ = "matchengine";
 const char *__version__ = "0.1.0";
 
 nw_timer cron_timer;
+static double handover_deadline;
 
 static void on_cron_check(nw_timer *timer, void *data)
 {
@@ -28,6 +32,49 @@ static void on_cron_check(nw_timer *timer, void *data)
         nw_loop_break();
         signal_exit = 0;
     }
+    // 已交出监听端口，回复发完或超时后退出，由新进程接着服务
+    if (handover_deadline > 0 && (server_pending_send() == 0 || current_timestamp() >= handover_deadline)) {
+        log_vip("handover drain done, pending: %zu", server_pending_send());
+        nw_loop_break();
+        handover_deadline = 0;
+    }
+}
+
+static void on_handover(void)
+{
+    handover_deadline = current_timestamp() + settings.handover_drain;
+}
+
+// 热升级: 从旧进程接过监听 fd，等它刷完 WAL 退出后再从快照和 WAL 加载状态
+static int take_over(void)
+{
+    int ret = handover_take(settings.handover_path, settings.handover_timeout);
+    if (ret < 0)
+        return ret;
+    log_stderr("handover %d listening fds", ret);
+
+    // 旧进程的 keepalive 父进程随后退出，释放进程锁
+    for (int i = 0; process_exist(__process__) != 0; ++i) {
+        if (i * 0.1 >= settings.handover_timeout)
+            return -__LINE__;
+        usleep(100 * 1000);
+    }
+    return 0;
+}
+
+// 只在主机上运行的服务，备机提升时才启动
+static int start_service(void)
+{
+    ERR_RET(init_tpsl());
+    ERR_RET(init_stop_out());
+/*
+    ERR_RET(init_limit());
+*/
+    ERR_RET(init_swap());
+    if (!settings.follower)
+        ERR_RET(init_server());
+    ERR_RET(init_tick(true));
+    return 0;
 }
 
 static int init_process(void)
@@ -67,10 +114,11 @@ int main(int argc, char *argv[])
     printf("process: %s version: %s, compile date: %s %s\n", __process__, __version__, __DATE__, __TIME__);
 
     if (argc < 2) {
-        printf("usage: %s config.json\n", argv[0]);
+        printf("usage: %s config.json [upgrade]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
-    if (process_exist(__process__) != 0) {
+    bool upgrade = argc > 2 && strcmp(argv[2], "upgrade") == 0;
+    if (!upgrade && process_exist(__process__) != 0) {
         printf("process: %s exist\n", __process__);
         exit(EXIT_FAILURE);
     }
@@ -112,6 +160,17 @@ int main(int argc, char *argv[])
     daemon(1, 1);
     process_keepalive();
 
+    if (upgrade) {
+        ret = take_over();
+        if (ret < 0) {
+            error(EXIT_FAILURE, errno, "take over fail: %d", ret);
+        }
+    }
+
+    ret = init_digest();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init digest fail: %d", ret);
+    }
     ret = init_from_db();
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init from db fail: %d", ret);
@@ -132,36 +191,40 @@ int main(int argc, char *argv[])
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init persist fail: %d", ret);
     }
-    ret = init_tpsl();
-    if (ret < 0) {
-        error(EXIT_FAILURE, errno, "init tpsl fail: %d", ret);
-    }
-    ret = init_stop_out();
-    if (ret < 0) {
-        error(EXIT_FAILURE, errno, "init stop out fail: %d", ret);
-    }
-/*
-    ret = init_limit();
-    if (ret < 0) {
-        error(EXIT_FAILURE, errno, "init limit fail: %d", ret);
-    }
-*/
-    ret = init_swap();
+    ret = init_snapshot();
     if (ret < 0) {
-        error(EXIT_FAILURE, errno, "init swap fail: %d", ret);
+        error(EXIT_FAILURE, errno, "init snapshot fail: %d", ret);
     }
     ret = init_cli();
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init cli fail: %d", ret);
     }
-    ret = init_server();
-    if (ret < 0) {
-        error(EXIT_FAILURE, errno, "init server fail: %d", ret);
+    if (settings.follower) {
+        ret = init_server();
+        if (ret < 0) {
+            error(EXIT_FAILURE, errno, "init server fail: %d", ret);
+        }
+        // 余额和持仓查询要用实时行情重估，follower 也订阅行情，但不做止盈止损、强平和隔夜费
+        ret = init_revalue();
+        if (ret < 0) {
+            error(EXIT_FAILURE, errno, "init revalue fail: %d", ret);
+        }
+        ret = init_tick(false);
+        if (ret < 0) {
+            error(EXIT_FAILURE, errno, "init tick fail: %d", ret);
+        }
     }
-    ret = init_tick();
+    ret = init_repl(start_service);
     if (ret < 0) {
-        error(EXIT_FAILURE, errno, "init tick fail: %d", ret);
+        error(EXIT_FAILURE, errno, "init repl fail: %d", ret);
+    }
+    if (settings.handover_path[0] != '\0') {
+        ret = handover_init(settings.handover_path, on_handover);
+        if (ret < 0) {
+            error(EXIT_FAILURE, errno, "init handover fail: %d", ret);
+        }
     }
+    nw_svr_inherit_release();
 
     nw_timer_set(&cron_timer, 0.5, true, on_cron_check, NULL);
     nw_timer_start(&cron_timer);
@@ -3,11 +3,17 @@
 # include "me_balance.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_stop.h"
+# include "me_snapshot.h"
+# include "me_digest.h"
 
 uint64_t order_id_start;
 uint64_t deals_id_start;
 skiplist_t *expire_orders;
 
+// sid -> 该账户所有品种的持仓，按订单号排序
+static dict_t *dict_positions;
+
 struct dict_user_key {
     uint32_t    user_id;
 };
@@ -90,6 +96,11 @@ static void dict_margin_val_free(void *val)
     mpd_del(val);
 }
 
+static void dict_exposure_val_free(void *val)
+{
+    free(val);
+}
+
 static uint32_t dict_order_hash_function(const void *key)
 {
     return dict_generic_hash_function(key, sizeof(struct dict_order_key));
@@ -165,9 +176,8 @@ static int order_buy_tp_compare(const void *value1, const void *value2)
         return 0;
     }
 
-    int cmp = mpd_cmp(order1->tp, order2->tp, &mpd_ctx);
-    if (cmp != 0) {
-        return cmp;
+    if (order1->fx_tp != order2->fx_tp) {
+        return order1->fx_tp > order2->fx_tp ? 1 : -1;
     }
     return order1->id > order2->id ? 1 : -1;
 }
@@ -181,9 +191,8 @@ static int order_sell_sl_compare(const void *value1, const void *value2)
         return 0;
     }
 
-    int cmp = mpd_cmp(order1->sl, order2->sl, &mpd_ctx);
-    if (cmp != 0) {
-        return cmp;
+    if (order1->fx_sl != order2->fx_sl) {
+        return order1->fx_sl > order2->fx_sl ? 1 : -1;
     }
     return order1->id > order2->id ? 1 : -1;
 }
@@ -197,9 +206,8 @@ static int order_buy_sl_compare(const void *value1, const void *value2)
         return 0;
     }
 
-    int cmp = mpd_cmp(order2->sl, order1->sl, &mpd_ctx);
-    if (cmp != 0) {
-        return cmp;
+    if (order2->fx_sl != order1->fx_sl) {
+        return order2->fx_sl > order1->fx_sl ? 1 : -1;
     }
     return order1->id > order2->id ? 1 : -1;
 }
@@ -213,9 +221,8 @@ static int order_sell_tp_compare(const void *value1, const void *value2)
         return 0;
     }
 
-    int cmp = mpd_cmp(order2->tp, order1->tp, &mpd_ctx);
-    if (cmp != 0) {
-        return cmp;
+    if (order2->fx_tp != order1->fx_tp) {
+        return order2->fx_tp > order1->fx_tp ? 1 : -1;
     }
     return order1->id > order2->id ? 1 : -1;
 }
@@ -464,6 +471,7 @@ market_t *market_create_v2(struct symbol *conf)
     market_t *m = malloc(sizeof(market_t));
     memset(m, 0, sizeof(market_t));
     m->name             = strdup(conf->name);
+    m->sym              = conf;
 
     dict_types dt;
     memset(&dt, 0, sizeof(dt));
@@ -498,6 +506,17 @@ market_t *market_create_v2(struct symbol *conf)
     if (m->margins == NULL)
         return NULL;
 
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function    = dict_sid_hash_function;
+    dt.key_compare      = dict_sid_key_compare;
+    dt.key_dup          = dict_sid_key_dup;
+    dt.key_destructor   = dict_sid_key_free;
+    dt.val_destructor   = dict_exposure_val_free;
+
+    m->exposures = dict_create(&dt, 1024);
+    if (m->exposures == NULL)
+        return NULL;
+
     skiplist_type lt;
     memset(&lt, 0, sizeof(lt));
     lt.compare = order_match_compare;
@@ -860,6 +879,7 @@ int market_put_limit_order(bool real, json_t **result, market_t *m, uint32_t use
     if (order == NULL) {
         return -__LINE__;
     }
+    memset(order, 0, sizeof(order_t));
 
     order->id           = ++order_id_start;
     order->type         = MARKET_ORDER_TYPE_LIMIT;
@@ -1188,6 +1208,7 @@ int market_put_market_order(bool real, json_t **result, market_t *m, uint32_t us
     if (order == NULL) {
         return -__LINE__;
     }
+    memset(order, 0, sizeof(order_t));
 
     order->id           = ++order_id_start;
     order->type         = MARKET_ORDER_TYPE_MARKET;
@@ -1278,6 +1299,32 @@ skiplist_t *market_get_order_list(market_t *m, uint32_t user_id)
     return NULL;
 }
 
+int market_init_positions(void)
+{
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function    = dict_sid_hash_function;
+    dt.key_compare      = dict_sid_key_compare;
+    dt.key_dup          = dict_sid_key_dup;
+    dt.key_destructor   = dict_sid_key_free;
+    dt.val_destructor   = dict_sid_val_free;
+
+    dict_positions = dict_create(&dt, 1024);
+    if (dict_positions == NULL)
+        return -__LINE__;
+
+    return 0;
+}
+
+skiplist_t *market_get_positions(uint64_t sid)
+{
+    struct dict_sid_key key = { .sid = sid };
+    dict_entry *entry = dict_find(dict_positions, &key);
+    if (entry)
+        return entry->val;
+    return NULL;
+}
+
 skiplist_t *market_get_order_list_v2(market_t *m, uint64_t sid)
 {
     struct dict_sid_key key = { .sid = sid };
@@ -1372,12 +1419,156 @@ sds market_status(sds reply)
     return reply;
 }
 
+static mpd_t *float_delta;
+
+// 浮动盈亏只记差额，第一次也要建立 BALANCE_TYPE_FLOAT 记录
+static void float_book(uint64_t sid, fixed_t delta)
+{
+    if (delta == 0 && balance_get_float(sid, BALANCE_TYPE_FLOAT) != NULL)
+        return;
+
+    if (float_delta == NULL)
+        float_delta = mpd_new(&mpd_ctx);
+    fixed_to_mpd(float_delta, delta, PREC_DEFAULT);
+    balance_add_float(sid, BALANCE_TYPE_FLOAT, float_delta);
+    stop_out_pnl(sid, delta);
+}
+
+static int exposure_add(market_t *m, order_t *order)
+{
+    struct dict_sid_key key = { .sid = order->sid };
+    exposure_t *e;
+    dict_entry *entry = dict_find(m->exposures, &key);
+    if (entry) {
+        e = entry->val;
+    } else {
+        e = malloc(sizeof(exposure_t));
+        if (e == NULL)
+            return -__LINE__;
+        memset(e, 0, sizeof(exposure_t));
+        e->sid = order->sid;
+        e->sym = m->sym;
+        if (dict_add(m->exposures, &key, e) == NULL) {
+            free(e);
+            return -__LINE__;
+        }
+    }
+
+    e->count++;
+    e->lot[order->side] += order->fx_lot;
+    e->cost[order->side] += (__int128)order->fx_lot * order->fx_price;
+    order->exposure = e;
+    order->fx_seq = e->seq[order->side];
+    return 0;
+}
+
+static void exposure_remove(market_t *m, order_t *order)
+{
+    exposure_t *e = order->exposure;
+    if (e == NULL)
+        return;
+
+    // 平仓时已从 BALANCE_TYPE_FLOAT 扣除 order->profit，这里同步扣掉
+    e->count--;
+    e->lot[order->side] -= order->fx_lot;
+    e->cost[order->side] -= (__int128)order->fx_lot * order->fx_price;
+    e->pnl[order->side] -= order->fx_profit;
+    order->exposure = NULL;
+
+    if (e->count == 0) {
+        // 汇总和逐笔的舍入误差，清掉
+        fixed_t residual = e->pnl[ORDER_SIDE_BUY] + e->pnl[ORDER_SIDE_SELL];
+        if (residual != 0)
+            float_book(e->sid, -residual);
+
+        struct dict_sid_key key = { .sid = e->sid };
+        dict_delete(m->exposures, &key);
+    }
+}
+
+void market_revalue_exposure(exposure_t *e, fixed_t bid, fixed_t ask, fixed_t profit_bid, fixed_t profit_ask)
+{
+    // buy close by bid, sell close by ask
+    for (int side = ORDER_SIDE_BUY; side <= ORDER_SIDE_SELL; ++side) {
+        fixed_t close_price = side == ORDER_SIDE_BUY ? bid : ask;
+        fixed_t profit_price = side == ORDER_SIDE_BUY ? profit_bid : profit_ask;
+
+        fixed_t pnl = 0;
+        if (e->lot[side] != 0) {
+            __int128 diff = (__int128)close_price * e->lot[side] - e->cost[side];
+            if (side == ORDER_SIDE_SELL)
+                diff = -diff;
+            pnl = symbol_profit_convert(e->sym, diff, close_price, profit_price);
+        }
+
+        float_book(e->sid, pnl - e->pnl[side]);
+        e->pnl[side] = pnl;
+        e->close_price[side] = close_price;
+        e->profit_price[side] = profit_price;
+        e->seq[side]++;
+    }
+}
+
+// 按汇总最近一次重估的价格计算单笔盈亏，只在查询或平仓时调用
+void order_refresh_fixed(order_t *order)
+{
+    exposure_t *e = order->exposure;
+    if (e == NULL || order->fx_seq == e->seq[order->side])
+        return;
+
+    order->fx_seq = e->seq[order->side];
+    if (e->close_price[order->side] <= 0)
+        return;
+
+    order->fx_close_price = e->close_price[order->side];
+    order->fx_profit_price = e->profit_price[order->side];
+    order->fx_profit = symbol_profit_fixed(e->sym, order->side, order->fx_price, order->fx_close_price, order->fx_lot, order->fx_profit_price);
+    order->fx_dirty = true;
+}
+
+// 指定成交价格（止盈止损），不再随汇总重估
+void order_set_profit_fixed(order_t *order, fixed_t profit, fixed_t close_price, fixed_t profit_price)
+{
+    order->fx_profit = profit;
+    order->fx_close_price = close_price;
+    order->fx_profit_price = profit_price;
+    order->fx_seq = order->exposure ? order->exposure->seq[order->side] : 0;
+    order->fx_dirty = true;
+}
+
+void order_sync_fixed(order_t *order)
+{
+    order_refresh_fixed(order);
+    if (!order->fx_dirty)
+        return;
+
+    fixed_to_mpd(order->profit, order->fx_profit, PREC_DEFAULT);
+    fixed_to_mpd(order->close_price, order->fx_close_price, PREC_PRICE);
+    fixed_to_mpd(order->profit_price, order->fx_profit_price, PREC_PRICE);
+    order->fx_dirty = false;
+}
+
 static int order_put_v2(market_t *m, order_t *order)
 {
+    snapshot_touch(order->sid);
+    digest_touch(order->sid);
+    order->fx_price         = fixed_from_mpd(order->price);
+    order->fx_lot           = fixed_from_mpd(order->lot);
+    order->fx_margin        = fixed_from_mpd(order->margin);
+    order->fx_profit        = fixed_from_mpd(order->profit);
+    order->fx_close_price   = fixed_from_mpd(order->close_price);
+    order->fx_profit_price  = fixed_from_mpd(order->profit_price);
+    order->fx_tp            = fixed_from_mpd(order->tp);
+    order->fx_sl            = fixed_from_mpd(order->sl);
+    order->fx_dirty         = false;
+
     struct dict_order_key order_key = { .order_id = order->id };
     if (dict_add(m->orders, &order_key, order) == NULL)
         return -__LINE__;
 
+    if (exposure_add(m, order) < 0)
+        return -__LINE__;
+
     struct dict_sid_key sid_key = { .sid = order->sid };
     dict_entry *entry = dict_find(m->users, &sid_key);
     if (entry) {
@@ -1397,6 +1588,24 @@ static int order_put_v2(market_t *m, order_t *order)
             return -__LINE__;
     }
 
+    entry = dict_find(dict_positions, &sid_key);
+    if (entry) {
+        skiplist_t *order_list = entry->val;
+        if (skiplist_insert(order_list, order) == NULL)
+            return -__LINE__;
+    } else {
+        skiplist_type type;
+        memset(&type, 0, sizeof(type));
+        type.compare = order_id_compare;
+        skiplist_t *order_list = skiplist_create(&type);
+        if (order_list == NULL)
+            return -__LINE__;
+        if (skiplist_insert(order_list, order) == NULL)
+            return -__LINE__;
+        if (dict_add(dict_positions, &sid_key, order_list) == NULL)
+            return -__LINE__;
+    }
+
     if (order->side == ORDER_SIDE_BUY) {
         if (skiplist_insert(m->buys, order) == NULL)
             return -__LINE__;
@@ -1429,6 +1638,7 @@ static int order_put_v2(market_t *m, order_t *order)
 
 json_t *get_order_info_v2(order_t *order)
 {
+    order_sync_fixed(order);
     json_t *info = json_object();
     json_object_set_new(info, "id", json_integer(order->id));
     json_object_set_new(info, "type", json_integer(order->type));
@@ -1474,7 +1684,6 @@ static void order_free_v2(order_t *order)
     mpd_del(order->sl);
     mpd_del(order->margin_price);
     mpd_del(order->profit_price);
-    free(order->symbol);
     free(order->comment);
     free(order);
 }
@@ -1502,26 +1711,7 @@ int market_open(bool real, json_t **result, market_t *m, symbol_t *sym, uint64_t
     mpd_div(margin, sym->c, margin, &mpd_ctx);
     mpd_mul(margin, margin, lot, &mpd_ctx);
 
-    if (sym->margin_calc == MARGIN_CALC_FOREX) {
-        if (sym->margin_type == MARGIN_TYPE_AU) {
-            mpd_mul(margin, margin, price, &mpd_ctx);        // EURUSD
-        } else if (sym->margin_type == MARGIN_TYPE_AC) {
-            mpd_mul(margin, margin, margin_price, &mpd_ctx); // EURGBP
-        } else if (sym->margin_type == MARGIN_TYPE_BC) {
-            mpd_div(margin, margin, margin_price, &mpd_ctx); // CADJPY
-        }
-    } else {
-         if (strcmp(sym->name, "HSI") == 0) {
-             mpd_div(margin, margin, margin_price, &mpd_ctx); // USDHKD
-         } else if (strcmp(sym->name, "DAX") == 0) {
-             mpd_mul(margin, margin, margin_price, &mpd_ctx); // EURUSD
-         } else if (strcmp(sym->name, "UK100") == 0) {
-             mpd_mul(margin, margin, margin_price, &mpd_ctx); // GBPUSD
-         } else if (strcmp(sym->name, "JP225") == 0) {
-             mpd_div(margin, margin, margin_price, &mpd_ctx); // USDJPY
-         }
-         mpd_mul(margin, margin, price, &mpd_ctx);
-    }
+    sym->margin_kernel(margin, sym, price, margin_price);
     mpd_rescale(margin, margin, -2, &mpd_ctx);
 
     // 2.判断可用金是否足够
@@ -1550,6 +1740,7 @@ log_info("## free = %s, margin = %s, total = %s", mpd_to_sci(free, 0), mpd_to_sc
     if (order == NULL) {
         return -__LINE__;
     }
+    memset(order, 0, sizeof(order_t));
 
     order->id           = ++order_id_start;
     order->type         = MARKET_ORDER_TYPE_MARKET;
@@ -1560,7 +1751,8 @@ log_info("## free = %s, margin = %s, total = %s", mpd_to_sci(free, 0), mpd_to_sc
     order->expire_time  = 0;
     order->sid          = sid;
     order->external     = external;
-    order->symbol       = strdup(m->name);
+    order->symbol       = m->name;
+    order->symbol_id    = m->sym->id;
     order->comment      = strdup(comment);
 
     order->price        = mpd_new(&mpd_ctx);
@@ -1610,6 +1802,10 @@ log_info("## free = %s, margin = %s, total = %s", mpd_to_sci(free, 0), mpd_to_sc
 
 static int order_finish_v2(market_t *m, order_t *order)
 {
+    snapshot_touch(order->sid);
+    digest_touch(order->sid);
+    exposure_remove(m, order);
+
     if (order->side == ORDER_SIDE_SELL) {
         skiplist_node *node = skiplist_find(m->sells, order);
         if (node) {
@@ -1661,12 +1857,30 @@ static int order_finish_v2(market_t *m, order_t *order)
         }
     }
 
+    entry = dict_find(dict_positions, &sid_key);
+    if (entry) {
+        skiplist_t *order_list = entry->val;
+        skiplist_node *node = skiplist_find(order_list, order);
+        if (node) {
+            skiplist_delete(order_list, node);
+        }
+        if (skiplist_len(order_list) == 0) {
+            dict_delete(dict_positions, &sid_key);
+        }
+    }
+
     order_free_v2(order);
     return 0;
 }
 
+int market_remove_position(market_t *m, order_t *order)
+{
+    return order_finish_v2(m, order);
+}
+
 int market_close(bool real, json_t **result, market_t *m, symbol_t *sym, uint64_t sid, order_t *order, mpd_t *price, const char *comment, mpd_t *profit_price, double finish_time)
 {
+    order_sync_fixed(order);
     if (mpd_cmp(price, mpd_zero, &mpd_ctx) <= 0) {
        return -3;
     }
@@ -1685,30 +1899,7 @@ int market_close(bool real, json_t **result, market_t *m, symbol_t *sym, uint64_
     }
     mpd_mul(profit, profit, order->lot, &mpd_ctx);
 
-    if (sym->profit_calc == PROFIT_CALC_FOREX) {
-        mpd_mul(profit, profit, sym->contract_size, &mpd_ctx);
-        if (sym->profit_type == PROFIT_TYPE_UB) {
-            mpd_div(profit, profit, price, &mpd_ctx);        // USDJPY
-        } else if (sym->profit_type == PROFIT_TYPE_AC) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // EURGBP
-        } else if (sym->profit_type == PROFIT_TYPE_CB) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // CADJPY
-        }
-    } else if (sym->profit_calc == PROFIT_CALC_CFD) {
-        mpd_mul(profit, profit, sym->contract_size, &mpd_ctx);
-        if (strcmp(sym->name, "HSI") == 0) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // USDHKD
-        } else if (strcmp(sym->name, "DAX") == 0) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // EURUSD
-        } else if (strcmp(sym->name, "UK100") == 0) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // GBPUSD
-        } else if (strcmp(sym->name, "JP225") == 0) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // USDJPY
-        }
-    } else {
-        mpd_mul(profit, profit, sym->tick_price, &mpd_ctx);
-        mpd_div(profit, profit, sym->tick_size, &mpd_ctx);
-    }
+    sym->profit_kernel(profit, sym, price, profit_price);
     mpd_rescale(profit, profit, -2, &mpd_ctx);
 
     if (real) {
@@ -1818,6 +2009,7 @@ static int order_tpsl(market_t *m, order_t *order)
 
 int market_tpsl(bool real, market_t *m, symbol_t *sym, uint64_t sid, order_t *order, mpd_t *price, const char *comment, mpd_t *profit_price, double finish_time)
 {
+    order_sync_fixed(order);
     if (mpd_cmp(price, mpd_zero, &mpd_ctx) <= 0) {
        return -3;
     }
@@ -1836,30 +2028,7 @@ int market_tpsl(bool real, market_t *m, symbol_t *sym, uint64_t sid, order_t *or
     }
     mpd_mul(profit, profit, order->lot, &mpd_ctx);
 
-    if (sym->profit_calc == PROFIT_CALC_FOREX) {
-        mpd_mul(profit, profit, sym->contract_size, &mpd_ctx);
-        if (sym->profit_type == PROFIT_TYPE_UB) {
-            mpd_div(profit, profit, price, &mpd_ctx);        // USDJPY
-        } else if (sym->profit_type == PROFIT_TYPE_AC) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // EURGBP
-        } else if (sym->profit_type == PROFIT_TYPE_CB) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // CADJPY
-        }
-    } else if (sym->profit_calc == PROFIT_CALC_CFD) {
-        mpd_mul(profit, profit, sym->contract_size, &mpd_ctx);
-        if (strcmp(sym->name, "HSI") == 0) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // USDHKD
-        } else if (strcmp(sym->name, "DAX") == 0) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // EURUSD
-        } else if (strcmp(sym->name, "UK100") == 0) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // GBPUSD
-        } else if (strcmp(sym->name, "JP225") == 0) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // USDJPY
-        }
-    } else {
-        mpd_mul(profit, profit, sym->tick_price, &mpd_ctx);
-        mpd_div(profit, profit, sym->tick_size, &mpd_ctx);
-    }
+    sym->profit_kernel(profit, sym, price, profit_price);
     mpd_rescale(profit, profit, -2, &mpd_ctx);
 
     if (real) {
@@ -1929,6 +2098,8 @@ int market_tpsl(bool real, market_t *m, symbol_t *sym, uint64_t sid, order_t *or
 
 int market_update(bool real, json_t **result, market_t *m, order_t *order, mpd_t *tp, mpd_t *sl)
 {
+    snapshot_touch(order->sid);
+    digest_touch(order->sid);
     int delete_tp = mpd_cmp(order->tp, tp, &mpd_ctx);
     int delete_sl = mpd_cmp(order->sl, sl, &mpd_ctx);
 
@@ -1962,6 +2133,8 @@ int market_update(bool real, json_t **result, market_t *m, order_t *order, mpd_t
 
     mpd_copy(order->tp, tp, &mpd_ctx);
     mpd_copy(order->sl, sl, &mpd_ctx);
+    order->fx_tp = fixed_from_mpd(tp);
+    order->fx_sl = fixed_from_mpd(sl);
 
     if (mpd_cmp(tp, mpd_zero, &mpd_ctx) > 0) {
         if (order->side == ORDER_SIDE_BUY) {
@@ -2012,6 +2185,7 @@ static void append_stop_out_log(order_t *order)
 
 int market_stop_out(bool real, market_t *m, uint64_t sid, order_t *order, const char *comment, double finish_time)
 {
+    order_sync_fixed(order);
     mpd_t *profit = mpd_new(&mpd_ctx);
     mpd_copy(profit, order->profit, &mpd_ctx);
 
@@ -2102,8 +2276,8 @@ static void market_set_margin(market_t *m, uint64_t sid, mpd_t *margin)
     }
 }
 
-int market_open_hedged(bool real, json_t **result, market_t *m, symbol_t *sym, uint64_t sid, uint32_t leverage, uint32_t side, mpd_t *price, mpd_t *lot,
-                mpd_t *tp, mpd_t *sl, mpd_t *percentage, mpd_t *fee, mpd_t *swap, uint64_t external, const char *comment, mpd_t *margin_price, double create_time)
+int market_open_hedged(bool real, json_t **result, market_t *m, symbol_t *sym, uint64_t sid, uint32_t side, mpd_t *price, mpd_t *lot,
+                mpd_t *tp, mpd_t *sl, mpd_t *margin_rate, mpd_t *fee, mpd_t *swap, uint64_t external, const char *comment, mpd_t *margin_price, double create_time)
 {
     if (mpd_cmp(price, mpd_zero, &mpd_ctx) <= 0) {
        return -3;
@@ -2112,35 +2286,13 @@ int market_open_hedged(bool real, json_t **result, market_t *m, symbol_t *sym, u
        return -4;
     }
 
-    // 1.计算保证金, c = contract_size / 100
+    // 1.计算保证金, margin_rate = contract_size / 100 / leverage * percentage
     // Forex = lots * contract_size / leverage * percentage / 100
     // CFD = lots * contract_size / leverage * percentage / 100 * market_price
     mpd_t *margin = mpd_new(&mpd_ctx);
-    mpd_set_u32(margin, leverage, &mpd_ctx);
-    mpd_div(margin, sym->c, margin, &mpd_ctx);
-    mpd_mul(margin, margin, percentage, &mpd_ctx);
-    mpd_mul(margin, margin, lot, &mpd_ctx);
+    mpd_mul(margin, margin_rate, lot, &mpd_ctx);
 
-    if (sym->margin_calc == MARGIN_CALC_FOREX) {
-        if (sym->margin_type == MARGIN_TYPE_AU) {
-            mpd_mul(margin, margin, price, &mpd_ctx);        // EURUSD
-        } else if (sym->margin_type == MARGIN_TYPE_AC) {
-            mpd_mul(margin, margin, margin_price, &mpd_ctx); // EURGBP
-        } else if (sym->margin_type == MARGIN_TYPE_BC) {
-            mpd_div(margin, margin, margin_price, &mpd_ctx); // CADJPY
-        }
-    } else {
-         if (strcmp(sym->name, "HSI") == 0) {
-             mpd_div(margin, margin, margin_price, &mpd_ctx); // USDHKD
-         } else if (strcmp(sym->name, "DAX") == 0) {
-             mpd_mul(margin, margin, margin_price, &mpd_ctx); // EURUSD
-         } else if (strcmp(sym->name, "UK100") == 0) {
-             mpd_mul(margin, margin, margin_price, &mpd_ctx); // GBPUSD
-         } else if (strcmp(sym->name, "JP225") == 0) {
-             mpd_div(margin, margin, margin_price, &mpd_ctx); // USDJPY
-         }
-         mpd_mul(margin, margin, price, &mpd_ctx);
-    }
+    sym->margin_kernel(margin, sym, price, margin_price);
     mpd_rescale(margin, margin, -2, &mpd_ctx);
 
     // 2.检查对冲订单
@@ -2391,6 +2543,7 @@ int market_open_hedged(bool real, json_t **result, market_t *m, symbol_t *sym, u
     if (order == NULL) {
         return -__LINE__;
     }
+    memset(order, 0, sizeof(order_t));
 
     order->id           = ++order_id_start;
     order->type         = MARKET_ORDER_TYPE_MARKET;
@@ -2401,7 +2554,8 @@ int market_open_hedged(bool real, json_t **result, market_t *m, symbol_t *sym, u
     order->expire_time  = 0;
     order->sid          = sid;
     order->external     = external;
-    order->symbol       = strdup(m->name);
+    order->symbol       = m->name;
+    order->symbol_id    = m->sym->id;
     order->comment      = strdup(comment);
 
     order->price        = mpd_new(&mpd_ctx);
@@ -2451,6 +2605,7 @@ int market_open_hedged(bool real, json_t **result, market_t *m, symbol_t *sym, u
 
 int market_close_hedged(bool real, json_t **result, market_t *m, symbol_t *sym, uint64_t sid, order_t *order, mpd_t *price, const char *comment, mpd_t *profit_price, double finish_time)
 {
+    order_sync_fixed(order);
     if (mpd_cmp(price, mpd_zero, &mpd_ctx) <= 0) {
        return -3;
     }
@@ -2469,30 +2624,7 @@ int market_close_hedged(bool real, json_t **result, market_t *m, symbol_t *sym,
     }
     mpd_mul(profit, profit, order->lot, &mpd_ctx);
 
-    if (sym->profit_calc == PROFIT_CALC_FOREX) {
-        mpd_mul(profit, profit, sym->contract_size, &mpd_ctx);
-        if (sym->profit_type == PROFIT_TYPE_UB) {
-            mpd_div(profit, profit, price, &mpd_ctx);        // USDJPY
-        } else if (sym->profit_type == PROFIT_TYPE_AC) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // EURGBP
-        } else if (sym->profit_type == PROFIT_TYPE_CB) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // CADJPY
-        }
-    } else if (sym->profit_calc == PROFIT_CALC_CFD) {
-        mpd_mul(profit, profit, sym->contract_size, &mpd_ctx);
-        if (strcmp(sym->name, "HSI") == 0) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // USDHKD
-        } else if (strcmp(sym->name, "DAX") == 0) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // EURUSD
-        } else if (strcmp(sym->name, "UK100") == 0) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // GBPUSD
-        } else if (strcmp(sym->name, "JP225") == 0) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // USDJPY
-        }
-    } else {
-        mpd_mul(profit, profit, sym->tick_price, &mpd_ctx);
-        mpd_div(profit, profit, sym->tick_size, &mpd_ctx);
-    }
+    sym->profit_kernel(profit, sym, price, profit_price);
     mpd_rescale(profit, profit, -2, &mpd_ctx);
 
     // 2.update float
@@ -2753,6 +2885,7 @@ int market_tpsl_hedged(market_t *m, uint64_t order_id)
     if (order == NULL)
         return -__LINE__;
     uint64_t sid = order->sid;
+    order_sync_fixed(order);
 
     // 1.update float
     balance_sub_float(sid, BALANCE_TYPE_FLOAT, order->profit);
@@ -2965,6 +3098,7 @@ int market_tpsl_hedged(market_t *m, uint64_t order_id)
 
 int market_stop_out_hedged(market_t *m, uint64_t sid, order_t *order, const char *comment, double finish_time)
 {
+    order_sync_fixed(order);
     // 1.update float
     balance_sub_float(sid, BALANCE_TYPE_FLOAT, order->profit);
 
@@ -3196,6 +3330,8 @@ int market_stop_out_hedged(market_t *m, uint64_t sid, order_t *order, const char
 
 static int limit_put(market_t *m, order_t *order)
 {
+    snapshot_touch(order->sid);
+    digest_touch(order->sid);
     struct dict_order_key order_key = { .order_id = order->id };
     if (dict_add(m->limit_orders, &order_key, order) == NULL)
         return -__LINE__;
@@ -3247,6 +3383,8 @@ order_t *market_get_limit(market_t *m, uint64_t order_id)
 
 static int order_cancel(market_t *m, order_t *order, bool free)
 {
+    snapshot_touch(order->sid);
+    digest_touch(order->sid);
     if (order->side == ORDER_SIDE_SELL) {
         skiplist_node *node = skiplist_find(m->limit_sells, order);
         if (node) {
@@ -3312,6 +3450,7 @@ int market_put_limit(bool real, json_t **result, market_t *m, uint64_t sid, uint
     if (order == NULL) {
         return -__LINE__;
     }
+    memset(order, 0, sizeof(order_t));
 
     order->id           = ++order_id_start;
     order->type         = MARKET_ORDER_TYPE_LIMIT;
@@ -3322,7 +3461,8 @@ int market_put_limit(bool real, json_t **result, market_t *m, uint64_t sid, uint
     order->expire_time  = expire_time;
     order->sid          = sid;
     order->external     = external;
-    order->symbol       = strdup(m->name);
+    order->symbol       = m->name;
+    order->symbol_id    = m->sym->id;
     order->comment      = strdup(comment);
 
     order->price        = mpd_new(&mpd_ctx);
@@ -3376,6 +3516,11 @@ int market_put_pending(market_t *m, order_t *order)
     return limit_put(m, order);
 }
 
+int market_remove_pending(market_t *m, order_t *order)
+{
+    return order_cancel(m, order, true);
+}
+
 int limit_open(bool real, market_t *m, symbol_t *sym, order_t *o, uint64_t sid, mpd_t *price, mpd_t *fee, mpd_t *margin_price, double update_time)
 {
     // 1.计算保证金, c = contract_size / 100, o->margin = percentage / leverage
@@ -3386,26 +3531,7 @@ int limit_open(bool real, market_t *m, symbol_t *sym, order_t *o, uint64_t sid,
     mpd_mul(margin, sym->c, margin, &mpd_ctx);
     mpd_mul(margin, margin, o->lot, &mpd_ctx);
 
-    if (sym->margin_calc == MARGIN_CALC_FOREX) {
-        if (sym->margin_type == MARGIN_TYPE_AU) {
-            mpd_mul(margin, margin, price, &mpd_ctx);        // EURUSD
-        } else if (sym->margin_type == MARGIN_TYPE_AC) {
-            mpd_mul(margin, margin, margin_price, &mpd_ctx); // EURGBP
-        } else if (sym->margin_type == MARGIN_TYPE_BC) {
-            mpd_div(margin, margin, margin_price, &mpd_ctx); // CADJPY
-        }
-    } else {
-         if (strcmp(sym->name, "HSI") == 0) {
-             mpd_div(margin, margin, margin_price, &mpd_ctx); // USDHKD
-         } else if (strcmp(sym->name, "DAX") == 0) {
-             mpd_mul(margin, margin, margin_price, &mpd_ctx); // EURUSD
-         } else if (strcmp(sym->name, "UK100") == 0) {
-             mpd_mul(margin, margin, margin_price, &mpd_ctx); // GBPUSD
-         } else if (strcmp(sym->name, "JP225") == 0) {
-             mpd_div(margin, margin, margin_price, &mpd_ctx); // USDJPY
-         }
-         mpd_mul(margin, margin, price, &mpd_ctx);
-    }
+    sym->margin_kernel(margin, sym, price, margin_price);
     mpd_rescale(margin, margin, -2, &mpd_ctx);
 
     // 2.检查对冲订单
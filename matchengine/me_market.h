@@ -8,6 +8,20 @@ extern uint64_t order_id_start;
 extern uint64_t deals_id_start;
 extern skiplist_t *expire_orders;
 
+// 每个 (sid, symbol) 的持仓汇总，按 side 分开
+// 浮动盈亏 = side * (close_price * lot - cost) 再折算 USD，tick 时每个 side 只算一次
+typedef struct exposure_t {
+    uint64_t        sid;
+    symbol_t        *sym;
+    uint32_t        count;
+    fixed_t         lot[2];
+    __int128        cost[2];            // sum(lot * open_price), scale 2 * FIXED_PREC
+    fixed_t         pnl[2];             // 已记入 BALANCE_TYPE_FLOAT 的部分
+    fixed_t         close_price[2];
+    fixed_t         profit_price[2];
+    uint64_t        seq[2];             // 每次重估 +1，订单据此判断是否需要重算
+} exposure_t;
+
 typedef struct order_t {
     uint64_t        id;
     uint64_t        external;
@@ -18,7 +32,8 @@ typedef struct order_t {
     double          finish_time;
     uint64_t        expire_time;
     uint64_t        sid;
-    char            *symbol;
+    uint32_t        symbol_id;
+    const char      *symbol;        // 指向 market 名字，不单独分配
     char            *comment;
     mpd_t           *lot;
     mpd_t           *price;
@@ -33,15 +48,30 @@ typedef struct order_t {
     mpd_t           *margin_price;
     mpd_t           *profit_price;
 
+    // 定点数镜像，tick 路径只更新这些字段，mpd 字段在 order_sync_fixed 时回写
+    fixed_t         fx_price;
+    fixed_t         fx_lot;
+    fixed_t         fx_margin;
+    fixed_t         fx_profit;
+    fixed_t         fx_close_price;
+    fixed_t         fx_profit_price;
+    fixed_t         fx_tp;              // tp/sl 队列按定点数排序
+    fixed_t         fx_sl;
+    bool            fx_dirty;
+    uint64_t        fx_seq;
+    exposure_t      *exposure;
+
     uint32_t        user_id;
 } order_t;
 
 typedef struct market_t {
     char            *name;
+    symbol_t        *sym;
 
     dict_t          *orders;
     dict_t          *users;
     dict_t          *margins;
+    dict_t          *exposures;
 
     skiplist_t      *buys;
     skiplist_t      *sells;
@@ -85,8 +115,8 @@ int market_tpsl(bool real, market_t *m, symbol_t *sym, uint64_t sid, order_t *or
 int market_update(bool real, json_t **result, market_t *m, order_t *order, mpd_t *tp, mpd_t *sl);
 int market_stop_out(bool real, market_t *m, uint64_t sid, order_t *order, const char *comment, double finish_time);
 
-int market_open_hedged(bool real, json_t **result, market_t *m, symbol_t *sym, uint64_t sid, uint32_t leverage, uint32_t side, mpd_t *price, mpd_t *lot,
-                mpd_t *tp, mpd_t *sl, mpd_t *percentage, mpd_t *fee, mpd_t *swap, uint64_t external, const char *comment, mpd_t *margin_price, double create_time);
+int market_open_hedged(bool real, json_t **result, market_t *m, symbol_t *sym, uint64_t sid, uint32_t side, mpd_t *price, mpd_t *lot,
+                mpd_t *tp, mpd_t *sl, mpd_t *margin_rate, mpd_t *fee, mpd_t *swap, uint64_t external, const char *comment, mpd_t *margin_price, double create_time);
 int market_close_hedged(bool real, json_t **result, market_t *m, symbol_t *sym, uint64_t sid, order_t *order, mpd_t *price, const char *comment, mpd_t *profit_price, double finish_time);
 int market_tpsl_hedged(market_t *m, uint64_t order_id);
 int market_stop_out_hedged(market_t *m, uint64_t sid, order_t *order, const char *comment, double finish_time);
@@ -97,10 +127,19 @@ int market_put_limit(bool real, json_t **result, market_t *m, uint64_t sid, uint
 order_t *market_get_limit(market_t *m, uint64_t id);
 int market_cancel(bool real, json_t **result, market_t *m, order_t *order, const char *comment, double finish_time);
 int market_put_pending(market_t *m, order_t *order);
+int market_remove_position(market_t *m, order_t *order);
+int market_remove_pending(market_t *m, order_t *order);
+skiplist_t *market_get_limit_list(market_t *m, uint64_t sid);
 int limit_open(bool real, market_t *m, symbol_t *sym, order_t *order, uint64_t sid, mpd_t *price, mpd_t *fee, mpd_t *margin_price, double update_time);
 int limit_expire(order_t *order);
 
+int market_init_positions(void);
+skiplist_t *market_get_positions(uint64_t sid);
 skiplist_t *market_get_order_list_v2(market_t *m, uint64_t sid);
+void order_refresh_fixed(order_t *order);
+void order_sync_fixed(order_t *order);
+void order_set_profit_fixed(order_t *order, fixed_t profit, fixed_t close_price, fixed_t profit_price);
+void market_revalue_exposure(exposure_t *e, fixed_t bid, fixed_t ask, fixed_t profit_bid, fixed_t profit_ask);
 json_t *get_order_info_v2(order_t *order);
 order_t *market_get_external_order(market_t *m, uint64_t sid, uint64_t external);
 order_t *market_get_external_limit(market_t *m, uint64_t sid, uint64_t external);
@@ -2,6 +2,7 @@
 # include "me_message.h"
 
 # include <librdkafka/rdkafka.h>
+# include "ut_binmsg.h"
 
 static rd_kafka_t *rk;
 
@@ -15,11 +16,45 @@ static list_t *list_balances;
 
 static nw_timer timer;
 
+// 消息按 key 分区，同一个 sid 总在同一个分区，保证账户内顺序
+struct kafka_msg {
+    char            *data;      // 成功提交后由 librdkafka 释放
+    size_t          len;
+    uint64_t        key;
+};
+
+// 每个 topic 的投递统计，挂在 topic opaque 上
+struct topic_stat {
+    uint64_t        produced;
+    uint64_t        delivered;
+    uint64_t        failed;
+    uint64_t        latency_sum;    // 微秒
+    uint64_t        latency_max;
+};
+
+static struct topic_stat stat_deals;
+static struct topic_stat stat_orders;
+static struct topic_stat stat_balances;
+
+// 按 kafka_binary 配置，这些 topic 用二进制编码
+static bool binary_deals;
+static bool binary_orders;
+static bool binary_balances;
+
 static void on_delivery(rd_kafka_t *rk, const rd_kafka_message_t *rkmessage, void *opaque)
 {
+    struct topic_stat *stat = rd_kafka_topic_opaque(rkmessage->rkt);
     if (rkmessage->err) {
+        stat->failed++;
         log_fatal("Message delivery failed: %s", rd_kafka_err2str(rkmessage->err));
     } else {
+        int64_t latency = rd_kafka_message_latency(rkmessage);
+        if (latency >= 0) {
+            stat->latency_sum += latency;
+            if ((uint64_t)latency > stat->latency_max)
+                stat->latency_max = latency;
+        }
+        stat->delivered++;
         log_trace("Message delivered (topic: %s, %zd bytes, partition %"PRId32")",
                 rd_kafka_topic_name(rkmessage->rkt), rkmessage->len, rkmessage->partition);
     }
@@ -30,18 +65,31 @@ static void on_logger(const rd_kafka_t *rk, int level, const char *fac, const ch
     log_error("RDKAFKA-%i-%s: %s: %s\n", level, fac, rk ? rd_kafka_name(rk) : NULL, buf);
 }
 
+static int produce_message(rd_kafka_topic_t *topic, struct kafka_msg *msg)
+{
+    char key[32];
+    int key_len = snprintf(key, sizeof(key), "%"PRIu64, msg->key);
+    int32_t partition = msg->key % settings.kafka_partitions;
+    int ret = rd_kafka_produce(topic, partition, RD_KAFKA_MSG_F_FREE, msg->data, msg->len, key, key_len, NULL);
+    if (ret == -1) {
+        log_fatal("Failed to produce: %zu bytes to topic %s: %s\n", msg->len,
+                rd_kafka_topic_name(topic), rd_kafka_err2str(rd_kafka_last_error()));
+        return -__LINE__;
+    }
+    msg->data = NULL;
+    struct topic_stat *stat = rd_kafka_topic_opaque(topic);
+    stat->produced++;
+    return 0;
+}
+
 static void produce_list(list_t *list, rd_kafka_topic_t *topic)
 {
     list_node *node;
     list_iter *iter = list_get_iterator(list, LIST_START_HEAD);
     while ((node = list_next(iter)) != NULL) {
-        int ret = rd_kafka_produce(topic, 0, RD_KAFKA_MSG_F_COPY, node->value, strlen(node->value), NULL, 0, NULL);
-        if (ret == -1) {
-            log_fatal("Failed to produce: %s to topic %s: %s\n", (char *)node->value,
-                    rd_kafka_topic_name(rkt_deals), rd_kafka_err2str(rd_kafka_last_error()));
-            if (rd_kafka_last_error() == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
-                break;
-            }
+        int ret = produce_message(topic, node->value);
+        if (ret < 0 && rd_kafka_last_error() == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+            break;
         }
         list_del(list, node);
     }
@@ -65,7 +113,27 @@ static void on_timer(nw_timer *t, void *privdata)
 
 static void on_list_free(void *value)
 {
-    free(value);
+    struct kafka_msg *msg = value;
+    free(msg->data);
+    free(msg);
+}
+
+static rd_kafka_topic_t *create_topic(const char *name, struct topic_stat *stat)
+{
+    char errstr[1024];
+    rd_kafka_topic_conf_t *conf = rd_kafka_topic_conf_new();
+    if (rd_kafka_topic_conf_set(conf, "compression.codec", settings.kafka_compression, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+        log_stderr("Set kafka compression: %s fail: %s", settings.kafka_compression, errstr);
+        return NULL;
+    }
+    rd_kafka_topic_conf_set_opaque(conf, stat);
+
+    rd_kafka_topic_t *rkt = rd_kafka_topic_new(rk, name, conf);
+    if (rkt == NULL) {
+        log_stderr("Failed to create topic object: %s", rd_kafka_err2str(rd_kafka_last_error()));
+        return NULL;
+    }
+    return rkt;
 }
 
 int init_message(void)
@@ -76,8 +144,16 @@ int init_message(void)
         log_stderr("Set kafka brokers: %s fail: %s", settings.brokers, errstr);
         return -__LINE__;
     }
-    if (rd_kafka_conf_set(conf, "queue.buffering.max.ms", "1", errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
-        log_stderr("Set kafka buffering: %s fail: %s", settings.brokers, errstr);
+    char linger[32];
+    snprintf(linger, sizeof(linger), "%d", settings.kafka_linger_ms);
+    if (rd_kafka_conf_set(conf, "queue.buffering.max.ms", linger, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+        log_stderr("Set kafka buffering: %s fail: %s", linger, errstr);
+        return -__LINE__;
+    }
+    char batch[32];
+    snprintf(batch, sizeof(batch), "%d", settings.kafka_batch_num);
+    if (rd_kafka_conf_set(conf, "batch.num.messages", batch, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+        log_stderr("Set kafka batch: %s fail: %s", batch, errstr);
         return -__LINE__;
     }
     rd_kafka_conf_set_log_cb(conf, on_logger);
@@ -89,21 +165,19 @@ int init_message(void)
         return -__LINE__;
     }
 
-    rkt_balances = rd_kafka_topic_new(rk, "balances", NULL);
-    if (rkt_balances == NULL) {
-        log_stderr("Failed to create topic object: %s", rd_kafka_err2str(rd_kafka_last_error()));
+    binary_balances = is_kafka_binary("balances");
+    binary_orders = is_kafka_binary("orders");
+    binary_deals = is_kafka_binary("deals");
+
+    rkt_balances = create_topic("balances", &stat_balances);
+    if (rkt_balances == NULL)
         return -__LINE__;
-    }
-    rkt_orders = rd_kafka_topic_new(rk, "orders", NULL);
-    if (rkt_orders == NULL) {
-        log_stderr("Failed to create topic object: %s", rd_kafka_err2str(rd_kafka_last_error()));
+    rkt_orders = create_topic("orders", &stat_orders);
+    if (rkt_orders == NULL)
         return -__LINE__;
-    }
-    rkt_deals = rd_kafka_topic_new(rk, "deals", NULL);
-    if (rkt_deals == NULL) {
-        log_stderr("Failed to create topic object: %s", rd_kafka_err2str(rd_kafka_last_error()));
+    rkt_deals = create_topic("deals", &stat_deals);
+    if (rkt_deals == NULL)
         return -__LINE__;
-    }
 
     list_type lt;
     memset(&lt, 0, sizeof(lt));
@@ -146,30 +220,65 @@ static json_t *json_array_append_mpd(json_t *message, mpd_t *val)
     return message;
 }
 
-static int push_message(char *message, rd_kafka_topic_t *topic, list_t *list)
+// message 是 malloc 的缓冲区，直接交给 librdkafka，不再拷贝
+static int push_message(char *message, size_t len, uint64_t key, rd_kafka_topic_t *topic, list_t *list)
 {
-    log_trace("push %s message: %s", rd_kafka_topic_name(topic), message);
-
-    if (list->len) {
-        list_add_node_tail(list, message);
-        return 0;
-    }
-
-    int ret = rd_kafka_produce(topic, 0, RD_KAFKA_MSG_F_COPY, message, strlen(message), NULL, 0, NULL);
-    if (ret == -1) {
-        log_fatal("Failed to produce: %s to topic %s: %s\n", message, rd_kafka_topic_name(rkt_deals), rd_kafka_err2str(rd_kafka_last_error()));
-        if (rd_kafka_last_error() == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
-            list_add_node_tail(list, message);
+    struct kafka_msg msg = { .data = message, .len = len, .key = key };
+    if (list->len == 0) {
+        int ret = produce_message(topic, &msg);
+        if (ret == 0)
             return 0;
+        if (rd_kafka_last_error() != RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+            free(message);
+            return -__LINE__;
         }
-        free(message);
-        return -__LINE__;
     }
-    free(message);
 
+    struct kafka_msg *pending = malloc(sizeof(struct kafka_msg));
+    *pending = msg;
+    list_add_node_tail(list, pending);
     return 0;
 }
 
+static int push_json(json_t *message, uint64_t key, rd_kafka_topic_t *topic, list_t *list)
+{
+    char *data = json_dumps(message, 0);
+    log_trace("push %s message: %s", rd_kafka_topic_name(topic), data);
+    return push_message(data, strlen(data), key, topic, list);
+}
+
+// 二进制编码: 定长字段加 varstr，按最大长度分配
+static char *binmsg_alloc(uint8_t type, size_t size, void **p, size_t *left)
+{
+    char *buf = malloc(size);
+    *p = buf;
+    *left = size;
+    binmsg_pack_head(p, left, type);
+    return buf;
+}
+
+static void pack_str(void **p, size_t *left, const char *str)
+{
+    pack_varstr(p, left, str ? str : "", str ? strlen(str) : 0);
+}
+
+static int push_binary(char *buf, size_t size, size_t left, uint64_t key, rd_kafka_topic_t *topic, list_t *list)
+{
+    log_trace("push %s message: %zu bytes", rd_kafka_topic_name(topic), size - left);
+    return push_message(buf, size - left, key, topic, list);
+}
+
+// 有一个 decimal 不能无损转成 fixed_t，整条消息改用 JSON
+static bool order_fits_fixed(order_t *order)
+{
+    return fixed_fits_mpd(order->lot) && fixed_fits_mpd(order->price) && fixed_fits_mpd(order->close_price) &&
+        fixed_fits_mpd(order->fee) && fixed_fits_mpd(order->swaps) && fixed_fits_mpd(order->profit) &&
+        fixed_fits_mpd(order->tp) && fixed_fits_mpd(order->sl);
+}
+
+// varint 长度前缀最多 10 字节
+# define STR_SIZE(str) ((str) ? strlen(str) + 10 : 10)
+
 int push_balance_message(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change)
 {
     json_t *message = json_array();
@@ -179,7 +288,7 @@ int push_balance_message(double t, uint32_t user_id, const char *asset, const ch
     json_array_append_new(message, json_string(business));
     json_array_append_mpd(message, change);
 
-    push_message(json_dumps(message, 0), rkt_balances, list_balances);
+    push_json(message, user_id, rkt_balances, list_balances);
     json_decref(message);
 
     return 0;
@@ -194,7 +303,7 @@ int push_order_message(uint32_t event, order_t *order, market_t *market)
     json_object_set_new(message, "stock", json_string(market->stock));
     json_object_set_new(message, "money", json_string(market->money));
 
-    push_message(json_dumps(message, 0), rkt_orders, list_orders);
+    push_json(message, order->user_id, rkt_orders, list_orders);
     json_decref(message);
 */
     return 0;
@@ -203,6 +312,31 @@ int push_order_message(uint32_t event, order_t *order, market_t *market)
 int push_deal_message(double t, const char *market, order_t *ask, order_t *bid, mpd_t *price, mpd_t *amount,
         mpd_t *ask_fee, mpd_t *bid_fee, int side, uint64_t id, const char *stock, const char *money)
 {
+    // 成交涉及两个账户，按品种分区，保证同一品种的成交有序
+    uint64_t key = dict_generic_hash_function(market, strlen(market));
+    if (binary_deals && fixed_fits_mpd(price) && fixed_fits_mpd(amount) && fixed_fits_mpd(ask_fee) && fixed_fits_mpd(bid_fee)) {
+        void *p;
+        size_t left;
+        size_t size = BINMSG_HEAD_SIZE + 8 * 3 + 4 * 2 + 8 * 4 + 4 + 8 + STR_SIZE(market) + STR_SIZE(stock) + STR_SIZE(money);
+        char *buf = binmsg_alloc(BINMSG_DEAL, size, &p, &left);
+        binmsg_pack_double(&p, &left, t);
+        pack_str(&p, &left, market);
+        pack_uint64_le(&p, &left, ask->id);
+        pack_uint64_le(&p, &left, bid->id);
+        pack_uint32_le(&p, &left, ask->user_id);
+        pack_uint32_le(&p, &left, bid->user_id);
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(price));
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(amount));
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(ask_fee));
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(bid_fee));
+        pack_uint32_le(&p, &left, side);
+        pack_uint64_le(&p, &left, id);
+        pack_str(&p, &left, stock);
+        pack_str(&p, &left, money);
+        push_binary(buf, size, left, key, rkt_deals, list_deals);
+        return 0;
+    }
+
     json_t *message = json_array();
     json_array_append_new(message, json_real(t));
     json_array_append_new(message, json_string(market));
@@ -219,7 +353,7 @@ int push_deal_message(double t, const char *market, order_t *ask, order_t *bid,
     json_array_append_new(message, json_string(stock));
     json_array_append_new(message, json_string(money));
 
-    push_message(json_dumps(message, 0), rkt_deals, list_deals);
+    push_json(message, key, rkt_deals, list_deals);
     json_decref(message);
 
     return 0;
@@ -227,6 +361,20 @@ int push_deal_message(double t, const char *market, order_t *ask, order_t *bid,
 
 int push_balance_message_v2(double t, uint64_t sid, mpd_t *change, mpd_t *balance, const char *comment)
 {
+    if (binary_balances && fixed_fits_mpd(change) && fixed_fits_mpd(balance)) {
+        void *p;
+        size_t left;
+        size_t size = BINMSG_HEAD_SIZE + 8 * 4 + STR_SIZE(comment);
+        char *buf = binmsg_alloc(BINMSG_BALANCE, size, &p, &left);
+        binmsg_pack_double(&p, &left, t);
+        pack_uint64_le(&p, &left, sid);
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(change));
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(balance));
+        pack_str(&p, &left, comment);
+        push_binary(buf, size, left, sid, rkt_balances, list_balances);
+        return 0;
+    }
+
     json_t *message = json_array();
     json_array_append_new(message, json_real(t));
     json_array_append_new(message, json_integer(sid));
@@ -234,7 +382,7 @@ int push_balance_message_v2(double t, uint64_t sid, mpd_t *change, mpd_t *balanc
     json_array_append_mpd(message, balance);
     json_array_append_new(message, json_string(comment));
 
-    push_message(json_dumps(message, 0), rkt_balances, list_balances);
+    push_json(message, sid, rkt_balances, list_balances);
     json_decref(message);
 
     return 0;
@@ -242,6 +390,33 @@ int push_balance_message_v2(double t, uint64_t sid, mpd_t *change, mpd_t *balanc
 
 int push_order_message_v2(uint32_t event, order_t *order)
 {
+    if (binary_orders && order_fits_fixed(order)) {
+        void *p;
+        size_t left;
+        size_t size = BINMSG_HEAD_SIZE + 4 + 8 * 2 + 4 + 8 * 4 + 8 * 8 + STR_SIZE(order->symbol) + STR_SIZE(order->comment);
+        char *buf = binmsg_alloc(BINMSG_ORDER, size, &p, &left);
+        pack_uint32_le(&p, &left, event);
+        pack_uint64_le(&p, &left, order->id);
+        pack_uint64_le(&p, &left, order->sid);
+        pack_uint32_le(&p, &left, order->side);
+        pack_str(&p, &left, order->symbol);
+        binmsg_pack_double(&p, &left, order->create_time);
+        binmsg_pack_double(&p, &left, order->update_time);
+        binmsg_pack_double(&p, &left, order->finish_time);
+        pack_uint64_le(&p, &left, order->expire_time);
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(order->lot));
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(order->price));
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(order->close_price));
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(order->fee));
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(order->swaps));
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(order->profit));
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(order->tp));
+        binmsg_pack_fixed(&p, &left, fixed_from_mpd(order->sl));
+        pack_str(&p, &left, order->comment);
+        push_binary(buf, size, left, order->sid, rkt_orders, list_orders);
+        return 0;
+    }
+
     json_t *message = json_array();
     json_array_append_new(message, json_integer(event));
 
@@ -264,7 +439,7 @@ int push_order_message_v2(uint32_t event, order_t *order)
     json_array_append_mpd(message, order->sl);
     json_array_append_new(message, json_string(order->comment));
 
-    push_message(json_dumps(message, 0), rkt_orders, list_orders);
+    push_json(message, order->sid, rkt_orders, list_orders);
     json_decref(message);
 
     return 0;
@@ -282,11 +457,21 @@ bool is_message_block(void)
     return false;
 }
 
+static sds topic_status(sds reply, const char *name, struct topic_stat *stat)
+{
+    return sdscatprintf(reply, "message %s produced: %"PRIu64", delivered: %"PRIu64", failed: %"PRIu64", latency avg: %.3fms, max: %.3fms\n",
+            name, stat->produced, stat->delivered, stat->failed,
+            stat->delivered ? stat->latency_sum / 1000.0 / stat->delivered : 0, stat->latency_max / 1000.0);
+}
+
 sds message_status(sds reply)
 {
     reply = sdscatprintf(reply, "message deals pending: %lu\n", list_deals->len);
     reply = sdscatprintf(reply, "message orders pending: %lu\n", list_orders->len);
     reply = sdscatprintf(reply, "message balances pending: %lu\n", list_balances->len);
+    reply = topic_status(reply, "deals", &stat_deals);
+    reply = topic_status(reply, "orders", &stat_orders);
+    reply = topic_status(reply, "balances", &stat_balances);
     return reply;
 }
 
@@ -1,5 +1,13 @@
+# include <fcntl.h>
+# include <limits.h>
+# include <dirent.h>
+# include <sys/stat.h>
+
 # include "me_config.h"
 # include "me_operlog.h"
+# include "me_repl.h"
+# include "me_snapshot.h"
+# include "ut_crc32.h"
 
 uint64_t operlog_id_start;
 
@@ -14,6 +22,33 @@ struct operlog {
     char *detail;
 };
 
+/*
+ * 本地 WAL，主 operlog
+ *
+ * 段文件 <operlog_path>/operlog.<首条 id>，文件头 8 字节 magic，之后是记录:
+ *   uint32 len | uint32 crc32c | uint64 id | double time | detail[len]
+ * crc 覆盖 id 之后的所有字节。记录先进内存缓冲，定时 write + fdatasync 一次(group commit)。
+ * MySQL operlog_YYYYMMDD 只做异步归档，不再阻塞下单。
+ */
+# define WAL_MAGIC          "MEWAL001"
+# define WAL_MAGIC_LEN      8
+# define WAL_HEAD_LEN       24
+# define WAL_RECORD_MAX     (16 * 1024 * 1024)
+# define WAL_FLUSH_SIZE     (1024 * 1024)
+
+static int wal_fd = -1;
+static size_t wal_size;
+static char *wal_buf;
+static size_t wal_buf_len;
+static size_t wal_buf_cap;
+static bool wal_fail;
+static bool wal_sync_fail; // fdatasync 失败后当前段的页缓存状态不可信，不能重试，只能换段
+static nw_timer wal_timer;
+
+// 回放时记下最后一个段的有效长度，打开时截掉写了一半的尾部
+static uint64_t wal_tail_id;
+static size_t wal_tail_len;
+
 static void *on_job_init(void)
 {
     return mysql_connect(&settings.db_log);
@@ -52,6 +87,28 @@ static void on_list_free(void *value)
     free(log);
 }
 
+static int init_list(void)
+{
+    if (list)
+        return 0;
+
+    list_type lt;
+    memset(&lt, 0, sizeof(lt));
+    lt.free = on_list_free;
+    list = list_create(&lt);
+    if (list == NULL)
+        return -__LINE__;
+    return 0;
+}
+
+static sds operlog_table(sds table, double create_time)
+{
+    time_t t = (time_t)create_time;
+    struct tm *tm = localtime(&t);
+    return sdscatprintf(table, "operlog_%04d%02d%02d", 1900 + tm->tm_year, 1 + tm->tm_mon, tm->tm_mday);
+}
+
+// 归档按记录时间入表，同一批不跨天；重放时会重复归档，用 INSERT IGNORE 去重
 static void flush_log(void)
 {
     static sds table_last;
@@ -59,10 +116,8 @@ static void flush_log(void)
         table_last = sdsempty();
     }
 
-    time_t now = time(NULL);
-    struct tm *tm = localtime(&now);
-    sds table = sdsempty();
-    table = sdscatprintf(table, "operlog_%04d%02d%02d", 1900 + tm->tm_year, 1 + tm->tm_mon, tm->tm_mday);
+    struct operlog *first = list->head->value;
+    sds table = operlog_table(sdsempty(), first->create_time);
 
     if (sdscmp(table_last, table) != 0) {
         sds create_table_sql = sdsempty();
@@ -72,38 +127,479 @@ static void flush_log(void)
     }
 
     sds sql = sdsempty();
-    sql = sdscatprintf(sql, "INSERT INTO `%s` (`id`, `time`, `detail`) VALUES ", table);
-    sdsfree(table);
+    sql = sdscatprintf(sql, "INSERT IGNORE INTO `%s` (`id`, `time`, `detail`) VALUES ", table);
 
     size_t count = 0;
-    char buf[10240];
+    size_t buf_size = 10240;
+    char *buf = malloc(buf_size);
+    sds record_table = sdsempty();
     list_node *node;
     list_iter *iter = list_get_iterator(list, LIST_START_HEAD);
     while ((node = list_next(iter)) != NULL) {
         struct operlog *log = node->value;
+        sdsclear(record_table);
+        record_table = operlog_table(record_table, log->create_time);
+        if (sdscmp(record_table, table) != 0)
+            break;
+
         size_t detail_len = strlen(log->detail);
+        if (detail_len * 2 + 1 > buf_size) {
+            buf_size = detail_len * 2 + 1;
+            buf = realloc(buf, buf_size);
+        }
         mysql_real_escape_string(mysql_conn, buf, log->detail, detail_len);
-        sql = sdscatprintf(sql, "(%"PRIu64", %f, '%s')", log->id, log->create_time, buf);
-        if (list_len(list) > 1 && count < 999) {
+        if (count > 0) {
             sql = sdscatprintf(sql, ", ");
         }
+        sql = sdscatprintf(sql, "(%"PRIu64", %f, '%s')", log->id, log->create_time, buf);
         list_del(list, node);
         count++;
-	if (count > 999)
+        if (count > 999)
             break;
     }
     list_release_iterator(iter);
+    sdsfree(record_table);
+    sdsfree(table);
+    free(buf);
+
     nw_job_add(job, 0, sql);
     log_debug("flush oper log count: %zu", count);
 }
 
 static void on_timer(nw_timer *t, void *privdata)
 {
-    if (list->len > 0) {
+    // MySQL 堵住时只在内存里排队，WAL 已经落盘；积压过多由 is_operlog_block 拒绝下单
+    if (list->len > 0 && job->request_count < MAX_PENDING_OPERLOG) {
         flush_log();
     }
 }
 
+static void archive_add(uint64_t id, double create_time, const char *detail, size_t len)
+{
+    struct operlog *log = malloc(sizeof(struct operlog));
+    log->id = id;
+    log->create_time = create_time;
+    log->detail = malloc(len + 1);
+    memcpy(log->detail, detail, len);
+    log->detail[len] = '\0';
+    list_add_node_tail(list, log);
+}
+
+static void wal_path(char *path, size_t size, uint64_t first_id)
+{
+    snprintf(path, size, "%s/operlog.%020"PRIu64, settings.operlog_path, first_id);
+}
+
+static int wal_id_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// 按首条 id 升序列出所有段
+static int wal_list(uint64_t **ids, size_t *num)
+{
+    *ids = NULL;
+    *num = 0;
+    DIR *dir = opendir(settings.operlog_path);
+    if (dir == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        log_error("opendir %s fail: %s", settings.operlog_path, strerror(errno));
+        return -__LINE__;
+    }
+
+    size_t cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "operlog.", 8) != 0 || strlen(ent->d_name) != 28)
+            continue;
+        char *end;
+        uint64_t id = strtoull(ent->d_name + 8, &end, 10);
+        if (*end != '\0' || id == 0)
+            continue;
+        if (*num == cap) {
+            cap = cap ? cap * 2 : 16;
+            *ids = realloc(*ids, cap * sizeof(uint64_t));
+        }
+        (*ids)[(*num)++] = id;
+    }
+    closedir(dir);
+
+    if (*num > 1)
+        qsort(*ids, *num, sizeof(uint64_t), wal_id_compare);
+    return 0;
+}
+
+uint64_t operlog_wal_first_id(void)
+{
+    uint64_t *ids;
+    size_t num;
+    if (wal_list(&ids, &num) < 0 || num == 0)
+        return 0;
+    uint64_t first = ids[0];
+    free(ids);
+    return first;
+}
+
+// 分块顺序读，缓冲区只需容纳一条最大记录
+struct wal_reader {
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t pos;
+    size_t end;
+    size_t offset;  // buf[pos] 在文件中的偏移
+    bool eof;
+};
+
+# define WAL_READ_CHUNK     (4 * 1024 * 1024)
+
+// 保证至少有 need 字节可读，不足说明到了文件尾
+static int wal_reader_fill(struct wal_reader *rd, size_t need)
+{
+    while (rd->end - rd->pos < need && !rd->eof) {
+        if (rd->pos > 0) {
+            memmove(rd->buf, rd->buf + rd->pos, rd->end - rd->pos);
+            rd->end -= rd->pos;
+            rd->pos = 0;
+        }
+        if (rd->cap < need || rd->cap - rd->end < WAL_READ_CHUNK / 2) {
+            size_t cap = rd->cap ? rd->cap : WAL_READ_CHUNK;
+            while (cap < need || cap - rd->end < WAL_READ_CHUNK / 2)
+                cap *= 2;
+            char *buf = realloc(rd->buf, cap);
+            if (buf == NULL)
+                return -__LINE__;
+            rd->buf = buf;
+            rd->cap = cap;
+        }
+        ssize_t n = read(rd->fd, rd->buf + rd->end, rd->cap - rd->end);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            log_error("read wal fail: %s", strerror(errno));
+            return -__LINE__;
+        }
+        if (n == 0)
+            rd->eof = true;
+        rd->end += n;
+    }
+    return 0;
+}
+
+static void wal_reader_skip(struct wal_reader *rd, size_t len)
+{
+    rd->pos += len;
+    rd->offset += len;
+}
+
+// 回放一个段中 id > *start_id 的记录，返回有效长度；只有最后一个段允许有不完整的尾部
+static int wal_load_segment(uint64_t first_id, bool last, uint64_t *start_id, operlog_apply_fn apply, size_t *valid_len)
+{
+    char path[PATH_MAX];
+    wal_path(path, sizeof(path), first_id);
+    log_stderr("load oper log from: %s", path);
+
+    struct wal_reader rd;
+    memset(&rd, 0, sizeof(rd));
+    rd.fd = open(path, O_RDONLY);
+    if (rd.fd < 0) {
+        log_error("open %s fail: %s", path, strerror(errno));
+        return -__LINE__;
+    }
+
+    int ret = wal_reader_fill(&rd, WAL_MAGIC_LEN);
+    if (ret < 0)
+        goto cleanup;
+    if (rd.end - rd.pos < WAL_MAGIC_LEN || memcmp(rd.buf + rd.pos, WAL_MAGIC, WAL_MAGIC_LEN) != 0) {
+        if (last && rd.end - rd.pos < WAL_MAGIC_LEN) {
+            *valid_len = 0;
+            goto cleanup;
+        }
+        log_error("invalid wal segment: %s", path);
+        ret = -__LINE__;
+        goto cleanup;
+    }
+    wal_reader_skip(&rd, WAL_MAGIC_LEN);
+
+    bool torn = false;
+    while (true) {
+        if ((ret = wal_reader_fill(&rd, WAL_HEAD_LEN)) < 0)
+            goto cleanup;
+        size_t avail = rd.end - rd.pos;
+        if (avail == 0)
+            break;
+        if (avail < WAL_HEAD_LEN) {
+            torn = true;
+            break;
+        }
+
+        uint32_t len, crc;
+        uint64_t id;
+        double create_time;
+        const char *p = rd.buf + rd.pos;
+        memcpy(&len, p, 4);
+        memcpy(&crc, p + 4, 4);
+        memcpy(&id, p + 8, 8);
+        memcpy(&create_time, p + 16, 8);
+        if (len > WAL_RECORD_MAX) {
+            torn = true;
+            break;
+        }
+        if ((ret = wal_reader_fill(&rd, WAL_HEAD_LEN + len)) < 0)
+            goto cleanup;
+        if (rd.end - rd.pos < WAL_HEAD_LEN + len) {
+            torn = true;
+            break;
+        }
+        p = rd.buf + rd.pos;
+        if (generate_crc32c(p + 8, WAL_HEAD_LEN - 8 + len) != crc) {
+            torn = true;
+            break;
+        }
+
+        if (id > *start_id) {
+            if (id != *start_id + 1) {
+                log_error("invalid id: %"PRIu64", last id: %"PRIu64"", id, *start_id);
+                ret = -__LINE__;
+                goto cleanup;
+            }
+            ret = apply(id, create_time, p + WAL_HEAD_LEN, len);
+            if (ret < 0) {
+                log_error("apply oper log: %"PRIu64" fail: %d", id, ret);
+                goto cleanup;
+            }
+            if ((ret = init_list()) < 0)
+                goto cleanup;
+            archive_add(id, create_time, p + WAL_HEAD_LEN, len);
+            *start_id = id;
+        }
+        wal_reader_skip(&rd, WAL_HEAD_LEN + len);
+    }
+
+    if (torn) {
+        if (!last) {
+            log_error("corrupted wal segment: %s at %zu", path, rd.offset);
+            ret = -__LINE__;
+            goto cleanup;
+        }
+        log_error("wal segment: %s truncated at %zu", path, rd.offset);
+    }
+    *valid_len = rd.offset;
+
+cleanup:
+    free(rd.buf);
+    close(rd.fd);
+    return ret;
+}
+
+int load_operlog_from_wal(uint64_t *start_id, operlog_apply_fn apply)
+{
+    uint64_t *ids;
+    size_t num;
+    ERR_RET(wal_list(&ids, &num));
+
+    for (size_t i = 0; i < num; ++i) {
+        // 整段都已包含在快照里
+        if (i + 1 < num && ids[i + 1] <= *start_id + 1)
+            continue;
+        size_t valid_len = 0;
+        int ret = wal_load_segment(ids[i], i + 1 == num, start_id, apply, &valid_len);
+        if (ret < 0) {
+            free(ids);
+            return ret;
+        }
+        if (i + 1 == num) {
+            wal_tail_id = ids[i];
+            wal_tail_len = valid_len;
+        }
+    }
+
+    free(ids);
+    return 0;
+}
+
+static int wal_create(uint64_t first_id)
+{
+    char path[PATH_MAX];
+    wal_path(path, sizeof(path), first_id);
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    if (fd < 0) {
+        log_fatal("create wal %s fail: %s", path, strerror(errno));
+        return -__LINE__;
+    }
+    if (write(fd, WAL_MAGIC, WAL_MAGIC_LEN) != WAL_MAGIC_LEN) {
+        log_fatal("write wal %s fail: %s", path, strerror(errno));
+        close(fd);
+        return -__LINE__;
+    }
+
+    if (wal_fd >= 0)
+        close(wal_fd);
+    wal_fd = fd;
+    wal_size = WAL_MAGIC_LEN;
+    log_info("wal segment: %s", path);
+    return 0;
+}
+
+// 只删除整段都已包含在最旧的本地快照里的段，任何留存的快照都能只靠 WAL 补齐
+static void wal_prune(void)
+{
+    uint64_t oper_id = snapshot_oldest_oper_id();
+    if (oper_id == 0)
+        return;
+
+    uint64_t *ids;
+    size_t num;
+    if (wal_list(&ids, &num) < 0)
+        return;
+
+    for (size_t i = 0; i + 1 < num; ++i) {
+        // 下一段的首条 id 之前都在本段
+        if (ids[i + 1] > oper_id + 1)
+            break;
+        char path[PATH_MAX];
+        wal_path(path, sizeof(path), ids[i]);
+        if (unlink(path) == 0) {
+            log_info("remove wal segment: %s", path);
+        }
+    }
+    free(ids);
+}
+
+static int wal_open(void)
+{
+    if (mkdir(settings.operlog_path, 0755) < 0 && errno != EEXIST) {
+        log_error("mkdir %s fail: %s", settings.operlog_path, strerror(errno));
+        return -__LINE__;
+    }
+
+    uint64_t *ids;
+    size_t num;
+    ERR_RET(wal_list(&ids, &num));
+    if (num == 0) {
+        free(ids);
+        return wal_create(operlog_id_start + 1);
+    }
+
+    uint64_t last = ids[num - 1];
+    free(ids);
+    if (last != wal_tail_id) {
+        log_error("wal segment %"PRIu64" not loaded", last);
+        return -__LINE__;
+    }
+
+    char path[PATH_MAX];
+    wal_path(path, sizeof(path), last);
+    if (wal_tail_len < WAL_MAGIC_LEN) {
+        unlink(path);
+        return wal_create(operlog_id_start + 1);
+    }
+
+    int fd = open(path, O_WRONLY | O_APPEND);
+    if (fd < 0) {
+        log_error("open wal %s fail: %s", path, strerror(errno));
+        return -__LINE__;
+    }
+    if (ftruncate(fd, wal_tail_len) < 0) {
+        log_error("truncate wal %s fail: %s", path, strerror(errno));
+        close(fd);
+        return -__LINE__;
+    }
+    wal_fd = fd;
+    wal_size = wal_tail_len;
+    return 0;
+}
+
+// fdatasync 失败的段不再追加，从缓冲中第一条记录开始建新段，新段建好才解除阻塞
+static int wal_roll(void)
+{
+    uint64_t first_id = operlog_id_start + 1;
+    if (wal_buf_len >= WAL_HEAD_LEN)
+        memcpy(&first_id, wal_buf + 8, 8);
+    ERR_RET(wal_create(first_id));
+    log_error("wal roll to segment %"PRIu64" after fdatasync fail", first_id);
+    wal_sync_fail = false;
+    return 0;
+}
+
+static int wal_flush(void)
+{
+    if (wal_sync_fail && wal_roll() < 0)
+        return -__LINE__;
+    if (wal_buf_len == 0) {
+        wal_fail = false;
+        return 0;
+    }
+
+    size_t off = 0;
+    while (off < wal_buf_len) {
+        ssize_t n = write(wal_fd, wal_buf + off, wal_buf_len - off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            log_fatal("write wal fail: %s", strerror(errno));
+            // 已写入的部分从缓冲中去掉，剩下的下次重试
+            memmove(wal_buf, wal_buf + off, wal_buf_len - off);
+            wal_buf_len -= off;
+            wal_size += off;
+            wal_fail = true;
+            return -__LINE__;
+        }
+        off += n;
+    }
+    wal_size += wal_buf_len;
+    wal_buf_len = 0;
+
+    if (settings.operlog_fsync && fdatasync(wal_fd) < 0) {
+        log_fatal("fdatasync wal fail: %s", strerror(errno));
+        wal_fail = true;
+        wal_sync_fail = true;
+        return -__LINE__;
+    }
+    wal_fail = false;
+    return 0;
+}
+
+static void on_wal_timer(nw_timer *t, void *privdata)
+{
+    if (wal_buf_len == 0 && !wal_fail)
+        return;
+    if (wal_flush() < 0)
+        return;
+
+    if (wal_size >= (size_t)settings.operlog_segment_size * 1024 * 1024) {
+        if (wal_create(operlog_id_start + 1) == 0)
+            wal_prune();
+    }
+}
+
+static void wal_append(uint64_t id, double create_time, const char *detail, size_t len)
+{
+    size_t need = wal_buf_len + WAL_HEAD_LEN + len;
+    if (need > wal_buf_cap) {
+        wal_buf_cap = wal_buf_cap ? wal_buf_cap : 64 * 1024;
+        while (wal_buf_cap < need)
+            wal_buf_cap *= 2;
+        wal_buf = realloc(wal_buf, wal_buf_cap);
+    }
+
+    char *p = wal_buf + wal_buf_len;
+    uint32_t len32 = len;
+    memcpy(p, &len32, 4);
+    memcpy(p + 8, &id, 8);
+    memcpy(p + 16, &create_time, 8);
+    memcpy(p + WAL_HEAD_LEN, detail, len);
+    uint32_t crc = generate_crc32c(p + 8, WAL_HEAD_LEN - 8 + len);
+    memcpy(p + 4, &crc, 4);
+    wal_buf_len = need;
+
+    if (wal_buf_len >= WAL_FLUSH_SIZE)
+        wal_flush();
+}
+
 int init_operlog(void)
 {
     mysql_conn = mysql_init(NULL);
@@ -123,22 +619,30 @@ int init_operlog(void)
     if (job == NULL)
         return -__LINE__;
 
-    list_type lt;
-    memset(&lt, 0, sizeof(lt));
-    lt.free = on_list_free;
-    list = list_create(&lt);
-    if (list == NULL)
-        return -__LINE__;
+    ERR_RET(init_list());
+    ERR_RET(wal_open());
 
     nw_timer_set(&timer, 0.1, true, on_timer, NULL);
     nw_timer_start(&timer);
 
+    nw_timer_set(&wal_timer, settings.operlog_sync_interval, true, on_wal_timer, NULL);
+    nw_timer_start(&wal_timer);
+
     return 0;
 }
 
 int fini_operlog(void)
 {
-    on_timer(NULL, NULL);
+    wal_flush();
+    if (wal_fd >= 0) {
+        fsync(wal_fd);
+        close(wal_fd);
+        wal_fd = -1;
+    }
+
+    while (list->len > 0) {
+        flush_log();
+    }
 
     usleep(100 * 1000);
     nw_job_release(job);
@@ -155,25 +659,39 @@ int append_operlog(const char *method, json_t *params)
     struct operlog *log = malloc(sizeof(struct operlog));
     log->id = ++operlog_id_start;
     log->create_time = current_timestamp();
-    log->detail = json_dumps(detail, JSON_SORT_KEYS);
+    log->detail = json_dumps(detail, JSON_COMPACT);
     json_decref(detail);
+
+    wal_append(log->id, log->create_time, log->detail, strlen(log->detail));
+    repl_publish(log->id, log->create_time, log->detail, strlen(log->detail));
     list_add_node_tail(list, log);
     log_debug("add log: %s", log->detail);
 
     return 0;
 }
 
+// 备机应用主机的记录，id 沿用主机的；MySQL 归档由主机负责
+int append_operlog_raw(uint64_t id, double create_time, const char *detail, size_t len)
+{
+    if (id != operlog_id_start + 1)
+        return -__LINE__;
+    operlog_id_start = id;
+    wal_append(id, create_time, detail, len);
+    repl_publish(id, create_time, detail, len);
+    return 0;
+}
+
+// WAL 写不进去，或 MySQL 归档积压超过上限时拒绝新的交易请求
 bool is_operlog_block(void)
 {
-    if (job->request_count >= MAX_PENDING_OPERLOG)
-        return true;
-    return false;
+    return wal_fail || list->len >= MAX_ARCHIVE_OPERLOG;
 }
 
 sds operlog_status(sds reply)
 {
     reply = sdscatprintf(reply, "operlog last ID: %"PRIu64"\n", operlog_id_start);
+    reply = sdscatprintf(reply, "operlog wal size: %zu, buffered: %zu, fail: %d\n", wal_size, wal_buf_len, wal_fail);
+    reply = sdscatprintf(reply, "operlog archive queue: %lu\n", list->len);
     reply = sdscatprintf(reply, "operlog pending: %d\n", job->request_count);
     return reply;
 }
-
@@ -5,10 +5,17 @@
 
 extern uint64_t operlog_id_start;
 
+// 回放一条 operlog，detail 为 {"method":..., "params":[...]}
+typedef int (*operlog_apply_fn)(uint64_t id, double create_time, const char *detail, size_t len);
+
 int init_operlog(void);
 int fini_operlog(void);
 
 int append_operlog(const char *method, json_t *params);
+int append_operlog_raw(uint64_t id, double create_time, const char *detail, size_t len);
+
+uint64_t operlog_wal_first_id(void);
+int load_operlog_from_wal(uint64_t *start_id, operlog_apply_fn apply);
 
 bool is_operlog_block(void);
 sds operlog_status(sds reply);
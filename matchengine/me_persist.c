@@ -1,12 +1,19 @@
+# include <fcntl.h>
+
 # include "me_config.h"
 # include "me_persist.h"
 # include "me_operlog.h"
 # include "me_market.h"
 # include "me_load.h"
 # include "me_dump.h"
+# include "me_replay.h"
+# include "me_snapshot.h"
+# include "me_digest.h"
+# include "me_repl.h"
 
 static time_t last_slice_time;
 static nw_timer timer;
+static int slice_fd = -1;   // 子进程写完本地快照后通过管道回报结果
 
 static time_t get_today_start(void)
 {
@@ -54,40 +61,20 @@ static int get_last_slice(MYSQL *conn, time_t *timestamp, uint64_t *last_oper_id
 
 static int load_slice_from_db(MYSQL *conn, time_t timestamp)
 {
-    sds table = sdsempty();
-
-    table = sdscatprintf(table, "slice_balance_%ld", timestamp);
-    log_stderr("load balance from: %s", table);
-//    ret = load_balance(conn, table);
-    int ret = load_balance_v2(conn, table);
+    sds balance_table = sdscatprintf(sdsempty(), "slice_balance_%ld", timestamp);
+    sds position_table = sdscatprintf(sdsempty(), "slice_position_%ld", timestamp);
+    sds limit_table = sdscatprintf(sdsempty(), "slice_limit_%ld", timestamp);
+    log_stderr("load slice from: %s %s %s", balance_table, position_table, limit_table);
+    int ret = load_slice_tables(conn, balance_table, position_table, limit_table);
     if (ret < 0) {
-        log_error("load_balance from %s fail: %d", table, ret);
-        log_stderr("load_balance from %s fail: %d", table, ret);
-        sdsfree(table);
-        return -__LINE__;
+        log_error("load_slice_tables of %ld fail: %d", timestamp, ret);
+        log_stderr("load_slice_tables of %ld fail: %d", timestamp, ret);
     }
-
-    sdsclear(table);
-    table = sdscatprintf(table, "slice_position_%ld", timestamp);
-    log_stderr("load positions from: %s", table);
-    ret = load_positions(conn, table);
-    if (ret < 0) {
-        log_error("load_positions from %s fail: %d", table, ret);
-        log_stderr("load_positions from %s fail: %d", table, ret);
-        sdsfree(table);
+    sdsfree(balance_table);
+    sdsfree(position_table);
+    sdsfree(limit_table);
+    if (ret < 0)
         return -__LINE__;
-    }
-
-    sdsclear(table);
-    table = sdscatprintf(table, "slice_limit_%ld", timestamp);
-    log_stderr("load limits from: %s", table);
-    ret = load_limits(conn, table);
-    if (ret < 0) {
-        log_error("load_limits from %s fail: %d", table, ret);
-        log_stderr("load_limits from %s fail: %d", table, ret);
-        sdsfree(table);
-        return -__LINE__;
-    }
 
 /*
     sdsclear(table);
@@ -102,7 +89,6 @@ static int load_slice_from_db(MYSQL *conn, time_t timestamp)
     }
 */
 
-    sdsfree(table);
     return 0;
 }
 
@@ -154,20 +140,45 @@ int init_from_db(void)
     log_stderr("last_slice_time: %ld, last_oper_id: %"PRIu64", last_order_id: %"PRIu64", last_deals_id: %"PRIu64,
             last_slice_time, last_oper_id, last_order_id, last_deals_id);
 
-    order_id_start = last_order_id;
-    deals_id_start = last_deals_id;
-
-    if (last_slice_time == 0) {
-        ret = load_operlog_from_db(conn, now, &last_oper_id);
-        if (ret < 0)
-            goto cleanup;
-    } else {
+    // 优先用不早于 MySQL 切片的本地快照
+    struct snapshot_meta meta;
+    ret = snapshot_load_latest(last_slice_time, &meta);
+    if (ret < 0) {
+        log_error("snapshot_load_latest fail: %d", ret);
+        log_stderr("snapshot_load_latest fail: %d", ret);
+        goto cleanup;
+    }
+    if (meta.time != 0) {
+        last_slice_time = meta.time;
+        last_oper_id  = meta.end_oper_id;
+        last_order_id = meta.end_order_id;
+        last_deals_id = meta.end_deals_id;
+        log_info("load from snapshot: %ld, delta: %u, last_oper_id: %"PRIu64", last_order_id: %"PRIu64", last_deals_id: %"PRIu64,
+                last_slice_time, meta.delta_seq, last_oper_id, last_order_id, last_deals_id);
+    } else if (last_slice_time != 0) {
         ret = load_slice_from_db(conn, last_slice_time);
         if (ret < 0) {
             goto cleanup;
         }
+    }
+
+    order_id_start = last_order_id;
+    deals_id_start = last_deals_id;
 
-        time_t begin = last_slice_time;
+    // 快照加载不逐条标记账户，重算一次后与快照记录的摘要比较
+    ret = digest_rebuild();
+    if (ret < 0) {
+        log_error("digest_rebuild fail: %d", ret);
+        goto cleanup;
+    }
+    if (meta.time != 0 && meta.digest != 0) {
+        digest_verify("snapshot", meta.digest);
+    }
+
+    // 本地 WAL 接不上快照时(首次启用或段已清理)，先从 MySQL 归档补齐
+    uint64_t wal_first_id = operlog_wal_first_id();
+    if (wal_first_id == 0 || wal_first_id > last_oper_id + 1) {
+        time_t begin = last_slice_time ? last_slice_time : now;
         time_t end = get_today_start() + 86400;
         while (begin < end) {
             ret = load_operlog_from_db(conn, begin, &last_oper_id);
@@ -178,6 +189,13 @@ int init_from_db(void)
         }
     }
 
+    ret = replay_wal(&last_oper_id);
+    if (ret < 0) {
+        log_error("replay_wal fail: %d", ret);
+        log_stderr("replay_wal fail: %d", ret);
+        goto cleanup;
+    }
+
     operlog_id_start = last_oper_id;
 
     mysql_close(conn);
@@ -440,31 +458,82 @@ cleanup:
 
 int make_slice(time_t timestamp)
 {
+    if (slice_fd >= 0) {
+        log_error("last slice not finished, skip: %ld", timestamp);
+        return -__LINE__;
+    }
+
+    // 备机的 MySQL 切片表属于主机，只写本地快照
+    bool upload = settings.slice_mysql && !repl_is_standby();
+    int fds[2];
+    if (pipe(fds) < 0) {
+        log_fatal("pipe fail: %s", strerror(errno));
+        return -__LINE__;
+    }
     int pid = fork();
     if (pid < 0) {
         log_fatal("fork fail: %d", pid);
+        close(fds[0]);
+        close(fds[1]);
         return -__LINE__;
     } else if (pid > 0) {
+        // 子进程写的是 fork 时刻的全量，之后的变化先另记，写成功后才切到新的增量链
+        close(fds[1]);
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        slice_fd = fds[0];
+        snapshot_checkpoint_begin(timestamp);
         return 0;
     }
 
+    close(fds[0]);
     int ret;
-    ret = dump_to_db(timestamp);
+    ret = snapshot_dump(timestamp);
+    char result = ret < 0 ? 1 : 0;
+    if (write(fds[1], &result, 1) != 1) {
+        log_error("report slice result fail: %s", strerror(errno));
+    }
+    close(fds[1]);
     if (ret < 0) {
-        log_fatal("dump_to_db fail: %d", ret);
+        log_fatal("snapshot_dump fail: %d", ret);
+    } else {
+        snapshot_clear(timestamp);
     }
 
-    ret = clear_slice(timestamp);
-    if (ret < 0) {
-        log_fatal("clear_slice fail: %d", ret);
+    // 本地快照落盘后再上传 MySQL，可关闭
+    if (upload) {
+        ret = dump_to_db(timestamp);
+        if (ret < 0) {
+            log_fatal("dump_to_db fail: %d", ret);
+        }
+
+        ret = clear_slice(timestamp);
+        if (ret < 0) {
+            log_fatal("clear_slice fail: %d", ret);
+        }
     }
 
     exit(0);
     return 0;
 }
 
+// 子进程没写结果就退出也算失败
+static void check_slice(void)
+{
+    if (slice_fd < 0)
+        return;
+    char result;
+    ssize_t n = read(slice_fd, &result, 1);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    snapshot_checkpoint_end(n == 1 && result == 0);
+    close(slice_fd);
+    slice_fd = -1;
+}
+
 static void on_timer(nw_timer *timer, void *privdata)
 {
+    check_slice();
+
     time_t now = time(NULL);
     struct tm *lt = localtime(&now);
     // 周二到周六0点要计算隔夜费,不在0点备份
@@ -0,0 +1,464 @@
+# include "me_repl.h"
+# include "me_load.h"
+# include "me_operlog.h"
+
+# define REPL_FEED_INTERVAL     0.05
+# define REPL_STATUS_INTERVAL   1.0
+
+struct repl_record {
+    uint64_t        id;
+    double          time;
+    sds             detail;
+};
+
+// 一个备机连接，live 之前由定时器从环里补齐
+struct repl_sub {
+    nw_ses          *ses;
+    uint64_t        next_id;
+    bool            live;
+};
+
+static rpc_svr *svr;
+static list_t *subs;
+static struct repl_record *backlog;
+static size_t backlog_cap;
+static nw_timer feed_timer;
+static double last_status;
+
+static rpc_clt *master;
+static nw_timer clt_timer;
+static bool standby;
+static bool broken;
+static bool resync;
+static uint64_t master_last_id;
+static double last_record_time;
+static double last_recv;
+static double synced_time;
+static int (*promote_cb)(void);
+
+static void backlog_add(uint64_t id, double create_time, const char *detail, size_t len)
+{
+    if (backlog == NULL) {
+        backlog_cap = settings.repl_backlog > 0 ? settings.repl_backlog : 100000;
+        backlog = calloc(backlog_cap, sizeof(struct repl_record));
+    }
+    struct repl_record *r = &backlog[id % backlog_cap];
+    r->id = id;
+    r->time = create_time;
+    r->detail = r->detail ? sdscpylen(r->detail, detail, len) : sdsnewlen(detail, len);
+}
+
+static struct repl_record *backlog_get(uint64_t id)
+{
+    struct repl_record *r = &backlog[id % backlog_cap];
+    return r->id == id ? r : NULL;
+}
+
+static int send_record(nw_ses *ses, struct repl_record *r)
+{
+    size_t len = 24 + sdslen(r->detail);
+    char *body = malloc(len);
+    memcpy(body, &r->id, 8);
+    memcpy(body + 8, &r->time, 8);
+    memcpy(body + 16, &operlog_id_start, 8);
+    memcpy(body + 24, r->detail, sdslen(r->detail));
+
+    rpc_pkg pkg;
+    memset(&pkg, 0, sizeof(pkg));
+    pkg.pkg_type = RPC_PKG_TYPE_PUSH;
+    pkg.command = CMD_REPL_RECORD;
+    pkg.body = body;
+    pkg.body_size = len;
+    int ret = rpc_send(ses, &pkg);
+    free(body);
+    return ret;
+}
+
+// 写缓冲用到一半就停下，留给定时器继续，不会因为缓冲满被断开
+static bool sub_busy(struct repl_sub *sub)
+{
+    nw_buf_list *buf = sub->ses->write_buf;
+    return buf->limit && buf->count * 2 >= buf->limit;
+}
+
+static int sub_feed(struct repl_sub *sub)
+{
+    while (sub->next_id <= operlog_id_start) {
+        if (sub_busy(sub))
+            return 0;
+        struct repl_record *r = backlog_get(sub->next_id);
+        if (r == NULL) {
+            log_error("repl peer: %s, record: %"PRIu64" out of backlog", nw_sock_human_addr(&sub->ses->peer_addr), sub->next_id);
+            return -__LINE__;
+        }
+        ERR_RET_LN(send_record(sub->ses, r));
+        sub->next_id++;
+    }
+    sub->live = true;
+    return 0;
+}
+
+static void sub_remove(nw_ses *ses)
+{
+    list_node *node;
+    list_iter *iter = list_get_iterator(subs, LIST_START_HEAD);
+    while ((node = list_next(iter)) != NULL) {
+        struct repl_sub *sub = node->value;
+        if (sub->ses == ses) {
+            list_del(subs, node);
+            break;
+        }
+    }
+    list_release_iterator(iter);
+}
+
+static void send_status(nw_ses *ses)
+{
+    char body[16];
+    double now = current_timestamp();
+    memcpy(body, &operlog_id_start, 8);
+    memcpy(body + 8, &now, 8);
+
+    rpc_pkg pkg;
+    memset(&pkg, 0, sizeof(pkg));
+    pkg.pkg_type = RPC_PKG_TYPE_PUSH;
+    pkg.command = CMD_REPL_STATUS;
+    pkg.body = body;
+    pkg.body_size = sizeof(body);
+    rpc_send(ses, &pkg);
+}
+
+static void on_feed_timer(nw_timer *timer, void *privdata)
+{
+    bool status = current_timestamp() - last_status >= REPL_STATUS_INTERVAL;
+    if (status)
+        last_status = current_timestamp();
+
+    list_node *node;
+    list_iter *iter = list_get_iterator(subs, LIST_START_HEAD);
+    while ((node = list_next(iter)) != NULL) {
+        struct repl_sub *sub = node->value;
+        if (!sub->live && sub_feed(sub) < 0) {
+            // 关闭连接会回调 sub_remove
+            rpc_svr_close_clt(svr, sub->ses);
+            continue;
+        }
+        if (status && !sub_busy(sub))
+            send_status(sub->ses);
+    }
+    list_release_iterator(iter);
+}
+
+static void reply_sync(nw_ses *ses, rpc_pkg *pkg, uint32_t result, const char *message)
+{
+    rpc_pkg reply;
+    memcpy(&reply, pkg, sizeof(reply));
+    reply.pkg_type = RPC_PKG_TYPE_REPLY;
+    reply.result = result;
+    reply.body = (void *)message;
+    reply.body_size = strlen(message);
+    rpc_send(ses, &reply);
+}
+
+static void on_sync(nw_ses *ses, rpc_pkg *pkg)
+{
+    uint64_t last_id;
+    if (pkg->body_size != 8) {
+        reply_sync(ses, pkg, 1, "invalid argument");
+        return;
+    }
+    memcpy(&last_id, pkg->body, 8);
+    if (last_id > operlog_id_start) {
+        log_error("repl peer: %s ahead of master, last id: %"PRIu64", master: %"PRIu64,
+                nw_sock_human_addr(&ses->peer_addr), last_id, operlog_id_start);
+        reply_sync(ses, pkg, 2, "standby ahead of master");
+        return;
+    }
+    if (last_id < operlog_id_start && backlog_get(last_id + 1) == NULL) {
+        log_error("repl peer: %s, last id: %"PRIu64" out of backlog", nw_sock_human_addr(&ses->peer_addr), last_id);
+        reply_sync(ses, pkg, 3, "out of backlog, reload from a newer slice");
+        return;
+    }
+
+    sub_remove(ses);
+    struct repl_sub *sub = malloc(sizeof(struct repl_sub));
+    sub->ses = ses;
+    sub->next_id = last_id + 1;
+    sub->live = false;
+    list_add_node_tail(subs, sub);
+    reply_sync(ses, pkg, 0, "");
+    log_info("repl peer: %s sync from: %"PRIu64", master: %"PRIu64, nw_sock_human_addr(&ses->peer_addr), last_id, operlog_id_start);
+}
+
+static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
+{
+    switch (pkg->command) {
+    case CMD_REPL_SYNC:
+        on_sync(ses, pkg);
+        break;
+    default:
+        log_error("repl peer: %s, unknown command: %u", nw_sock_human_addr(&ses->peer_addr), pkg->command);
+        break;
+    }
+}
+
+static void svr_on_connection_close(nw_ses *ses)
+{
+    log_info("repl peer: %s close", nw_sock_human_addr(&ses->peer_addr));
+    sub_remove(ses);
+}
+
+// 启动回放时 subs 还没创建，只进环，备机重连后仍可从这里补齐
+void repl_publish(uint64_t id, double create_time, const char *detail, size_t len)
+{
+    if (!settings.has_repl_svr)
+        return;
+    backlog_add(id, create_time, detail, len);
+    if (subs == NULL)
+        return;
+
+    list_node *node;
+    list_iter *iter = list_get_iterator(subs, LIST_START_HEAD);
+    while ((node = list_next(iter)) != NULL) {
+        struct repl_sub *sub = node->value;
+        if (!sub->live)
+            continue;
+        if (sub_busy(sub)) {
+            // 备机跟不上，退回补齐模式
+            sub->live = false;
+            sub->next_id = id;
+            continue;
+        }
+        send_record(sub->ses, backlog_get(id));
+    }
+    list_release_iterator(iter);
+}
+
+static void on_sub_free(void *value)
+{
+    free(value);
+}
+
+static int init_repl_svr(void)
+{
+    list_type lt;
+    memset(&lt, 0, sizeof(lt));
+    lt.free = on_sub_free;
+    subs = list_create(&lt);
+    if (subs == NULL)
+        return -__LINE__;
+
+    rpc_svr_type type;
+    memset(&type, 0, sizeof(type));
+    type.on_recv_pkg = svr_on_recv_pkg;
+    type.on_connection_close = svr_on_connection_close;
+
+    svr = rpc_svr_create(&settings.repl_svr, &type);
+    if (svr == NULL)
+        return -__LINE__;
+    if (rpc_svr_start(svr) < 0)
+        return -__LINE__;
+
+    nw_timer_set(&feed_timer, REPL_FEED_INTERVAL, true, on_feed_timer, NULL);
+    nw_timer_start(&feed_timer);
+
+    return 0;
+}
+
+// 备机: 顺序应用主机推来的记录，与启动回放走同一个 load_oper
+static int apply_record(rpc_pkg *pkg)
+{
+    if (pkg->body_size < 24)
+        return -__LINE__;
+    uint64_t id;
+    double create_time;
+    memcpy(&id, pkg->body, 8);
+    memcpy(&create_time, pkg->body + 8, 8);
+    memcpy(&master_last_id, pkg->body + 16, 8);
+    const char *data = pkg->body + 24;
+    size_t len = pkg->body_size - 24;
+
+    if (id <= operlog_id_start)
+        return 0;
+    if (id != operlog_id_start + 1) {
+        log_error("repl record id: %"PRIu64" not continuous, last id: %"PRIu64, id, operlog_id_start);
+        return -__LINE__;
+    }
+
+    json_t *detail = json_loadb(data, len, 0, NULL);
+    if (detail == NULL) {
+        log_error("repl record: %"PRIu64" invalid detail", id);
+        return -__LINE__;
+    }
+    int ret = load_oper(detail);
+    json_decref(detail);
+    if (ret < 0) {
+        log_fatal("repl load_oper: %"PRIu64":%.*s fail: %d", id, (int)len, data, ret);
+        broken = true;
+        return -__LINE__;
+    }
+
+    append_operlog_raw(id, create_time, data, len);
+    last_record_time = create_time;
+    return 0;
+}
+
+static void send_sync(nw_ses *ses)
+{
+    rpc_pkg pkg;
+    memset(&pkg, 0, sizeof(pkg));
+    pkg.pkg_type = RPC_PKG_TYPE_REQUEST;
+    pkg.command = CMD_REPL_SYNC;
+    pkg.body = &operlog_id_start;
+    pkg.body_size = 8;
+    rpc_send(ses, &pkg);
+}
+
+static void on_master_connect(nw_ses *ses, bool result)
+{
+    if (!result) {
+        log_error("connect repl master: %s fail", nw_sock_human_addr(&ses->peer_addr));
+        return;
+    }
+    log_info("connect repl master: %s success, sync from: %"PRIu64, nw_sock_human_addr(&ses->peer_addr), operlog_id_start);
+    send_sync(ses);
+}
+
+// 回调里不能关闭连接，交给定时器处理
+static void on_master_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
+{
+    if (broken || resync)
+        return;
+    last_recv = current_timestamp();
+
+    switch (pkg->command) {
+    case CMD_REPL_SYNC:
+        if (pkg->result != 0) {
+            log_fatal("repl sync from master fail: %u %.*s", pkg->result, (int)pkg->body_size, (char *)pkg->body);
+            broken = true;
+        }
+        break;
+    case CMD_REPL_RECORD:
+        // 重连后按本地最后 id 重新同步；状态已不一致时停止复制
+        if (apply_record(pkg) < 0)
+            resync = true;
+        break;
+    case CMD_REPL_STATUS:
+        if (pkg->body_size == 16)
+            memcpy(&master_last_id, pkg->body, 8);
+        break;
+    default:
+        break;
+    }
+    if (!broken && !resync && operlog_id_start >= master_last_id)
+        synced_time = last_recv;
+}
+
+static void on_clt_timer(nw_timer *timer, void *privdata)
+{
+    if (broken) {
+        rpc_clt_close(master);
+        nw_timer_stop(&clt_timer);
+    } else if (resync) {
+        rpc_clt_close(master);
+        rpc_clt_start(master);
+        resync = false;
+    }
+}
+
+static int init_repl_clt(void)
+{
+    rpc_clt_type type;
+    memset(&type, 0, sizeof(type));
+    type.on_connect = on_master_connect;
+    type.on_recv_pkg = on_master_recv_pkg;
+
+    master = rpc_clt_create(&settings.repl_master, &type);
+    if (master == NULL)
+        return -__LINE__;
+    if (rpc_clt_start(master) < 0)
+        return -__LINE__;
+
+    nw_timer_set(&clt_timer, 0.1, true, on_clt_timer, NULL);
+    nw_timer_start(&clt_timer);
+
+    return 0;
+}
+
+int init_repl(int (*on_promote)(void))
+{
+    promote_cb = on_promote;
+    standby = settings.standby;
+    master_last_id = operlog_id_start;
+
+    if (settings.has_repl_svr) {
+        ERR_RET(init_repl_svr());
+    }
+    if (standby) {
+        ERR_RET(init_repl_clt());
+    } else {
+        ERR_RET(promote_cb());
+    }
+
+    return 0;
+}
+
+bool repl_is_standby(void)
+{
+    return standby;
+}
+
+// 记录收到即应用，提升只需断开主机并启动服务，耗时取决于未收到的部分
+int repl_promote(void)
+{
+    if (!standby)
+        return -__LINE__;
+
+    log_vip("promote to master, last id: %"PRIu64", master last id: %"PRIu64, operlog_id_start, master_last_id);
+    nw_timer_stop(&clt_timer);
+    rpc_clt_close(master);
+    rpc_clt_release(master);
+    master = NULL;
+    standby = false;
+
+    int ret = promote_cb();
+    if (ret < 0) {
+        log_fatal("start service after promote fail: %d", ret);
+        return ret;
+    }
+    return 0;
+}
+
+double repl_staleness(void)
+{
+    if (!standby)
+        return 0;
+    return current_timestamp() - synced_time;
+}
+
+sds repl_status(sds reply)
+{
+    if (standby) {
+        uint64_t lag = master_last_id > operlog_id_start ? master_last_id - operlog_id_start : 0;
+        reply = sdscatprintf(reply, "repl role: standby%s, connected: %d\n", broken ? " (broken)" : "", rpc_clt_connected(master));
+        reply = sdscatprintf(reply, "repl applied id: %"PRIu64", master id: %"PRIu64", lag: %"PRIu64"\n",
+                operlog_id_start, master_last_id, lag);
+        reply = sdscatprintf(reply, "repl last record: %.3fs ago, last recv: %.3fs ago, staleness: %.3fs\n",
+                last_record_time ? current_timestamp() - last_record_time : 0, last_recv ? current_timestamp() - last_recv : 0,
+                repl_staleness());
+    } else {
+        reply = sdscatprintf(reply, "repl role: master, last id: %"PRIu64"\n", operlog_id_start);
+    }
+    if (subs) {
+        list_node *node;
+        list_iter *iter = list_get_iterator(subs, LIST_START_HEAD);
+        while ((node = list_next(iter)) != NULL) {
+            struct repl_sub *sub = node->value;
+            uint64_t sent = sub->live ? operlog_id_start : sub->next_id - 1;
+            reply = sdscatprintf(reply, "repl standby: %s, sent: %"PRIu64", live: %d, buffered: %u\n",
+                    nw_sock_human_addr(&sub->ses->peer_addr), sent, sub->live, sub->ses->write_buf->count);
+        }
+        list_release_iterator(iter);
+    }
+    return reply;
+}
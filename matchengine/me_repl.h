@@ -0,0 +1,26 @@
+# ifndef _ME_REPL_H_
+# define _ME_REPL_H_
+
+# include "me_config.h"
+
+/*
+ * operlog 流复制
+ *
+ * 主机在 repl_svr 上把追加的 operlog 按 id 顺序推给备机，最近 repl_backlog 条保存在内存环里，
+ * 备机断线重连后从环里补齐。备机(配置了 repl_master)通过 load_oper 实时应用并写入本地 WAL，
+ * 不对外提供交易服务，提升后才启动。配置 follower 的备机提前启动 rpc 服务，只应答查询。
+ */
+
+// on_promote 启动只在主机上运行的服务
+int init_repl(int (*on_promote)(void));
+bool repl_is_standby(void);
+int repl_promote(void);
+// 备机状态落后主机的秒数: 距最后一次确认已追上主机的时间，主机为 0
+double repl_staleness(void);
+
+// 新的 operlog 已写入 WAL，推给备机
+void repl_publish(uint64_t id, double create_time, const char *detail, size_t len);
+
+sds repl_status(sds reply);
+
+# endif
@@ -0,0 +1,300 @@
+# include <pthread.h>
+
+# include "me_replay.h"
+# include "me_load.h"
+# include "me_repl.h"
+
+# define REPLAY_SLOTS       4096
+# define REPLAY_REPORT      100000
+
+enum {
+    SLOT_EMPTY,
+    SLOT_RAW,
+    SLOT_DECODING,
+    SLOT_READY,
+};
+
+struct replay_slot {
+    int             state;
+    uint64_t        id;
+    double          create_time;
+    char            *raw;
+    size_t          len;
+    json_t          *detail;
+};
+
+// 环形队列，seq 单调递增，slot = seq % REPLAY_SLOTS
+struct replay {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    struct replay_slot slots[REPLAY_SLOTS];
+    uint64_t        push_seq;       // 读线程下一个写入
+    uint64_t        decode_seq;     // 下一个待解码
+    uint64_t        apply_seq;      // 主线程下一个应用
+    bool            reader_done;
+    int             reader_ret;
+    bool            stop;
+
+    replay_reader_fn reader;
+    void            *privdata;
+};
+
+// 读线程只有一个，push 不需要额外参数
+static struct replay *current;
+
+static int replay_push(uint64_t id, double create_time, const char *data, size_t len)
+{
+    struct replay *r = current;
+    pthread_mutex_lock(&r->lock);
+    while (!r->stop && r->push_seq - r->apply_seq >= REPLAY_SLOTS)
+        pthread_cond_wait(&r->cond, &r->lock);
+    if (r->stop) {
+        pthread_mutex_unlock(&r->lock);
+        return -__LINE__;
+    }
+    struct replay_slot *slot = &r->slots[r->push_seq % REPLAY_SLOTS];
+    pthread_mutex_unlock(&r->lock);
+
+    // 槽位已空，只有读线程会写
+    slot->id = id;
+    slot->create_time = create_time;
+    slot->len = len;
+    slot->raw = malloc(len + 1);
+    memcpy(slot->raw, data, len);
+    slot->raw[len] = '\0';
+    slot->detail = NULL;
+
+    pthread_mutex_lock(&r->lock);
+    slot->state = SLOT_RAW;
+    r->push_seq++;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
+
+static void *reader_thread(void *arg)
+{
+    struct replay *r = arg;
+    int ret = r->reader(r->privdata, replay_push);
+
+    pthread_mutex_lock(&r->lock);
+    r->reader_done = true;
+    r->reader_ret = ret;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+static void *decode_thread(void *arg)
+{
+    struct replay *r = arg;
+    pthread_mutex_lock(&r->lock);
+    while (true) {
+        while (!r->stop && r->decode_seq == r->push_seq && !r->reader_done)
+            pthread_cond_wait(&r->cond, &r->lock);
+        if (r->stop || (r->decode_seq == r->push_seq && r->reader_done))
+            break;
+
+        struct replay_slot *slot = &r->slots[r->decode_seq % REPLAY_SLOTS];
+        r->decode_seq++;
+        slot->state = SLOT_DECODING;
+        pthread_mutex_unlock(&r->lock);
+
+        json_t *detail = json_loadb(slot->raw, slot->len, 0, NULL);
+
+        pthread_mutex_lock(&r->lock);
+        slot->detail = detail;
+        slot->state = SLOT_READY;
+        pthread_cond_broadcast(&r->cond);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+// load_oper 修改撮合状态，必须按 id 顺序在主线程执行，解码线程只做 JSON 解析
+static int replay_apply(struct replay_slot *slot, uint64_t *last_id)
+{
+    if (slot->detail == NULL) {
+        log_error("invalid detail data: %s", slot->raw);
+        return -__LINE__;
+    }
+    int ret = load_oper(slot->detail);
+    if (ret < 0) {
+        log_error("load_oper: %"PRIu64":%s fail: %d", slot->id, slot->raw, ret);
+        return -__LINE__;
+    }
+    *last_id = slot->id;
+    // 回放的记录也进复制环，主机重启后备机仍可接着同步
+    repl_publish(slot->id, slot->create_time, slot->raw, slot->len);
+    return 0;
+}
+
+static void slot_clear(struct replay_slot *slot)
+{
+    free(slot->raw);
+    slot->raw = NULL;
+    if (slot->detail) {
+        json_decref(slot->detail);
+        slot->detail = NULL;
+    }
+    slot->state = SLOT_EMPTY;
+}
+
+int replay_run(const char *name, replay_reader_fn reader, void *privdata, uint64_t *last_id)
+{
+    struct replay *r = malloc(sizeof(struct replay));
+    if (r == NULL)
+        return -__LINE__;
+    memset(r, 0, sizeof(struct replay));
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    r->reader = reader;
+    r->privdata = privdata;
+    current = r;
+
+    int thread_num = settings.replay_thread > 0 ? settings.replay_thread : 1;
+    pthread_t reader_tid;
+    pthread_t *decode_tids = malloc(sizeof(pthread_t) * thread_num);
+    if (pthread_create(&reader_tid, NULL, reader_thread, r) != 0) {
+        free(decode_tids);
+        free(r);
+        return -__LINE__;
+    }
+    int started = 0;
+    for (; started < thread_num; ++started) {
+        if (pthread_create(&decode_tids[started], NULL, decode_thread, r) != 0)
+            break;
+    }
+
+    int ret = started > 0 ? 0 : -__LINE__;
+    double begin = current_timestamp();
+    double last_report = begin;
+    uint64_t count = 0;
+
+    pthread_mutex_lock(&r->lock);
+    r->stop = (ret < 0);
+    while (!r->stop) {
+        struct replay_slot *slot = &r->slots[r->apply_seq % REPLAY_SLOTS];
+        if (r->apply_seq < r->push_seq && slot->state == SLOT_READY) {
+            pthread_mutex_unlock(&r->lock);
+            ret = replay_apply(slot, last_id);
+            slot_clear(slot);
+            pthread_mutex_lock(&r->lock);
+            if (ret < 0) {
+                r->stop = true;
+                break;
+            }
+            r->apply_seq++;
+            pthread_cond_broadcast(&r->cond);
+
+            if (++count % REPLAY_REPORT == 0) {
+                double now = current_timestamp();
+                log_stderr("replay %s: %"PRIu64" records, last id: %"PRIu64", %.0f/s",
+                        name, count, *last_id, REPLAY_REPORT / (now - last_report));
+                last_report = now;
+            }
+            continue;
+        }
+        if (r->reader_done && r->apply_seq == r->push_seq) {
+            ret = r->reader_ret;
+            break;
+        }
+        pthread_cond_wait(&r->cond, &r->lock);
+    }
+    r->stop = true;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+
+    pthread_join(reader_tid, NULL);
+    for (int i = 0; i < started; ++i)
+        pthread_join(decode_tids[i], NULL);
+    free(decode_tids);
+
+    for (size_t i = 0; i < REPLAY_SLOTS; ++i) {
+        if (r->slots[i].state != SLOT_EMPTY)
+            slot_clear(&r->slots[i]);
+    }
+    if (ret == 0 && r->reader_ret < 0)
+        ret = r->reader_ret;
+
+    double cost = current_timestamp() - begin;
+    log_info("replay %s: %"PRIu64" records in %.3fs, last id: %"PRIu64", ret: %d", name, count, cost, *last_id, ret);
+    log_stderr("replay %s: %"PRIu64" records in %.3fs, %.0f/s", name, count, cost, cost > 0 ? count / cost : 0);
+
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+    current = NULL;
+    return ret;
+}
+
+struct mysql_source {
+    const char      *table;
+    uint64_t        start_id;
+};
+
+// 独立连接，mysql_use_result 边取边交给流水线，不整表缓存
+static int mysql_reader(void *privdata, operlog_apply_fn push)
+{
+    struct mysql_source *src = privdata;
+    MYSQL *conn = mysql_connect(&settings.db_log);
+    if (conn == NULL) {
+        log_error("connect mysql fail");
+        return -__LINE__;
+    }
+
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "SELECT `id`, `time`, `detail` from `%s` WHERE `id` > %"PRIu64" ORDER BY `id`", src->table, src->start_id);
+    log_trace("exec sql: %s", sql);
+    if (mysql_real_query(conn, sql, sdslen(sql)) != 0) {
+        log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        sdsfree(sql);
+        mysql_close(conn);
+        return -__LINE__;
+    }
+    sdsfree(sql);
+
+    int ret = 0;
+    uint64_t last_id = src->start_id;
+    MYSQL_RES *result = mysql_use_result(conn);
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        unsigned long *lengths = mysql_fetch_lengths(result);
+        uint64_t id = strtoull(row[0], NULL, 0);
+        if (id != last_id + 1) {
+            log_error("invalid id: %"PRIu64", last id: %"PRIu64"", id, last_id);
+            ret = -__LINE__;
+            break;
+        }
+        last_id = id;
+        if (push(id, strtod(row[1], NULL), row[2], lengths[2]) < 0) {
+            ret = -__LINE__;
+            break;
+        }
+    }
+    if (ret == 0 && mysql_errno(conn) != 0) {
+        log_error("fetch %s fail: %d %s", src->table, mysql_errno(conn), mysql_error(conn));
+        ret = -__LINE__;
+    }
+    mysql_free_result(result);
+    mysql_close(conn);
+    return ret;
+}
+
+int replay_mysql_table(const char *table, uint64_t *start_id)
+{
+    struct mysql_source src = { .table = table, .start_id = *start_id };
+    return replay_run(table, mysql_reader, &src, start_id);
+}
+
+static int wal_reader(void *privdata, operlog_apply_fn push)
+{
+    uint64_t start_id = *(uint64_t *)privdata;
+    return load_operlog_from_wal(&start_id, push);
+}
+
+int replay_wal(uint64_t *start_id)
+{
+    uint64_t from = *start_id;
+    return replay_run("wal", wal_reader, &from, start_id);
+}
@@ -0,0 +1,17 @@
+# ifndef _ME_REPLAY_H_
+# define _ME_REPLAY_H_
+
+# include "me_config.h"
+# include "me_operlog.h"
+
+// 读线程按 id 顺序调用 push 交出原始记录，push 返回 < 0 时应停止读取
+typedef int (*replay_reader_fn)(void *privdata, operlog_apply_fn push);
+
+// 流水线回放: 读线程取数据，解码线程并行解析 JSON，主线程按顺序 load_oper
+int replay_run(const char *name, replay_reader_fn reader, void *privdata, uint64_t *last_id);
+
+int replay_mysql_table(const char *table, uint64_t *start_id);
+int replay_wal(uint64_t *start_id);
+
+# endif
+
@@ -9,6 +9,8 @@
 # include "me_message.h"
 # include "me_symbol.h"
 # include "me_tick.h"
+# include "me_repl.h"
+# include "me_digest.h"
 
 static rpc_svr *svr;
 static dict_t *dict_cache;
@@ -74,6 +76,11 @@ static int reply_error_service_unavailable(nw_ses *ses, rpc_pkg *pkg)
     return reply_error(ses, pkg, 3, "service unavailable");
 }
 
+static int reply_error_read_only(nw_ses *ses, rpc_pkg *pkg)
+{
+    return reply_error(ses, pkg, 6, "read only follower");
+}
+
 static int reply_error_market_close(nw_ses *ses, rpc_pkg *pkg)
 {
     return reply_error(ses, pkg, 20, "market is close");
@@ -214,6 +221,45 @@ static int on_cmd_tick_status(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     return ret;
 }
 
+// tick.history (symbol, start, end, limit), start / end 为毫秒，end 为 0 表示到最新
+static int on_cmd_tick_history(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+{
+    if (json_array_size(params) != 4)
+        return reply_error_invalid_argument(ses, pkg);
+
+    // symbol
+    if (!json_is_string(json_array_get(params, 0)))
+        return reply_error_invalid_argument(ses, pkg);
+    const char *symbol = json_string_value(json_array_get(params, 0));
+
+    // start
+    if (!json_is_integer(json_array_get(params, 1)))
+        return reply_error_invalid_argument(ses, pkg);
+    uint64_t start = json_integer_value(json_array_get(params, 1));
+
+    // end
+    if (!json_is_integer(json_array_get(params, 2)))
+        return reply_error_invalid_argument(ses, pkg);
+    uint64_t end = json_integer_value(json_array_get(params, 2));
+    if (end && end < start)
+        return reply_error_invalid_argument(ses, pkg);
+
+    // limit
+    if (!json_is_integer(json_array_get(params, 3)))
+        return reply_error_invalid_argument(ses, pkg);
+    size_t limit = json_integer_value(json_array_get(params, 3));
+    if (limit == 0 || limit > TICK_HISTORY_MAX_LEN)
+        return reply_error_invalid_argument(ses, pkg);
+
+    json_t *result = tick_history(symbol, start, end, limit);
+    if (result == NULL)
+        return reply_error_invalid_argument(ses, pkg);
+
+    int ret = reply_result(ses, pkg, result);
+    json_decref(result);
+    return ret;
+}
+
 // balance.query (sid)
 static int on_cmd_balance_query_v2(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 {
@@ -328,9 +374,9 @@ static int on_cmd_order_open2(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         return reply_error_invalid_argument(ses, pkg);
     const char *group = json_string_value(json_array_get(params, 1));
 
-    // get group leverage
-    int leverage = group_leverage(group);
-    if (leverage == 0)
+    // get group id and leverage
+    int gid = get_group_id(group);
+    if (gid < 0 || configs.groups[gid].leverage == 0)
         return reply_error_invalid_argument(ses, pkg);
 
     // symbol
@@ -420,16 +466,17 @@ static int on_cmd_order_open2(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         goto invalid_argument;
 
     // get symbol fee and swap
-    mpd_copy(fee, symbol_fee(group, symbol), &mpd_ctx);
+    struct fee_entry *fe = get_fee_entry(gid, market->sym->id);
+    mpd_copy(fee, fe->fee, &mpd_ctx);
     mpd_mul(fee, lot, fee, &mpd_ctx);
     if (side == ORDER_SIDE_BUY) {
-        mpd_copy(swap, symbol_swap_long(group, symbol), &mpd_ctx);
+        mpd_copy(swap, fe->swap_long, &mpd_ctx);
     } else {
-        mpd_copy(swap, symbol_swap_short(group, symbol), &mpd_ctx);
+        mpd_copy(swap, fe->swap_short, &mpd_ctx);
     }
 
     json_t *result = NULL;
-    int ret = market_open_hedged(true, &result, market, get_symbol(symbol), sid, leverage, side, price, lot, tp, sl, symbol_percentage(group, symbol), fee, swap, 0, comment, margin_price, 0);
+    int ret = market_open_hedged(true, &result, market, get_symbol(symbol), sid, side, price, lot, tp, sl, fe->margin_rate, fee, swap, 0, comment, margin_price, 0);
 
     mpd_del(price);
     mpd_del(lot);
@@ -621,9 +668,9 @@ static int on_cmd_order_open(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         return reply_error_invalid_argument(ses, pkg);
     const char *group = json_string_value(json_array_get(params, 1));
 
-    // get group leverage
-    int leverage = group_leverage(group);
-    if (leverage == 0)
+    // get group id and leverage
+    int gid = get_group_id(group);
+    if (gid < 0 || configs.groups[gid].leverage == 0)
         return reply_error_invalid_argument(ses, pkg);
 
     // symbol
@@ -738,57 +785,23 @@ static int on_cmd_order_open(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     const char *comment = json_string_value(json_array_get(params, 8));
 
     // margin price
-    mpd_copy(margin_price, mpd_one, &mpd_ctx);
     symbol_t *sym = get_symbol(symbol);
-    if (sym->margin_calc == MARGIN_CALC_FOREX) {
-        if (sym->margin_type == MARGIN_TYPE_AC || sym->margin_type == MARGIN_TYPE_BC) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(margin_price, symbol_ask(sym->margin_symbol), &mpd_ctx);
-            } else {
-                mpd_copy(margin_price, symbol_bid(sym->margin_symbol), &mpd_ctx);
-            }
-        }
-    } else {
-        if (strcmp(sym->name, "HSI") == 0) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(margin_price, symbol_ask("USDHKD"), &mpd_ctx);
-            } else {
-                mpd_copy(margin_price, symbol_bid("USDHKD"), &mpd_ctx);
-            }
-        } else if (strcmp(sym->name, "DAX") == 0) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(margin_price, symbol_ask("EURUSD"), &mpd_ctx);
-            } else {
-                mpd_copy(margin_price, symbol_bid("EURUSD"), &mpd_ctx);
-            }
-        } else if (strcmp(sym->name, "UK100") == 0) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(margin_price, symbol_ask("GBPUSD"), &mpd_ctx);
-            } else {
-                mpd_copy(margin_price, symbol_bid("GBPUSD"), &mpd_ctx);
-            }
-        } else if (strcmp(sym->name, "JP225") == 0) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(margin_price, symbol_ask("USDJPY"), &mpd_ctx);
-            } else {
-                mpd_copy(margin_price, symbol_bid("USDJPY"), &mpd_ctx);
-            }
-        }
-    }
+    mpd_copy(margin_price, symbol_margin_price(sym, side), &mpd_ctx);
 
     // get symbol fee and swap
-    mpd_copy(fee, symbol_fee(group, symbol), &mpd_ctx);
+    struct fee_entry *fe = get_fee_entry(gid, market->sym->id);
+    mpd_copy(fee, fe->fee, &mpd_ctx);
     mpd_mul(fee, lot, fee, &mpd_ctx);
     if (side == ORDER_SIDE_BUY) {
-        mpd_copy(swap, symbol_swap_long(group, symbol), &mpd_ctx);
+        mpd_copy(swap, fe->swap_long, &mpd_ctx);
     } else {
-        mpd_copy(swap, symbol_swap_short(group, symbol), &mpd_ctx);
+        mpd_copy(swap, fe->swap_short, &mpd_ctx);
     }
 
     double create_time = current_timestamp();
     json_t *result = NULL;
 //    int ret = market_open(true, &result, market, sym, sid, leverage, side, price, lot, tp, sl, fee, swap, external, comment, margin_price, create_time);
-    int ret = market_open_hedged(true, &result, market, sym, sid, leverage, side, price, lot, tp, sl, symbol_percentage(group, symbol), fee, swap, external, comment, margin_price, create_time);
+    int ret = market_open_hedged(true, &result, market, sym, sid, side, price, lot, tp, sl, fe->margin_rate, fee, swap, external, comment, margin_price, create_time);
 
     if (ret == 0) {
         // 添加参数 price, margin_time, create_time,系统重启时创建订单使用
@@ -902,43 +915,8 @@ static int on_cmd_order_close(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     }
 
     // profit price
-    mpd_copy(profit_price, mpd_one, &mpd_ctx);
     symbol_t *sym = get_symbol(symbol);
-    if (sym->profit_calc == PROFIT_CALC_FOREX) {
-        if (sym->profit_type == PROFIT_TYPE_AC || sym->profit_type == PROFIT_TYPE_CB) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(profit_price, symbol_bid(sym->profit_symbol), &mpd_ctx);
-            } else {
-                mpd_copy(profit_price, symbol_ask(sym->profit_symbol), &mpd_ctx);
-            }
-        }
-    } else {
-        if (strcmp(sym->name, "HSI") == 0) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(profit_price, symbol_bid("USDHKD"), &mpd_ctx);
-            } else {
-                mpd_copy(profit_price, symbol_ask("USDHKD"), &mpd_ctx);
-            }
-        } else if (strcmp(sym->name, "DAX") == 0) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(profit_price, symbol_bid("EURUSD"), &mpd_ctx);
-            } else {
-                mpd_copy(profit_price, symbol_ask("EURUSD"), &mpd_ctx);
-            }
-        } else if (strcmp(sym->name, "UK100") == 0) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(profit_price, symbol_ask("GBPUSD"), &mpd_ctx);
-            } else {
-                mpd_copy(profit_price, symbol_bid("GBPUSD"), &mpd_ctx);
-            }
-        } else if (strcmp(sym->name, "JP225") == 0) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(profit_price, symbol_ask("USDJPY"), &mpd_ctx);
-            } else {
-                mpd_copy(profit_price, symbol_bid("USDJPY"), &mpd_ctx);
-            }
-        }
-    }
+    mpd_copy(profit_price, symbol_profit_price(sym, side), &mpd_ctx);
 
     double finish_time = current_timestamp();
     json_t *result = NULL;
@@ -1113,10 +1091,11 @@ static int on_cmd_order_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         return reply_error_invalid_argument(ses, pkg);
     const char *group = json_string_value(json_array_get(params, 1));
 
-    // get group leverage
-    int leverage = group_leverage(group);
-    if (leverage == 0)
+    // get group id and leverage
+    int gid = get_group_id(group);
+    if (gid < 0 || configs.groups[gid].leverage == 0)
         return reply_error_invalid_argument(ses, pkg);
+    int leverage = configs.groups[gid].leverage;
 
     // symbol
     if (!json_is_string(json_array_get(params, 2)))
@@ -1252,17 +1231,18 @@ static int on_cmd_order_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     const char *comment = json_string_value(json_array_get(params, 10));
 
     // get symbol fee and swap
-    mpd_copy(fee, symbol_fee(group, symbol), &mpd_ctx);
+    struct fee_entry *fe = get_fee_entry(gid, market->sym->id);
+    mpd_copy(fee, fe->fee, &mpd_ctx);
     mpd_mul(fee, lot, fee, &mpd_ctx);
     if (side == ORDER_SIDE_BUY) {
-        mpd_copy(swap, symbol_swap_long(group, symbol), &mpd_ctx);
+        mpd_copy(swap, fe->swap_long, &mpd_ctx);
     } else {
-        mpd_copy(swap, symbol_swap_short(group, symbol), &mpd_ctx);
+        mpd_copy(swap, fe->swap_short, &mpd_ctx);
     }
 
     double create_time = current_timestamp();
     json_t *result = NULL;
-    int ret = market_put_limit(true, &result, market, sid, leverage, side, price, lot, tp, sl, symbol_percentage(group, symbol), fee, swap, external, comment, create_time, expire_time);
+    int ret = market_put_limit(true, &result, market, sid, leverage, side, price, lot, tp, sl, fe->percentage, fee, swap, external, comment, create_time, expire_time);
 
     if (ret == 0) {
         // 添加参数 create_time,系统重启时创建订单使用
@@ -1450,43 +1430,8 @@ static int on_cmd_order_close_external(nw_ses *ses, rpc_pkg *pkg, json_t *params
     }
 
     // profit price
-    mpd_copy(profit_price, mpd_one, &mpd_ctx);
     symbol_t *sym = get_symbol(symbol);
-    if (sym->profit_calc == PROFIT_CALC_FOREX) {
-        if (sym->profit_type == PROFIT_TYPE_AC || sym->profit_type == PROFIT_TYPE_CB) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(profit_price, symbol_bid(sym->profit_symbol), &mpd_ctx);
-            } else {
-                mpd_copy(profit_price, symbol_ask(sym->profit_symbol), &mpd_ctx);
-            }
-        }
-    } else {
-        if (strcmp(sym->name, "HSI") == 0) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(profit_price, symbol_bid("USDHKD"), &mpd_ctx);
-            } else {
-                mpd_copy(profit_price, symbol_ask("USDHKD"), &mpd_ctx);
-            }
-        } else if (strcmp(sym->name, "DAX") == 0) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(profit_price, symbol_bid("EURUSD"), &mpd_ctx);
-            } else {
-                mpd_copy(profit_price, symbol_ask("EURUSD"), &mpd_ctx);
-            }
-        } else if (strcmp(sym->name, "UK100") == 0) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(profit_price, symbol_ask("GBPUSD"), &mpd_ctx);
-            } else {
-                mpd_copy(profit_price, symbol_bid("GBPUSD"), &mpd_ctx);
-            }
-        } else if (strcmp(sym->name, "JP225") == 0) {
-            if (side == ORDER_SIDE_BUY) {
-                mpd_copy(profit_price, symbol_ask("USDJPY"), &mpd_ctx);
-            } else {
-                mpd_copy(profit_price, symbol_bid("USDJPY"), &mpd_ctx);
-            }
-        }
-    }
+    mpd_copy(profit_price, symbol_profit_price(sym, side), &mpd_ctx);
 
     double finish_time = current_timestamp();
     json_t *result = NULL;
@@ -2508,6 +2453,99 @@ invalid_argument:
     return reply_error_invalid_argument(ses, pkg);
 }
 
+// repl.status ()，接入层据此决定查询是否可以发给 follower
+static int on_cmd_repl_status(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+{
+    json_t *result = json_object();
+    json_object_set_new(result, "standby", json_boolean(repl_is_standby()));
+    json_object_set_new(result, "last_id", json_integer(operlog_id_start));
+    // follower 行情断开时浮动盈亏不再更新，报告为无限滞后，查询都回到主机
+    double staleness = repl_staleness();
+    if (settings.follower && repl_is_standby() && tick_status() == 0)
+        staleness = 1e9;
+    json_object_set_new(result, "staleness", json_real(staleness));
+    int ret = reply_result(ses, pkg, result);
+    json_decref(result);
+    return ret;
+}
+
+static json_t *digest_hashes(uint32_t bucket, bool leaf)
+{
+    json_t *list = json_array();
+    for (uint32_t i = 0; i < DIGEST_FANOUT; ++i) {
+        char hash[32];
+        snprintf(hash, sizeof(hash), "%016"PRIx64, leaf ? digest_leaf(bucket, i) : digest_bucket(i));
+        json_array_append_new(list, json_string(hash));
+    }
+    return list;
+}
+
+// state.digest ()            根和 256 个桶
+// state.digest (bucket)      桶和它的 256 个叶子
+// state.digest (bucket, leaf) 叶子下各账户的哈希
+static int on_cmd_state_digest(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+{
+    size_t size = json_array_size(params);
+    if (size > 2)
+        return reply_error_invalid_argument(ses, pkg);
+    for (size_t i = 0; i < size; ++i) {
+        json_t *index = json_array_get(params, i);
+        if (!json_is_integer(index) || json_integer_value(index) < 0 || json_integer_value(index) >= DIGEST_FANOUT)
+            return reply_error_invalid_argument(ses, pkg);
+    }
+
+    char hash[32];
+    json_t *result = json_object();
+    json_object_set_new(result, "last_id", json_integer(operlog_id_start));
+    if (size == 0) {
+        snprintf(hash, sizeof(hash), "%016"PRIx64, digest_root());
+        json_object_set_new(result, "root", json_string(hash));
+        json_object_set_new(result, "accounts", json_integer(digest_accounts()));
+        json_object_set_new(result, "buckets", digest_hashes(0, false));
+    } else if (size == 1) {
+        uint32_t bucket = json_integer_value(json_array_get(params, 0));
+        snprintf(hash, sizeof(hash), "%016"PRIx64, digest_bucket(bucket));
+        json_object_set_new(result, "bucket", json_string(hash));
+        json_object_set_new(result, "leaves", digest_hashes(bucket, true));
+    } else {
+        uint32_t bucket = json_integer_value(json_array_get(params, 0));
+        uint32_t leaf = json_integer_value(json_array_get(params, 1));
+        snprintf(hash, sizeof(hash), "%016"PRIx64, digest_leaf(bucket, leaf));
+        json_object_set_new(result, "leaf", json_string(hash));
+        json_object_set_new(result, "accounts", digest_leaf_accounts(bucket, leaf));
+    }
+
+    int ret = reply_result(ses, pkg, result);
+    json_decref(result);
+    return ret;
+}
+
+// 会写 operlog 的命令，以及依赖 tick 订阅的命令，只在主机上处理
+// follower 也按行情重估浮动盈亏，余额和持仓查询可以在 follower 上处理
+static bool is_master_command(uint32_t command)
+{
+    switch (command) {
+    case CMD_TICK_STATUS:
+    case CMD_TICK_HISTORY:
+    case CMD_BALANCE_UPDATE:
+    case CMD_ORDER_OPEN:
+    case CMD_ORDER_CLOSE:
+    case CMD_ORDER_OPEN2:
+    case CMD_ORDER_CLOSE2:
+    case CMD_ORDER_UPDATE:
+    case CMD_ORDER_CLOSE_EXTERNAL:
+    case CMD_ORDER_UPDATE_EXTERNAL:
+    case CMD_ORDER_CANCEL_EXTERNAL:
+    case CMD_ORDER_LIMIT:
+    case CMD_ORDER_PUT_LIMIT:
+    case CMD_ORDER_PUT_MARKET:
+    case CMD_ORDER_CANCEL:
+        return true;
+    default:
+        return false;
+    }
+}
+
 static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
 {
     json_t *params = json_loadb(pkg->body, pkg->body_size, 0, NULL);
@@ -2515,6 +2553,11 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
         goto decode_error;
     }
     sds params_str = sdsnewlen(pkg->body, pkg->body_size);
+    if (repl_is_standby() && is_master_command(pkg->command)) {
+        log_trace("from: %s cmd: %u rejected by follower", nw_sock_human_addr(&ses->peer_addr), pkg->command);
+        reply_error_read_only(ses, pkg);
+        goto cleanup;
+    }
 
     int ret;
     switch (pkg->command) {
@@ -2559,6 +2602,13 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
             log_error("on_cmd_tick_status %s fail: %d", params_str, ret);
         }
         break;
+    case CMD_TICK_HISTORY:
+        log_trace("from: %s cmd tick history, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        ret = on_cmd_tick_history(ses, pkg, params);
+        if (ret < 0) {
+            log_error("on_cmd_tick_history %s fail: %d", params_str, ret);
+        }
+        break;
     case CMD_ORDER_OPEN:
         if (is_operlog_block() || is_history_block() || is_message_block()) {
             log_fatal("service unavailable, operlog: %d, history: %d, message: %d",
@@ -2781,6 +2831,20 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
             log_error("on_cmd_market_summary%s fail: %d", params_str, ret);
         }
         break;
+    case CMD_STATE_DIGEST:
+        log_trace("from: %s cmd state digest, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        ret = on_cmd_state_digest(ses, pkg, params);
+        if (ret < 0) {
+            log_error("on_cmd_state_digest %s fail: %d", params_str, ret);
+        }
+        break;
+    case CMD_REPL_STATUS:
+        log_trace("from: %s cmd repl status, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        ret = on_cmd_repl_status(ses, pkg, params);
+        if (ret < 0) {
+            log_error("on_cmd_repl_status %s fail: %d", params_str, ret);
+        }
+        break;
     default:
         log_error("from: %s unknown command: %u", nw_sock_human_addr(&ses->peer_addr), pkg->command);
         break;
@@ -2853,6 +2917,19 @@ static void on_cache_timer(nw_timer *timer, void *privdata)
     dict_clear(dict_cache);
 }
 
+// 还没写出去的回复，热升级时等它们发完再退出
+size_t server_pending_send(void)
+{
+    // 未提升的备机没有启动 RPC 服务
+    if (svr == NULL)
+        return 0;
+    size_t count = 0;
+    for (nw_ses *curr = svr->raw_svr->clt_list_head; curr; curr = curr->next) {
+        count += curr->write_buf->count;
+    }
+    return count;
+}
+
 int init_server(void)
 {
     rpc_svr_type type;
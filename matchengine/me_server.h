@@ -2,6 +2,7 @@
 # define _ME_SERVER_H_
 
 int init_server(void);
+size_t server_pending_send(void);
 
 # endif
 
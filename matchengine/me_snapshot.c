@@ -0,0 +1,1249 @@
+# include <fcntl.h>
+# include <limits.h>
+# include <dirent.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+
+# include "me_snapshot.h"
+# include "me_trade.h"
+# include "me_market.h"
+# include "me_balance.h"
+# include "me_operlog.h"
+# include "me_digest.h"
+# include "ut_crc32.h"
+
+/*
+ * 本地二进制快照，替代逐行 INSERT 的 slice_* 表
+ *
+ * 全量 <snapshot_path>/slice.<timestamp>，增量 <snapshot_path>/delta.<全量 timestamp>.<seq>，
+ * 都是先写 .tmp，fsync 后 rename。文件头 64 字节:
+ *   magic[8] | uint32 version | uint32 crc32c | int64 time | uint64 end_oper_id
+ *   | uint64 end_order_id | uint64 end_deals_id | uint32 seq | uint64 digest | reserved[4]
+ * crc 覆盖 time 到文件头末尾。之后是若干块:
+ *   uint32 type | uint32 count | uint32 len | uint32 crc32c | data[len]
+ * 同一类型的连续块构成一个表，记录不跨块；type 为 SNAP_END 的空块结束文件。
+ * 数值按 mpd_to_sci 文本保存，保证与内存中的精度完全一致。
+ *
+ * 增量只有 SNAP_ACCOUNT 一种记录，保存一个 sid 的全部余额、持仓和挂单，
+ * 恢复时先清空该 sid 再写入，删除因此不需要单独记录。
+ */
+# define SNAP_MAGIC         "MESNAP01"
+# define DELTA_MAGIC        "MEDELT01"
+# define SNAP_MAGIC_LEN     8
+# define SNAP_VERSION       1
+# define SNAP_HEAD_LEN      64
+# define SNAP_BLOCK_HEAD    16
+# define SNAP_BLOCK_SIZE    (4 * 1024 * 1024)
+# define SNAP_COMMENT_MAX   65535
+
+enum {
+    SNAP_END        = 0,
+    SNAP_BALANCE    = 1,
+    SNAP_POSITION   = 2,
+    SNAP_PENDING    = 3,
+    SNAP_ACCOUNT    = 4,
+};
+
+struct dict_sid_key {
+    uint64_t    sid;
+};
+
+// 自上次检查点以来变化过的 sid，为 NULL 时不跟踪
+static dict_t *dict_dirty;
+static time_t chain_base;
+static uint32_t chain_seq;
+// 新全量还在子进程里写，fork 之后的变化同时记在这里，写成功后才切换
+static dict_t *dict_pending;
+static time_t next_base;
+static nw_job *delta_job;
+static nw_timer delta_timer;
+
+struct delta_file {
+    sds         path;
+    sds         data;
+};
+
+struct delta_name {
+    time_t      base;
+    uint32_t    seq;
+};
+
+static uint32_t dict_sid_hash_function(const void *key)
+{
+    return dict_generic_hash_function(key, sizeof(struct dict_sid_key));
+}
+
+static int dict_sid_key_compare(const void *key1, const void *key2)
+{
+    const struct dict_sid_key *obj1 = key1;
+    const struct dict_sid_key *obj2 = key2;
+    if (obj1->sid == obj2->sid) {
+        return 0;
+    }
+    return 1;
+}
+
+static void *dict_sid_key_dup(const void *key)
+{
+    struct dict_sid_key *obj = malloc(sizeof(struct dict_sid_key));
+    memcpy(obj, key, sizeof(struct dict_sid_key));
+    return obj;
+}
+
+static void dict_sid_key_free(void *key)
+{
+    free(key);
+}
+
+static void snapshot_file(char *path, size_t size, time_t timestamp)
+{
+    snprintf(path, size, "%s/slice.%ld", settings.snapshot_path, (long)timestamp);
+}
+
+static void delta_file(char *path, size_t size, time_t base, uint32_t seq)
+{
+    snprintf(path, size, "%s/delta.%ld.%u", settings.snapshot_path, (long)base, seq);
+}
+
+static int time_compare_desc(const void *a, const void *b)
+{
+    time_t x = *(const time_t *)a;
+    time_t y = *(const time_t *)b;
+    return x < y ? 1 : (x > y ? -1 : 0);
+}
+
+// 按时间从新到旧列出全量快照
+static int snapshot_list(time_t **times, size_t *num)
+{
+    *times = NULL;
+    *num = 0;
+    DIR *dir = opendir(settings.snapshot_path);
+    if (dir == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        log_error("opendir %s fail: %s", settings.snapshot_path, strerror(errno));
+        return -__LINE__;
+    }
+
+    size_t cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "slice.", 6) != 0)
+            continue;
+        char *end;
+        long t = strtol(ent->d_name + 6, &end, 10);
+        if (*end != '\0' || t <= 0)
+            continue;
+        if (*num == cap) {
+            cap = cap ? cap * 2 : 16;
+            *times = realloc(*times, cap * sizeof(time_t));
+        }
+        (*times)[(*num)++] = t;
+    }
+    closedir(dir);
+
+    if (*num > 1)
+        qsort(*times, *num, sizeof(time_t), time_compare_desc);
+    return 0;
+}
+
+static int delta_list(struct delta_name **names, size_t *num)
+{
+    *names = NULL;
+    *num = 0;
+    DIR *dir = opendir(settings.snapshot_path);
+    if (dir == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        log_error("opendir %s fail: %s", settings.snapshot_path, strerror(errno));
+        return -__LINE__;
+    }
+
+    size_t cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "delta.", 6) != 0)
+            continue;
+        char *end;
+        long base = strtol(ent->d_name + 6, &end, 10);
+        if (*end != '.' || base <= 0)
+            continue;
+        unsigned long seq = strtoul(end + 1, &end, 10);
+        if (*end != '\0' || seq == 0)
+            continue;
+        if (*num == cap) {
+            cap = cap ? cap * 2 : 16;
+            *names = realloc(*names, cap * sizeof(struct delta_name));
+        }
+        (*names)[*num].base = base;
+        (*names)[*num].seq = seq;
+        *num += 1;
+    }
+    closedir(dir);
+    return 0;
+}
+
+static int write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -__LINE__;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int sync_dir(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -__LINE__;
+    int ret = fsync(fd);
+    close(fd);
+    return ret < 0 ? -__LINE__ : 0;
+}
+
+// fd < 0 时写入内存 out，供增量在后台线程落盘
+struct snap_writer {
+    int         fd;
+    sds         out;
+    char        *buf;
+    size_t      cap;
+    size_t      len;        // 不含块头
+    uint32_t    type;
+    uint32_t    count;
+    size_t      total;
+};
+
+static void writer_init(struct snap_writer *w, int fd, uint32_t type)
+{
+    memset(w, 0, sizeof(struct snap_writer));
+    w->fd = fd;
+    w->cap = SNAP_BLOCK_SIZE;
+    w->buf = malloc(SNAP_BLOCK_HEAD + w->cap);
+    w->type = type;
+    w->total = SNAP_HEAD_LEN;
+}
+
+static int writer_flush(struct snap_writer *w)
+{
+    if (w->count == 0 && w->type != SNAP_END)
+        return 0;
+
+    uint32_t len = w->len;
+    uint32_t crc = generate_crc32c(w->buf + SNAP_BLOCK_HEAD, w->len);
+    memcpy(w->buf, &w->type, 4);
+    memcpy(w->buf + 4, &w->count, 4);
+    memcpy(w->buf + 8, &len, 4);
+    memcpy(w->buf + 12, &crc, 4);
+    if (w->fd < 0) {
+        w->out = sdscatlen(w->out, w->buf, SNAP_BLOCK_HEAD + w->len);
+    } else if (write_all(w->fd, w->buf, SNAP_BLOCK_HEAD + w->len) < 0) {
+        log_error("write snapshot fail: %s", strerror(errno));
+        return -__LINE__;
+    }
+    w->total += SNAP_BLOCK_HEAD + w->len;
+    w->len = 0;
+    w->count = 0;
+    return 0;
+}
+
+// 开始一条记录，整条记录落在同一块内，块满后在记录边界切块
+static int writer_record(struct snap_writer *w, uint32_t type)
+{
+    if (w->type != type || w->len >= SNAP_BLOCK_SIZE) {
+        ERR_RET(writer_flush(w));
+        w->type = type;
+    }
+    w->count++;
+    return 0;
+}
+
+static int writer_finish(struct snap_writer *w)
+{
+    ERR_RET(writer_flush(w));
+    w->type = SNAP_END;
+    return writer_flush(w);
+}
+
+static void put_data(struct snap_writer *w, const void *data, size_t len)
+{
+    if (w->len + len > w->cap) {
+        while (w->len + len > w->cap)
+            w->cap *= 2;
+        w->buf = realloc(w->buf, SNAP_BLOCK_HEAD + w->cap);
+    }
+    memcpy(w->buf + SNAP_BLOCK_HEAD + w->len, data, len);
+    w->len += len;
+}
+
+static void put_u32(struct snap_writer *w, uint32_t val)
+{
+    put_data(w, &val, 4);
+}
+
+static void put_u64(struct snap_writer *w, uint64_t val)
+{
+    put_data(w, &val, 8);
+}
+
+static void put_double(struct snap_writer *w, double val)
+{
+    put_data(w, &val, 8);
+}
+
+static void put_str(struct snap_writer *w, const char *str)
+{
+    size_t len = str ? strlen(str) : 0;
+    if (len > SNAP_COMMENT_MAX)
+        len = SNAP_COMMENT_MAX;
+    uint16_t len16 = len;
+    put_data(w, &len16, 2);
+    if (len > 0)
+        put_data(w, str, len);
+}
+
+static void put_mpd(struct snap_writer *w, mpd_t *val)
+{
+    char *str = mpd_to_sci(val, 0);
+    uint8_t len = strlen(str);
+    put_data(w, &len, 1);
+    put_data(w, str, len);
+    free(str);
+}
+
+// 回填记录内的计数
+static void put_count(struct snap_writer *w, size_t offset, uint32_t count)
+{
+    memcpy(w->buf + SNAP_BLOCK_HEAD + offset, &count, 4);
+}
+
+static void put_balance(struct snap_writer *w, uint64_t sid, uint32_t type, mpd_t *balance)
+{
+    put_u64(w, sid);
+    put_u32(w, type);
+    put_mpd(w, balance);
+}
+
+static void put_position(struct snap_writer *w, order_t *order)
+{
+    put_u64(w, order->id);
+    put_u64(w, order->sid);
+    put_u32(w, order->side);
+    put_double(w, order->create_time);
+    put_double(w, order->update_time);
+    put_u64(w, order->external);
+    put_str(w, order->symbol);
+    put_str(w, order->comment);
+    put_mpd(w, order->price);
+    put_mpd(w, order->lot);
+    put_mpd(w, order->margin);
+    put_mpd(w, order->fee);
+    put_mpd(w, order->swap);
+    put_mpd(w, order->swaps);
+    put_mpd(w, order->tp);
+    put_mpd(w, order->sl);
+    put_mpd(w, order->margin_price);
+}
+
+static void put_pending(struct snap_writer *w, order_t *order)
+{
+    put_u64(w, order->id);
+    put_u64(w, order->sid);
+    put_u32(w, order->side);
+    put_double(w, order->create_time);
+    put_u64(w, order->expire_time);
+    put_u64(w, order->external);
+    put_str(w, order->symbol);
+    put_str(w, order->comment);
+    put_mpd(w, order->price);
+    put_mpd(w, order->lot);
+    put_mpd(w, order->margin);
+    put_mpd(w, order->fee);
+    put_mpd(w, order->swap);
+    put_mpd(w, order->tp);
+    put_mpd(w, order->sl);
+}
+
+static int dump_balance_dict(struct snap_writer *w, size_t *count)
+{
+    dict_iterator *iter = dict_get_iterator(dict_balance);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct balance_key *key = entry->key;
+        // float not dump
+        if (key->type > BALANCE_TYPE_FREE)
+            continue;
+
+        if (writer_record(w, SNAP_BALANCE) < 0) {
+            dict_release_iterator(iter);
+            return -__LINE__;
+        }
+        uint64_t sid1 = key->sid1;
+        put_balance(w, sid1 * 100 + key->sid2, key->type, entry->val);
+        *count += 1;
+    }
+    dict_release_iterator(iter);
+    return 0;
+}
+
+static int dump_order_list(struct snap_writer *w, skiplist_t *list, uint32_t type, size_t *count)
+{
+    skiplist_iter *iter = skiplist_get_iterator(list);
+    skiplist_node *node;
+    while ((node = skiplist_next(iter)) != NULL) {
+        if (writer_record(w, type) < 0) {
+            skiplist_release_iterator(iter);
+            return -__LINE__;
+        }
+        if (type == SNAP_POSITION) {
+            put_position(w, node->value);
+        } else {
+            put_pending(w, node->value);
+        }
+        *count += 1;
+    }
+    skiplist_release_iterator(iter);
+    return 0;
+}
+
+static int dump_tables(struct snap_writer *w, size_t *balances, size_t *positions, size_t *pendings)
+{
+    ERR_RET(dump_balance_dict(w, balances));
+    for (int i = 0; i < configs.symbol_num; ++i) {
+        market_t *market = get_market(configs.symbols[i].name);
+        if (market == NULL)
+            return -__LINE__;
+        ERR_RET(dump_order_list(w, market->buys, SNAP_POSITION, positions));
+        ERR_RET(dump_order_list(w, market->sells, SNAP_POSITION, positions));
+    }
+    for (int i = 0; i < configs.symbol_num; ++i) {
+        market_t *market = get_market(configs.symbols[i].name);
+        ERR_RET(dump_order_list(w, market->limit_buys, SNAP_PENDING, pendings));
+        ERR_RET(dump_order_list(w, market->limit_sells, SNAP_PENDING, pendings));
+    }
+
+    return writer_finish(w);
+}
+
+// 一个 sid 的完整状态: 余额、持仓、挂单
+static int dump_account(struct snap_writer *w, uint64_t sid)
+{
+    ERR_RET(writer_record(w, SNAP_ACCOUNT));
+    put_u64(w, sid);
+
+    uint32_t count = 0;
+    size_t offset = w->len;
+    put_u32(w, 0);
+    for (uint32_t type = BALANCE_TYPE_BALANCE; type <= BALANCE_TYPE_FREE; ++type) {
+        mpd_t *balance = balance_get_v2(sid, type);
+        if (balance) {
+            put_balance(w, sid, type, balance);
+            count++;
+        }
+    }
+    put_count(w, offset, count);
+
+    count = 0;
+    offset = w->len;
+    put_u32(w, 0);
+    skiplist_t *list = market_get_positions(sid);
+    if (list) {
+        skiplist_iter *iter = skiplist_get_iterator(list);
+        skiplist_node *node;
+        while ((node = skiplist_next(iter)) != NULL) {
+            put_position(w, node->value);
+            count++;
+        }
+        skiplist_release_iterator(iter);
+    }
+    put_count(w, offset, count);
+
+    count = 0;
+    offset = w->len;
+    put_u32(w, 0);
+    for (int i = 0; i < configs.symbol_num; ++i) {
+        list = market_get_limit_list(get_market(configs.symbols[i].name), sid);
+        if (list == NULL)
+            continue;
+        skiplist_iter *iter = skiplist_get_iterator(list);
+        skiplist_node *node;
+        while ((node = skiplist_next(iter)) != NULL) {
+            put_pending(w, node->value);
+            count++;
+        }
+        skiplist_release_iterator(iter);
+    }
+    put_count(w, offset, count);
+
+    return 0;
+}
+
+static void build_head(char *head, const char *magic, struct snapshot_meta *meta, uint32_t seq)
+{
+    memset(head, 0, SNAP_HEAD_LEN);
+    memcpy(head, magic, SNAP_MAGIC_LEN);
+    uint32_t version = SNAP_VERSION;
+    int64_t time = meta->time;
+    memcpy(head + 8, &version, 4);
+    memcpy(head + 16, &time, 8);
+    memcpy(head + 24, &meta->end_oper_id, 8);
+    memcpy(head + 32, &meta->end_order_id, 8);
+    memcpy(head + 40, &meta->end_deals_id, 8);
+    memcpy(head + 48, &seq, 4);
+    memcpy(head + 52, &meta->digest, 8);
+    uint32_t crc = generate_crc32c(head + 16, SNAP_HEAD_LEN - 16);
+    memcpy(head + 12, &crc, 4);
+}
+
+static void current_meta(struct snapshot_meta *meta, time_t timestamp)
+{
+    memset(meta, 0, sizeof(struct snapshot_meta));
+    meta->time = timestamp;
+    meta->end_oper_id = operlog_id_start;
+    meta->end_order_id = order_id_start;
+    meta->end_deals_id = deals_id_start;
+    meta->digest = digest_root();
+}
+
+int snapshot_dump(time_t timestamp)
+{
+    if (mkdir(settings.snapshot_path, 0755) < 0 && errno != EEXIST) {
+        log_error("mkdir %s fail: %s", settings.snapshot_path, strerror(errno));
+        return -__LINE__;
+    }
+
+    char path[PATH_MAX];
+    char temp[PATH_MAX];
+    snapshot_file(path, sizeof(path), timestamp);
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    double begin = current_timestamp();
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        log_error("open %s fail: %s", temp, strerror(errno));
+        return -__LINE__;
+    }
+
+    struct snapshot_meta meta;
+    current_meta(&meta, timestamp);
+    char head[SNAP_HEAD_LEN];
+    build_head(head, SNAP_MAGIC, &meta, 0);
+
+    struct snap_writer w;
+    writer_init(&w, fd, SNAP_BALANCE);
+
+    int ret = 0;
+    size_t balances = 0, positions = 0, pendings = 0;
+    if (write_all(fd, head, SNAP_HEAD_LEN) < 0) {
+        log_error("write %s fail: %s", temp, strerror(errno));
+        ret = -__LINE__;
+    } else if (dump_tables(&w, &balances, &positions, &pendings) < 0) {
+        ret = -__LINE__;
+    } else if (fsync(fd) < 0) {
+        log_error("fsync %s fail: %s", temp, strerror(errno));
+        ret = -__LINE__;
+    }
+    free(w.buf);
+    close(fd);
+
+    if (ret == 0 && rename(temp, path) < 0) {
+        log_error("rename %s fail: %s", temp, strerror(errno));
+        ret = -__LINE__;
+    }
+    if (ret < 0) {
+        unlink(temp);
+        return ret;
+    }
+    sync_dir(settings.snapshot_path);
+
+    log_info("dump snapshot: %s, balance: %zu, position: %zu, pending: %zu, size: %zu, cost: %.3fs",
+            path, balances, positions, pendings, w.total, current_timestamp() - begin);
+    return 0;
+}
+
+// 删除 before 之前(keep 链除外)的增量，以及 base 链上 seq > max_seq 的增量
+static void delta_remove(time_t before, time_t keep, time_t base, uint32_t max_seq)
+{
+    struct delta_name *names;
+    size_t num;
+    if (delta_list(&names, &num) < 0)
+        return;
+
+    for (size_t i = 0; i < num; ++i) {
+        bool expired = names[i].base < before && names[i].base != keep;
+        bool stale = names[i].base == base && names[i].seq > max_seq;
+        if (!expired && !stale)
+            continue;
+        char path[PATH_MAX];
+        delta_file(path, sizeof(path), names[i].base, names[i].seq);
+        if (unlink(path) == 0) {
+            log_info("remove snapshot delta: %s", path);
+        }
+    }
+    free(names);
+}
+
+int snapshot_clear(time_t timestamp)
+{
+    time_t *times;
+    size_t num;
+    ERR_RET(snapshot_list(&times, &num));
+
+    time_t before = timestamp - settings.slice_keeptime;
+    for (size_t i = 1; i < num; ++i) {
+        if (times[i] >= before)
+            continue;
+        char path[PATH_MAX];
+        snapshot_file(path, sizeof(path), times[i]);
+        if (unlink(path) == 0) {
+            log_info("remove snapshot: %s", path);
+        }
+    }
+    delta_remove(before, num > 0 ? times[0] : 0, 0, 0);
+    free(times);
+    return 0;
+}
+
+static dict_t *dirty_create(void)
+{
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function    = dict_sid_hash_function;
+    dt.key_compare      = dict_sid_key_compare;
+    dt.key_dup          = dict_sid_key_dup;
+    dt.key_destructor   = dict_sid_key_free;
+    return dict_create(&dt, 1024);
+}
+
+static void checkpoint_start(time_t base, uint32_t seq)
+{
+    if (dict_dirty == NULL) {
+        dict_dirty = dirty_create();
+    } else {
+        dict_clear(dict_dirty);
+    }
+    chain_base = base;
+    chain_seq = seq;
+}
+
+static void dirty_add(dict_t *dict, uint64_t sid)
+{
+    struct dict_sid_key key = { .sid = sid };
+    if (dict_find(dict, &key) == NULL)
+        dict_add(dict, &key, NULL);
+}
+
+void snapshot_touch(uint64_t sid)
+{
+    if (dict_dirty)
+        dirty_add(dict_dirty, sid);
+    if (dict_pending)
+        dirty_add(dict_pending, sid);
+}
+
+void snapshot_checkpoint_begin(time_t timestamp)
+{
+    if (dict_pending == NULL) {
+        dict_pending = dirty_create();
+    } else {
+        dict_clear(dict_pending);
+    }
+    next_base = timestamp;
+}
+
+void snapshot_checkpoint_end(bool success)
+{
+    if (dict_pending == NULL)
+        return;
+    if (!success) {
+        log_error("snapshot %ld not written, keep delta chain on %ld", (long)next_base, (long)chain_base);
+        dict_release(dict_pending);
+        dict_pending = NULL;
+        return;
+    }
+
+    // 旧链上还没写出的变化已包含在新全量或 dict_pending 里
+    if (dict_dirty)
+        dict_release(dict_dirty);
+    dict_dirty = dict_pending;
+    dict_pending = NULL;
+    chain_base = next_base;
+    chain_seq = 1;
+}
+
+// 最旧的有效全量快照的 end_oper_id，WAL 只能删到这里；没有快照返回 0
+uint64_t snapshot_oldest_oper_id(void)
+{
+    time_t *times;
+    size_t num;
+    if (snapshot_list(&times, &num) < 0)
+        return 0;
+
+    uint64_t oper_id = 0;
+    for (size_t i = num; i > 0; --i) {
+        char path[PATH_MAX];
+        snapshot_file(path, sizeof(path), times[i - 1]);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            continue;
+        char head[SNAP_HEAD_LEN];
+        ssize_t n = pread(fd, head, SNAP_HEAD_LEN, 0);
+        close(fd);
+        if (n != SNAP_HEAD_LEN || memcmp(head, SNAP_MAGIC, SNAP_MAGIC_LEN) != 0)
+            continue;
+        uint32_t crc;
+        int64_t time;
+        memcpy(&crc, head + 12, 4);
+        memcpy(&time, head + 16, 8);
+        if (crc != generate_crc32c(head + 16, SNAP_HEAD_LEN - 16) || time != times[i - 1])
+            continue;
+        memcpy(&oper_id, head + 24, 8);
+        break;
+    }
+    free(times);
+    return oper_id;
+}
+
+static int write_file(const char *path, const char *data, size_t len)
+{
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        log_error("open %s fail: %s", temp, strerror(errno));
+        return -__LINE__;
+    }
+    if (write_all(fd, data, len) < 0 || fsync(fd) < 0) {
+        log_error("write %s fail: %s", temp, strerror(errno));
+        close(fd);
+        unlink(temp);
+        return -__LINE__;
+    }
+    close(fd);
+    if (rename(temp, path) < 0) {
+        log_error("rename %s fail: %s", temp, strerror(errno));
+        unlink(temp);
+        return -__LINE__;
+    }
+    sync_dir(settings.snapshot_path);
+    return 0;
+}
+
+static void on_delta_job(nw_job_entry *entry, void *privdata)
+{
+    struct delta_file *file = entry->request;
+    double begin = current_timestamp();
+    int ret = write_file(file->path, file->data, sdslen(file->data));
+    if (ret < 0) {
+        log_fatal("write snapshot delta: %s fail: %d", file->path, ret);
+        return;
+    }
+    log_info("write snapshot delta: %s, size: %zu, cost: %.3fs", file->path, sdslen(file->data), current_timestamp() - begin);
+}
+
+static void on_delta_cleanup(nw_job_entry *entry)
+{
+    struct delta_file *file = entry->request;
+    sdsfree(file->path);
+    sdsfree(file->data);
+    free(file);
+}
+
+// 主线程只序列化脏账户，写盘和 fsync 交给后台线程
+static int snapshot_delta(void)
+{
+    if (dict_dirty == NULL || chain_base == 0 || dict_size(dict_dirty) == 0)
+        return 0;
+    if (mkdir(settings.snapshot_path, 0755) < 0 && errno != EEXIST) {
+        log_error("mkdir %s fail: %s", settings.snapshot_path, strerror(errno));
+        return -__LINE__;
+    }
+
+    double begin = current_timestamp();
+    struct snapshot_meta meta;
+    current_meta(&meta, chain_base);
+    char head[SNAP_HEAD_LEN];
+    build_head(head, DELTA_MAGIC, &meta, chain_seq);
+
+    struct snap_writer w;
+    writer_init(&w, -1, SNAP_ACCOUNT);
+    w.out = sdsnewlen(head, SNAP_HEAD_LEN);
+
+    size_t accounts = 0;
+    int ret = 0;
+    dict_iterator *iter = dict_get_iterator(dict_dirty);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct dict_sid_key *key = entry->key;
+        ret = dump_account(&w, key->sid);
+        if (ret < 0)
+            break;
+        accounts++;
+    }
+    dict_release_iterator(iter);
+    if (ret == 0)
+        ret = writer_finish(&w);
+    free(w.buf);
+    if (ret < 0) {
+        sdsfree(w.out);
+        return ret;
+    }
+
+    char path[PATH_MAX];
+    delta_file(path, sizeof(path), chain_base, chain_seq);
+    struct delta_file *file = malloc(sizeof(struct delta_file));
+    file->path = sdsnew(path);
+    file->data = w.out;
+    nw_job_add(delta_job, 0, file);
+
+    log_info("snapshot delta: %s, account: %zu, size: %zu, cost: %.3fs", path, accounts, sdslen(w.out), current_timestamp() - begin);
+    dict_clear(dict_dirty);
+    chain_seq++;
+    return 0;
+}
+
+static void on_delta_timer(nw_timer *timer, void *privdata)
+{
+    int ret = snapshot_delta();
+    if (ret < 0) {
+        log_fatal("snapshot_delta fail: %d", ret);
+    }
+}
+
+int init_snapshot(void)
+{
+    if (settings.snapshot_delta_interval <= 0)
+        return 0;
+
+    nw_job_type type;
+    memset(&type, 0, sizeof(type));
+    type.on_job = on_delta_job;
+    type.on_cleanup = on_delta_cleanup;
+
+    delta_job = nw_job_create(&type, 1);
+    if (delta_job == NULL)
+        return -__LINE__;
+
+    nw_timer_set(&delta_timer, settings.snapshot_delta_interval, true, on_delta_timer, NULL);
+    nw_timer_start(&delta_timer);
+
+    return 0;
+}
+
+struct snap_reader {
+    const char  *pos;
+    const char  *end;
+    bool        fail;
+};
+
+static const void *get_data(struct snap_reader *r, size_t len)
+{
+    if (r->fail || (size_t)(r->end - r->pos) < len) {
+        r->fail = true;
+        return NULL;
+    }
+    const char *data = r->pos;
+    r->pos += len;
+    return data;
+}
+
+static uint32_t get_u32(struct snap_reader *r)
+{
+    uint32_t val = 0;
+    const void *data = get_data(r, 4);
+    if (data)
+        memcpy(&val, data, 4);
+    return val;
+}
+
+static uint64_t get_u64(struct snap_reader *r)
+{
+    uint64_t val = 0;
+    const void *data = get_data(r, 8);
+    if (data)
+        memcpy(&val, data, 8);
+    return val;
+}
+
+static double get_double(struct snap_reader *r)
+{
+    double val = 0;
+    const void *data = get_data(r, 8);
+    if (data)
+        memcpy(&val, data, 8);
+    return val;
+}
+
+// 返回的字符串需调用方释放
+static char *get_str(struct snap_reader *r)
+{
+    uint16_t len = 0;
+    const void *data = get_data(r, 2);
+    if (data)
+        memcpy(&len, data, 2);
+    data = get_data(r, len);
+    if (data == NULL)
+        return NULL;
+    char *str = malloc(len + 1);
+    memcpy(str, data, len);
+    str[len] = '\0';
+    return str;
+}
+
+static mpd_t *get_mpd(struct snap_reader *r, int prec)
+{
+    const uint8_t *len = get_data(r, 1);
+    if (len == NULL)
+        return NULL;
+    const char *data = get_data(r, *len);
+    if (data == NULL)
+        return NULL;
+    char str[256];
+    memcpy(str, data, *len);
+    str[*len] = '\0';
+    mpd_t *val = decimal(str, prec);
+    if (val == NULL)
+        r->fail = true;
+    return val;
+}
+
+static void order_release(order_t *order)
+{
+    free(order->comment);
+    mpd_t *vals[] = { order->price, order->lot, order->margin, order->fee, order->swap, order->swaps,
+        order->tp, order->sl, order->margin_price, order->close_price, order->profit, order->profit_price };
+    for (size_t i = 0; i < sizeof(vals) / sizeof(vals[0]); ++i) {
+        if (vals[i])
+            mpd_del(vals[i]);
+    }
+    free(order);
+}
+
+static int load_balance_record(struct snap_reader *r)
+{
+    uint64_t sid = get_u64(r);
+    uint32_t type = get_u32(r);
+    mpd_t *balance = get_mpd(r, PREC_DEFAULT);
+    if (r->fail) {
+        if (balance)
+            mpd_del(balance);
+        return -__LINE__;
+    }
+    balance_set_float(sid, type, balance);
+    return 0;
+}
+
+static int load_order_record(struct snap_reader *r, uint32_t type)
+{
+    order_t *order = malloc(sizeof(order_t));
+    memset(order, 0, sizeof(order_t));
+    order->id = get_u64(r);
+    order->sid = get_u64(r);
+    order->side = get_u32(r);
+    order->create_time = get_double(r);
+    if (type == SNAP_POSITION) {
+        order->update_time = get_double(r);
+    } else {
+        order->expire_time = get_u64(r);
+    }
+    order->external = get_u64(r);
+    char *symbol = get_str(r);
+    order->comment = get_str(r);
+
+    order->price = get_mpd(r, PREC_PRICE);
+    order->lot = get_mpd(r, PREC_DEFAULT);
+    order->margin = get_mpd(r, PREC_DEFAULT);
+    order->fee = get_mpd(r, PREC_DEFAULT);
+    order->swap = get_mpd(r, PREC_SWAP);
+    if (type == SNAP_POSITION) {
+        order->swaps = get_mpd(r, PREC_DEFAULT);
+    }
+    order->tp = get_mpd(r, PREC_PRICE);
+    order->sl = get_mpd(r, PREC_PRICE);
+    if (type == SNAP_POSITION) {
+        order->margin_price = get_mpd(r, PREC_PRICE);
+    }
+    if (r->fail) {
+        log_error("invalid snapshot order record");
+        free(symbol);
+        order_release(order);
+        return -__LINE__;
+    }
+
+    market_t *market = get_market(symbol);
+    free(symbol);
+    if (market == NULL) {
+        order_release(order);
+        return 0;
+    }
+    order->symbol = market->name;
+    order->symbol_id = market->sym->id;
+
+    order->finish_time = 0;
+    order->close_price = mpd_new(&mpd_ctx);
+    order->profit      = mpd_new(&mpd_ctx);
+    order->profit_price = mpd_new(&mpd_ctx);
+    mpd_copy(order->close_price, mpd_zero, &mpd_ctx);
+    mpd_copy(order->profit, mpd_zero, &mpd_ctx);
+    mpd_copy(order->profit_price, mpd_one, &mpd_ctx);
+
+    if (type == SNAP_POSITION) {
+        order->type = MARKET_ORDER_TYPE_MARKET;
+        return market_put_position(market, order);
+    }
+
+    order->type = MARKET_ORDER_TYPE_LIMIT;
+    order->swaps = mpd_new(&mpd_ctx);
+    order->margin_price = mpd_new(&mpd_ctx);
+    mpd_copy(order->swaps, mpd_zero, &mpd_ctx);
+    mpd_copy(order->margin_price, mpd_zero, &mpd_ctx);
+    return market_put_pending(market, order);
+}
+
+static order_t **collect_orders(skiplist_t *list, size_t *num)
+{
+    order_t **orders = malloc(sizeof(order_t *) * (skiplist_len(list) + 1));
+    size_t i = 0;
+    skiplist_iter *iter = skiplist_get_iterator(list);
+    skiplist_node *node;
+    while ((node = skiplist_next(iter)) != NULL) {
+        orders[i++] = node->value;
+    }
+    skiplist_release_iterator(iter);
+    *num = i;
+    return orders;
+}
+
+// 清空一个 sid 的余额、持仓和挂单，之后由增量记录重新写入
+static void account_clear(uint64_t sid)
+{
+    for (uint32_t type = BALANCE_TYPE_BALANCE; type <= BALANCE_TYPE_FREE; ++type) {
+        balance_del_v2(sid, type);
+    }
+
+    size_t num;
+    skiplist_t *list = market_get_positions(sid);
+    if (list) {
+        order_t **orders = collect_orders(list, &num);
+        for (size_t i = 0; i < num; ++i) {
+            market_remove_position(get_market(orders[i]->symbol), orders[i]);
+        }
+        free(orders);
+    }
+
+    for (int i = 0; i < configs.symbol_num; ++i) {
+        market_t *market = get_market(configs.symbols[i].name);
+        list = market_get_limit_list(market, sid);
+        if (list == NULL || skiplist_len(list) == 0)
+            continue;
+        order_t **orders = collect_orders(list, &num);
+        for (size_t j = 0; j < num; ++j) {
+            market_remove_pending(market, orders[j]);
+        }
+        free(orders);
+    }
+}
+
+static int load_account_record(struct snap_reader *r)
+{
+    uint64_t sid = get_u64(r);
+    if (r->fail)
+        return -__LINE__;
+    account_clear(sid);
+
+    uint32_t count = get_u32(r);
+    for (uint32_t i = 0; i < count; ++i) {
+        ERR_RET(load_balance_record(r));
+    }
+    count = get_u32(r);
+    for (uint32_t i = 0; i < count; ++i) {
+        ERR_RET(load_order_record(r, SNAP_POSITION));
+    }
+    count = get_u32(r);
+    for (uint32_t i = 0; i < count; ++i) {
+        ERR_RET(load_order_record(r, SNAP_PENDING));
+    }
+    return r->fail ? -__LINE__ : 0;
+}
+
+// 先整体校验头和所有块的 crc，校验通过才开始恢复，避免恢复到一半才发现损坏
+static int snapshot_verify(const char *data, size_t size, const char *magic, time_t timestamp, uint32_t seq, struct snapshot_meta *meta)
+{
+    if (size < SNAP_HEAD_LEN || memcmp(data, magic, SNAP_MAGIC_LEN) != 0)
+        return -__LINE__;
+
+    uint32_t version, crc, head_seq;
+    int64_t time;
+    memcpy(&version, data + 8, 4);
+    memcpy(&crc, data + 12, 4);
+    if (version != SNAP_VERSION || crc != generate_crc32c(data + 16, SNAP_HEAD_LEN - 16))
+        return -__LINE__;
+    memcpy(&time, data + 16, 8);
+    memcpy(&head_seq, data + 48, 4);
+    if (time != timestamp || head_seq != seq)
+        return -__LINE__;
+    memset(meta, 0, sizeof(struct snapshot_meta));
+    meta->time = time;
+    meta->delta_seq = seq;
+    memcpy(&meta->end_oper_id, data + 24, 8);
+    memcpy(&meta->end_order_id, data + 32, 8);
+    memcpy(&meta->end_deals_id, data + 40, 8);
+    memcpy(&meta->digest, data + 52, 8);
+
+    size_t offset = SNAP_HEAD_LEN;
+    while (offset + SNAP_BLOCK_HEAD <= size) {
+        uint32_t type, len;
+        memcpy(&type, data + offset, 4);
+        memcpy(&len, data + offset + 8, 4);
+        memcpy(&crc, data + offset + 12, 4);
+        if (len > size - offset - SNAP_BLOCK_HEAD)
+            return -__LINE__;
+        if (crc != generate_crc32c(data + offset + SNAP_BLOCK_HEAD, len))
+            return -__LINE__;
+        offset += SNAP_BLOCK_HEAD + len;
+        if (type == SNAP_END)
+            return offset == size ? 0 : -__LINE__;
+    }
+
+    return -__LINE__;
+}
+
+static int snapshot_apply(const char *data, size_t size)
+{
+    size_t offset = SNAP_HEAD_LEN;
+    while (true) {
+        uint32_t type, count, len;
+        memcpy(&type, data + offset, 4);
+        memcpy(&count, data + offset + 4, 4);
+        memcpy(&len, data + offset + 8, 4);
+        if (type == SNAP_END)
+            break;
+
+        struct snap_reader r = { .pos = data + offset + SNAP_BLOCK_HEAD, .end = data + offset + SNAP_BLOCK_HEAD + len };
+        for (uint32_t i = 0; i < count; ++i) {
+            int ret;
+            if (type == SNAP_BALANCE) {
+                ret = load_balance_record(&r);
+            } else if (type == SNAP_POSITION || type == SNAP_PENDING) {
+                ret = load_order_record(&r, type);
+            } else if (type == SNAP_ACCOUNT) {
+                ret = load_account_record(&r);
+            } else {
+                log_error("unknown snapshot block type: %u", type);
+                return -__LINE__;
+            }
+            if (ret < 0) {
+                log_error("load snapshot record type: %u fail: %d", type, ret);
+                return -__LINE__;
+            }
+        }
+        if (r.pos != r.end)
+            return -__LINE__;
+        offset += SNAP_BLOCK_HEAD + len;
+    }
+
+    return 0;
+}
+
+// 返回 1 表示文件不存在或无效，内存状态未改动
+static int snapshot_load(const char *path, const char *magic, time_t timestamp, uint32_t seq, struct snapshot_meta *meta)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            log_error("open %s fail: %s", path, strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < SNAP_HEAD_LEN) {
+        close(fd);
+        log_error("invalid snapshot: %s", path);
+        return 1;
+    }
+    size_t size = st.st_size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        log_error("mmap %s fail: %s", path, strerror(errno));
+        return 1;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    double begin = current_timestamp();
+    struct snapshot_meta file_meta;
+    int ret = snapshot_verify(data, size, magic, timestamp, seq, &file_meta);
+    if (ret < 0) {
+        log_error("verify snapshot: %s fail: %d", path, ret);
+        log_stderr("verify snapshot: %s fail: %d", path, ret);
+        munmap(data, size);
+        return 1;
+    }
+
+    ret = snapshot_apply(data, size);
+    munmap(data, size);
+    if (ret < 0) {
+        log_error("load snapshot: %s fail: %d", path, ret);
+        log_stderr("load snapshot: %s fail: %d", path, ret);
+        return -__LINE__;
+    }
+    *meta = file_meta;
+
+    log_info("load snapshot: %s, size: %zu, cost: %.3fs", path, size, current_timestamp() - begin);
+    log_stderr("load snapshot: %s, size: %zu, cost: %.3fs", path, size, current_timestamp() - begin);
+    return 0;
+}
+
+// 全量之后按 seq 连续应用增量，遇到缺失或损坏即停止，其后的由 operlog 补齐
+static int load_deltas(time_t base, struct snapshot_meta *meta)
+{
+    for (uint32_t seq = 1; ; ++seq) {
+        char path[PATH_MAX];
+        delta_file(path, sizeof(path), base, seq);
+        int ret = snapshot_load(path, DELTA_MAGIC, base, seq, meta);
+        if (ret < 0)
+            return ret;
+        if (ret > 0)
+            break;
+    }
+
+    // 断点之后的旧增量不能再用，避免与新写入的序号混在一起
+    delta_remove(0, 0, base, meta->delta_seq);
+    return 0;
+}
+
+int snapshot_load_latest(time_t min_time, struct snapshot_meta *meta)
+{
+    memset(meta, 0, sizeof(struct snapshot_meta));
+
+    time_t *times;
+    size_t num;
+    ERR_RET(snapshot_list(&times, &num));
+
+    int ret = 0;
+    for (size_t i = 0; i < num && times[i] >= min_time; ++i) {
+        char path[PATH_MAX];
+        snapshot_file(path, sizeof(path), times[i]);
+        log_stderr("load snapshot from: %s", path);
+        ret = snapshot_load(path, SNAP_MAGIC, times[i], 0, meta);
+        if (ret < 0)
+            break;
+        if (ret > 0) {
+            ret = 0;
+            continue;
+        }
+
+        ret = load_deltas(times[i], meta);
+        if (ret == 0) {
+            checkpoint_start(times[i], meta->delta_seq + 1);
+        }
+        break;
+    }
+    free(times);
+    return ret;
+}
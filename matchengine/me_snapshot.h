@@ -0,0 +1,34 @@
+# ifndef _ME_SNAPSHOT_H_
+# define _ME_SNAPSHOT_H_
+
+# include <time.h>
+# include "me_config.h"
+
+struct snapshot_meta {
+    time_t      time;
+    uint64_t    end_oper_id;
+    uint64_t    end_order_id;
+    uint64_t    end_deals_id;
+    uint32_t    delta_seq;      // 已应用的最后一个增量，0 表示只有全量
+    uint64_t    digest;         // 写入时的状态摘要，0 表示没有记录
+};
+
+// 子进程调用，写 <snapshot_path>/slice.<timestamp>
+int snapshot_dump(time_t timestamp);
+// 删除 slice_keeptime 之前的本地快照，至少保留最新一个
+int snapshot_clear(time_t timestamp);
+
+// 从最新的有效本地快照及其增量恢复，不早于 min_time；没有可用快照返回 0 且 meta->time = 0
+int snapshot_load_latest(time_t min_time, struct snapshot_meta *meta);
+
+// 增量快照: 记录变化过的 sid，定时只序列化这些账户
+int init_snapshot(void);
+void snapshot_touch(uint64_t sid);
+// fork 写全量时开始记录新链的变化，子进程写成功后切换，之后的增量挂在新全量后面
+void snapshot_checkpoint_begin(time_t timestamp);
+void snapshot_checkpoint_end(bool success);
+// 最旧的有效全量快照的 end_oper_id，没有快照返回 0
+uint64_t snapshot_oldest_oper_id(void);
+
+# endif
+
@@ -1,71 +1,284 @@
 # include "me_stop.h"
 # include "me_tick.h"
+# include "me_trade.h"
 # include "me_market.h"
 # include "me_symbol.h"
 # include "me_balance.h"
 
 static nw_timer timer;
 static int flag = 0;
-static json_t *list;
+static bool *pending; // 按品种 id 标记收到新行情
+
+// 账户风险索引，按 headroom = equity + pnl - stop_out * margin 从小到大排序
+// headroom < 0 即 margin level 低于 stop_out，tick 时只需检查队列头部
+typedef struct risk_t {
+    uint64_t    sid;
+    fixed_t     base;       // equity - stop_out * margin，余额变化时重算
+    fixed_t     pnl;        // 与 BALANCE_TYPE_FLOAT 一致，tick 时按差额更新
+    bool        indexed;
+} risk_t;
+
+static dict_t *dict_risk;
+static skiplist_t *risk_list;
+static uint64_t *candidates;
+static size_t candidates_cap;
+static fixed_t stop_out_fx; // settings.stop_out 的定点数
 static int pos = 0; // 当前品种索引
 static int cap = 1; // 每次处理有效品种的数量
 static int start = 0; // 收到tick再开始风控
 
-static void float_profit(order_t *order, symbol_t *sym, mpd_t *close_price, mpd_t *profit_price)
+struct dict_sid_key {
+    uint64_t    sid;
+};
+
+static uint32_t dict_sid_hash_function(const void *key)
 {
-    uint64_t sid = order->sid;
-    // 1.计算价格差
-    mpd_t *profit = mpd_new(&mpd_ctx);
-    if (order->side == ORDER_SIDE_BUY) {
-        mpd_sub(profit, close_price, order->price, &mpd_ctx);
-    } else {
-        mpd_sub(profit, order->price, close_price, &mpd_ctx);
+    return dict_generic_hash_function(key, sizeof(struct dict_sid_key));
+}
+
+static int dict_sid_key_compare(const void *key1, const void *key2)
+{
+    const struct dict_sid_key *obj1 = key1;
+    const struct dict_sid_key *obj2 = key2;
+    if (obj1->sid == obj2->sid) {
+        return 0;
     }
-    mpd_mul(profit, profit, order->lot, &mpd_ctx);
-
-    // 2.折算USD
-    if (sym->profit_calc == PROFIT_CALC_FOREX) {
-        mpd_mul(profit, profit, sym->contract_size, &mpd_ctx);
-        if (sym->profit_type == PROFIT_TYPE_UB) {
-            mpd_div(profit, profit, close_price, &mpd_ctx);  // USDJPY
-        } else if (sym->profit_type == PROFIT_TYPE_AC) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // EURGBP
-        } else if (sym->profit_type == PROFIT_TYPE_CB) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // CADJPY
-        }
-    } else if (sym->profit_calc == PROFIT_CALC_CFD) {
-        mpd_mul(profit, profit, sym->contract_size, &mpd_ctx);
-        if (strcmp(sym->name, "HSI") == 0) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // USDHKD
-        } else if (strcmp(sym->name, "DAX") == 0) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // EURUSD
-        } else if (strcmp(sym->name, "UK100") == 0) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // GBPUSD
-        } else if (strcmp(sym->name, "JP225") == 0) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // USDJPY
-        }
+    return 1;
+}
+
+static void *dict_sid_key_dup(const void *key)
+{
+    struct dict_sid_key *obj = malloc(sizeof(struct dict_sid_key));
+    memcpy(obj, key, sizeof(struct dict_sid_key));
+    return obj;
+}
+
+static void dict_sid_key_free(void *key)
+{
+    free(key);
+}
+
+static int risk_compare(const void *value1, const void *value2)
+{
+    const risk_t *r1 = value1;
+    const risk_t *r2 = value2;
+
+    if (r1->sid == r2->sid)
+        return 0;
+
+    fixed_t h1 = r1->base + r1->pnl;
+    fixed_t h2 = r2->base + r2->pnl;
+    if (h1 != h2)
+        return h1 > h2 ? 1 : -1;
+    return r1->sid > r2->sid ? 1 : -1;
+}
+
+static void dict_risk_val_free(void *val)
+{
+    free(val);
+}
+
+static void risk_unlink(risk_t *r)
+{
+    if (!r->indexed)
+        return;
+
+    skiplist_node *node = skiplist_find(risk_list, r);
+    if (node)
+        skiplist_delete(risk_list, node);
+    r->indexed = false;
+}
+
+static void risk_link(risk_t *r)
+{
+    if (skiplist_insert(risk_list, r) == NULL) {
+        log_error("[stop out] index %"PRIu64" fail", r->sid);
+        return;
+    }
+    r->indexed = true;
+}
+
+static risk_t *get_risk(uint64_t sid)
+{
+    struct dict_sid_key key = { .sid = sid };
+    dict_entry *entry = dict_find(dict_risk, &key);
+    if (entry)
+        return entry->val;
+    return NULL;
+}
+
+static risk_t *add_risk(uint64_t sid)
+{
+    risk_t *r = malloc(sizeof(risk_t));
+    if (r == NULL)
+        return NULL;
+    memset(r, 0, sizeof(risk_t));
+    r->sid = sid;
+    struct dict_sid_key key = { .sid = sid };
+    if (dict_add(dict_risk, &key, r) == NULL) {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+static void del_risk(risk_t *r)
+{
+    risk_unlink(r);
+    struct dict_sid_key key = { .sid = r->sid };
+    dict_delete(dict_risk, &key);
+}
+
+// 按定点数重算 base 和 pnl，没有占用保证金的账户从索引和字典中删除
+// 返回 false 时 r 已释放
+static bool risk_reload(risk_t *r)
+{
+    mpd_t *margin = balance_get_v2(r->sid, BALANCE_TYPE_MARGIN);
+    fixed_t margin_fx = margin ? fixed_from_mpd(margin) : 0;
+    if (margin_fx == 0) {
+        del_risk(r);
+        return false;
+    }
+
+    mpd_t *equity = balance_get_v2(r->sid, BALANCE_TYPE_EQUITY);
+    mpd_t *pnl = balance_get_v2(r->sid, BALANCE_TYPE_FLOAT);
+
+    risk_unlink(r);
+    r->pnl = pnl ? fixed_from_mpd(pnl) : 0;
+    r->base = (equity ? fixed_from_mpd(equity) : 0) - fixed_mul(stop_out_fx, margin_fx);
+    risk_link(r);
+    return true;
+}
+
+void stop_out_pnl(uint64_t sid, fixed_t delta)
+{
+    if (dict_risk == NULL)
+        return;
+
+    risk_t *r = get_risk(sid);
+    if (r == NULL) {
+        if (balance_get_v2(sid, BALANCE_TYPE_MARGIN) == NULL)
+            return;
+        r = add_risk(sid);
+        if (r)
+            risk_reload(r);
+        return;
+    }
+
+    if (delta == 0)
+        return;
+
+    if (r->indexed) {
+        risk_unlink(r);
+        r->pnl += delta;
+        risk_link(r);
     } else {
-        mpd_mul(profit, profit, sym->tick_price, &mpd_ctx);
-        mpd_div(profit, profit, sym->tick_size, &mpd_ctx);
+        r->pnl += delta;
+    }
+}
+
+void stop_out_touch(uint64_t sid)
+{
+    if (dict_risk == NULL)
+        return;
+
+    risk_t *r = get_risk(sid);
+    if (r == NULL) {
+        if (balance_get_v2(sid, BALANCE_TYPE_MARGIN) == NULL)
+            return;
+        r = add_risk(sid);
+        if (r == NULL)
+            return;
+    }
+    risk_reload(r);
+}
+
+// 强平候选按当前盈亏排成小顶堆，亏损最大的先平
+// 强平过程中没有新行情，其余持仓的盈亏不变，堆只需建一次
+static order_t **heap;
+static size_t heap_len;
+static size_t heap_cap;
+
+static bool heap_less(const order_t *o1, const order_t *o2)
+{
+    if (o1->fx_profit != o2->fx_profit)
+        return o1->fx_profit < o2->fx_profit;
+    return o1->id < o2->id;
+}
+
+static void heap_down(size_t i)
+{
+    while (true) {
+        size_t min = i;
+        size_t l = 2 * i + 1;
+        size_t r = 2 * i + 2;
+        if (l < heap_len && heap_less(heap[l], heap[min]))
+            min = l;
+        if (r < heap_len && heap_less(heap[r], heap[min]))
+            min = r;
+        if (min == i)
+            return;
+
+        order_t *tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
     }
-    mpd_rescale(profit, profit, -2, &mpd_ctx);
+}
 
-    // 3.撤销上次盈亏
-    if (mpd_cmp(order->profit, mpd_zero, &mpd_ctx) != 0) {
-        balance_sub_float(sid, BALANCE_TYPE_FLOAT, order->profit);
+static int heap_build(uint64_t sid)
+{
+    heap_len = 0;
+    skiplist_t *list = market_get_positions(sid);
+    if (list == NULL)
+        return 0;
+
+    if (heap_cap < skiplist_len(list)) {
+        order_t **orders = realloc(heap, skiplist_len(list) * sizeof(order_t *));
+        if (orders == NULL)
+            return -__LINE__;
+        heap = orders;
+        heap_cap = skiplist_len(list);
     }
 
-    // 4.更新这次盈亏
-    mpd_copy(order->profit, profit, &mpd_ctx);
-    mpd_copy(order->close_price, close_price, &mpd_ctx);
-    mpd_copy(order->profit_price, profit_price, &mpd_ctx);
+    skiplist_node *node;
+    skiplist_iter *iter = skiplist_get_iterator(list);
+    while ((node = skiplist_next(iter)) != NULL) {
+        order_t *order = node->value;
+        if (strcmp(order->symbol, "USDHKD") == 0)
+            continue;
+
+        // 如果平仓价格为0，说明还没收到过行情，跳过这笔订单
+        order_refresh_fixed(order);
+        if (order->fx_close_price <= 0)
+            continue;
+        heap[heap_len++] = order;
+    }
+    skiplist_release_iterator(iter);
+
+    for (size_t i = heap_len / 2; i-- > 0;)
+        heap_down(i);
+    return 0;
+}
+
+static order_t *heap_pop(void)
+{
+    if (heap_len == 0)
+        return NULL;
 
-    balance_add_float(sid, BALANCE_TYPE_FLOAT, profit);
-    mpd_del(profit);
+    order_t *order = heap[0];
+    heap[0] = heap[--heap_len];
+    heap_down(0);
+    return order;
 }
 
 static void margin_stop_out(uint64_t sid)
 { 
+    if (heap_build(sid) < 0) {
+        log_error("[stop out] build heap fail: %"PRIu64"", sid);
+        return;
+    }
+
     while (true) {
         mpd_t *margin = balance_get_v2(sid, BALANCE_TYPE_MARGIN);
         // 无持仓单
@@ -93,58 +306,24 @@ static void margin_stop_out(uint64_t sid)
         comment = sdscatprintf(comment, "so:%s/%s/%s", mpd_to_sci(ml, 0), temp, mpd_to_sci(margin, 0));
         log_info("## [%"PRIu64"] stop out comment = %s", sid, comment);
 
-        mpd_t *profit = mpd_new(&mpd_ctx);
-        mpd_copy(profit, mpd_zero, &mpd_ctx);
-        uint64_t id = 0;
-        char *so_symbol = "";
-
-        for (int i = 0; i < configs.symbol_num; ++i) {
-            const char* symbol = configs.symbols[i].name;
-            if (strcmp(symbol, "USDHKD") == 0)
-                continue;
-
-            market_t *m = get_market(symbol);
-            if (m == NULL)
-                continue;
-
-            skiplist_t *list = market_get_order_list_v2(m, sid);
-            if (list == NULL)
-                continue;
-
-            skiplist_node *node;
-            skiplist_iter *iter = skiplist_get_iterator(list);
-            while ((node = skiplist_next(iter)) != NULL) {
-                order_t *order = node->value;
-                if (id == 0 || mpd_cmp(profit, order->profit, &mpd_ctx) > 0) {
-                    // 如果平仓价格为0，说明还没收到过行情，跳过这笔订单
-                    if (mpd_cmp(order->close_price, mpd_zero, &mpd_ctx) > 0) {
-                        mpd_copy(profit, order->profit, &mpd_ctx);
-                        id = order->id;
-                        so_symbol = strdup(order->symbol);
-                    }
-                }
-            }
-            skiplist_release_iterator(iter);
-        }
-
-        log_info("## [%"PRIu64"] stop out symbol = %s, id = %"PRIu64"", sid, so_symbol, id);
-        if (id == 0) {
-            mpd_del(profit);
+        order_t *order = heap_pop();
+        log_info("## [%"PRIu64"] stop out symbol = %s, id = %"PRIu64"", sid, order ? order->symbol : "", order ? order->id : 0);
+        if (order == NULL) {
+            mpd_del(ml);
             free(temp);
             sdsfree(comment);
             break;
         }
 
-        market_t *m = get_market(so_symbol);
-        order_t *order = market_get_order(m, id);
+        uint64_t id = order->id;
+        market_t *m = get_market(order->symbol);
         double finish_time = current_timestamp();
         int ret = market_stop_out_hedged(m, sid, order, comment, finish_time);
         if (ret < 0)
-            log_error("market_stop_out fail: %"PRIu64"", order->id);
-    
-        mpd_del(profit);
+            log_error("market_stop_out fail: %"PRIu64"", id);
+
+        mpd_del(ml);
         free(temp);
-        free(so_symbol);
         sdsfree(comment);
     }
 }
@@ -171,130 +350,72 @@ static void flush_list(void)
 
         const char* symbol = configs.symbols[pos].name;
 //log_info("## [%d].symbol = %s ##", pos, symbol);
-        if (json_object_get(list, symbol) == NULL) {
+        if (!pending[pos]) {
 //log_info("## continue-11 ##");
             continue;
 	}
 
-        // bid
-        mpd_t *bid = mpd_new(&mpd_ctx);
-        mpd_copy(bid, symbol_bid(symbol), &mpd_ctx);
-        if (mpd_cmp(bid, mpd_zero, &mpd_ctx) <= 0) {
-            mpd_del(bid);
+        fixed_t fx_bid = tick_bid_fixed(pos);
+        fixed_t fx_ask = tick_ask_fixed(pos);
+        if (fx_bid <= 0) {
 //log_info("## continue-22 ##");
             continue;
         }
 
-        // ask
-        mpd_t *ask = mpd_new(&mpd_ctx);
-        mpd_copy(ask, symbol_ask(symbol), &mpd_ctx);
-
         // profit price
-        mpd_t *profit_bid_price = mpd_new(&mpd_ctx);
-        mpd_t *profit_ask_price = mpd_new(&mpd_ctx);
-        mpd_copy(profit_bid_price, mpd_one, &mpd_ctx);
-        mpd_copy(profit_ask_price, mpd_one, &mpd_ctx);
-
-        symbol_t *sym = get_symbol(symbol);
-        if (sym->profit_calc == PROFIT_CALC_FOREX) {
-            if (sym->profit_type == PROFIT_TYPE_AC || sym->profit_type == PROFIT_TYPE_CB) {
-                mpd_copy(profit_bid_price, symbol_bid(sym->profit_symbol), &mpd_ctx);
-                mpd_copy(profit_ask_price, symbol_ask(sym->profit_symbol), &mpd_ctx);
-            }
-        } else {
-            if (strcmp(sym->name, "HSI") == 0) {
-                mpd_copy(profit_bid_price, symbol_bid("USDHKD"), &mpd_ctx);
-                mpd_copy(profit_ask_price, symbol_ask("USDHKD"), &mpd_ctx);
-            } else if (strcmp(sym->name, "DAX") == 0) {
-                mpd_copy(profit_bid_price, symbol_bid("EURUSD"), &mpd_ctx);
-                mpd_copy(profit_ask_price, symbol_ask("EURUSD"), &mpd_ctx);
-            } else if (strcmp(sym->name, "UK100") == 0) {
-                mpd_copy(profit_bid_price, symbol_bid("GBPUSD"), &mpd_ctx);
-                mpd_copy(profit_ask_price, symbol_ask("GBPUSD"), &mpd_ctx);
-            } else if (strcmp(sym->name, "JP225") == 0) {
-                mpd_copy(profit_bid_price, symbol_bid("USDJPY"), &mpd_ctx);
-                mpd_copy(profit_ask_price, symbol_ask("USDJPY"), &mpd_ctx);
-            }
-        }
-
-        if (mpd_cmp(profit_bid_price, mpd_zero, &mpd_ctx) <= 0) {
-            mpd_del(bid);
-            mpd_del(ask);
-            mpd_del(profit_bid_price);
-            mpd_del(profit_ask_price);
+        symbol_t *sym = &configs.symbols[pos];
+        fixed_t fx_profit_bid = symbol_profit_price_fixed(sym, ORDER_SIDE_BUY);
+        fixed_t fx_profit_ask = symbol_profit_price_fixed(sym, ORDER_SIDE_SELL);
+        if (fx_profit_bid <= 0)
             continue;
-        }
 
-        json_object_del(list, symbol);
+        pending[pos] = false;
         count++;
-        // TODO 每次最多处理 10000 个帐号的风控
-        uint64_t *sids = (uint64_t *) malloc(10000 * sizeof(uint64_t));
-        int total = 0;
-        uint64_t sid = 0;
 
         market_t *m = get_market(symbol);
-        dict_iterator *iter = dict_get_iterator(m->users);
+        dict_iterator *iter = dict_get_iterator(m->exposures);
         dict_entry *entry;
 
+        // 1.按 (sid, side) 汇总更新浮动盈亏，单笔盈亏在查询/平仓时再算
+        // 盈亏变化通过 stop_out_pnl 同步到风险索引
         while ((entry = dict_next(iter)) != NULL) {
-            // 1.更新浮动盈亏
-            skiplist_node *node;
-            skiplist_iter *it = skiplist_get_iterator(entry->val);
-            while ((node = skiplist_next(it)) != NULL) {
-                order_t *order = node->value;
-                if (sid == 0)
-                    sid = order->sid;
-
-                if (order->side == ORDER_SIDE_BUY) {
-                    float_profit(order, sym, bid, profit_bid_price);
-                } else {
-                    float_profit(order, sym, ask, profit_ask_price);
-                }
-            }
-            skiplist_release_iterator(it);
+            market_revalue_exposure(entry->val, fx_bid, fx_ask, fx_profit_bid, fx_profit_ask);
+        }
+        dict_release_iterator(iter);
 
-            // 2.判断 margin level
-            mpd_t *balance = balance_get_v2(sid, BALANCE_TYPE_BALANCE);
-            mpd_t *pnl = balance_get_v2(sid, BALANCE_TYPE_FLOAT);
-            if (pnl == NULL)
-                continue;
+        // follower 只重估，不强平
+        if (risk_list == NULL)
+            continue;
 
-            if (mpd_cmp(balance, mpd_zero, &mpd_ctx) > 0 && mpd_cmp(pnl, mpd_zero, &mpd_ctx) >= 0) {
-                sid = 0;
+        // 2.只取 headroom < 0 的账户，强平会修改索引，先收集
+        size_t total = 0;
+        skiplist_node *node;
+        skiplist_iter *it = skiplist_get_iterator(risk_list);
+        while ((node = skiplist_next(it)) != NULL) {
+            risk_t *r = node->value;
+            if (r->base + r->pnl >= 0)
+                break;
+
+            mpd_t *balance = balance_get_v2(r->sid, BALANCE_TYPE_BALANCE);
+            if (balance && mpd_cmp(balance, mpd_zero, &mpd_ctx) > 0 && r->pnl >= 0)
                 continue;
-            }
 
-            mpd_t *ml = mpd_new(&mpd_ctx);
-            mpd_t *equity = balance_get_v2(sid, BALANCE_TYPE_EQUITY);
-            mpd_add(ml, equity, pnl, &mpd_ctx);
-            mpd_t *margin = balance_get_v2(sid, BALANCE_TYPE_MARGIN);
-            mpd_div(ml, ml, margin, &mpd_ctx);
-
-            if (mpd_cmp(ml, settings.stop_out, &mpd_ctx) < 0) {
-                // 3.符合条件，稍后处理 
-                sids[total] = sid;
-                total++;
-
-                if (total > 9999) {
-                    log_error("[stop out] total > 9999");
+            if (total == candidates_cap) {
+                size_t cap = candidates_cap ? candidates_cap * 2 : 1024;
+                uint64_t *sids = realloc(candidates, cap * sizeof(uint64_t));
+                if (sids == NULL)
                     break;
-                }
+                candidates = sids;
+                candidates_cap = cap;
             }
-            mpd_del(ml);
-            sid = 0;
+            candidates[total++] = r->sid;
         }
-        dict_release_iterator(iter);
-
-        mpd_del(bid);
-        mpd_del(ask);
-        mpd_del(profit_bid_price);
-        mpd_del(profit_ask_price);
+        skiplist_release_iterator(it);
 
-        // 4.stop out
-        for (int j = 0; j < total; ++j) {
-             margin_stop_out(sids[j]);
+        // 3.stop out
+        for (size_t j = 0; j < total; ++j) {
+             margin_stop_out(candidates[j]);
         }
-        free(sids);
     }
 }
 
@@ -307,18 +428,53 @@ static void on_timer(nw_timer *t, void *privdata)
     }
 }
 
-int init_stop_out(void)
+int init_revalue(void)
 {
-    list = json_object();
+    if (pending == NULL) {
+        pending = malloc(sizeof(bool) * configs.symbol_num);
+        if (pending == NULL)
+            return -__LINE__;
+        memset(pending, 0, sizeof(bool) * configs.symbol_num);
+    }
 
     nw_timer_set(&timer, 0.1, true, on_timer, NULL);
     nw_timer_start(&timer);
     return 0;
 }
 
-int append_stop_symbol(const char *symbol)
+int init_stop_out(void)
+{
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function    = dict_sid_hash_function;
+    dt.key_compare      = dict_sid_key_compare;
+    dt.key_dup          = dict_sid_key_dup;
+    dt.key_destructor   = dict_sid_key_free;
+    dt.val_destructor   = dict_risk_val_free;
+
+    dict_risk = dict_create(&dt, 1024);
+    if (dict_risk == NULL)
+        return -__LINE__;
+
+    skiplist_type st;
+    memset(&st, 0, sizeof(st));
+    st.compare = risk_compare;
+
+    risk_list = skiplist_create(&st);
+    if (risk_list == NULL)
+        return -__LINE__;
+
+    stop_out_fx = fixed_from_mpd(settings.stop_out);
+
+    return init_revalue();
+}
+
+int append_stop_symbol(uint32_t id)
 {
+    if (id >= configs.symbol_num)
+        return -__LINE__;
+
     start = 1;
-    json_object_set(list, symbol, json_integer(0));
+    pending[id] = true;
     return 0;
 }
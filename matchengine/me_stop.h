@@ -2,10 +2,18 @@
 # define _ME_STOP_H_
 
 # include "me_config.h"
+# include "ut_fixed.h"
 
+// 只按行情重估浮动盈亏，follower 使用；init_stop_out 在此之上做强平检查
+int init_revalue(void);
 int init_stop_out(void);
 
-int append_stop_symbol(const char *symbol);
+// id 为品种在 configs.symbols 中的下标
+int append_stop_symbol(uint32_t id);
+
+// 账户风险索引，浮动盈亏差额和余额变化时调用
+void stop_out_pnl(uint64_t sid, fixed_t delta);
+void stop_out_touch(uint64_t sid);
 
 # endif
 
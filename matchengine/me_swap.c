@@ -57,7 +57,7 @@ static void make_swap(int wday)
 
     for (int i = 0; i < configs.symbol_num; ++i) {
         market_t *m = get_market(configs.symbols[i].name);
-        symbol_t *sym = get_symbol(configs.symbols[i].name);
+        symbol_t *sym = &configs.symbols[i];
 
         skiplist_node *node;
         skiplist_iter *iter = skiplist_get_iterator(m->buys);
@@ -70,23 +70,7 @@ static void make_swap(int wday)
                 mpd_mul(swaps, order->swap, days_t, &mpd_ctx);
                 mpd_mul(swaps, swaps, order->lot, &mpd_ctx);
 
-                if (sym->margin_calc == MARGIN_CALC_FOREX) {
-                    if (sym->margin_type == MARGIN_TYPE_AU) {
-                        mpd_mul(swaps, swaps, order->price, &mpd_ctx);        // EURUSD
-                    } else if (sym->margin_type == MARGIN_TYPE_AC) {
-                        mpd_mul(swaps, swaps, order->margin_price, &mpd_ctx); // EURGBP
-                    } else if (sym->margin_type == MARGIN_TYPE_BC) {
-                        mpd_div(swaps, swaps, order->margin_price, &mpd_ctx); // CADJBP
-                    }
-                } else if (strcmp(sym->name, "HSI") == 0) {
-                    mpd_div(swaps, swaps, order->margin_price, &mpd_ctx); // USDHKD
-                } else if (strcmp(sym->name, "DAX") == 0) {
-                    mpd_mul(swaps, swaps, order->margin_price, &mpd_ctx); // EURUSD
-                } else if (strcmp(sym->name, "UK100") == 0) {
-                    mpd_mul(swaps, swaps, order->margin_price, &mpd_ctx); // GBPUSD
-                } else if (strcmp(sym->name, "JP225") == 0) {
-                    mpd_div(swaps, swaps, order->margin_price, &mpd_ctx); // USDJPY
-                }
+                sym->swap_kernel(swaps, sym, order->price, order->margin_price);
 
                 mpd_rescale(swaps, swaps, -2, &mpd_ctx);
                 mpd_sub(delta, swaps, order->swaps, &mpd_ctx);
@@ -110,23 +94,7 @@ log_info("## [%"PRIu64"] buy [%s] swaps = %s", order->id, sym->name, mpd_to_sci(
                 mpd_mul(swaps, order->swap, days_t, &mpd_ctx);
                 mpd_mul(swaps, swaps, order->lot, &mpd_ctx);
 
-                if (sym->margin_calc == MARGIN_CALC_FOREX) {
-                    if (sym->margin_type == MARGIN_TYPE_AU) {
-                        mpd_mul(swaps, swaps, order->price, &mpd_ctx);        // EURUSD
-                    } else if (sym->margin_type == MARGIN_TYPE_AC) {
-                        mpd_mul(swaps, swaps, order->margin_price, &mpd_ctx); // EURGBP
-                    } else if (sym->margin_type == MARGIN_TYPE_BC) {
-                        mpd_div(swaps, swaps, order->margin_price, &mpd_ctx); // CADJBP
-                    }
-                } else if (strcmp(sym->name, "HSI") == 0) {
-                    mpd_div(swaps, swaps, order->margin_price, &mpd_ctx); // USDHKD
-                } else if (strcmp(sym->name, "DAX") == 0) {
-                    mpd_mul(swaps, swaps, order->margin_price, &mpd_ctx); // EURUSD
-                } else if (strcmp(sym->name, "UK100") == 0) {
-                    mpd_mul(swaps, swaps, order->margin_price, &mpd_ctx); // GBPUSD
-                } else if (strcmp(sym->name, "JP225") == 0) {
-                    mpd_div(swaps, swaps, order->margin_price, &mpd_ctx); // USDJPY
-                }
+                sym->swap_kernel(swaps, sym, order->price, order->margin_price);
 
                 mpd_rescale(swaps, swaps, -2, &mpd_ctx);
                 mpd_sub(delta, swaps, order->swaps, &mpd_ctx);
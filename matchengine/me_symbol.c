@@ -1,11 +1,26 @@
 # include "me_symbol.h"
 # include "me_config.h"
+# include "me_tick.h"
 
 struct configs configs;
 
+// 指数 CFD 的折算品种，ask_buy 为 buy 平仓时用 ask 折算盈亏 (沿用旧版平仓逻辑)
+static const struct {
+    const char *name;
+    const char *quote;
+    int conv;
+    bool ask_buy;
+} cfd_quotes[] = {
+    { "HSI",   "USDHKD", CONV_DIV, false },
+    { "DAX",   "EURUSD", CONV_MUL, false },
+    { "UK100", "GBPUSD", CONV_MUL, true  },
+    { "JP225", "USDJPY", CONV_DIV, true  },
+};
+
 static dict_t *dict_group;
 
 struct group_type {
+    int id;
     int leverage;
 };
 
@@ -43,52 +58,11 @@ static void group_dict_val_free(void *val)
     free(val);
 }
 
-static dict_t *dict_fee;
-
-struct fee_type {
-    mpd_t *percentage;
-    mpd_t *fee;
-    mpd_t *swap_long;
-    mpd_t *swap_short;
-};
-
-static uint32_t fee_dict_hash_function(const void *key)
-{
-    return dict_generic_hash_function(key, strlen(key));
-}
-
-static void *fee_dict_key_dup(const void *key)
-{
-    return strdup(key);
-}
-
-static void *fee_dict_val_dup(const void *val)
-{
-    struct fee_type *obj = malloc(sizeof(struct fee_type));
-    if (obj == NULL)
-        return NULL;
-    memcpy(obj, val, sizeof(struct fee_type));
-    return obj;
-}
-
-static int fee_dict_key_compare(const void *key1, const void *key2)
-{
-    return strcmp(key1, key2);
-}
-
-static void fee_dict_key_free(void *key)
-{
-    free(key);
-}
+// 名字只在 RPC 入口解析一次，之后都用下标
+static dict_t *dict_symbol;
 
-static void fee_dict_val_free(void *val)
-{
-    struct fee_type *ft = val;
-    mpd_del(ft->fee);
-    mpd_del(ft->swap_long);
-    mpd_del(ft->swap_short);
-    free(val);
-}
+// [group_id * symbol_num + symbol_id]
+static struct fee_entry *fee_table;
 
 static dict_t *dict_week;
 
@@ -149,17 +123,15 @@ static int init_dict(void)
     if (dict_group == NULL)
         return -__LINE__;
 
-    dict_types fee_dt;
-    memset(&fee_dt, 0, sizeof(fee_dt));
-    fee_dt.hash_function  = fee_dict_hash_function;
-    fee_dt.key_compare    = fee_dict_key_compare;
-    fee_dt.key_dup        = fee_dict_key_dup;
-    fee_dt.key_destructor = fee_dict_key_free;
-    fee_dt.val_dup        = fee_dict_val_dup;
-    fee_dt.val_destructor = fee_dict_val_free;
-
-    dict_fee = dict_create(&fee_dt, 64);
-    if (dict_fee == NULL)
+    dict_types symbol_dt;
+    memset(&symbol_dt, 0, sizeof(symbol_dt));
+    symbol_dt.hash_function  = group_dict_hash_function;
+    symbol_dt.key_compare    = group_dict_key_compare;
+    symbol_dt.key_dup        = group_dict_key_dup;
+    symbol_dt.key_destructor = group_dict_key_free;
+
+    dict_symbol = dict_create(&symbol_dt, 64);
+    if (dict_symbol == NULL)
         return -__LINE__;
 
     dict_types week_dt;
@@ -225,7 +197,7 @@ static int load_symbol_from_db(MYSQL *conn)
     size_t num_rows = mysql_num_rows(result);
 
     configs.symbol_num = num_rows;
-    configs.symbols = malloc(sizeof(struct symbol) * num_rows);
+    configs.symbols = calloc(num_rows, sizeof(struct symbol));
 
     mpd_t *hundred = mpd_new(&mpd_ctx);
     mpd_set_string(hundred, "100", &mpd_ctx);
@@ -263,6 +235,9 @@ static int load_symbol_from_db(MYSQL *conn)
         configs.symbols[i].friday = strdup(friday);
         // c = contract_size / 100
         mpd_div(configs.symbols[i].c, configs.symbols[i].c, hundred, &mpd_ctx);
+        configs.symbols[i].fx_contract_size = fixed_from_mpd(configs.symbols[i].contract_size);
+        configs.symbols[i].fx_tick_size = fixed_from_mpd(configs.symbols[i].tick_size);
+        configs.symbols[i].fx_tick_price = fixed_from_mpd(configs.symbols[i].tick_price);
 
         if (margin_calc == MARGIN_CALC_FOREX) {
             if (strcmp(currency, "USD") == 0) {
@@ -280,6 +255,10 @@ static int load_symbol_from_db(MYSQL *conn)
                 strcat(ms, currency);
                 configs.symbols[i].margin_symbol = strdup(strcat(ms, "USD"));
             }
+            if (configs.symbols[i].margin_type == MARGIN_TYPE_AC)
+                configs.symbols[i].margin_conv = CONV_MUL;
+            else if (configs.symbols[i].margin_type == MARGIN_TYPE_BC)
+                configs.symbols[i].margin_conv = CONV_DIV;
         } else {
             configs.symbols[i].margin_type = 0;
         }
@@ -303,10 +282,30 @@ static int load_symbol_from_db(MYSQL *conn)
                     configs.symbols[i].profit_symbol = strdup(strcat(ps, "USD"));
                 }
             }
+            if (configs.symbols[i].profit_type == PROFIT_TYPE_AC)
+                configs.symbols[i].profit_conv = CONV_MUL;
+            else if (configs.symbols[i].profit_type == PROFIT_TYPE_CB)
+                configs.symbols[i].profit_conv = CONV_DIV;
         } else {
             configs.symbols[i].profit_type = 0;
         }
 
+        if (margin_calc != MARGIN_CALC_FOREX || profit_calc == PROFIT_CALC_CFD) {
+            for (size_t j = 0; j < sizeof(cfd_quotes) / sizeof(cfd_quotes[0]); ++j) {
+                if (strcmp(name, cfd_quotes[j].name) != 0)
+                    continue;
+                if (margin_calc != MARGIN_CALC_FOREX) {
+                    configs.symbols[i].margin_conv = cfd_quotes[j].conv;
+                    configs.symbols[i].margin_symbol = strdup(cfd_quotes[j].quote);
+                }
+                if (profit_calc == PROFIT_CALC_CFD) {
+                    configs.symbols[i].profit_conv = cfd_quotes[j].conv;
+                    configs.symbols[i].profit_symbol = strdup(cfd_quotes[j].quote);
+                    configs.symbols[i].profit_ask_buy = cfd_quotes[j].ask_buy;
+                }
+            }
+        }
+
     }
 
     mpd_del(hundred);
@@ -359,23 +358,243 @@ static struct group_type *get_group_type(const char *group)
 
 symbol_t *get_symbol(const char *name)
 {
-    for (int i = 0; i < configs.symbol_num; ++i) {
-        if (strcmp(name, configs.symbols[i].name) == 0)
-            return &(configs.symbols[i]);
+    dict_entry *entry = dict_find(dict_symbol, name);
+    if (entry == NULL)
+        return NULL;
+
+    return entry->val;
+}
+
+int get_symbol_id(const char *name)
+{
+    symbol_t *sym = get_symbol(name);
+    return sym ? sym->id : -1;
+}
+
+int get_group_id(const char *group)
+{
+    struct group_type *at = get_group_type(group);
+    return at ? at->id : -1;
+}
+
+struct fee_entry *get_fee_entry(int group_id, int symbol_id)
+{
+    if (group_id < 0 || group_id >= configs.group_num || symbol_id < 0 || symbol_id >= configs.symbol_num)
+        return NULL;
+    return &fee_table[group_id * configs.symbol_num + symbol_id];
+}
+
+// 开仓占用保证金的折算价格，buy 用 ask，sell 用 bid
+mpd_t *symbol_margin_price(symbol_t *sym, uint32_t side)
+{
+    if (sym->margin_conv == CONV_NONE)
+        return mpd_one;
+    if (sym->margin_quote < 0)
+        return mpd_zero;
+    return side == ORDER_SIDE_BUY ? tick_ask(sym->margin_quote) : tick_bid(sym->margin_quote);
+}
+
+// 平仓盈亏的折算价格，buy 用 bid，sell 用 ask，profit_ask_buy 的品种相反
+mpd_t *symbol_profit_price(symbol_t *sym, uint32_t side)
+{
+    if (sym->profit_conv == CONV_NONE)
+        return mpd_one;
+    if (sym->profit_quote < 0)
+        return mpd_zero;
+    bool bid = (side == ORDER_SIDE_BUY) != sym->profit_ask_buy;
+    return bid ? tick_bid(sym->profit_quote) : tick_ask(sym->profit_quote);
+}
+
+fixed_t symbol_profit_price_fixed(symbol_t *sym, uint32_t side)
+{
+    if (sym->profit_conv == CONV_NONE)
+        return FIXED_ONE;
+    if (sym->profit_quote < 0)
+        return 0;
+    bool bid = (side == ORDER_SIDE_BUY) != sym->profit_ask_buy;
+    return bid ? tick_bid_fixed(sym->profit_quote) : tick_ask_fixed(sym->profit_quote);
+}
+
+// 保证金内核: value = lots * contract_size / leverage * percentage / 100
+static void margin_none(mpd_t *value, symbol_t *sym, mpd_t *price, mpd_t *quote_price)
+{
+}
+
+static void margin_price(mpd_t *value, symbol_t *sym, mpd_t *price, mpd_t *quote_price)
+{
+    mpd_mul(value, value, price, &mpd_ctx);         // EURUSD
+}
+
+static void margin_mul(mpd_t *value, symbol_t *sym, mpd_t *price, mpd_t *quote_price)
+{
+    mpd_mul(value, value, quote_price, &mpd_ctx);   // EURGBP
+}
+
+static void margin_div(mpd_t *value, symbol_t *sym, mpd_t *price, mpd_t *quote_price)
+{
+    mpd_div(value, value, quote_price, &mpd_ctx);   // CADJPY
+}
+
+static void margin_cfd_mul(mpd_t *value, symbol_t *sym, mpd_t *price, mpd_t *quote_price)
+{
+    mpd_mul(value, value, quote_price, &mpd_ctx);   // DAX
+    mpd_mul(value, value, price, &mpd_ctx);
+}
+
+static void margin_cfd_div(mpd_t *value, symbol_t *sym, mpd_t *price, mpd_t *quote_price)
+{
+    mpd_div(value, value, quote_price, &mpd_ctx);   // HSI
+    mpd_mul(value, value, price, &mpd_ctx);
+}
+
+// 盈亏内核: value = (close_price - open_price) * lots
+static void profit_contract(mpd_t *value, symbol_t *sym, mpd_t *price, mpd_t *quote_price)
+{
+    mpd_mul(value, value, sym->contract_size, &mpd_ctx);
+}
+
+static void profit_ub(mpd_t *value, symbol_t *sym, mpd_t *price, mpd_t *quote_price)
+{
+    mpd_mul(value, value, sym->contract_size, &mpd_ctx);
+    mpd_div(value, value, price, &mpd_ctx);         // USDJPY
+}
+
+static void profit_mul(mpd_t *value, symbol_t *sym, mpd_t *price, mpd_t *quote_price)
+{
+    mpd_mul(value, value, sym->contract_size, &mpd_ctx);
+    mpd_mul(value, value, quote_price, &mpd_ctx);   // EURGBP, DAX
+}
+
+static void profit_div(mpd_t *value, symbol_t *sym, mpd_t *price, mpd_t *quote_price)
+{
+    mpd_mul(value, value, sym->contract_size, &mpd_ctx);
+    mpd_div(value, value, quote_price, &mpd_ctx);   // CADJPY, HSI
+}
+
+static void profit_futures(mpd_t *value, symbol_t *sym, mpd_t *price, mpd_t *quote_price)
+{
+    mpd_mul(value, value, sym->tick_price, &mpd_ctx);
+    mpd_div(value, value, sym->tick_size, &mpd_ctx);
+}
+
+// 定点盈亏内核，profit 为 2 * FIXED_PREC 精度
+static __int128 fx_profit_contract(symbol_t *sym, __int128 profit, fixed_t close_price, fixed_t profit_price)
+{
+    return fixed_div128(profit * sym->fx_contract_size, FIXED_ONE);
+}
+
+static __int128 fx_profit_ub(symbol_t *sym, __int128 profit, fixed_t close_price, fixed_t profit_price)
+{
+    profit = fixed_div128(profit * sym->fx_contract_size, FIXED_ONE);
+    return fixed_div128(profit * FIXED_ONE, close_price);
+}
+
+static __int128 fx_profit_mul(symbol_t *sym, __int128 profit, fixed_t close_price, fixed_t profit_price)
+{
+    profit = fixed_div128(profit * sym->fx_contract_size, FIXED_ONE);
+    return fixed_div128(profit * profit_price, FIXED_ONE);
+}
+
+static __int128 fx_profit_div(symbol_t *sym, __int128 profit, fixed_t close_price, fixed_t profit_price)
+{
+    profit = fixed_div128(profit * sym->fx_contract_size, FIXED_ONE);
+    return fixed_div128(profit * FIXED_ONE, profit_price);
+}
+
+static __int128 fx_profit_futures(symbol_t *sym, __int128 profit, fixed_t close_price, fixed_t profit_price)
+{
+    profit = fixed_div128(profit * sym->fx_tick_price, FIXED_ONE);
+    return fixed_div128(profit * FIXED_ONE, sym->fx_tick_size);
+}
+
+// 按品种配置选定内核，热路径直接调用，不再逐次判断 calc / type
+static void select_kernels(symbol_t *sym)
+{
+    if (sym->margin_calc == MARGIN_CALC_FOREX) {
+        if (sym->margin_type == MARGIN_TYPE_AU) {
+            sym->margin_kernel = margin_price;
+        } else if (sym->margin_conv == CONV_MUL) {
+            sym->margin_kernel = margin_mul;
+        } else if (sym->margin_conv == CONV_DIV) {
+            sym->margin_kernel = margin_div;
+        } else {
+            sym->margin_kernel = margin_none;
+        }
+    } else {
+        if (sym->margin_conv == CONV_MUL) {
+            sym->margin_kernel = margin_cfd_mul;
+        } else if (sym->margin_conv == CONV_DIV) {
+            sym->margin_kernel = margin_cfd_div;
+        } else {
+            sym->margin_kernel = margin_price;
+        }
+    }
+
+    // 隔夜费只做币种折算，CFD 不乘市价
+    if (sym->margin_calc == MARGIN_CALC_FOREX && sym->margin_type == MARGIN_TYPE_AU) {
+        sym->swap_kernel = margin_price;
+    } else if (sym->margin_conv == CONV_MUL) {
+        sym->swap_kernel = margin_mul;
+    } else if (sym->margin_conv == CONV_DIV) {
+        sym->swap_kernel = margin_div;
+    } else {
+        sym->swap_kernel = margin_none;
+    }
+
+    if (sym->profit_calc == PROFIT_CALC_FOREX && sym->profit_type == PROFIT_TYPE_UB) {
+        sym->profit_kernel = profit_ub;
+        sym->profit_fixed_kernel = fx_profit_ub;
+    } else if (sym->profit_calc == PROFIT_CALC_FOREX || sym->profit_calc == PROFIT_CALC_CFD) {
+        if (sym->profit_conv == CONV_MUL) {
+            sym->profit_kernel = profit_mul;
+            sym->profit_fixed_kernel = fx_profit_mul;
+        } else if (sym->profit_conv == CONV_DIV) {
+            sym->profit_kernel = profit_div;
+            sym->profit_fixed_kernel = fx_profit_div;
+        } else {
+            sym->profit_kernel = profit_contract;
+            sym->profit_fixed_kernel = fx_profit_contract;
+        }
+    } else {
+        sym->profit_kernel = profit_futures;
+        sym->profit_fixed_kernel = fx_profit_futures;
     }
-    return NULL;
 }
 
-static struct fee_type *get_fee_type(const char *group, const char *symbol)
+// 定点数计算盈亏，与 mpd 版本公式一致，中间结果保留 16 位小数，最后四舍五入到 2 位
+// profit = (close_price - open_price) * lot, scale 2 * FIXED_PREC
+fixed_t symbol_profit_convert(symbol_t *sym, __int128 profit, fixed_t close_price, fixed_t profit_price)
 {
-    char *key = (char *) malloc(strlen(group) + strlen(symbol) + 1);
-    strcpy(key, group);
-    strcat(key, symbol);
-    dict_entry *entry = dict_find(dict_fee, key);
-    if (entry == NULL)
+    profit = sym->profit_fixed_kernel(sym, profit, close_price, profit_price);
+
+    // scale 16 -> PREC_DEFAULT, back to FIXED_PREC
+    profit = fixed_div128(profit, fixed_pow10[2 * FIXED_PREC - PREC_DEFAULT]);
+    return (fixed_t)profit * fixed_pow10[FIXED_PREC - PREC_DEFAULT];
+}
+
+fixed_t symbol_profit_fixed(symbol_t *sym, uint32_t side, fixed_t open_price, fixed_t close_price, fixed_t lot, fixed_t profit_price)
+{
+    fixed_t diff = side == ORDER_SIDE_BUY ? close_price - open_price : open_price - close_price;
+    return symbol_profit_convert(sym, (__int128)diff * lot, close_price, profit_price);
+}
+
+static struct fee_entry *get_fee_type(const char *group, const char *symbol)
+{
+    return get_fee_entry(get_group_id(group), get_symbol_id(symbol));
+}
+
+// c / leverage * percentage，开仓时只需再乘手数
+static mpd_t *new_margin_rate(const char *group, symbol_t *sym, mpd_t *percentage)
+{
+    int leverage = group_leverage(group);
+    if (sym == NULL || leverage == 0)
         return NULL;
 
-    return entry->val;
+    mpd_t *rate = mpd_new(&mpd_ctx);
+    mpd_set_u32(rate, leverage, &mpd_ctx);
+    mpd_div(rate, sym->c, rate, &mpd_ctx);
+    mpd_mul(rate, rate, percentage, &mpd_ctx);
+    return rate;
 }
 
 static struct week_type *get_week_type(const char *symbol)
@@ -395,25 +614,31 @@ int group_leverage(const char *group)
 
 mpd_t* symbol_percentage(const char *group, const char *symbol)
 {
-    struct fee_type *at = get_fee_type(group, symbol);
+    struct fee_entry *at = get_fee_type(group, symbol);
     return at ? at->percentage : mpd_one;
 }
 
+mpd_t* symbol_margin_rate(const char *group, const char *symbol)
+{
+    struct fee_entry *at = get_fee_type(group, symbol);
+    return at ? at->margin_rate : NULL;
+}
+
 mpd_t* symbol_fee(const char *group, const char *symbol)
 {
-    struct fee_type *at = get_fee_type(group, symbol);
+    struct fee_entry *at = get_fee_type(group, symbol);
     return at ? at->fee : mpd_zero;
 }
 
 mpd_t* symbol_swap_long(const char *group, const char *symbol)
 {
-    struct fee_type *at = get_fee_type(group, symbol);
+    struct fee_entry *at = get_fee_type(group, symbol);
     return at ? at->swap_long : mpd_zero;
 }
 
 mpd_t* symbol_swap_short(const char *group, const char *symbol)
 {
-    struct fee_type *at = get_fee_type(group, symbol);
+    struct fee_entry *at = get_fee_type(group, symbol);
     return at ? at->swap_short : mpd_zero;
 }
 
@@ -569,6 +794,53 @@ bool symbol_check_time_in_range(const char *symbol_str)
     return time_in_range;
 }
 
+static int symbol_index(const char *name)
+{
+    if (name == NULL)
+        return -1;
+    return get_symbol_id(name);
+}
+
+static int add_dependent(symbol_t *quote, int id)
+{
+    for (size_t i = 0; i < quote->dependent_num; ++i) {
+        if (quote->dependents[i] == id)
+            return 0;
+    }
+
+    int *dependents = realloc(quote->dependents, (quote->dependent_num + 1) * sizeof(int));
+    if (dependents == NULL)
+        return -__LINE__;
+    dependents[quote->dependent_num++] = id;
+    quote->dependents = dependents;
+    return 0;
+}
+
+// 解析折算品种，建立 quote -> 依赖品种 的关系
+static int build_symbol_graph(void)
+{
+    for (size_t i = 0; i < configs.symbol_num; ++i) {
+        symbol_t *sym = &configs.symbols[i];
+        sym->margin_quote = sym->margin_conv ? symbol_index(sym->margin_symbol) : -1;
+        sym->profit_quote = sym->profit_conv ? symbol_index(sym->profit_symbol) : -1;
+
+        if (sym->margin_conv && sym->margin_quote < 0)
+            log_error("symbol %s margin quote %s not found", sym->name, sym->margin_symbol);
+        if (sym->profit_conv && sym->profit_quote < 0)
+            log_error("symbol %s profit quote %s not found", sym->name, sym->profit_symbol);
+    }
+
+    for (size_t i = 0; i < configs.symbol_num; ++i) {
+        symbol_t *sym = &configs.symbols[i];
+        if (sym->margin_quote >= 0 && sym->margin_quote != i)
+            ERR_RET(add_dependent(&configs.symbols[sym->margin_quote], i));
+        if (sym->profit_quote >= 0 && sym->profit_quote != i)
+            ERR_RET(add_dependent(&configs.symbols[sym->profit_quote], i));
+    }
+
+    return 0;
+}
+
 int init_symbol(void)
 {
     ERR_RET(init_dict());
@@ -598,26 +870,52 @@ int init_symbol(void)
     mysql_close(conn);
     log_stderr("load symbol success");
 
+    for (size_t i = 0; i < configs.symbol_num; ++i) {
+        configs.symbols[i].id = i;
+        if (dict_add(dict_symbol, configs.symbols[i].name, &configs.symbols[i]) == NULL)
+            return -__LINE__;
+    }
+    ERR_RET(build_symbol_graph());
+    for (size_t i = 0; i < configs.symbol_num; ++i) {
+        select_kernels(&configs.symbols[i]);
+    }
+
     for (size_t i = 0; i < configs.group_num; ++i) {
         struct group_type gt;
+        gt.id = i;
         gt.leverage = configs.groups[i].leverage;
         if (dict_add(dict_group, configs.groups[i].name, &gt) == NULL)
             return -__LINE__;
     }
 
+    // 没有配置 fee 的 (group, symbol) 取默认值，保证金系数同样预先算好
+    fee_table = malloc(sizeof(struct fee_entry) * (configs.group_num * configs.symbol_num + 1));
+    if (fee_table == NULL)
+        return -__LINE__;
+    for (size_t i = 0; i < configs.group_num; ++i) {
+        for (size_t j = 0; j < configs.symbol_num; ++j) {
+            struct fee_entry *fe = &fee_table[i * configs.symbol_num + j];
+            fe->percentage = mpd_one;
+            fe->fee = mpd_zero;
+            fe->swap_long = mpd_zero;
+            fe->swap_short = mpd_zero;
+            fe->margin_rate = new_margin_rate(configs.groups[i].name, &configs.symbols[j], fe->percentage);
+        }
+    }
+
     for (size_t i = 0; i < configs.fee_num; ++i) {
-        struct fee_type ft;
-        ft.percentage = configs.fees[i].percentage;
-        ft.fee = configs.fees[i].fee;
-        ft.swap_long = configs.fees[i].swap_long;
-        ft.swap_short = configs.fees[i].swap_short;
-        char *group = configs.fees[i].group;
-        char *symbol = configs.fees[i].symbol;
-        char *key = (char *) malloc(strlen(group) + strlen(symbol) + 1);
-        strcpy(key, group);
-        strcat(key, symbol);
-        if (dict_add(dict_fee, key, &ft) == NULL)
-            return -__LINE__;
+        struct fee_entry *fe = get_fee_type(configs.fees[i].group, configs.fees[i].symbol);
+        if (fe == NULL) {
+            log_error("fee %s %s: unknown group or symbol", configs.fees[i].group, configs.fees[i].symbol);
+            continue;
+        }
+        if (fe->margin_rate)
+            mpd_del(fe->margin_rate);
+        fe->percentage = configs.fees[i].percentage;
+        fe->fee = configs.fees[i].fee;
+        fe->swap_long = configs.fees[i].swap_long;
+        fe->swap_short = configs.fees[i].swap_short;
+        fe->margin_rate = new_margin_rate(configs.fees[i].group, get_symbol(configs.fees[i].symbol), fe->percentage);
     }
     for (int i = 0; i < configs.symbol_num; ++i) {
         struct week_type wt;
@@ -3,6 +3,7 @@
 
 # include <stdbool.h>
 # include "ut_decimal.h"
+# include "ut_fixed.h"
 
 // Forex = lots * contract_size / leverage * percentage / 100
 // CFD   = lots * contract_size / leverage * percentage / 100 * market_price
@@ -33,6 +34,11 @@
 # define PROFIT_TYPE_AC         3
 # define PROFIT_TYPE_CB         4
 
+// 折算到 USD: value * quote 或 value / quote
+# define CONV_NONE              0
+# define CONV_MUL               1
+# define CONV_DIV               2
+
 # define SWAP_CALC_MONEY        1
 # define SWAP_CALC_USD          2
 
@@ -55,6 +61,23 @@ struct fee {
     mpd_t           *swap_short;
 };
 
+// 按 (group_id, symbol_id) 下标存放，init_symbol 时填充
+struct fee_entry {
+    mpd_t           *percentage;
+    mpd_t           *margin_rate;   // contract_size / 100 / leverage * percentage
+    mpd_t           *fee;
+    mpd_t           *swap_long;
+    mpd_t           *swap_short;
+};
+
+struct symbol;
+
+// 计算内核，init_symbol 时按 margin_calc / profit_calc / 折算方式选定
+// value 为已乘好手数的中间值，内核只做品种相关的部分
+typedef void (*symbol_kernel_t)(mpd_t *value, struct symbol *sym, mpd_t *price, mpd_t *quote_price);
+// 定点版本盈亏内核，输入输出均为 2 * FIXED_PREC 精度
+typedef __int128 (*symbol_kernel_fixed_t)(struct symbol *sym, __int128 profit, fixed_t close_price, fixed_t profit_price);
+
 struct symbol {
     char            *name;
     char            *security;
@@ -77,6 +100,28 @@ struct symbol {
     char            *thursday;
     char            *friday;
     mpd_t           *c; // c = contract_size / 100
+
+    // fixed-point mirrors used on the tick path
+    fixed_t         fx_contract_size;
+    fixed_t         fx_tick_size;
+    fixed_t         fx_tick_price;
+
+    // 折算描述，init_symbol 时解析，quote 为 configs.symbols 下标，没有为 -1
+    int             id;
+    int             margin_conv;
+    int             margin_quote;
+    int             profit_conv;
+    int             profit_quote;
+    bool            profit_ask_buy;
+
+    // 以本品种作为折算价格的品种，本品种 tick 时需要一起重估
+    int             *dependents;
+    size_t          dependent_num;
+
+    symbol_kernel_t         margin_kernel;
+    symbol_kernel_t         profit_kernel;
+    symbol_kernel_t         swap_kernel;
+    symbol_kernel_fixed_t   profit_fixed_kernel;
 };
 
 struct configs {
@@ -99,10 +144,21 @@ bool check_time_in_range(const char *time_range, int timezone_offset);
 bool symbol_check_time_in_range(const char *symbol_str);
 
 mpd_t* symbol_percentage(const char *group, const char *symbol);
+mpd_t* symbol_margin_rate(const char *group, const char *symbol);
 mpd_t* symbol_fee(const char *group, const char *symbol);
 mpd_t* symbol_swap_long(const char *group, const char *symbol);
 mpd_t* symbol_swap_short(const char *group, const char *symbol);
 symbol_t *get_symbol(const char *name);
+int get_symbol_id(const char *name);
+int get_group_id(const char *group);
+struct fee_entry *get_fee_entry(int group_id, int symbol_id);
+
+mpd_t *symbol_margin_price(symbol_t *sym, uint32_t side);
+mpd_t *symbol_profit_price(symbol_t *sym, uint32_t side);
+fixed_t symbol_profit_price_fixed(symbol_t *sym, uint32_t side);
+
+fixed_t symbol_profit_convert(symbol_t *sym, __int128 profit, fixed_t close_price, fixed_t profit_price);
+fixed_t symbol_profit_fixed(symbol_t *sym, uint32_t side, fixed_t open_price, fixed_t close_price, fixed_t lot, fixed_t profit_price);
 
 # endif
 
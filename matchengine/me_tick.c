@@ -1,113 +1,462 @@
 # include "me_tick.h"
 # include "me_symbol.h"
 # include "me_config.h"
+# include "me_tpsl.h"
+# include "me_stop.h"
 //# include "me_limit.h"
 
 //struct configs configs;
-static dict_t *dict_tick;
+static struct tick_type *ticks;
+
+// 品种名到槽位的开放寻址索引，直接用报文里的 (ptr, len) 查找，不拷贝不补 '\0'
+static struct tick_type **tick_index;
+static uint32_t tick_index_mask;
 int status;
+static bool tick_started;
+static bool tick_trigger;
+
+// 最近报价环形缓冲，每个品种 tick_ring_size 个连续槽位，按时间递增写入
+struct tick_point {
+    uint64_t time;
+    fixed_t bid;
+    fixed_t ask;
+};
+
+static struct tick_point *tick_ring;
+static uint32_t tick_ring_size;
 
+// 每个品种一个预分配的报价槽位，下标即品种 id (configs.symbols 的下标)
+// 行情只写定点数，mpd 在读取时按需回写
 struct tick_type {
+    uint32_t id;
+    fixed_t fx_bid;
+    fixed_t fx_ask;
+    uint64_t time;
+    bool dirty;
     mpd_t *bid;
     mpd_t *ask;
+    uint32_t ring_head;     // 下一个写入位置
+    uint32_t ring_num;
+    uint32_t log_seq;       // tick_log 采样计数
+    const char *name;
+    size_t name_len;
+};
+
+// 解析出的字段直接指向 websocket 缓冲区，不拷贝
+struct tick_frame {
+    const char *s;
+    size_t s_len;
+    const char *b;
+    size_t b_len;
+    const char *a;
+    size_t a_len;
+    const char *t;
+    size_t t_len;
 };
 
-static uint32_t tick_dict_hash_function(const void *key)
+static int init_dict(void)
 {
-    return dict_generic_hash_function(key, strlen(key));
+    ticks = malloc(sizeof(struct tick_type) * configs.symbol_num);
+    if (ticks == NULL)
+        return -__LINE__;
+    memset(ticks, 0, sizeof(struct tick_type) * configs.symbol_num);
+
+    // 取 2 的幂，下标用掩码回绕
+    tick_ring_size = 1;
+    while (tick_ring_size < settings.tick_history)
+        tick_ring_size <<= 1;
+    tick_ring = malloc(sizeof(struct tick_point) * tick_ring_size * configs.symbol_num);
+    if (tick_ring == NULL)
+        return -__LINE__;
+
+    for (int i = 0; i < configs.symbol_num; ++i) {
+        struct tick_type *tt = &ticks[i];
+        tt->id = i;
+        tt->bid = mpd_new(&mpd_ctx);
+        tt->ask = mpd_new(&mpd_ctx);
+        // USDHKD 行情固定
+        if (strcmp(configs.symbols[i].name, "USDHKD") == 0) {
+            fixed_from_str("7.843", 5, &tt->fx_bid);
+            fixed_from_str("7.844", 5, &tt->fx_ask);
+        }
+        tt->dirty = true;
+        tt->name = configs.symbols[i].name;
+        tt->name_len = strlen(tt->name);
+    }
+
+    // 装载因子不超过 1/2
+    uint32_t index_size = 16;
+    while (index_size < configs.symbol_num * 2)
+        index_size <<= 1;
+    tick_index = calloc(index_size, sizeof(struct tick_type *));
+    if (tick_index == NULL)
+        return -__LINE__;
+    tick_index_mask = index_size - 1;
+    for (int i = 0; i < configs.symbol_num; ++i) {
+        struct tick_type *tt = &ticks[i];
+        uint32_t pos = dict_generic_hash_function(tt->name, tt->name_len) & tick_index_mask;
+        while (tick_index[pos] != NULL) {
+            if (tick_index[pos]->name_len == tt->name_len && memcmp(tick_index[pos]->name, tt->name, tt->name_len) == 0)
+                return -__LINE__;
+            pos = (pos + 1) & tick_index_mask;
+        }
+        tick_index[pos] = tt;
+    }
+
+    return 0;
 }
 
-static void *tick_dict_key_dup(const void *key)
+static struct tick_type *get_tick_type_len(const char *symbol, size_t len)
 {
-    return strdup(key);
+    uint32_t pos = dict_generic_hash_function(symbol, len) & tick_index_mask;
+    struct tick_type *tt;
+    while ((tt = tick_index[pos]) != NULL) {
+        if (tt->name_len == len && memcmp(tt->name, symbol, len) == 0)
+            return tt;
+        pos = (pos + 1) & tick_index_mask;
+    }
+    return NULL;
 }
 
-static void *tick_dict_val_dup(const void *val)
+static struct tick_type *get_tick_type(const char *symbol)
 {
-    struct tick_type *obj = malloc(sizeof(struct tick_type));
-    if (obj == NULL)
-        return NULL;
-    memcpy(obj, val, sizeof(struct tick_type));
-    return obj;
+    return get_tick_type_len(symbol, strlen(symbol));
 }
 
-static int tick_dict_key_compare(const void *key1, const void *key2)
+static struct tick_type *tick_sync(struct tick_type *tt)
 {
-    return strcmp(key1, key2);
+    if (tt->dirty) {
+        fixed_to_mpd(tt->bid, tt->fx_bid, PREC_PRICE);
+        fixed_to_mpd(tt->ask, tt->fx_ask, PREC_PRICE);
+        tt->dirty = false;
+    }
+    return tt;
 }
 
-static void tick_dict_key_free(void *key)
+int tick_symbol_id(const char *symbol)
 {
-    free(key);
+    struct tick_type *at = get_tick_type(symbol);
+    if (at) {
+        return at->id;
+    }
+    return -1;
 }
 
-static void tick_dict_val_free(void *val)
+mpd_t* symbol_bid(const char *symbol)
 {
-    struct tick_type *tt = val;
-    mpd_del(tt->bid);
-    mpd_del(tt->ask);
-    free(val);
+    struct tick_type *at = get_tick_type(symbol);
+    if (at) {
+        return tick_sync(at)->bid;
+    }
+    return mpd_zero;
 }
 
-static int init_dict(void)
+mpd_t* symbol_ask(const char *symbol)
 {
-    dict_types type;
-    memset(&type, 0, sizeof(type));
-    type.hash_function  = tick_dict_hash_function;
-    type.key_compare    = tick_dict_key_compare;
-    type.key_dup        = tick_dict_key_dup;
-    type.key_destructor = tick_dict_key_free;
-    type.val_dup        = tick_dict_val_dup;
-    type.val_destructor = tick_dict_val_free;
-
-    dict_tick = dict_create(&type, 64);
-    if (dict_tick == NULL)
-        return -__LINE__;
+    struct tick_type *at = get_tick_type(symbol);
+    if (at) {
+        return tick_sync(at)->ask;
+    }
+    return mpd_zero;
+}
 
-    for (int i = 0; i < configs.symbol_num; ++i) {
-        struct tick_type tt;
-        tt.bid = mpd_new(&mpd_ctx);
-        tt.ask = mpd_new(&mpd_ctx);
-        // USDHKD 行情固定
-        if (strcmp(configs.symbols[i].name, "USDHKD") == 0) {
-            mpd_set_string(tt.bid, "7.843", &mpd_ctx);
-            mpd_set_string(tt.ask, "7.844", &mpd_ctx);
+fixed_t symbol_bid_fixed(const char *symbol)
+{
+    struct tick_type *at = get_tick_type(symbol);
+    return at ? at->fx_bid : 0;
+}
+
+fixed_t symbol_ask_fixed(const char *symbol)
+{
+    struct tick_type *at = get_tick_type(symbol);
+    return at ? at->fx_ask : 0;
+}
+
+mpd_t* tick_bid(uint32_t id)
+{
+    return id < configs.symbol_num ? tick_sync(&ticks[id])->bid : mpd_zero;
+}
+
+mpd_t* tick_ask(uint32_t id)
+{
+    return id < configs.symbol_num ? tick_sync(&ticks[id])->ask : mpd_zero;
+}
+
+fixed_t tick_bid_fixed(uint32_t id)
+{
+    return id < configs.symbol_num ? ticks[id].fx_bid : 0;
+}
+
+fixed_t tick_ask_fixed(uint32_t id)
+{
+    return id < configs.symbol_num ? ticks[id].fx_ask : 0;
+}
+
+static const char *skip_space(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        p++;
+    return p;
+}
+
+// 返回字符串结束引号的位置，p 指向开始引号之后
+static const char *scan_string(const char *p, const char *end)
+{
+    while (p < end && *p != '"') {
+        if (*p == '\\')
+            p++;
+        p++;
+    }
+    return p < end ? p : NULL;
+}
+
+// 跳过任意 json 值，返回值之后的位置
+static const char *skip_value(const char *p, const char *end)
+{
+    int depth = 0;
+    while (p < end) {
+        char c = *p;
+        if (c == '"') {
+            p = scan_string(p + 1, end);
+            if (p == NULL)
+                return NULL;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (depth == 0)
+                return p;
+            depth--;
+        } else if (c == ',' && depth == 0) {
+            return p;
+        }
+        p++;
+    }
+    return depth == 0 ? p : NULL;
+}
+
+// 解析 {"s":"BTCUSD","b":"16938.4","a":"16948.72","t":"1670837032014"}，字段值可以带引号也可以不带
+static const char *parse_tick_object(const char *p, const char *end, struct tick_frame *f)
+{
+    memset(f, 0, sizeof(struct tick_frame));
+    p = skip_space(p, end);
+    if (p >= end || *p != '{')
+        return NULL;
+    p++;
+
+    while (true) {
+        p = skip_space(p, end);
+        if (p >= end)
+            return NULL;
+        if (*p == '}')
+            return p + 1;
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        if (*p != '"')
+            return NULL;
+
+        const char *key = p + 1;
+        p = scan_string(key, end);
+        if (p == NULL)
+            return NULL;
+        size_t key_len = p - key;
+        p = skip_space(p + 1, end);
+        if (p >= end || *p != ':')
+            return NULL;
+        p = skip_space(p + 1, end);
+        if (p >= end)
+            return NULL;
+
+        const char *val;
+        size_t val_len;
+        if (*p == '"') {
+            val = p + 1;
+            p = scan_string(val, end);
+            if (p == NULL)
+                return NULL;
+            val_len = p - val;
+            p++;
         } else {
-            mpd_copy(tt.bid, mpd_zero, &mpd_ctx);
-            mpd_copy(tt.ask, mpd_zero, &mpd_ctx);
+            val = p;
+            p = skip_value(p, end);
+            if (p == NULL)
+                return NULL;
+            val_len = p - val;
+            while (val_len > 0 && (val[val_len - 1] == ' ' || val[val_len - 1] == '\r' || val[val_len - 1] == '\n'))
+                val_len--;
+        }
+
+        if (key_len == 1) {
+            switch (key[0]) {
+            case 's': f->s = val; f->s_len = val_len; break;
+            case 'b': f->b = val; f->b_len = val_len; break;
+            case 'a': f->a = val; f->a_len = val_len; break;
+            case 't': f->t = val; f->t_len = val_len; break;
+            default: break;
+            }
         }
-        if (dict_add(dict_tick, configs.symbols[i].name, &tt) == NULL)
-            return -__LINE__; 
     }
+}
 
-    return 0;
+static struct tick_point *ring_at(struct tick_type *tt, uint32_t i)
+{
+    // i 为逻辑下标，0 是最早的一条
+    uint32_t pos = (tt->ring_head - tt->ring_num + i) & (tick_ring_size - 1);
+    return &tick_ring[(size_t)tt->id * tick_ring_size + pos];
 }
 
-static struct tick_type *get_tick_type(const char *symbol)
+static void ring_append(struct tick_type *tt)
 {
-    dict_entry *entry = dict_find(dict_tick, symbol);
-    if (entry == NULL)
+    // 乱序的报价不进环，保证按时间有序可二分
+    if (tt->ring_num > 0 && ring_at(tt, tt->ring_num - 1)->time > tt->time)
+        return;
+
+    struct tick_point *tp = &tick_ring[(size_t)tt->id * tick_ring_size + tt->ring_head];
+    tp->time = tt->time;
+    tp->bid = tt->fx_bid;
+    tp->ask = tt->fx_ask;
+    tt->ring_head = (tt->ring_head + 1) & (tick_ring_size - 1);
+    if (tt->ring_num < tick_ring_size)
+        tt->ring_num++;
+}
+
+// 第一个 time > t 的逻辑下标
+static uint32_t ring_upper(struct tick_type *tt, uint64_t t)
+{
+    uint32_t lo = 0, hi = tt->ring_num;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ring_at(tt, mid)->time > t) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// [start, end] 内最近的 limit 条报价，按时间升序；end 为 0 表示不限
+json_t *tick_history(const char *symbol, uint64_t start, uint64_t end, size_t limit)
+{
+    struct tick_type *tt = get_tick_type(symbol);
+    if (tt == NULL)
         return NULL;
 
-    return entry->val;
+    uint32_t last = end ? ring_upper(tt, end) : tt->ring_num;
+    uint32_t first = last > limit ? last - limit : 0;
+    while (first < last && ring_at(tt, first)->time < start)
+        first++;
+
+    int prec = configs.symbols[tt->id].digit;
+    json_t *result = json_array();
+    for (uint32_t i = first; i < last; ++i) {
+        struct tick_point *tp = ring_at(tt, i);
+        char bid[32], ask[32];
+        json_t *item = json_array();
+        json_array_append_new(item, json_integer(tp->time));
+        json_array_append_new(item, json_string(fixed_to_str(bid, sizeof(bid), tp->bid, prec)));
+        json_array_append_new(item, json_string(fixed_to_str(ask, sizeof(ask), tp->ask, prec)));
+        json_array_append_new(result, item);
+    }
+
+    return result;
 }
 
-mpd_t* symbol_bid(const char *symbol)
+static uint64_t parse_tick_time(const char *p, size_t len)
 {
-    struct tick_type *at = get_tick_type(symbol);
-    if (at) {
-        return at->bid;
+    uint64_t val = 0;
+    for (size_t i = 0; i < len && p[i] >= '0' && p[i] <= '9'; ++i)
+        val = val * 10 + (p[i] - '0');
+    return val;
+}
+
+// trigger 为 false 时只更新报价，不触发止盈止损和重估 (MT4 行情)
+// tick_trigger 为 false 时 (follower) 只重估浮动盈亏，不触发止盈止损
+// time_scale 把行情里的时间换算成毫秒，MT4 是秒，Centroid 是毫秒
+static void on_tick(const struct tick_frame *f, bool trigger, uint32_t time_scale)
+{
+    if (f->s == NULL || f->b == NULL || f->a == NULL)
+        return;
+
+    struct tick_type *at = get_tick_type_len(f->s, f->s_len);
+    if (at == NULL)
+        return;
+
+    // 默认每条都记；tick_log_sample > 1 时每个品种每 N 条记一条，0 表示不记
+    if (settings.tick_log_sample > 0 && ++at->log_seq >= (uint32_t)settings.tick_log_sample) {
+        at->log_seq = 0;
+        log_tick("[%.*s] %.*s / %.*s (%.*s)", (int)f->s_len, f->s, (int)f->b_len, f->b, (int)f->a_len, f->a, (int)f->t_len, f->t ? f->t : "");
     }
-    return mpd_zero;
+
+    fixed_t bid, ask;
+    if (fixed_from_str(f->b, f->b_len, &bid) < 0 || fixed_from_str(f->a, f->a_len, &ask) < 0) {
+        log_error("invalid tick: %.*s %.*s / %.*s", (int)f->s_len, f->s, (int)f->b_len, f->b, (int)f->a_len, f->a);
+        return;
+    }
+
+    at->fx_bid = bid;
+    at->fx_ask = ask;
+    if (f->t) {
+        at->time = parse_tick_time(f->t, f->t_len) * time_scale;
+    } else {
+        at->time = (uint64_t)(current_timestamp() * 1000);
+    }
+    at->dirty = true;
+    ring_append(at);
+
+    if (!trigger)
+        return;
+    if (tick_trigger)
+        append_tpsl(at->id);
+    append_stop_symbol(at->id);
+
+    // 以本品种折算盈亏/保证金的品种也要重估
+    symbol_t *sym = &configs.symbols[at->id];
+    for (size_t i = 0; i < sym->dependent_num; ++i) {
+        append_stop_symbol(sym->dependents[i]);
+    }
+//    append_limit_symbol(symbol);
 }
 
-mpd_t* symbol_ask(const char *symbol)
+// 解析 [{...},{...}] 或单个 {...}，返回处理的报价数量，格式错误返回 < 0
+static int parse_ticks(const char *p, const char *end, bool trigger, uint32_t time_scale)
 {
-    struct tick_type *at = get_tick_type(symbol);
-    if (at) {
-        return at->ask;
+    struct tick_frame f;
+    p = skip_space(p, end);
+    if (p >= end)
+        return 0;
+
+    if (*p == '{') {
+        if (parse_tick_object(p, end, &f) == NULL)
+            return -__LINE__;
+        on_tick(&f, trigger, time_scale);
+        return 1;
     }
-    return mpd_zero;
+
+    if (*p != '[')
+        return -__LINE__;
+    p++;
+
+    int count = 0;
+    while (true) {
+        p = skip_space(p, end);
+        if (p >= end)
+            return -__LINE__;
+        if (*p == ']')
+            break;
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        p = parse_tick_object(p, end, &f);
+        if (p == NULL)
+            return -__LINE__;
+        on_tick(&f, trigger, time_scale);
+        count++;
+    }
+
+    return count;
 }
 
 /*
@@ -172,38 +521,26 @@ static void on_message(struct uwsc_client *cl, void *data, size_t len, bool bina
 // qwertyuiopasdfghjklzxcvbnm123456{"cmd":"intervalTicks","code":0,"comment":"","data":[{"a":"1488.350000","b":"1487.380000","g":6,"s":"ETHUSD","t":1658384901}],"message":""}
 // 00000000000000000000000000000000{"cmd":"intervalTicks","data":[{"a":"1488.390000","b":"1487.560000","g":6,"s":"ETHUSD","t":1658384906}]}
 
-        // MT4 tick
-        sds msg = sdsempty();
-        msg = sdscatlen(msg, data + 32, len - 32);
-
-        json_error_t error;
-        json_t *root = json_loads(msg, 0, &error);
-        json_t *node = json_object_get(root, "data");
-        if (!node || !json_is_array(node))
+        // MT4 tick, 32 字节前缀之后是 {"cmd":...,"data":[{...}],...}
+        if (len <= 32)
             return;
 
-        json_t *entry = json_array_get(node, 0);
-        json_t *s = json_object_get(entry, "s");
-        json_t *a = json_object_get(entry, "a");
-        json_t *b = json_object_get(entry, "b");
-        json_t *t = json_object_get(entry, "t");
-//log_info("## %s = %s / %s", json_string_value(s), json_string_value(b), json_string_value(a));
-
-        char *symbol = strdup(json_string_value(s));
-        log_tick("[%s] %s / %s (%d)", symbol, json_string_value(b), json_string_value(a), json_integer_value(t));
-
-        struct tick_type *at = get_tick_type(symbol);
-        if (at) {
-            mpd_set_string(at->bid, json_string_value(b), &mpd_ctx);
-            mpd_set_string(at->ask, json_string_value(a), &mpd_ctx);
-        }
+        const char *begin = (const char *)data + 32;
+        const char *end = (const char *)data + len;
+        const char *key = begin;
+        while (key + 6 <= end && memcmp(key, "\"data\"", 6) != 0)
+            key++;
+        if (key + 6 > end)
+            return;
 
-//        append_tpsl(symbol);
-//        append_limit_symbol(symbol);
+        const char *p = skip_space(key + 6, end);
+        if (p >= end || *p != ':')
+            return;
 
-        json_decref(root);
-        free(symbol);
-        sdsfree(msg);
+        // 和原来一样，MT4 行情只更新报价
+        int ret = parse_ticks(p + 1, end, false, 1000);
+        if (ret < 0)
+            log_error("invalid tick message: %d, %.*s", ret, (int)len, (char *)data);
 
 /*
         // AB-Hub tick
@@ -259,61 +596,10 @@ static void on_message_fix(struct uwsc_client *cl, void *data, size_t len, bool
         if (len < 10)
             return;
 
-        // Centroid tick
-        sds msg = sdsempty();
-        msg = sdscatlen(msg, data, len);
-
-        json_error_t error;
-        json_t *root = json_loads(msg, 0, &error);
-        if (!root)
-            return;
-
-        // 第一次收到的消息是数组
-        if (len > 200) {
-            for (size_t i = 0; i < json_array_size(root); ++i) {
-                json_t *entry = json_array_get(root, i);
-                json_t *s = json_object_get(entry, "s");
-                json_t *a = json_object_get(entry, "a");
-                json_t *b = json_object_get(entry, "b");
-                json_t *t = json_object_get(entry, "t");
-
-                char *symbol = strdup(json_string_value(s));
-                log_tick("[%s] %s / %s (%s)", symbol, json_string_value(b), json_string_value(a), json_string_value(t));
-
-                struct tick_type *at = get_tick_type(symbol);
-                if (at) {
-                    mpd_set_string(at->bid, json_string_value(b), &mpd_ctx);
-                    mpd_set_string(at->ask, json_string_value(a), &mpd_ctx);
-                }
-
-                append_tpsl(symbol);
-                append_stop_symbol(symbol);
-//                append_limit_symbol(symbol);
-                free(symbol);
-            }
-        } else {
-            json_t *s = json_object_get(root, "s");
-            json_t *a = json_object_get(root, "a");
-            json_t *b = json_object_get(root, "b");
-            json_t *t = json_object_get(root, "t");
-
-            char *symbol = strdup(json_string_value(s));
-            log_tick("[%s] %s / %s (%s)", symbol, json_string_value(b), json_string_value(a), json_string_value(t));
-
-            struct tick_type *at = get_tick_type(symbol);
-            if (at) {
-                mpd_set_string(at->bid, json_string_value(b), &mpd_ctx);
-                mpd_set_string(at->ask, json_string_value(a), &mpd_ctx);
-            }
-
-            append_tpsl(symbol);
-            append_stop_symbol(symbol);
-//            append_limit_symbol(symbol);
-            free(symbol);
-        }
-
-        json_decref(root);
-        sdsfree(msg);
+        // Centroid tick, 第一次收到的消息是数组
+        int ret = parse_ticks(data, (const char *)data + len, true, 1);
+        if (ret < 0)
+            log_error("invalid tick message: %d, %.*s", ret, (int)len, (char *)data);
     }
 
 }
@@ -335,8 +621,13 @@ int tick_status()
     return status;
 }
 
-int init_tick(void)
+int init_tick(bool trigger)
 {
+    // follower 提升为主机时行情订阅已在，只打开止盈止损
+    tick_trigger = trigger;
+    if (tick_started)
+        return 0;
+
     status = 0;
     ERR_RET(init_dict());
 
@@ -348,6 +639,7 @@ int init_tick(void)
     struct uwsc_client *cli = ws_cli_create(settings.tick_svr, open, message, error, close);
     if (cli == NULL)
         return -__LINE__;
+    tick_started = true;
 
     return 0;
 }
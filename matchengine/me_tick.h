@@ -2,11 +2,21 @@
 # define _ME_TICK_H_
 
 # include "ut_decimal.h"
+# include "ut_fixed.h"
 # include "uwsc.h"
 
-int init_tick(void);
+// trigger 为 false 时只更新报价和重估浮动盈亏，不触发止盈止损；可再次调用打开
+int init_tick(bool trigger);
+int tick_symbol_id(const char *symbol);
 mpd_t* symbol_bid(const char *symbol);
 mpd_t* symbol_ask(const char *symbol);
+fixed_t symbol_bid_fixed(const char *symbol);
+fixed_t symbol_ask_fixed(const char *symbol);
+mpd_t* tick_bid(uint32_t id);
+mpd_t* tick_ask(uint32_t id);
+fixed_t tick_bid_fixed(uint32_t id);
+fixed_t tick_ask_fixed(uint32_t id);
+json_t *tick_history(const char *symbol, uint64_t start, uint64_t end, size_t limit);
 
 void reconnect(struct uwsc_client *cl);
 
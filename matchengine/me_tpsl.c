@@ -2,283 +2,120 @@
 # include "me_market.h"
 # include "me_symbol.h"
 # include "me_balance.h"
+# include "me_trade.h"
+# include "me_tick.h"
 
 static nw_timer timer;
 static int flag = 0;
-static json_t *list;
+static bool *pending; // 按品种 id 标记还有未处理的触发单
 
-static void order_profit(order_t *order, symbol_t *sym, mpd_t *close_price, mpd_t *profit_price)
+// 每个品种每轮最多平仓数量，避免单个 tick 长时间占用事件循环
+# define TPSL_BATCH 256
+
+static uint64_t order_ids[TPSL_BATCH];
+static int total;
+
+static void order_profit(order_t *order, symbol_t *sym, fixed_t close_price, fixed_t profit_price)
 {
-    // 1.计算价格差
-    mpd_t *profit = mpd_new(&mpd_ctx);
-    if (order->side == ORDER_SIDE_BUY) {
-        mpd_sub(profit, close_price, order->price, &mpd_ctx);
-    } else {
-        mpd_sub(profit, order->price, close_price, &mpd_ctx);
-    }
-    mpd_mul(profit, profit, order->lot, &mpd_ctx);
+    // 按触发价格计算盈亏，浮动盈亏由汇总持仓维护，平仓时一并扣除
+    fixed_t profit = symbol_profit_fixed(sym, order->side, order->fx_price, close_price, order->fx_lot, profit_price);
+    order_set_profit_fixed(order, profit, close_price, profit_price);
+}
 
-    // 2.折算USD
-    if (sym->profit_calc == PROFIT_CALC_FOREX) {
-        mpd_mul(profit, profit, sym->contract_size, &mpd_ctx);
-        if (sym->profit_type == PROFIT_TYPE_UB) {
-            mpd_div(profit, profit, close_price, &mpd_ctx);  // USDJPY
-        } else if (sym->profit_type == PROFIT_TYPE_AC) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // EURGBP
-        } else if (sym->profit_type == PROFIT_TYPE_CB) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // CADJPY
-        }
-    } else if (sym->profit_calc == PROFIT_CALC_CFD) {
-        mpd_mul(profit, profit, sym->contract_size, &mpd_ctx);
-        if (strcmp(sym->name, "HSI") == 0) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // USDHKD
-        } else if (strcmp(sym->name, "DAX") == 0) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // EURUSD
-        } else if (strcmp(sym->name, "UK100") == 0) {
-            mpd_mul(profit, profit, profit_price, &mpd_ctx); // GBPUSD
-        } else if (strcmp(sym->name, "JP225") == 0) {
-            mpd_div(profit, profit, profit_price, &mpd_ctx); // USDJPY
-        }
-    } else {
-        mpd_mul(profit, profit, sym->tick_price, &mpd_ctx);
-        mpd_div(profit, profit, sym->tick_size, &mpd_ctx);
-    }
-    mpd_rescale(profit, profit, -2, &mpd_ctx);
+static void trigger(order_t *order, const char *type, symbol_t *sym, fixed_t close_price, fixed_t profit_price)
+{
+    char price[32];
+    log_info("## [%s] %"PRIu64" %s %s [%"PRIu64"] [%s / %s] at %s", type, order->sid, order->side == ORDER_SIDE_BUY ? "buy" : "sell",
+            sym->name, order->id, mpd_to_sci(order->tp, 0), mpd_to_sci(order->sl, 0), fixed_to_str(price, sizeof(price), close_price, sym->digit));
+    order_profit(order, sym, close_price, profit_price);
+    order->comment = strdup(type);
+    order->finish_time = current_timestamp();
+    order_ids[total++] = order->id;
+}
 
-    // 3.更新实时盈亏
-    if (mpd_cmp(order->profit, mpd_zero, &mpd_ctx) != 0) {
-        balance_sub_float(order->sid, BALANCE_TYPE_FLOAT, order->profit);
+// 只遍历已被穿过的价位，队列头不满足条件即停止
+// 返回 true 表示还有未处理的触发单，留到下一轮
+static bool check_symbol(uint32_t id)
+{
+    symbol_t *sym = &configs.symbols[id];
+    market_t *m = get_market(sym->name);
+    if (m == NULL)
+        return false;
+
+    if (m->tp_buys->len + m->tp_sells->len + m->sl_buys->len + m->sl_sells->len == 0)
+        return false;
+
+    fixed_t bid = tick_bid_fixed(id);
+    fixed_t ask = tick_ask_fixed(id);
+    if (bid <= 0 || ask <= 0)
+        return false;
+
+    fixed_t profit_bid = symbol_profit_price_fixed(sym, ORDER_SIDE_BUY);
+    fixed_t profit_ask = symbol_profit_price_fixed(sym, ORDER_SIDE_SELL);
+    if (profit_bid <= 0)
+        return false;
+
+    total = 0;
+    skiplist_node *node;
+    skiplist_iter *iter;
+
+    // buy [tp] close by bid
+    iter = skiplist_get_iterator(m->tp_buys);
+    while (total < TPSL_BATCH && (node = skiplist_next(iter)) != NULL) {
+        order_t *order = node->value;
+        if (bid < order->fx_tp)
+            break;
+        trigger(order, "tp", sym, bid, profit_bid);
+    }
+    skiplist_release_iterator(iter);
+
+    // buy [sl] close by bid
+    iter = skiplist_get_iterator(m->sl_buys);
+    while (total < TPSL_BATCH && (node = skiplist_next(iter)) != NULL) {
+        order_t *order = node->value;
+        if (bid > order->fx_sl)
+            break;
+        trigger(order, "sl", sym, bid, profit_bid);
+    }
+    skiplist_release_iterator(iter);
+
+    // sell [tp] close by ask
+    iter = skiplist_get_iterator(m->tp_sells);
+    while (total < TPSL_BATCH && (node = skiplist_next(iter)) != NULL) {
+        order_t *order = node->value;
+        if (ask > order->fx_tp)
+            break;
+        trigger(order, "tp", sym, ask, profit_ask);
+    }
+    skiplist_release_iterator(iter);
+
+    // sell [sl] close by ask
+    iter = skiplist_get_iterator(m->sl_sells);
+    while (total < TPSL_BATCH && (node = skiplist_next(iter)) != NULL) {
+        order_t *order = node->value;
+        if (ask < order->fx_sl)
+            break;
+        trigger(order, "sl", sym, ask, profit_ask);
     }
-    balance_add_float(order->sid, BALANCE_TYPE_FLOAT, profit);
+    skiplist_release_iterator(iter);
 
-    // 4.更新订单
-    mpd_copy(order->profit, profit, &mpd_ctx);
-    mpd_copy(order->close_price, close_price, &mpd_ctx);
-    mpd_copy(order->profit_price, profit_price, &mpd_ctx);
+    // close order
+    for (int j = 0; j < total; ++j) {
+        int ret = market_tpsl_hedged(m, order_ids[j]);
+        if (ret < 0)
+            log_fatal("tpsl fail: %d, order: %"PRIu64"", ret, order_ids[j]);
+    }
 
-    mpd_del(profit);
+    return total == TPSL_BATCH;
 }
 
 static void flush_list(void)
 {
-    const char *symbol;
-    json_t *value;
-    json_object_foreach(list, symbol, value) {
-
-//    for (int i = 0; i < configs.symbol_num; ++i) {
-//        const char* symbol = configs.symbols[i].name;
-
-        market_t *m = get_market(symbol);
-        if (m == NULL)
-            continue;
-
-        int size = m->tp_buys->len + m->tp_sells->len + m->sl_buys->len + m->sl_sells->len;
-        if (size == 0)
-            continue;
-
-        // bid
-        mpd_t *bid = mpd_new(&mpd_ctx);
-        mpd_copy(bid, symbol_bid(symbol), &mpd_ctx);
-        if (mpd_cmp(bid, mpd_zero, &mpd_ctx) <= 0) {
-            mpd_del(bid);
-            continue;
-        }
-        // ask
-        mpd_t *ask = mpd_new(&mpd_ctx);
-        mpd_copy(ask, symbol_ask(symbol), &mpd_ctx);
-        if (mpd_cmp(ask, mpd_zero, &mpd_ctx) <= 0) {
-            mpd_del(bid);
-            mpd_del(ask);
-            continue;
-        }
-
-        // profit price
-        mpd_t *profit_bid_price = mpd_new(&mpd_ctx);
-        mpd_t *profit_ask_price = mpd_new(&mpd_ctx);
-        mpd_copy(profit_bid_price, mpd_one, &mpd_ctx);
-        mpd_copy(profit_ask_price, mpd_one, &mpd_ctx);
-
-        symbol_t *sym = get_symbol(symbol);
-        if (sym->profit_calc == PROFIT_CALC_FOREX) {
-            if (sym->profit_type == PROFIT_TYPE_AC || sym->profit_type == PROFIT_TYPE_CB) {
-                mpd_copy(profit_bid_price, symbol_bid(sym->profit_symbol), &mpd_ctx);
-                mpd_copy(profit_ask_price, symbol_ask(sym->profit_symbol), &mpd_ctx);
-            }
-        } else {
-            if (strcmp(sym->name, "HSI") == 0) {
-                mpd_copy(profit_bid_price, symbol_bid("USDHKD"), &mpd_ctx);
-                mpd_copy(profit_ask_price, symbol_ask("USDHKD"), &mpd_ctx);
-            } else if (strcmp(sym->name, "DAX") == 0) {
-                mpd_copy(profit_bid_price, symbol_bid("EURUSD"), &mpd_ctx);
-                mpd_copy(profit_ask_price, symbol_ask("EURUSD"), &mpd_ctx);
-            } else if (strcmp(sym->name, "UK100") == 0) {
-                mpd_copy(profit_bid_price, symbol_bid("GBPUSD"), &mpd_ctx);
-                mpd_copy(profit_ask_price, symbol_ask("GBPUSD"), &mpd_ctx);
-            } else if (strcmp(sym->name, "JP225") == 0) {
-                mpd_copy(profit_bid_price, symbol_bid("USDJPY"), &mpd_ctx);
-                mpd_copy(profit_ask_price, symbol_ask("USDJPY"), &mpd_ctx);
-            }
-        }
-
-        if (mpd_cmp(profit_bid_price, mpd_zero, &mpd_ctx) <= 0) {
-            mpd_del(bid);
-            mpd_del(ask);
-            mpd_del(profit_bid_price);
-            mpd_del(profit_ask_price);
+    for (int i = 0; i < configs.symbol_num; ++i) {
+        if (!pending[i])
             continue;
-        }
-
-        uint64_t *order_ids = (uint64_t *) malloc(size * sizeof(uint64_t));
-        int total = 0;
-
-        // buy [tp] close by bid
-        skiplist_node *node;
-        skiplist_iter *iter = skiplist_get_iterator(m->tp_buys);
-        while ((node = skiplist_next(iter)) != NULL) {
-            order_t *order = node->value;
-            if (mpd_cmp(bid, order->tp, &mpd_ctx) < 0)
-                break;
-
-            log_info("## [tp] %"PRIu64" buy %s [%"PRIu64"] [%s / %s] at %s", order->sid, symbol,
-                    order->id, mpd_to_sci(order->tp, 0), mpd_to_sci(order->sl, 0), mpd_to_sci(bid, 0));
-            order_profit(order, sym, bid, profit_bid_price);
-            order->comment = strdup("tp");
-            order->finish_time = current_timestamp();
-            order_ids[total] = order->id;
-            total++;
-        }
-        skiplist_release_iterator(iter);
-
-        // buy [sl] close by bid
-        iter = skiplist_get_iterator(m->sl_buys);
-        while ((node = skiplist_next(iter)) != NULL) {
-            order_t *order = node->value;
-            if (mpd_cmp(bid, order->sl, &mpd_ctx) > 0)
-                break;
-
-            log_info("## [sl] %"PRIu64" buy %s [%"PRIu64"] [%s / %s] at %s", order->sid, symbol,
-                    order->id, mpd_to_sci(order->tp, 0), mpd_to_sci(order->sl, 0), mpd_to_sci(bid, 0));
-            order_profit(order, sym, bid, profit_bid_price);
-            order->comment = strdup("sl");
-            order->finish_time = current_timestamp();
-            order_ids[total] = order->id;
-            total++;
-        }
-        skiplist_release_iterator(iter);
-
-        // sell [tp] close by ask
-        iter = skiplist_get_iterator(m->tp_sells);
-        while ((node = skiplist_next(iter)) != NULL) {
-            order_t *order = node->value;
-            if (mpd_cmp(ask, order->tp, &mpd_ctx) > 0)
-                break;
-
-            log_info("## [tp] %"PRIu64" sell %s [%"PRIu64"] [%s / %s] at %s", order->sid, symbol,
-                    order->id, mpd_to_sci(order->tp, 0), mpd_to_sci(order->sl, 0), mpd_to_sci(ask, 0));
-            order_profit(order, sym, ask, profit_ask_price);
-            order->comment = strdup("tp");
-            order->finish_time = current_timestamp();
-            order_ids[total] = order->id;
-            total++;
-        }
-        skiplist_release_iterator(iter);
-
-        // sell [sl] close by ask
-        iter = skiplist_get_iterator(m->sl_sells);
-        while ((node = skiplist_next(iter)) != NULL) {
-            order_t *order = node->value;
-            if (mpd_cmp(ask, order->sl, &mpd_ctx) < 0)
-                break;
-
-            log_info("## [sl] %"PRIu64" sell %s [%"PRIu64"] [%s / %s] at %s", order->sid, symbol,
-                    order->id, mpd_to_sci(order->tp, 0), mpd_to_sci(order->sl, 0), mpd_to_sci(ask, 0));
-            order_profit(order, sym, ask, profit_ask_price);
-            order->comment = strdup("sl");
-            order->finish_time = current_timestamp();
-            order_ids[total] = order->id;
-            total++;
-        }
-        skiplist_release_iterator(iter);
-
-/*
-        // buy orders
-        skiplist_node *node;
-        skiplist_iter *iter = skiplist_get_iterator(m->tpsl_buys);
-        while ((node = skiplist_next(iter)) != NULL) {
-            order_t *order = node->value;
-
-            // [tp] close by bid
-            if (mpd_cmp(order->tp, mpd_zero, &mpd_ctx) > 0 && mpd_cmp(bid, order->tp, &mpd_ctx) >= 0) {
-                log_info("## [tp] %"PRIu64" buy %s [%"PRIu64"] [%s / %s] at %s", order->sid, symbol,
-                         order->id, mpd_to_sci(order->tp, 0), mpd_to_sci(order->sl, 0), mpd_to_sci(bid, 0));
-                order_profit(order, sym, bid, profit_bid_price);
-                order->comment = strdup("tp");
-                order->finish_time = current_timestamp();
-                order_ids[total] = order->id;
-                total++;
-                continue;
-            } 
-
-            // [sl] close by bid
-            if (mpd_cmp(order->sl, mpd_zero, &mpd_ctx) > 0 && mpd_cmp(bid, order->sl, &mpd_ctx) <= 0) {
-                log_info("## [sl] %"PRIu64" buy %s [%"PRIu64"] [%s / %s] at %s", order->sid, symbol,
-                         order->id, mpd_to_sci(order->tp, 0), mpd_to_sci(order->sl, 0), mpd_to_sci(bid, 0));
-                order_profit(order, sym, bid, profit_bid_price);
-                order->comment = strdup("sl");
-                order->finish_time = current_timestamp();
-                order_ids[total] = order->id;
-                total++;
-            } 
-        }
-        skiplist_release_iterator(iter);
-
-        // sell orders
-        iter = skiplist_get_iterator(m->tpsl_sells);
-        while ((node = skiplist_next(iter)) != NULL) {
-            order_t *order = node->value;
-
-            // [tp] close by ask
-            if (mpd_cmp(order->tp, mpd_zero, &mpd_ctx) > 0 && mpd_cmp(ask, order->tp, &mpd_ctx) <= 0) {
-                log_info("## [tp] %"PRIu64" sell %s [%"PRIu64"] [%s / %s] at %s", order->sid, symbol,
-                         order->id, mpd_to_sci(order->tp, 0), mpd_to_sci(order->sl, 0), mpd_to_sci(ask, 0));
-                order_profit(order, sym, ask, profit_ask_price);
-                order->comment = strdup("tp");
-                order->finish_time = current_timestamp();
-                order_ids[total] = order->id;
-                total++;
-                continue;
-            } 
-
-            // [sl] close by ask
-            if (mpd_cmp(order->sl, mpd_zero, &mpd_ctx) > 0 && mpd_cmp(ask, order->sl, &mpd_ctx) >= 0) {
-                log_info("## [sl] %"PRIu64" sell %s [%"PRIu64"] [%s / %s] at %s", order->sid, symbol,
-                         order->id, mpd_to_sci(order->tp, 0), mpd_to_sci(order->sl, 0), mpd_to_sci(ask, 0));
-                order_profit(order, sym, ask, profit_ask_price);
-                order->comment = strdup("sl");
-                order->finish_time = current_timestamp();
-                order_ids[total] = order->id;
-                total++;
-            } 
-        }
-        skiplist_release_iterator(iter);
-*/
-
-        mpd_del(bid);
-        mpd_del(ask);
-        mpd_del(profit_bid_price);
-        mpd_del(profit_ask_price);
-
-        // close order
-        int ret = 0;
-        for (int j = 0; j < total; ++j) {
-            ret = market_tpsl_hedged(m, order_ids[j]);
-            if (ret < 0)
-                log_fatal("tpsl fail: %d, order: %"PRIu64"", ret, order_ids[j]);
-        }
-        free(order_ids);
+        pending[i] = check_symbol(i);
     }
-
-    json_object_clear(list);
 }
 
 static void on_timer(nw_timer *t, void *privdata)
@@ -292,15 +129,28 @@ static void on_timer(nw_timer *t, void *privdata)
 
 int init_tpsl(void)
 {
-    list = json_object();
+    pending = malloc(sizeof(bool) * configs.symbol_num);
+    if (pending == NULL)
+        return -__LINE__;
+    memset(pending, 0, sizeof(bool) * configs.symbol_num);
 
-    nw_timer_set(&timer, 0.2, true, on_timer, NULL);
+    nw_timer_set(&timer, 0.01, true, on_timer, NULL);
     nw_timer_start(&timer);
     return 0;
 }
 
-int append_tpsl(const char *symbol)
+// 收到 tick 立即检查，处理不完的由定时器继续
+int append_tpsl(uint32_t id)
 {
-    json_object_set(list, symbol, json_integer(0));
+    if (id >= configs.symbol_num)
+        return -__LINE__;
+
+    if (flag == 0) {
+        flag = 1;
+        pending[id] = check_symbol(id);
+        flag = 0;
+    } else {
+        pending[id] = true;
+    }
     return 0;
 }
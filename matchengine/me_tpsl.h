@@ -5,7 +5,8 @@
 
 int init_tpsl(void);
 
-int append_tpsl(const char *symbol);
+// id 为品种在 configs.symbols 中的下标
+int append_tpsl(uint32_t id);
 
 # endif
 
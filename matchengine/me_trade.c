@@ -90,6 +90,8 @@ int init_trade_v2(void)
         dict_add(dict_market, configs.symbols[i].name, m);
     }
 
+    ERR_RET(market_init_positions());
+
     skiplist_type st;
     memset(&st, 0, sizeof(st));
     st.compare = order_expire_compare;
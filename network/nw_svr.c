@@ -1,9 +1,18 @@
 # include <stdlib.h>
 # include <stdio.h>
+# include <string.h>
 # include <unistd.h>
 
 # include "nw_svr.h"
 
+# define NW_SVR_MAX     64
+# define NW_INHERIT_MAX 64
+
+static nw_svr *svr_started[NW_SVR_MAX];
+static int svr_started_count;
+static int inherit_fds[NW_INHERIT_MAX];
+static int inherit_count;
+
 static int create_socket(int family, int sock_type)
 {
     int sockfd = socket(family, sock_type, 0);
@@ -261,11 +270,51 @@ nw_svr *nw_svr_create(nw_svr_cfg *cfg, nw_svr_type *type, void *privdata)
     return svr;
 }
 
+static bool same_addr(nw_addr_t *a, nw_addr_t *b)
+{
+    if (a->family != b->family)
+        return false;
+    switch (a->family) {
+    case AF_INET:
+        return a->in.sin_port == b->in.sin_port && a->in.sin_addr.s_addr == b->in.sin_addr.s_addr;
+    case AF_INET6:
+        return a->in6.sin6_port == b->in6.sin6_port && memcmp(&a->in6.sin6_addr, &b->in6.sin6_addr, sizeof(a->in6.sin6_addr)) == 0;
+    case AF_UNIX:
+        return strcmp(a->un.sun_path, b->un.sun_path) == 0;
+    default:
+        return false;
+    }
+}
+
+static int inherit_take(nw_ses *ses)
+{
+    for (int i = 0; i < inherit_count; ++i) {
+        nw_addr_t addr;
+        int sock_type;
+        socklen_t len = sizeof(sock_type);
+        if (nw_sock_host_addr(inherit_fds[i], &addr) < 0)
+            continue;
+        if (getsockopt(inherit_fds[i], SOL_SOCKET, SO_TYPE, &sock_type, &len) < 0)
+            continue;
+        if (sock_type != ses->sock_type || !same_addr(&addr, ses->host_addr))
+            continue;
+
+        int fd = inherit_fds[i];
+        inherit_fds[i] = inherit_fds[--inherit_count];
+        return fd;
+    }
+    return -1;
+}
+
 int nw_svr_start(nw_svr *svr)
 {
     for (uint32_t i = 0; i < svr->svr_count; ++i) {
         nw_ses *ses = &svr->svr_list[i];
-        if (nw_ses_bind(ses, ses->host_addr) < 0) {
+        int fd = inherit_take(ses);
+        if (fd >= 0) {
+            close(ses->sockfd);
+            ses->sockfd = fd;
+        } else if (nw_ses_bind(ses, ses->host_addr) < 0) {
             return -1;
         }
         if (nw_ses_start(ses) < 0) {
@@ -273,9 +322,51 @@ int nw_svr_start(nw_svr *svr)
         }
     }
 
+    for (int i = 0; i < svr_started_count; ++i) {
+        if (svr_started[i] == svr)
+            return 0;
+    }
+    if (svr_started_count < NW_SVR_MAX) {
+        svr_started[svr_started_count++] = svr;
+    }
+
     return 0;
 }
 
+void nw_svr_inherit(int *fds, int count)
+{
+    for (int i = 0; i < count && inherit_count < NW_INHERIT_MAX; ++i) {
+        inherit_fds[inherit_count++] = fds[i];
+    }
+}
+
+void nw_svr_inherit_release(void)
+{
+    for (int i = 0; i < inherit_count; ++i) {
+        close(inherit_fds[i]);
+    }
+    inherit_count = 0;
+}
+
+int nw_svr_listen_fds(int *fds, int max)
+{
+    int count = 0;
+    for (int i = 0; i < svr_started_count; ++i) {
+        nw_svr *svr = svr_started[i];
+        for (uint32_t j = 0; j < svr->svr_count && count < max; ++j) {
+            fds[count++] = svr->svr_list[j].sockfd;
+        }
+    }
+    return count;
+}
+
+void nw_svr_stop_all(void)
+{
+    for (int i = 0; i < svr_started_count; ++i) {
+        nw_svr_stop(svr_started[i]);
+    }
+}
+
 int nw_svr_stop(nw_svr *svr)
 {
     for (uint32_t i = 0; i < svr->svr_count; ++i) {
@@ -289,6 +380,12 @@ int nw_svr_stop(nw_svr *svr)
 void nw_svr_release(nw_svr *svr)
 {
     nw_svr_stop(svr);
+    for (int i = 0; i < svr_started_count; ++i) {
+        if (svr_started[i] == svr) {
+            svr_started[i] = svr_started[--svr_started_count];
+            break;
+        }
+    }
     nw_ses *curr = svr->clt_list_head;
     while (curr) {
         nw_ses *next = curr->next;
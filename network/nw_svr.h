@@ -105,5 +105,15 @@ int nw_svr_stop(nw_svr *svr);
 void nw_svr_release(nw_svr *svr);
 void nw_svr_close_clt(nw_svr *svr, nw_ses *ses);
 
+/* listening fds taken over from a previous process, nw_svr_start will use
+ * the fd which bind on the same addr and sock type instead of bind again */
+void nw_svr_inherit(int *fds, int count);
+/* close inherited fds that no svr claimed */
+void nw_svr_inherit_release(void);
+/* copy the listening fds of all started svr to fds, return the count */
+int nw_svr_listen_fds(int *fds, int max);
+/* stop accept on all started svr, established connections are not affected */
+void nw_svr_stop_all(void);
+
 # endif
 
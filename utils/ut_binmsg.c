@@ -0,0 +1,189 @@
+# include <string.h>
+# include <inttypes.h>
+
+# include "ut_binmsg.h"
+
+bool binmsg_is_binary(const char *data, size_t len)
+{
+    return len >= BINMSG_HEAD_SIZE && (uint8_t)data[0] == BINMSG_MAGIC;
+}
+
+int binmsg_pack_head(void **dest, size_t *left, uint8_t type)
+{
+    if (pack_char(dest, left, BINMSG_MAGIC) < 0)
+        return -1;
+    if (pack_char(dest, left, BINMSG_VERSION) < 0)
+        return -1;
+    if (pack_char(dest, left, type) < 0)
+        return -1;
+    return BINMSG_HEAD_SIZE;
+}
+
+int binmsg_pack_double(void **dest, size_t *left, double val)
+{
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    return pack_uint64_le(dest, left, bits);
+}
+
+int binmsg_pack_fixed(void **dest, size_t *left, fixed_t val)
+{
+    return pack_uint64_le(dest, left, (uint64_t)val);
+}
+
+/* field decoders append to the array and return -1 once the buffer runs out */
+
+static int append_uint32(json_t *msg, void **src, size_t *left)
+{
+    uint32_t val;
+    if (unpack_uint32_le(src, left, &val) < 0)
+        return -1;
+    json_array_append_new(msg, json_integer(val));
+    return 0;
+}
+
+static int append_uint64(json_t *msg, void **src, size_t *left)
+{
+    uint64_t val;
+    if (unpack_uint64_le(src, left, &val) < 0)
+        return -1;
+    json_array_append_new(msg, json_integer(val));
+    return 0;
+}
+
+static int append_double(json_t *msg, void **src, size_t *left)
+{
+    uint64_t bits;
+    if (unpack_uint64_le(src, left, &bits) < 0)
+        return -1;
+    double val;
+    memcpy(&val, &bits, sizeof(val));
+    json_array_append_new(msg, json_real(val));
+    return 0;
+}
+
+/* same text as mpd_to_sci of a reduced value: no trailing zeros */
+static int append_fixed(json_t *msg, void **src, size_t *left, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        uint64_t raw;
+        if (unpack_uint64_le(src, left, &raw) < 0)
+            return -1;
+        char buf[32];
+        fixed_to_str(buf, sizeof(buf), (fixed_t)raw, FIXED_PREC);
+        char *dot = strchr(buf, '.');
+        if (dot) {
+            char *end = buf + strlen(buf) - 1;
+            while (*end == '0')
+                *end-- = '\0';
+            if (end == dot)
+                *end = '\0';
+        }
+        json_array_append_new(msg, json_string(buf));
+    }
+    return 0;
+}
+
+static int append_str(json_t *msg, void **src, size_t *left, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        uint64_t len;
+        if (unpack_varint_le(src, left, &len) < 0 || *left < len)
+            return -1;
+        json_array_append_new(msg, json_stringn(*src, len));
+        *src  += len;
+        *left -= len;
+    }
+    return 0;
+}
+
+static int decode_balance(json_t *msg, void **src, size_t *left)
+{
+    if (append_double(msg, src, left) < 0)
+        return -__LINE__;
+    if (append_uint64(msg, src, left) < 0)
+        return -__LINE__;
+    if (append_fixed(msg, src, left, 2) < 0)
+        return -__LINE__;
+    if (append_str(msg, src, left, 1) < 0)
+        return -__LINE__;
+    return 0;
+}
+
+static int decode_order(json_t *msg, void **src, size_t *left)
+{
+    if (append_uint32(msg, src, left) < 0)
+        return -__LINE__;
+    if (append_uint64(msg, src, left) < 0 || append_uint64(msg, src, left) < 0)
+        return -__LINE__;
+    if (append_uint32(msg, src, left) < 0)
+        return -__LINE__;
+    if (append_str(msg, src, left, 1) < 0)
+        return -__LINE__;
+    if (append_double(msg, src, left) < 0 || append_double(msg, src, left) < 0 || append_double(msg, src, left) < 0)
+        return -__LINE__;
+    if (append_uint64(msg, src, left) < 0)
+        return -__LINE__;
+    if (append_fixed(msg, src, left, 8) < 0)
+        return -__LINE__;
+    if (append_str(msg, src, left, 1) < 0)
+        return -__LINE__;
+    return 0;
+}
+
+static int decode_deal(json_t *msg, void **src, size_t *left)
+{
+    if (append_double(msg, src, left) < 0)
+        return -__LINE__;
+    if (append_str(msg, src, left, 1) < 0)
+        return -__LINE__;
+    if (append_uint64(msg, src, left) < 0 || append_uint64(msg, src, left) < 0)
+        return -__LINE__;
+    if (append_uint32(msg, src, left) < 0 || append_uint32(msg, src, left) < 0)
+        return -__LINE__;
+    if (append_fixed(msg, src, left, 4) < 0)
+        return -__LINE__;
+    if (append_uint32(msg, src, left) < 0)
+        return -__LINE__;
+    if (append_uint64(msg, src, left) < 0)
+        return -__LINE__;
+    if (append_str(msg, src, left, 2) < 0)
+        return -__LINE__;
+    return 0;
+}
+
+json_t *binmsg_decode(const char *data, size_t len)
+{
+    if (!binmsg_is_binary(data, len))
+        return NULL;
+    if ((uint8_t)data[1] != BINMSG_VERSION)
+        return NULL;
+
+    uint8_t type = data[2];
+    void *src = (void *)(data + BINMSG_HEAD_SIZE);
+    size_t left = len - BINMSG_HEAD_SIZE;
+    json_t *msg = json_array();
+
+    int ret;
+    switch (type) {
+    case BINMSG_BALANCE:
+        ret = decode_balance(msg, &src, &left);
+        break;
+    case BINMSG_ORDER:
+        ret = decode_order(msg, &src, &left);
+        break;
+    case BINMSG_DEAL:
+        ret = decode_deal(msg, &src, &left);
+        break;
+    default:
+        ret = -__LINE__;
+        break;
+    }
+    if (ret < 0 || left != 0) {
+        json_decref(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
@@ -0,0 +1,56 @@
+# ifndef _UT_BINMSG_H_
+# define _UT_BINMSG_H_
+
+# include <stddef.h>
+# include <stdint.h>
+# include <stdbool.h>
+# include <jansson.h>
+
+# include "ut_pack.h"
+# include "ut_fixed.h"
+
+/*
+ * Binary encoding of the matchengine kafka messages.
+ *
+ * header: magic (1 byte), version (1 byte), type (1 byte)
+ * body:   fixed-size fields in the same order as the JSON array, little endian,
+ *         integers as uint32/uint64, times as IEEE double bits in a uint64,
+ *         decimals as fixed_t (int64, scaled by 10^FIXED_PREC), strings as varstr.
+ *
+ * The magic byte can never start a JSON document, so consumers accept both
+ * encodings and producers can switch topics one at a time.
+ *
+ * Decimal text differs from the JSON encoding: binmsg_decode prints the
+ * shortest plain form, so "100.00" arrives as "100" and "0.50" as "0.5",
+ * while JSON keeps the engine's scale. Numeric values are identical.
+ * A message with a decimal that fixed_t cannot hold exactly (more than
+ * FIXED_PREC decimals, or 10^10 and above) is sent as JSON instead, see
+ * fixed_fits_mpd.
+ */
+
+# define BINMSG_MAGIC       0xB7
+# define BINMSG_VERSION     1
+# define BINMSG_HEAD_SIZE   3
+
+enum {
+    /* double time, uint64 sid, fixed change, fixed balance, str comment */
+    BINMSG_BALANCE  = 1,
+    /* uint32 event, uint64 id, uint64 sid, uint32 side, str symbol, double create_time, double update_time,
+     * double finish_time, uint64 expire_time, fixed lot, price, close_price, fee, swaps, profit, tp, sl, str comment */
+    BINMSG_ORDER    = 2,
+    /* double time, str market, uint64 ask_id, uint64 bid_id, uint32 ask_user, uint32 bid_user,
+     * fixed price, amount, ask_fee, bid_fee, uint32 side, uint64 id, str stock, str money */
+    BINMSG_DEAL     = 3,
+};
+
+bool binmsg_is_binary(const char *data, size_t len);
+
+int binmsg_pack_head(void **dest, size_t *left, uint8_t type);
+int binmsg_pack_double(void **dest, size_t *left, double val);
+int binmsg_pack_fixed(void **dest, size_t *left, fixed_t val);
+
+/* decode into the same json array the JSON encoding carries, decimals as strings */
+json_t *binmsg_decode(const char *data, size_t len);
+
+# endif
+
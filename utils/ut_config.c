@@ -362,7 +362,7 @@ int load_cfg_kafka_consumer(json_t *root, const char *key, kafka_consumer_cfg *c
 
     ERR_RET(read_cfg_str(node, "brokers", &cfg->brokers, NULL));
     ERR_RET(read_cfg_str(node, "topic", &cfg->topic, NULL));
-    ERR_RET(read_cfg_int(node, "partition", &cfg->partition, false, 0));
+    ERR_RET(read_cfg_int(node, "partition", &cfg->partition, false, -1));
     ERR_RET(read_cfg_int(node, "limit", &cfg->limit, false, 1000));
     ERR_RET(read_cfg_int64(node, "offset", &cfg->offset, false, 0));
 
@@ -0,0 +1,164 @@
+# include <stdio.h>
+# include <string.h>
+# include <inttypes.h>
+
+# include "ut_fixed.h"
+# include "ut_decimal.h"
+
+const int64_t fixed_pow10[19] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL, 100000000LL,
+    1000000000LL, 10000000000LL, 100000000000LL, 1000000000000LL, 10000000000000LL,
+    100000000000000LL, 1000000000000000LL, 10000000000000000LL, 100000000000000000LL,
+    1000000000000000000LL,
+};
+
+__int128 fixed_div128(__int128 a, __int128 b)
+{
+    if (b == 0)
+        return 0;
+
+    bool neg = (a < 0) != (b < 0);
+    unsigned __int128 ua = a < 0 ? -(unsigned __int128)a : (unsigned __int128)a;
+    unsigned __int128 ub = b < 0 ? -(unsigned __int128)b : (unsigned __int128)b;
+    unsigned __int128 q = ua / ub;
+    unsigned __int128 r = ua % ub;
+    if (r >= ub - r)
+        q++;
+
+    return neg ? -(__int128)q : (__int128)q;
+}
+
+fixed_t fixed_mul(fixed_t a, fixed_t b)
+{
+    return (fixed_t)fixed_div128((__int128)a * b, FIXED_ONE);
+}
+
+fixed_t fixed_div(fixed_t a, fixed_t b)
+{
+    return (fixed_t)fixed_div128((__int128)a * FIXED_ONE, b);
+}
+
+fixed_t fixed_muldiv(fixed_t a, fixed_t b, fixed_t c)
+{
+    return (fixed_t)fixed_div128((__int128)a * b, c);
+}
+
+fixed_t fixed_round(fixed_t val, int prec)
+{
+    if (prec >= FIXED_PREC)
+        return val;
+    if (prec < 0)
+        prec = 0;
+
+    int64_t unit = fixed_pow10[FIXED_PREC - prec];
+    return (fixed_t)fixed_div128(val, unit) * unit;
+}
+
+int fixed_from_str(const char *str, size_t len, fixed_t *val)
+{
+    size_t i = 0;
+    bool neg = false;
+    if (i < len && (str[i] == '-' || str[i] == '+')) {
+        neg = str[i] == '-';
+        i++;
+    }
+
+    uint64_t integer = 0;
+    int int_digits = 0;
+    while (i < len && str[i] >= '0' && str[i] <= '9') {
+        integer = integer * 10 + (str[i] - '0');
+        if (++int_digits > 10)
+            return -__LINE__;
+        i++;
+    }
+
+    uint64_t frac = 0;
+    int frac_digits = 0;
+    bool round_up = false;
+    if (i < len && str[i] == '.') {
+        i++;
+        while (i < len && str[i] >= '0' && str[i] <= '9') {
+            if (frac_digits < FIXED_PREC) {
+                frac = frac * 10 + (str[i] - '0');
+                frac_digits++;
+            } else if (frac_digits == FIXED_PREC) {
+                round_up = str[i] >= '5';
+                frac_digits++;
+            }
+            i++;
+        }
+    }
+
+    if (i != len || (int_digits == 0 && frac_digits == 0))
+        return -__LINE__;
+
+    if (frac_digits < FIXED_PREC)
+        frac *= fixed_pow10[FIXED_PREC - frac_digits];
+
+    int64_t raw = (int64_t)(integer * FIXED_ONE + frac) + (round_up ? 1 : 0);
+    *val = neg ? -raw : raw;
+    return 0;
+}
+
+char *fixed_to_str(char *buf, size_t size, fixed_t val, int prec)
+{
+    if (prec > FIXED_PREC)
+        prec = FIXED_PREC;
+    if (prec < 0)
+        prec = 0;
+
+    val = fixed_round(val, prec);
+    uint64_t abs = val < 0 ? -(uint64_t)val : (uint64_t)val;
+    uint64_t integer = abs / FIXED_ONE;
+    uint64_t frac = (abs % FIXED_ONE) / fixed_pow10[FIXED_PREC - prec];
+
+    if (prec == 0) {
+        snprintf(buf, size, "%s%"PRIu64, val < 0 ? "-" : "", integer);
+    } else {
+        snprintf(buf, size, "%s%"PRIu64".%0*"PRIu64, val < 0 ? "-" : "", integer, prec, frac);
+    }
+    return buf;
+}
+
+fixed_t fixed_from_mpd(const mpd_t *val)
+{
+    /* fast path: one coefficient word and no more than FIXED_PREC decimals, scale without an mpd multiply */
+    if (!mpd_isspecial(val) && val->len == 1 && val->exp >= -FIXED_PREC && val->exp <= 18 - FIXED_PREC) {
+        uint64_t coef = val->data[0];
+        int64_t mul = fixed_pow10[FIXED_PREC + val->exp];
+        if (coef <= (uint64_t)INT64_MAX / mul) {
+            int64_t raw = (int64_t)coef * mul;
+            return mpd_isnegative(val) ? -raw : raw;
+        }
+    }
+
+    mpd_t *scaled = mpd_new(&mpd_ctx);
+    mpd_t *one = mpd_new(&mpd_ctx);
+    mpd_set_i64(one, FIXED_ONE, &mpd_ctx);
+    mpd_mul(scaled, val, one, &mpd_ctx);
+    mpd_round_to_int(scaled, scaled, &mpd_ctx);
+    fixed_t raw = mpd_get_i64(scaled, &mpd_ctx);
+    mpd_del(scaled);
+    mpd_del(one);
+    return raw;
+}
+
+bool fixed_fits_mpd(const mpd_t *val)
+{
+    if (mpd_isspecial(val))
+        return false;
+    if (mpd_iszero(val))
+        return true;
+    /* digits past FIXED_PREC decimals must all be trailing zeros */
+    if (val->exp < -FIXED_PREC && val->exp + mpd_trail_zeros(val) < -FIXED_PREC)
+        return false;
+    /* below 10^10 the scaled value stays under 10^18 */
+    return mpd_adjexp(val) < 18 - FIXED_PREC;
+}
+
+void fixed_to_mpd(mpd_t *dst, fixed_t val, int prec)
+{
+    char buf[32];
+    mpd_set_string(dst, fixed_to_str(buf, sizeof(buf), val, prec), &mpd_ctx);
+}
+
@@ -0,0 +1,39 @@
+# ifndef _UT_FIXED_H_
+# define _UT_FIXED_H_
+
+# include <stddef.h>
+# include <stdint.h>
+# include <stdbool.h>
+# include <mpdecimal.h>
+
+/*
+ * Scaled int64 decimal: value = raw / 10^FIXED_PREC.
+ *
+ * FIXED_PREC matches PREC_PRICE so every price, lot and money amount the
+ * engine stores fits without loss. Results are rounded half away from zero,
+ * the same rule as mpd_ctx (MPD_ROUND_HALF_UP).
+ */
+typedef int64_t fixed_t;
+
+# define FIXED_PREC     8
+# define FIXED_ONE      100000000LL
+
+extern const int64_t fixed_pow10[19];
+
+fixed_t fixed_from_mpd(const mpd_t *val);
+/* true if val converts without rounding or overflow: at most FIXED_PREC decimals and |val| < 10^10 */
+bool    fixed_fits_mpd(const mpd_t *val);
+void    fixed_to_mpd(mpd_t *dst, fixed_t val, int prec);
+int     fixed_from_str(const char *str, size_t len, fixed_t *val);
+char   *fixed_to_str(char *buf, size_t size, fixed_t val, int prec);
+
+fixed_t fixed_mul(fixed_t a, fixed_t b);
+fixed_t fixed_div(fixed_t a, fixed_t b);
+fixed_t fixed_muldiv(fixed_t a, fixed_t b, fixed_t c);
+fixed_t fixed_round(fixed_t val, int prec);
+
+/* raw128 helpers keep a wider intermediate while chaining mul/div, round once at the end */
+__int128 fixed_div128(__int128 a, __int128 b);
+
+# endif
+
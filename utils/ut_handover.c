@@ -0,0 +1,264 @@
+/*
+ * Description: hand over listening sockets to a new process for binary upgrade
+ */
+
+# ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+# endif
+
+# include <poll.h>
+# include <errno.h>
+# include <string.h>
+# include <unistd.h>
+# include <libgen.h>
+# include <limits.h>
+# include <sys/stat.h>
+
+# include "ut_log.h"
+# include "ut_misc.h"
+# include "ut_handover.h"
+
+# define HANDOVER_MAX_FD    64
+# define HANDOVER_REQUEST   "handover"
+
+static nw_svr *handover_svr;
+static void (*handover_cb)(void);
+static bool handover_done;
+
+static int decode_pkg(nw_ses *ses, void *data, size_t max)
+{
+    return max;
+}
+
+static bool peer_is_self(int sockfd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+        return false;
+    return cred.uid == geteuid();
+}
+
+static void on_recv_pkg(nw_ses *ses, void *data, size_t size)
+{
+    if (size != strlen(HANDOVER_REQUEST) || memcmp(data, HANDOVER_REQUEST, size) != 0)
+        return;
+    if (!peer_is_self(ses->sockfd)) {
+        log_error("handover request from other user rejected");
+        return;
+    }
+    if (handover_done) {
+        log_error("handover already done, peer: %s", nw_sock_human_addr(&ses->peer_addr));
+        return;
+    }
+
+    // 先停止 accept，之后到达的连接留在 backlog 里由新进程处理
+    int fds[HANDOVER_MAX_FD];
+    int count = nw_svr_listen_fds(fds, HANDOVER_MAX_FD);
+    nw_svr_stop_all();
+
+    uint32_t num = count;
+    if (nw_ses_send(ses, &num, sizeof(num)) < 0) {
+        log_error("send handover fd count fail");
+        return;
+    }
+    for (int i = 0; i < count; ++i) {
+        if (nw_ses_send_fd(ses, fds[i]) < 0) {
+            log_error("send handover fd: %d fail: %s", fds[i], strerror(errno));
+            return;
+        }
+    }
+
+    handover_done = true;
+    log_vip("handover %d listening fds to new process", count);
+    if (handover_cb) {
+        handover_cb();
+    }
+}
+
+static void on_error_msg(nw_ses *ses, const char *msg)
+{
+    log_error("handover error, msg: %s", msg);
+}
+
+// the socket must live in a directory only we can access
+static int check_dir(const char *path)
+{
+    char buf[PATH_MAX];
+    if (strlen(path) >= sizeof(buf))
+        return -__LINE__;
+    strcpy(buf, path);
+    const char *dir = dirname(buf);
+
+    struct stat st;
+    if (stat(dir, &st) < 0) {
+        if (errno != ENOENT || mkdir(dir, 0700) < 0)
+            return -__LINE__;
+        if (stat(dir, &st) < 0)
+            return -__LINE__;
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077) != 0) {
+        log_error("handover dir: %s must be owned by us with mode 0700", dir);
+        return -__LINE__;
+    }
+    return 0;
+}
+
+// refuse to unlink a path another live process still listens on
+static bool path_in_use(nw_addr_t *addr)
+{
+    int sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sockfd < 0)
+        return false;
+    bool in_use = connect(sockfd, NW_SOCKADDR(addr), addr->addrlen) == 0;
+    close(sockfd);
+    return in_use;
+}
+
+int handover_init(const char *path, void (*on_handover)(void))
+{
+    if (check_dir(path) < 0)
+        return -__LINE__;
+
+    nw_svr_bind bind;
+    memset(&bind, 0, sizeof(bind));
+    sds cfg = sdscatprintf(sdsempty(), "seqpacket@%s", path);
+    int ret = nw_sock_cfg_parse(cfg, &bind.addr, &bind.sock_type);
+    sdsfree(cfg);
+    if (ret < 0)
+        return -__LINE__;
+    if (path_in_use(&bind.addr)) {
+        log_error("handover path: %s is used by another process", path);
+        return -__LINE__;
+    }
+
+    nw_svr_cfg svr_cfg;
+    memset(&svr_cfg, 0, sizeof(svr_cfg));
+    svr_cfg.bind_count = 1;
+    svr_cfg.bind_arr = &bind;
+    svr_cfg.max_pkg_size = 1024;
+
+    nw_svr_type type;
+    memset(&type, 0, sizeof(type));
+    type.decode_pkg = decode_pkg;
+    type.on_recv_pkg = on_recv_pkg;
+    type.on_error_msg = on_error_msg;
+
+    handover_svr = nw_svr_create(&svr_cfg, &type, NULL);
+    if (handover_svr == NULL)
+        return -__LINE__;
+    if (nw_svr_start(handover_svr) < 0)
+        return -__LINE__;
+    if (nw_sock_set_mode(&bind.addr, 0600) < 0)
+        return -__LINE__;
+    handover_cb = on_handover;
+
+    return 0;
+}
+
+static int recv_fd(int sockfd, int *fd)
+{
+    struct msghdr msg;
+    struct iovec io;
+    int data;
+    char control[CMSG_SPACE(sizeof(int))];
+
+    memset(&msg, 0, sizeof(msg));
+    io.iov_base = &data;
+    io.iov_len = sizeof(data);
+    msg.msg_iov = &io;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(sockfd, &msg, 0) <= 0)
+        return -__LINE__;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return -__LINE__;
+    *fd = *((int *)CMSG_DATA(cmsg));
+    return 0;
+}
+
+// 等到对端关闭，即旧进程退出
+static int wait_close(int sockfd, double timeout)
+{
+    double deadline = current_timestamp() + timeout;
+    while (true) {
+        double left = deadline - current_timestamp();
+        if (left <= 0)
+            return -__LINE__;
+        struct pollfd pfd = { .fd = sockfd, .events = POLLIN };
+        int ret = poll(&pfd, 1, (int)(left * 1000) + 1);
+        if (ret < 0 && errno != EINTR)
+            return -__LINE__;
+        if (ret <= 0)
+            continue;
+        char buf[64];
+        ssize_t n = recv(sockfd, buf, sizeof(buf), 0);
+        if (n == 0)
+            return 0;
+        if (n < 0 && errno != EINTR && errno != EAGAIN)
+            return 0;
+    }
+}
+
+int handover_take(const char *path, double timeout)
+{
+    if (path == NULL || path[0] == '\0') {
+        log_error("handover_path is not set");
+        return -__LINE__;
+    }
+
+    nw_addr_t addr;
+    int sock_type;
+    sds cfg = sdscatprintf(sdsempty(), "seqpacket@%s", path);
+    int ret = nw_sock_cfg_parse(cfg, &addr, &sock_type);
+    sdsfree(cfg);
+    if (ret < 0)
+        return -__LINE__;
+
+    int sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sockfd < 0)
+        return -__LINE__;
+    if (connect(sockfd, NW_SOCKADDR(&addr), addr.addrlen) < 0) {
+        log_info("no process to handover from %s: %s", path, strerror(errno));
+        close(sockfd);
+        return 0;
+    }
+
+    if (send(sockfd, HANDOVER_REQUEST, strlen(HANDOVER_REQUEST), MSG_EOR) < 0) {
+        close(sockfd);
+        return -__LINE__;
+    }
+    uint32_t num = 0;
+    if (recv(sockfd, &num, sizeof(num), 0) != sizeof(num) || num > HANDOVER_MAX_FD) {
+        close(sockfd);
+        return -__LINE__;
+    }
+
+    int fds[HANDOVER_MAX_FD];
+    int count = 0;
+    for (; count < (int)num; ++count) {
+        if (recv_fd(sockfd, &fds[count]) < 0)
+            break;
+    }
+    if (count < (int)num) {
+        log_error("handover receive %d of %u fds", count, num);
+        for (int i = 0; i < count; ++i)
+            close(fds[i]);
+        close(sockfd);
+        return -__LINE__;
+    }
+    nw_svr_inherit(fds, count);
+    log_vip("handover received %d listening fds, waiting old process exit", count);
+
+    ret = wait_close(sockfd, timeout);
+    close(sockfd);
+    if (ret < 0) {
+        log_error("wait old process exit timeout: %.1fs", timeout);
+        return ret;
+    }
+
+    return count;
+}
@@ -0,0 +1,31 @@
+/*
+ * Description: hand over listening sockets to a new process for binary upgrade
+ */
+
+# ifndef _UT_HANDOVER_H_
+# define _UT_HANDOVER_H_
+
+# include "nw_svr.h"
+
+/*
+ * old process: listen on the unix seqpacket path, when a new process asks,
+ * stop accepting on all started nw_svr, send their listening fds and call
+ * on_handover. the new process treats the close of this connection, which
+ * happens when the old process exit, as the end of the handover.
+ * path must be unique per instance; its directory is created with mode 0700
+ * if missing and must not be accessible by other users. the socket is 0600,
+ * requests from another uid are ignored, and a path another live process is
+ * listening on is refused instead of taken over.
+ */
+int handover_init(const char *path, void (*on_handover)(void));
+
+/*
+ * new process: take the listening fds from the old process and wait it exit
+ * within timeout seconds, the fds are passed to nw_svr_inherit.
+ * return 0 if no old process is listening on path, < 0 on error or when path
+ * is empty, or the
+ * number of fds received.
+ */
+int handover_take(const char *path, double timeout);
+
+# endif
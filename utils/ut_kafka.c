@@ -7,6 +7,7 @@
 
 typedef struct message_t {
     sds message;
+    int32_t partition;
     int64_t offset;
 } message_t;
 
@@ -36,7 +37,7 @@ static void *thread_routine(void *data)
         }
 
         rd_kafka_poll(consumer->rk, 0);
-        rd_kafka_message_t *rkmessage = rd_kafka_consume(consumer->rkt, consumer->partition, 100);
+        rd_kafka_message_t *rkmessage = rd_kafka_consume_queue(consumer->queue, 100);
         if (!rkmessage)
             continue;
         if (rkmessage->err) {
@@ -47,6 +48,7 @@ static void *thread_routine(void *data)
         } else {
             struct message_t *m = malloc(sizeof(message_t));
             m->message = sdsnewlen(rkmessage->payload, rkmessage->len);
+            m->partition = rkmessage->partition;
             m->offset = rkmessage->offset;
             pthread_mutex_lock(&consumer->lock);
             list_add_node_head(consumer->list, m);
@@ -56,7 +58,9 @@ static void *thread_routine(void *data)
         rd_kafka_message_destroy(rkmessage);
     }
 
-    rd_kafka_consume_stop(consumer->rkt, consumer->partition);
+    for (int i = 0; i < consumer->partition_num; ++i) {
+        rd_kafka_consume_stop(consumer->rkt, consumer->partitions[i]);
+    }
     return data;
 }
 
@@ -78,12 +82,44 @@ static void on_can_read(struct ev_loop *loop, ev_io *watcher, int events)
         }
         list_node *node = list_tail(consumer->list);
         message_t *m = node->value;
-        consumer->callback(m->message, m->offset);
+        consumer->callback(m->message, m->partition, m->offset);
         list_del(consumer->list, node);
         pthread_mutex_unlock(&consumer->lock);
     }
 }
 
+static int load_partitions(kafka_consumer_t *consumer, kafka_consumer_cfg *cfg)
+{
+    if (cfg->partition >= 0) {
+        consumer->partitions = malloc(sizeof(int32_t));
+        consumer->partitions[0] = cfg->partition;
+        consumer->partition_num = 1;
+        return 0;
+    }
+
+    const struct rd_kafka_metadata *metadata;
+    rd_kafka_resp_err_t err = rd_kafka_metadata(consumer->rk, 0, consumer->rkt, &metadata, 5000);
+    if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        log_error("Failed to get metadata of topic %s: %s", cfg->topic, rd_kafka_err2str(err));
+        return -__LINE__;
+    }
+    if (metadata->topic_cnt != 1 || metadata->topics[0].err != RD_KAFKA_RESP_ERR_NO_ERROR ||
+            metadata->topics[0].partition_cnt <= 0) {
+        log_error("No partition found for topic %s", cfg->topic);
+        rd_kafka_metadata_destroy(metadata);
+        return -__LINE__;
+    }
+    int count = metadata->topics[0].partition_cnt;
+    consumer->partitions = malloc(sizeof(int32_t) * count);
+    for (int i = 0; i < count; ++i) {
+        consumer->partitions[i] = metadata->topics[0].partitions[i].id;
+    }
+    consumer->partition_num = count;
+    rd_kafka_metadata_destroy(metadata);
+
+    return 0;
+}
+
 kafka_consumer_t *kafka_consumer_create(kafka_consumer_cfg *cfg, kafka_message_callback callback)
 {
     kafka_consumer_t *consumer = malloc(sizeof(kafka_consumer_t));
@@ -116,7 +152,6 @@ kafka_consumer_t *kafka_consumer_create(kafka_consumer_cfg *cfg, kafka_message_c
     consumer->limit = cfg->limit;
 
     char errstr[1024];
-    consumer->partition = cfg->partition;
     consumer->conf = rd_kafka_conf_new();
     rd_kafka_conf_set_log_cb(consumer->conf, on_logger);
     consumer->rk = rd_kafka_new(RD_KAFKA_CONSUMER, consumer->conf, errstr, sizeof(errstr));
@@ -140,12 +175,29 @@ kafka_consumer_t *kafka_consumer_create(kafka_consumer_cfg *cfg, kafka_message_c
         kafka_consumer_release(consumer);
         return NULL;
     }
-    if (rd_kafka_consume_start(consumer->rkt, cfg->partition, cfg->offset) == -1) {
-        log_error("Failed to start consumer: %s", rd_kafka_err2str(rd_kafka_last_error()));
-        log_stderr("Failed to start consumer: %s", rd_kafka_err2str(rd_kafka_last_error()));
+    if (load_partitions(consumer, cfg) < 0) {
+        log_stderr("Failed to get partitions of topic: %s", cfg->topic);
         kafka_consumer_release(consumer);
         return NULL;
     }
+    consumer->queue = rd_kafka_queue_new(consumer->rk);
+    if (consumer->queue == NULL) {
+        kafka_consumer_release(consumer);
+        return NULL;
+    }
+    for (int i = 0; i < consumer->partition_num; ++i) {
+        int32_t partition = consumer->partitions[i];
+        int64_t offset = partition < cfg->offset_num ? cfg->offsets[partition] : cfg->offset;
+        if (rd_kafka_consume_start_queue(consumer->rkt, partition, offset, consumer->queue) == -1) {
+            log_error("Failed to start consumer partition %"PRId32": %s", partition, rd_kafka_err2str(rd_kafka_last_error()));
+            log_stderr("Failed to start consumer partition %"PRId32": %s", partition, rd_kafka_err2str(rd_kafka_last_error()));
+            for (int j = 0; j < i; ++j) {
+                rd_kafka_consume_stop(consumer->rkt, consumer->partitions[j]);
+            }
+            kafka_consumer_release(consumer);
+            return NULL;
+        }
+    }
     if (pthread_mutex_init(&consumer->lock, NULL) != 0) {
         kafka_consumer_release(consumer);
         return NULL;
@@ -182,11 +234,15 @@ void kafka_consumer_release(kafka_consumer_t *consumer)
     if (consumer->conf) {
         rd_kafka_conf_destroy(consumer->conf);
     }
-    if (consumer->rk) {
-        rd_kafka_destroy(consumer->rk);
+    if (consumer->queue) {
+        rd_kafka_queue_destroy(consumer->queue);
     }
     if (consumer->rkt) {
         rd_kafka_topic_destroy(consumer->rkt);
     }
+    if (consumer->rk) {
+        rd_kafka_destroy(consumer->rk);
+    }
+    free(consumer->partitions);
 }
 
@@ -11,14 +11,21 @@
 # include "ut_sds.h"
 # include "ut_list.h"
 
-typedef void (*kafka_message_callback)(sds message, int64_t offset);
+typedef void (*kafka_message_callback)(sds message, int32_t partition, int64_t offset);
 
+/*
+ * partition < 0 consumes every partition of the topic, otherwise only the
+ * given one. offsets[p], when p < offset_num, is the start offset of
+ * partition p; other partitions start from offset.
+ */
 typedef struct kafka_consumer_cfg {
     char    *brokers;
     char    *topic;
     int     partition;
     int     limit;
     int64_t offset;
+    int64_t *offsets;
+    int     offset_num;
 } kafka_consumer_cfg;
 
 typedef struct kafka_consumer_t {
@@ -32,7 +39,9 @@ typedef struct kafka_consumer_t {
     rd_kafka_conf_t *conf;
     rd_kafka_t *rk;
     rd_kafka_topic_t *rkt;
-    int32_t partition;
+    rd_kafka_queue_t *queue;
+    int32_t *partitions;
+    int partition_num;
     list_t *list;
     int limit;
     kafka_message_callback callback;
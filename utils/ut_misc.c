@@ -39,8 +39,10 @@ int process_exist(const char *fmt, ...)
     int fd = open(path, O_CREAT, 400);
     if (fd < 0)
         return -1;
-    if (flock(fd, LOCK_EX | LOCK_NB) < 0)
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        close(fd);
         return 1;
+    }
 
     return 0;
 }
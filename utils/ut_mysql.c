@@ -1,5 +1,46 @@
 # include "ut_log.h"
 # include "ut_mysql.h"
+# include "ut_misc.h"
+
+struct bulk_source {
+    const char  *data;
+    size_t      len;
+    size_t      pos;
+};
+
+static uint64_t bulk_loads;
+static uint64_t bulk_rows;
+static uint64_t bulk_bytes;
+static uint64_t bulk_cost_us;
+static uint64_t bulk_warnings;
+
+// local infile is only served from memory while mysql_load_data is running, any other request is refused
+static int bulk_init(void **ptr, const char *filename, void *userdata)
+{
+    *ptr = userdata;
+    return userdata ? 0 : 1;
+}
+
+static int bulk_read(void *ptr, char *buf, unsigned int len)
+{
+    struct bulk_source *src = ptr;
+    size_t n = src->len - src->pos;
+    if (n > len)
+        n = len;
+    memcpy(buf, src->data + src->pos, n);
+    src->pos += n;
+    return n;
+}
+
+static void bulk_end(void *ptr)
+{
+}
+
+static int bulk_error(void *ptr, char *msg, unsigned int len)
+{
+    snprintf(msg, len, "local infile not allowed");
+    return CR_UNKNOWN_ERROR;
+}
 
 MYSQL *mysql_connect(mysql_cfg *db)
 {
@@ -16,10 +57,16 @@ MYSQL *mysql_connect(mysql_cfg *db)
         mysql_close(conn);
         return NULL;
     }
+    unsigned int local_infile = 1;
+    if (mysql_options(conn, MYSQL_OPT_LOCAL_INFILE, &local_infile) != 0) {
+        mysql_close(conn);
+        return NULL;
+    }
     if (mysql_real_connect(conn, db->host, db->user, db->pass, db->name, db->port, NULL, 0) == NULL) {
         mysql_close(conn);
         return NULL;
     }
+    mysql_set_local_infile_handler(conn, bulk_init, bulk_read, bulk_end, bulk_error, NULL);
 
     return conn;
 }
@@ -46,3 +93,100 @@ bool is_table_exists(MYSQL *conn, const char *table)
     return false;
 }
 
+
+sds mysql_bulk_append_str(sds buf, const char *str, bool last)
+{
+    if (str == NULL) {
+        buf = sdscatlen(buf, "\\N", 2);
+    } else {
+        const char *start = str;
+        for (const char *p = str; *p; ++p) {
+            char esc = 0;
+            switch (*p) {
+            case '\t': esc = 't'; break;
+            case '\n': esc = 'n'; break;
+            case '\r': esc = 'r'; break;
+            case '\\': esc = '\\'; break;
+            }
+            if (esc == 0)
+                continue;
+            buf = sdscatlen(buf, start, p - start);
+            char seq[2] = { '\\', esc };
+            buf = sdscatlen(buf, seq, 2);
+            start = p + 1;
+        }
+        buf = sdscat(buf, start);
+    }
+    return sdscatlen(buf, last ? "\n" : "\t", 1);
+}
+
+// count and log the warnings of the last load, duplicate keys are expected and skipped
+static int bulk_check_warnings(MYSQL *conn, const char *table)
+{
+    unsigned int total = mysql_warning_count(conn);
+    if (total == 0)
+        return 0;
+
+    const char *sql = "SHOW WARNINGS";
+    if (mysql_real_query(conn, sql, strlen(sql)) != 0) {
+        log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        return total;
+    }
+    MYSQL_RES *result = mysql_store_result(conn);
+    if (result == NULL)
+        return total;
+
+    int count = 0;
+    size_t listed = mysql_num_rows(result);
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        if (row[1] && strtoul(row[1], NULL, 0) == ER_DUP_ENTRY)
+            continue;
+        if (count++ < 5) {
+            log_error("load %s %s %s: %s", table, row[0], row[1], row[2]);
+        }
+    }
+    mysql_free_result(result);
+
+    if (count) {
+        log_error("load %s has %d bad rows in %zu of %u warnings", table, count, listed, total);
+        __atomic_add_fetch(&bulk_warnings, count, __ATOMIC_RELAXED);
+    }
+    return count;
+}
+
+int mysql_load_data(MYSQL *conn, const char *table, const char *columns, const char *data, size_t len)
+{
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "LOAD DATA LOCAL INFILE 'bulk' INTO TABLE `%s` CHARACTER SET utf8 (%s)", table, columns);
+    log_trace("exec sql: %s, %zu bytes", sql, len);
+
+    struct bulk_source src = { .data = data, .len = len, .pos = 0 };
+    double start = current_timestamp();
+    mysql_set_local_infile_handler(conn, bulk_init, bulk_read, bulk_end, bulk_error, &src);
+    int ret = mysql_real_query(conn, sql, sdslen(sql));
+    mysql_set_local_infile_handler(conn, bulk_init, bulk_read, bulk_end, bulk_error, NULL);
+    if (ret != 0) {
+        log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        sdsfree(sql);
+        return -__LINE__;
+    }
+    sdsfree(sql);
+
+    __atomic_add_fetch(&bulk_loads, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bulk_rows, mysql_affected_rows(conn), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bulk_bytes, len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bulk_cost_us, (uint64_t)((current_timestamp() - start) * 1000000), __ATOMIC_RELAXED);
+    return bulk_check_warnings(conn, table);
+}
+
+sds mysql_bulk_status(sds reply)
+{
+    uint64_t loads = __atomic_load_n(&bulk_loads, __ATOMIC_RELAXED);
+    uint64_t rows = __atomic_load_n(&bulk_rows, __ATOMIC_RELAXED);
+    uint64_t bytes = __atomic_load_n(&bulk_bytes, __ATOMIC_RELAXED);
+    uint64_t warnings = __atomic_load_n(&bulk_warnings, __ATOMIC_RELAXED);
+    double cost = __atomic_load_n(&bulk_cost_us, __ATOMIC_RELAXED) / 1000000.0;
+    return sdscatprintf(reply, "bulk load: %"PRIu64", rows: %"PRIu64", bytes: %"PRIu64", warnings: %"PRIu64", cost: %.3fs, %.0f rows/s\n",
+            loads, rows, bytes, warnings, cost, cost > 0 ? rows / cost : 0);
+}
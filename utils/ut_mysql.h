@@ -4,9 +4,24 @@
 # include "ut_config.h"
 # include <mysql/mysql.h>
 # include <mysql/errmsg.h>
+# include <mysql/mysqld_error.h>
 
 MYSQL *mysql_connect(mysql_cfg *cfg);
 bool is_table_exists(MYSQL *conn, const char *table);
 
+/*
+ * Bulk load through LOAD DATA LOCAL INFILE, fed from memory instead of a file.
+ * Rows use the default text format: fields separated by '\t', rows ended by '\n',
+ * NULL written as \N. Duplicate keys are skipped, like INSERT IGNORE.
+ *
+ * LOAD DATA LOCAL turns conversion and truncation errors into warnings and
+ * keeps the row. mysql_load_data returns < 0 if the statement failed, 0 if it
+ * loaded cleanly, or the number of warnings other than duplicate keys, which
+ * are logged; the rows are already written in that case.
+ */
+sds mysql_bulk_append_str(sds buf, const char *str, bool last);
+int mysql_load_data(MYSQL *conn, const char *table, const char *columns, const char *data, size_t len);
+sds mysql_bulk_status(sds reply);
+
 # endif
 
@@ -5,6 +5,7 @@
 # define CMD_GROUP_LIST             91
 # define CMD_SYMBOL_LIST            92
 # define CMD_TICK_STATUS            93
+# define CMD_TICK_HISTORY           94
 
 // balance
 # define CMD_BALANCE_QUERY          101
@@ -46,5 +47,11 @@
 # define CMD_MARKET_LIST            307
 # define CMD_MARKET_SUMMARY         308
 
+// replication
+# define CMD_REPL_SYNC              401
+# define CMD_REPL_RECORD            402
+# define CMD_REPL_STATUS            403
+# define CMD_STATE_DIGEST           404
+
 # endif
 
@@ -0,0 +1,125 @@
+/*
+ * Description: route read requests to a follower matchengine
+ */
+
+# include <assert.h>
+# include <jansson.h>
+
+# include "ut_rpc_route.h"
+# include "ut_rpc_cmd.h"
+# include "ut_misc.h"
+# include "ut_log.h"
+
+# define ROUTE_STATUS_INTERVAL  0.5
+# define ROUTE_STATUS_EXPIRE    3.0
+# define ROUTE_MAX              16
+
+static rpc_route *routes[ROUTE_MAX];
+static int route_count;
+
+static rpc_route *route_find(rpc_clt *clt)
+{
+    for (int i = 0; i < route_count; ++i) {
+        if (routes[i]->follower == clt)
+            return routes[i];
+    }
+    return NULL;
+}
+
+static void on_status(rpc_route *route, rpc_pkg *pkg)
+{
+    json_t *reply = json_loadb(pkg->body, pkg->body_size, 0, NULL);
+    if (reply == NULL)
+        return;
+    json_t *result = json_object_get(reply, "result");
+    json_t *staleness = json_object_get(result, "staleness");
+    if (staleness && json_is_number(staleness)) {
+        route->staleness = json_number_value(staleness);
+        route->status_time = current_timestamp();
+    }
+    json_decref(reply);
+}
+
+static void on_follower_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
+{
+    rpc_route *route = route_find(ses->privdata);
+    if (route == NULL)
+        return;
+    if (pkg->command == CMD_REPL_STATUS && pkg->sequence == 0) {
+        on_status(route, pkg);
+        return;
+    }
+    route->on_recv_pkg(ses, pkg);
+}
+
+static void on_timer(nw_timer *timer, void *privdata)
+{
+    rpc_route *route = privdata;
+    if (!rpc_clt_connected(route->follower))
+        return;
+
+    rpc_pkg pkg;
+    memset(&pkg, 0, sizeof(pkg));
+    pkg.pkg_type  = RPC_PKG_TYPE_REQUEST;
+    pkg.command   = CMD_REPL_STATUS;
+    pkg.body      = "[]";
+    pkg.body_size = 2;
+    rpc_clt_send(route->follower, &pkg);
+}
+
+rpc_route *rpc_route_create(rpc_clt_cfg *primary_cfg, rpc_clt_cfg *follower_cfg, rpc_clt_type *type, double max_staleness)
+{
+    if (follower_cfg && route_count >= ROUTE_MAX)
+        return NULL;
+
+    rpc_route *route = malloc(sizeof(rpc_route));
+    assert(route != NULL);
+    memset(route, 0, sizeof(rpc_route));
+    route->max_staleness = max_staleness;
+    route->on_recv_pkg = type->on_recv_pkg;
+
+    route->primary = rpc_clt_create(primary_cfg, type);
+    if (route->primary == NULL) {
+        free(route);
+        return NULL;
+    }
+    if (follower_cfg) {
+        rpc_clt_type follower_type;
+        memcpy(&follower_type, type, sizeof(follower_type));
+        follower_type.on_recv_pkg = on_follower_recv_pkg;
+        route->follower = rpc_clt_create(follower_cfg, &follower_type);
+        if (route->follower == NULL) {
+            rpc_clt_release(route->primary);
+            free(route);
+            return NULL;
+        }
+        routes[route_count++] = route;
+        nw_timer_set(&route->timer, ROUTE_STATUS_INTERVAL, true, on_timer, route);
+    }
+
+    return route;
+}
+
+int rpc_route_start(rpc_route *route)
+{
+    if (rpc_clt_start(route->primary) < 0)
+        return -__LINE__;
+    if (route->follower) {
+        if (rpc_clt_start(route->follower) < 0)
+            return -__LINE__;
+        nw_timer_start(&route->timer);
+    }
+    return 0;
+}
+
+rpc_clt *rpc_route_read(rpc_route *route)
+{
+    if (route->follower == NULL || !rpc_clt_connected(route->follower))
+        return route->primary;
+
+    double age = current_timestamp() - route->status_time;
+    if (age > ROUTE_STATUS_EXPIRE || route->staleness + age > route->max_staleness)
+        return route->primary;
+    return route->follower;
+}
+
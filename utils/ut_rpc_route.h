@@ -0,0 +1,38 @@
+/*
+ * Description: route read requests to a follower matchengine when it is
+ *              fresh enough, everything else goes to the primary
+ */
+
+# ifndef _UT_RPC_ROUTE_H_
+# define _UT_RPC_ROUTE_H_
+
+# include "ut_rpc_clt.h"
+
+typedef struct rpc_route {
+    rpc_clt *primary;
+    rpc_clt *follower;
+    double max_staleness;
+    double staleness;
+    double status_time;
+    nw_timer timer;
+    void (*on_recv_pkg)(nw_ses *ses, rpc_pkg *pkg);
+} rpc_route;
+
+/*
+ * follower_cfg may be NULL, then all requests go to the primary. replies
+ * from both are passed to type->on_recv_pkg, except the status replies
+ * used to track follower staleness.
+ */
+rpc_route *rpc_route_create(rpc_clt_cfg *primary_cfg, rpc_clt_cfg *follower_cfg, rpc_clt_type *type, double max_staleness);
+int rpc_route_start(rpc_route *route);
+
+/*
+ * the client for a read request: the follower if it is connected and its
+ * state is no more than max_staleness seconds behind, otherwise the primary.
+ */
+rpc_clt *rpc_route_read(rpc_route *route);
+
+# define rpc_route_write(route) ((route)->primary)
+
+# endif
+